@@ -94,10 +94,10 @@
 #define PAD_RELAY2_TEST    3
 
 /*
- * Serial port assignments.
+ * UART assignments.
  */
-#define SD_OW1   (&SD1)
-#define SD_OW2   (&SD2)
+#define UART_OW1 (&UARTD1)
+#define UART_OW2 (&UARTD2)
 
 /*
  * SPI bus assignments.
@@ -196,8 +196,8 @@
  * PB7  - Spare
  * PB8  - Spare
  * PB9  - Spare
- * PB10 - Spare
- * PB11 - Spare
+ * PB10 - Spare (debug console - USART3 TX in debug builds)
+ * PB11 - Spare (debug console - USART3 RX in debug builds)
  * PB12 - Flash CS                      (PP Output)
  * PB13 - SPI SCK  - SPI2               (alternate 5)
  * PB14 - SPI MISO - SPI2               (alternate 5)
@@ -0,0 +1,86 @@
+#include "ch.h"
+#include "hal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/* Exit status used to ask a wrapper script to restart the simulator. */
+#define SIM_RESET_EXIT_CODE 3
+
+/* Internal flash size of the simulated part, matches iflash_sim.c */
+#define SIM_FLASH_SIZE (1024 * 1024)
+
+
+/*
+ * Virtual ports initial setup. All inputs read high, which keeps the self
+ * test pin released and the relay feedback lines idle.
+ */
+#if HAL_USE_PAL || defined(__DOXYGEN__)
+const PALConfig pal_default_config = {
+  {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+  {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF}
+};
+#endif
+
+/*
+ * The recovery image copier reads the running application from here. The
+ * simulator has no application image, so the header reports a zero size.
+ */
+uint8_t __app_base__;
+
+static uint32_t device_id[3] = {
+  0x53494D00, 0x4D4F4445, 0x4C540000
+};
+
+/*
+ * Board-specific initialization code.
+ */
+void boardInit(void) {
+  const char* id = getenv("SIM_DEVICE_ID");
+
+  if (id != NULL)
+    device_id[2] = strtoul(id, NULL, 16);
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+}
+
+uint32_t*
+board_get_device_id()
+{
+  return device_id;
+}
+
+uint32_t
+board_get_flash_size()
+{
+  return SIM_FLASH_SIZE;
+}
+
+float
+board_get_core_temp()
+{
+  return 25.0f;
+}
+
+void
+NVIC_SystemReset()
+{
+  printf("System reset requested\r\n");
+  exit(SIM_RESET_EXIT_CODE);
+}
+
+/*
+ * Host libc needs much more stack than newlib-nano, so every thread created
+ * from the heap gets SIM_STACK_EXTRA bytes on top of what it asked for.
+ */
+Thread*
+__real_chThdCreateFromHeap(MemoryHeap* heapp, size_t size,
+    tprio_t prio, tfunc_t pf, void* arg);
+
+Thread*
+__wrap_chThdCreateFromHeap(MemoryHeap* heapp, size_t size,
+    tprio_t prio, tfunc_t pf, void* arg)
+{
+  return __real_chThdCreateFromHeap(heapp, size + SIM_STACK_EXTRA, prio, pf, arg);
+}
@@ -0,0 +1,83 @@
+#ifndef _BOARD_H_
+#define _BOARD_H_
+
+/*
+ * Setup for the BrewBit Model-T host simulator.
+ */
+
+/*
+ * Board identifier.
+ */
+#define BOARD_SIMULATOR
+#define BOARD_NAME              "BrewBit Model-T Simulator"
+
+/*
+ * The simulator exposes two 32 bit virtual I/O ports. The touch panel and
+ * board setup pins of GPIOA live on IOPORT1, everything else on IOPORT2.
+ */
+#define GPIOA          IOPORT1
+#define GPIOB          IOPORT2
+#define GPIOC          IOPORT2
+#define GPIOD          IOPORT2
+#define GPIOE          IOPORT2
+
+/*
+ * IO pins assignments.
+ */
+
+#define PORT_TFT_BKLT  GPIOA
+#define PAD_TFT_BKLT   3
+
+#define PORT_TFT_RST   GPIOA
+#define PAD_TFT_RST    8
+
+#define PORT_LED1      GPIOB
+#define PAD_LED1       0
+
+#define PORT_LED2      GPIOB
+#define PAD_LED2       1
+
+#define PORT_SFLASH_CS GPIOD
+#define PAD_SFLASH_CS  13
+
+#define PORT_RELAY1    GPIOC
+#define PAD_RELAY1     4
+
+#define PORT_RELAY2    GPIOC
+#define PAD_RELAY2     5
+
+#define PORT_WIFI_EN   GPIOC
+#define PAD_WIFI_EN    8
+
+#define PORT_WIFI_IRQ  GPIOD
+#define PAD_WIFI_IRQ   12
+
+#define PORT_WIFI_CS   GPIOB
+#define PAD_WIFI_CS    12
+
+#define PORT_SELF_TEST_EN   GPIOA
+#define PAD_SELF_TEST_EN    0
+
+#define PORT_RELAY1_TEST   GPIOE
+#define PAD_RELAY1_TEST    2
+
+#define PORT_RELAY2_TEST   GPIOE
+#define PAD_RELAY2_TEST    3
+
+#if !defined(_FROM_ASM_)
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void boardInit(void);
+
+  uint32_t* board_get_device_id(void);
+  uint32_t board_get_flash_size(void);
+  float board_get_core_temp(void);
+
+  void NVIC_SystemReset(void);
+#ifdef __cplusplus
+}
+#endif
+#endif /* _FROM_ASM_ */
+
+#endif /* _BOARD_H_ */
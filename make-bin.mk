@@ -50,6 +50,11 @@ ifeq ($(USE_FWLIB),)
   USE_FWLIB = no
 endif
 
+# Enable this to compute CRC32s with the STM32 CRC unit.
+ifeq ($(USE_HW_CRC),)
+  USE_HW_CRC = yes
+endif
+
 #
 # Architecture or project specific options
 ##############################################################################
@@ -80,6 +85,7 @@ CSRC = $(PORTSRC) \
        $(PLATFORMSRC) \
        $(BOARDSRC) \
        $(CHIBIOS)/os/various/evtimer.c \
+       $(CHIBIOS)/os/various/chprintf.c \
        $(addprefix $(AUTOGEN_DIR)/,$(PROJECT_AUTOGEN_CSRC)) \
        $(addprefix $(PROJECT_SRC_DIR)/,$(PROJECT_CSRC)) \
        $(foreach dep,$(addsuffix _CSRC,$(DEPS)),$($(dep)))
@@ -199,6 +205,10 @@ UDEFS = -DMAJOR_VERSION=$(MAJOR_VERSION) \
         -DWEB_API_PORT=$(WEB_API_PORT) \
          $(foreach dep,$(addsuffix _DEFS,$(DEPS)),$($(dep)))
 
+ifeq ($(USE_HW_CRC),yes)
+  UDEFS += -DCRC32_USE_HW
+endif
+
 # Define ASM defines here
 UADEFS =
 
@@ -227,25 +237,4 @@ endif
 
 include $(CHIBIOS)/os/ports/GCC/ARMCMx/rules.mk
 
-AUTOGEN_SRCS = \
-	font_resources.c \
-	image_resources.c \
-	bbmt.pb.c
-
-autogen: $(addprefix $(AUTOGEN_DIR)/, $(AUTOGEN_SRCS)) | $(AUTOGEN_DIR)
-
-$(AUTOGEN_DIR): | $(BUILDDIR)
-	@mkdir -p $@
-
-$(AUTOGEN_DIR)/font_resources.c $(AUTOGEN_DIR)/font_resources.h: scripts/fontconv $(wildcard fonts/*.ttf) fonts/font_specs | $(AUTOGEN_DIR)
-	@python scripts/fontconv fonts $(AUTOGEN_DIR)
-
-$(AUTOGEN_DIR)/image_resources.c $(AUTOGEN_DIR)/image_resources.h: scripts/imgconv $(wildcard images/*.png) | $(AUTOGEN_DIR)
-	@python scripts/imgconv $(AUTOGEN_DIR) $(wildcard images/*.png)
-
-$(AUTOGEN_DIR)/bbmt.pb: $(BBMT_MSGS)/bbmt.proto | $(AUTOGEN_DIR)
-	@protoc $(BBMT_MSGS_INCLUDES) -o$@ --python_out=$(AUTOGEN_DIR) $(BBMT_MSGS)/bbmt.proto
-	
-$(AUTOGEN_DIR)/bbmt.pb.c $(AUTOGEN_DIR)/bbmt.pb.h: $(AUTOGEN_DIR)/bbmt.pb | $(AUTOGEN_DIR)
-	@python $(NANOPB)/generator/nanopb_generator.py $(AUTOGEN_DIR)/bbmt.pb
-
+include autogen.mk
@@ -0,0 +1,160 @@
+##############################################################################
+# Host simulator build.
+#
+# Builds the project as a native executable on top of the ChibiOS GCC/SIMIA32
+# port and the Posix HAL platform. Peripherals without a Posix driver are
+# replaced by the models listed in SIM_CSRC, and the matching target drivers
+# are removed from the build through SIM_EXCLUDED_CSRC.
+#
+
+include deps.mk
+
+# Compiler options here.
+ifeq ($(CONFIG),release)
+  USE_OPT = -O2 -ggdb
+else
+  USE_OPT = -O0 -ggdb
+endif
+
+# Enable this if you want to see the full log while compiling.
+ifeq ($(USE_VERBOSE_COMPILE),)
+  USE_VERBOSE_COMPILE = no
+endif
+
+# Extra stack given to every thread created from the heap. Host libc calls
+# (printf in particular) need far more stack than newlib-nano does.
+SIM_STACK_EXTRA ?= 16384
+
+##############################################################################
+# Project, sources and paths
+#
+
+PROJECT_SRC_DIR = src/$(PROJECT)
+BUILDDIR   = build/$(PROJECT)_sim
+AUTOGEN_DIR = $(BUILDDIR)/autogen
+OBJDIR     = $(BUILDDIR)/obj
+
+BOARD = SIMULATOR
+
+# Imported source files and paths
+include $(CHIBIOS)/os/hal/platforms/Posix/platform.mk
+include $(CHIBIOS)/os/hal/hal.mk
+include $(CHIBIOS)/os/ports/GCC/SIMIA32/port.mk
+include $(CHIBIOS)/os/kernel/kernel.mk
+
+BOARDSRC = board/$(BOARD)/board.c
+BOARDINC = board/$(BOARD)
+
+# ChibiOS and board sources. These talk to the host and are built against
+# the GNU extensions of the C library.
+SYS_CSRC = $(PORTSRC) \
+           $(KERNSRC) \
+           $(HALSRC) \
+           $(PLATFORMSRC) \
+           $(BOARDSRC) \
+           $(CHIBIOS)/os/various/evtimer.c \
+           $(CHIBIOS)/os/various/chprintf.c
+
+# Application sources, built as they are for the target, and the peripheral
+# models that replace the excluded drivers.
+APP_CSRC = $(addprefix $(AUTOGEN_DIR)/,$(PROJECT_AUTOGEN_CSRC)) \
+           $(addprefix $(PROJECT_SRC_DIR)/,$(filter-out $(SIM_EXCLUDED_CSRC),$(PROJECT_CSRC))) \
+           $(addprefix $(PROJECT_SRC_DIR)/,$(SIM_CSRC)) \
+           $(foreach dep,$(addsuffix _CSRC,$(DEPS)),$($(dep)))
+
+# The simulator directory comes first so its halconf.h shadows the target one.
+INCDIR = $(PROJECT_SRC_DIR)/sim \
+         src/common \
+         $(AUTOGEN_DIR) \
+         $(PROJECT_SRC_DIR) \
+         $(addprefix $(PROJECT_SRC_DIR)/,$(PROJECT_INCDIR)) \
+         $(PORTINC) $(KERNINC) \
+         $(HALINC) $(PLATFORMINC) $(BOARDINC) \
+         $(CHIBIOS)/os/various \
+         $(foreach dep,$(addsuffix _INCDIR,$(DEPS)),$($(dep)))
+
+#
+# Project, sources and paths
+##############################################################################
+
+##############################################################################
+# Compiler settings
+#
+
+CC   = gcc
+LD   = gcc
+
+ARCH = -m32
+
+CWARN = -Wall -Wextra -Wstrict-prototypes
+
+DDEFS = -DSIMULATOR \
+        -DCH_MEMCORE_SIZE=0x20000 \
+        -DSIM_STACK_EXTRA=$(SIM_STACK_EXTRA)
+
+UDEFS = -DMAJOR_VERSION=$(MAJOR_VERSION) \
+        -DMINOR_VERSION=$(MINOR_VERSION) \
+        -DPATCH_VERSION=$(PATCH_VERSION) \
+        -DVERSION_STR=\"$(MAJOR_VERSION).$(MINOR_VERSION).$(PATCH_VERSION)\" \
+        -DWEB_API_HOST=$(WEB_API_HOST) \
+        -DWEB_API_PORT=$(WEB_API_PORT) \
+         $(foreach dep,$(addsuffix _DEFS,$(DEPS)),$($(dep)))
+
+CFLAGS  = $(ARCH) $(USE_OPT) -fno-stack-protector -MMD $(CWARN) \
+          $(DDEFS) $(UDEFS) $(addprefix -I,$(INCDIR))
+
+# The CC3000 host driver redefines a few libc types (clock_t, struct timeval,
+# select), so application code must not see the glibc extensions.
+APP_CSTD = -std=c99 -Dasm=__asm__
+SYS_CSTD = -std=gnu99 -D_GNU_SOURCE
+
+LDFLAGS = $(ARCH) -Wl,--wrap=chThdCreateFromHeap -Wl,-Map=$(BUILDDIR)/$(PROJECT).map
+LIBS    = -lm -lpthread
+
+#
+# Compiler settings
+##############################################################################
+
+##############################################################################
+# Rules
+#
+
+SYS_OBJS = $(addprefix $(OBJDIR)/, $(notdir $(SYS_CSRC:.c=.o)))
+APP_OBJS = $(addprefix $(OBJDIR)/, $(notdir $(APP_CSRC:.c=.o)))
+OBJS     = $(SYS_OBJS) $(APP_OBJS)
+
+$(SYS_OBJS): CSTD = $(SYS_CSTD)
+$(APP_OBJS): CSTD = $(APP_CSTD)
+
+vpath %.c $(sort $(dir $(SYS_CSRC) $(APP_CSRC)))
+
+all: $(BUILDDIR)/$(PROJECT)
+
+$(BUILDDIR) $(OBJDIR):
+	@mkdir -p $@
+
+$(OBJDIR)/%.o: %.c | $(OBJDIR)
+ifeq ($(USE_VERBOSE_COMPILE),yes)
+	$(CC) -c $(CFLAGS) $(CSTD) $< -o $@
+else
+	@echo Compiling $(<F)
+	@$(CC) -c $(CFLAGS) $(CSTD) $< -o $@
+endif
+
+$(BUILDDIR)/$(PROJECT): $(OBJS)
+ifeq ($(USE_VERBOSE_COMPILE),yes)
+	$(LD) $(LDFLAGS) $(OBJS) $(LIBS) -o $@
+else
+	@echo Linking $@
+	@$(LD) $(LDFLAGS) $(OBJS) $(LIBS) -o $@
+endif
+	@echo Done
+
+clean:
+	@rm -rf $(BUILDDIR)
+
+-include $(OBJS:.o=.d)
+
+include autogen.mk
+
+.PHONY: all clean autogen
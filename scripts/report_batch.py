@@ -0,0 +1,108 @@
+#!/usr/bin/env python
+#
+# Decodes a batch of controller reports as written by report_batch.c, for
+# checking backlog dumps and as a reference for the server side.
+#
+#   report_batch.py <batch file>
+#
+# Prints one line per report.
+
+from __future__ import print_function
+
+import sys
+
+REPORT_BATCH_MAGIC = 0xB1
+NUM_CONTROLLERS = 2
+NUM_OUTPUTS = 2
+
+FLAG_PID = 1 << 3
+FLAG_NO_READING = 1 << (4 + (2 * NUM_OUTPUTS))
+FLAG_NO_SETPOINT = 1 << (5 + (2 * NUM_OUTPUTS))
+
+
+def flag_present(out):
+    return 1 << (4 + (2 * out))
+
+
+def flag_status(out):
+    return 1 << (5 + (2 * out))
+
+
+class Reader(object):
+    def __init__(self, data):
+        self.data = bytearray(data)
+        self.pos = 0
+
+    def at_end(self):
+        return self.pos >= len(self.data)
+
+    def varint(self):
+        value = 0
+        for shift in range(0, 35, 7):
+            if self.at_end():
+                raise ValueError("truncated varint")
+            b = self.data[self.pos]
+            self.pos += 1
+            value |= (b & 0x7F) << shift
+            if (b & 0x80) == 0:
+                return value & 0xFFFFFFFF
+        raise ValueError("varint too long")
+
+    def svarint(self):
+        v = self.varint()
+        return (v >> 1) ^ -(v & 1)
+
+
+def decode(data):
+    r = Reader(data)
+    if r.at_end() or r.data[0] != REPORT_BATCH_MAGIC:
+        raise ValueError("not a report batch")
+    r.pos = 1
+
+    timestamp = r.varint()
+    sensor_reading = [0] * NUM_CONTROLLERS
+    setpoint = [0] * NUM_CONTROLLERS
+    pid = [[[0, 0, 0] for o in range(NUM_OUTPUTS)] for c in range(NUM_CONTROLLERS)]
+
+    reports = []
+    while not r.at_end():
+        timestamp = (timestamp + r.svarint()) & 0xFFFFFFFF
+        flags = r.varint()
+        c = flags & 0x7
+        if c >= NUM_CONTROLLERS:
+            raise ValueError("bad controller %d" % c)
+
+        if not flags & FLAG_NO_READING:
+            sensor_reading[c] += r.svarint()
+        if not flags & FLAG_NO_SETPOINT:
+            setpoint[c] += r.svarint()
+
+        outputs = []
+        for o in range(NUM_OUTPUTS):
+            if not flags & flag_present(o):
+                continue
+
+            output = {"index": o, "status": bool(flags & flag_status(o))}
+            if flags & FLAG_PID:
+                for i in range(3):
+                    pid[c][o][i] += r.svarint()
+                output["kp"] = pid[c][o][0] / 100.0
+                output["ki"] = pid[c][o][1] / 100.0
+                output["kd"] = pid[c][o][2] / 100.0
+            outputs.append(output)
+
+        reports.append({
+            "timestamp": timestamp,
+            "controller": c,
+            "sensor_reading": None if flags & FLAG_NO_READING else sensor_reading[c] / 100.0,
+            "setpoint": None if flags & FLAG_NO_SETPOINT else setpoint[c] / 100.0,
+            "outputs": outputs,
+        })
+
+    return reports
+
+
+if __name__ == "__main__":
+    with open(sys.argv[1], "rb") as f:
+        for report in decode(f.read()):
+            print(report)
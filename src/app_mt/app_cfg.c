@@ -5,13 +5,40 @@
 #include "sxfs.h"
 #include "common.h"
 #include "crc/crc32.h"
+#include "app_cfg_legacy.h"
 #include "touch.h"
+#include "temp_profile_lib.h"
 #include "types.h"
 
+#include <chprintf.h>
 #include <string.h>
+#include <stddef.h>
 #include <stdio.h>
 
 
+/* Readers see the settings through one of two snapshots. A writer copies
+ * the published snapshot into the other one, changes it and publishes it,
+ * so readers never block. Each snapshot has a sequence count that is odd
+ * while it is being written. Getters copy values out and check the count,
+ * retrying if the snapshot was reused under them, so they never see a
+ * change half made.
+ *
+ * Settings are kept as a log of small key/value records appended to one of
+ * the two config partitions. Setters only mark the values they change dirty
+ * and a flush appends a record for each of them. Boot replays the log over
+ * the defaults. When the log fills, a snapshot of every value is written to
+ * the other partition, whose header is written last so an interrupted
+ * compaction leaves the old log in use.
+ */
+
+#define LOG_SIZE       0x10000 // 64 KB, one partition
+
+#define LOG_MAGIC      0x47464341 // "ACFG"
+#define ERASED_KEY     0xFF
+
+#define REC_SIZE(len)  ((sizeof(rec_hdr_t) + (len) + 3) & ~3)
+
+
 typedef struct {
   uint32_t reset_count;
   unit_t temp_unit;
@@ -28,38 +55,238 @@ typedef struct {
   fault_data_t fault;
 } app_cfg_data_t;
 
+/* Record keys. These are stored in flash, only ever add to the end. */
+typedef enum {
+  KEY_RESET_COUNT,
+  KEY_TEMP_UNIT,
+  KEY_CONTROL_MODE,
+  KEY_HYSTERESIS,
+  KEY_SCREEN_SAVER,
+  KEY_SENSOR_CONFIG,
+  KEY_TOUCH_CALIB,
+  KEY_CONTROLLER_SETTINGS,
+  KEY_TEMP_PROFILE_CHECKPOINT,
+  KEY_OTA_UPDATE_CHECKPOINT,
+  KEY_AUTH_TOKEN,
+  KEY_NET_SETTINGS,
+  KEY_FAULT,
+
+  NUM_CFG_KEYS
+} cfg_key_id_t;
+
+/* Where a key lives in app_cfg_data_t. Array fields have one record per
+ * element.
+ */
 typedef struct {
-  app_cfg_data_t data;
+  uint16_t offset;
+  uint16_t size;
+  uint8_t count;
+} cfg_key_t;
+
+#define CFG_KEY(field, n) \
+  { offsetof(app_cfg_data_t, field), sizeof(((app_cfg_data_t*)0)->field) / (n), (n) }
+
+static const cfg_key_t cfg_keys[NUM_CFG_KEYS] = {
+  [KEY_RESET_COUNT]             = CFG_KEY(reset_count, 1),
+  [KEY_TEMP_UNIT]               = CFG_KEY(temp_unit, 1),
+  [KEY_CONTROL_MODE]            = CFG_KEY(control_mode, 1),
+  [KEY_HYSTERESIS]              = CFG_KEY(hysteresis, 1),
+  [KEY_SCREEN_SAVER]            = CFG_KEY(screen_saver, 1),
+  [KEY_SENSOR_CONFIG]           = CFG_KEY(sensor_configs, MAX_NUM_SENSOR_CONFIGS),
+  [KEY_TOUCH_CALIB]             = CFG_KEY(touch_calib, 1),
+  [KEY_CONTROLLER_SETTINGS]     = CFG_KEY(controller_settings, NUM_CONTROLLERS),
+  [KEY_TEMP_PROFILE_CHECKPOINT] = CFG_KEY(temp_profile_checkpoints, NUM_CONTROLLERS),
+  [KEY_OTA_UPDATE_CHECKPOINT]   = CFG_KEY(ota_update_checkpoint, 1),
+  [KEY_AUTH_TOKEN]              = CFG_KEY(auth_token, 1),
+  [KEY_NET_SETTINGS]            = CFG_KEY(net_settings, 1),
+  [KEY_FAULT]                   = CFG_KEY(fault, 1),
+};
+
+/* Large enough for the value of any key */
+typedef union {
+  uint32_t reset_count;
+  unit_t temp_unit;
+  output_ctrl_t control_mode;
+  quantity_t quantity;
+  sensor_config_t sensor_config;
+  matrix_t touch_calib;
+  controller_settings_t controller_settings;
+  temp_profile_checkpoint_t temp_profile_checkpoint;
+  ota_update_checkpoint_t ota_update_checkpoint;
+  char auth_token[64];
+  net_settings_t net_settings;
+  fault_data_t fault;
+} cfg_value_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;
+} log_hdr_t;
+
+/* crc covers key, index and len followed by the value */
+typedef struct {
+  uint8_t key;
+  uint8_t index;
+  uint16_t len;
   uint32_t crc;
-} app_cfg_rec_t;
+} rec_hdr_t;
 
+typedef struct {
+  rec_hdr_t hdr;
+  cfg_value_t value;
+} rec_t;
 
-static msg_t app_cfg_thread(void* arg);
-static app_cfg_rec_t* app_cfg_load(sxfs_part_id_t* loaded_from);
-static app_cfg_rec_t* app_cfg_load_from(sxfs_part_id_t part);
+typedef struct {
+  volatile uint32_t seq;
+  app_cfg_data_t data;
+} cfg_snapshot_t;
+
+#define barrier() __asm__ volatile("" ::: "memory")
+
+/* Once a value is changed the flush waits for edits to stop for
+ * FLUSH_QUIET, but never longer than FLUSH_DEADLINE, so a burst of edits
+ * from the UI or the server goes out as one flush.
+ */
+#define FLUSH_QUIET     MS2ST(500)
+#define FLUSH_DEADLINE  S2ST(5)
 
+#define STATS_PERIOD    S2ST(60 * 60)
 
-/* Local RAM copy of app_cfg */
-static app_cfg_rec_t app_cfg_local;
+/* Copies a field out of the published snapshot */
+#define CFG_READ(dst, field) \
+  read_snapshot(&(dst), offsetof(app_cfg_data_t, field), sizeof(dst))
+
+
+static msg_t app_cfg_thread(void* arg);
+static void app_cfg_set_defaults(app_cfg_data_t* cfg);
+static void load_settings(void);
+static app_cfg_data_t* cfg_current(void);
+static app_cfg_data_t* update_begin(void);
+static void update_end(void);
+static void read_snapshot(void* dst, uint32_t offset, uint32_t size);
+static bool app_cfg_load(app_cfg_data_t* cfg);
+static bool log_is_torn(void);
+static app_cfg_rec_t* app_cfg_load_legacy(sxfs_part_id_t part);
+static void import_legacy(const legacy_app_cfg_data_t* legacy, app_cfg_data_t* cfg);
+static void mark_dirty(cfg_key_id_t key, uint8_t index);
+static void mark_all_dirty(void);
+static void build_rec(cfg_key_id_t key, uint8_t index);
+static bool append_rec(cfg_key_id_t key, uint8_t index);
+static bool write_snapshot(sxfs_part_id_t part, uint32_t* offset);
+static bool compact(void);
+static bool log_read(sxfs_part_id_t part, uint32_t offset, uint8_t* data, uint32_t data_len);
+static bool log_write(sxfs_part_id_t part, uint32_t offset, uint8_t* data, uint32_t data_len);
+static bool log_erase(sxfs_part_id_t part);
+
+
+/* Local RAM copies of app_cfg. app_cfg_mtx serializes writers. */
+static cfg_snapshot_t snapshots[2];
+static volatile uint32_t published;
 static Mutex app_cfg_mtx;
 
+/* Values changed since they were last written, one bit per element */
+static volatile uint32_t dirty[NUM_CFG_KEYS];
+
+/* Bumped on every change, so readers can tell when to refresh a cache */
+static volatile uint32_t change_gen;
+
+/* Signalled when a value is marked dirty */
+static BinarySemaphore flush_sem;
+
+static app_cfg_stats_t stats;
+static app_cfg_stats_t stats_hour;
+static systime_t stats_start;
+
+/* Serializes writers of the log */
+static Mutex log_mtx;
+static sxfs_part_id_t active_part;
+static uint32_t log_seq;
+static uint32_t write_offset;
+static rec_t rec_buf;
+
+/* Bumped whenever a probe offset changes so readers can cache offsets */
+static volatile uint32_t probe_offsets_gen;
+
 
 void
 app_cfg_init()
 {
   chMtxInit(&app_cfg_mtx);
+  chMtxInit(&log_mtx);
+  chBSemInit(&flush_sem, TRUE);
 
-  app_cfg_rec_t* app_cfg = app_cfg_load(NULL);
-  if (app_cfg != NULL) {
-    app_cfg_local = *app_cfg;
-    app_cfg_local.data.reset_count++;
-    free(app_cfg);
+  load_settings();
+
+  chThdCreateFromHeap(NULL, 1024, LOWPRIO, app_cfg_thread, NULL);
+}
+
+void
+app_cfg_suspend()
+{
+  chMtxLock(&app_cfg_mtx);
+  app_cfg_flush();
+  chMtxLock(&log_mtx);
+}
+
+void
+app_cfg_reload()
+{
+  memset((void*)dirty, 0, sizeof(dirty));
+  load_settings();
+
+  chMtxUnlock();
+  chMtxUnlock();
+}
+
+/* Loads the settings from the log over the defaults, or imports them from
+ * the old format and starts a log if there is none. Other threads must be
+ * kept out, as they are at boot or by app_cfg_suspend().
+ */
+static void
+load_settings()
+{
+  app_cfg_data_t* cfg = update_begin();
+  bool have_log;
+
+  app_cfg_set_defaults(cfg);
+
+  have_log = app_cfg_load(cfg);
+  if (have_log) {
+    cfg->reset_count++;
   }
   else {
-    app_cfg_reset();
+    app_cfg_rec_t* app_cfg = app_cfg_load_legacy(SP_APP_CFG_1);
+    if (app_cfg == NULL)
+      app_cfg = app_cfg_load_legacy(SP_APP_CFG_2);
+
+    if (app_cfg != NULL) {
+      printf("Importing app cfg\r\n");
+      import_legacy(&app_cfg->data, cfg);
+      cfg->reset_count++;
+      free(app_cfg);
+    }
   }
 
-  chThdCreateFromHeap(NULL, 1024, LOWPRIO, app_cfg_thread, NULL);
+  /* Records are built from the published snapshot, so nothing can be
+   * written until the loaded values are published
+   */
+  update_end();
+
+  if (!have_log) {
+    printf("Formatting app cfg log\r\n");
+    active_part = SP_APP_CFG_2;
+    if (!compact())
+      printf("app cfg format failed!\r\n");
+  }
+  else if (log_is_torn()) {
+    /* A record torn by a reset can't be appended over, start a new log */
+    printf("app cfg log damaged at %d\r\n", (int)write_offset);
+    if (!compact())
+      printf("app cfg compaction failed!\r\n");
+  }
+  else {
+    mark_dirty(KEY_RESET_COUNT, 0);
+  }
 }
 
 static msg_t
@@ -68,9 +295,30 @@ app_cfg_thread(void* arg)
   (void)arg;
   chRegSetThreadName("app_cfg");
 
+  stats_start = chTimeNow();
+
   while (!chThdShouldTerminate()) {
+    systime_t elapsed = chTimeNow() - stats_start;
+
+    if (elapsed >= STATS_PERIOD) {
+      chSysLock();
+      stats_hour = stats;
+      memset(&stats, 0, sizeof(stats));
+      chSysUnlock();
+
+      stats_start += STATS_PERIOD;
+      continue;
+    }
+
+    if (chBSemWaitTimeout(&flush_sem, STATS_PERIOD - elapsed) != RDY_OK)
+      continue;
+
+    systime_t first_change = chTimeNow();
+    while ((systime_t)(chTimeNow() - first_change) < FLUSH_DEADLINE &&
+        chBSemWaitTimeout(&flush_sem, FLUSH_QUIET) == RDY_OK)
+      ;
+
     app_cfg_flush();
-    chThdSleepSeconds(2);
   }
 
   return 0;
@@ -79,98 +327,166 @@ app_cfg_thread(void* arg)
 void
 app_cfg_reset()
 {
-  memset(&app_cfg_local.data, 0, sizeof(app_cfg_local.data));
-
-  app_cfg_local.data.reset_count = 0;
+  chMtxLock(&app_cfg_mtx);
+  app_cfg_set_defaults(update_begin());
+  update_end();
+  chMtxUnlock();
 
-  app_cfg_local.data.ota_update_checkpoint.download_in_progress = false;
-  app_cfg_local.data.ota_update_checkpoint.update_size = 0;
-  app_cfg_local.data.ota_update_checkpoint.last_block_offset = 0;
-  memset(app_cfg_local.data.ota_update_checkpoint.update_ver, 0, sizeof(app_cfg_local.data.ota_update_checkpoint.update_ver));
+  /* Start a new log, so nothing from the old one is replayed */
+  chMtxLock(&log_mtx);
+  if (!compact())
+    printf("app cfg reset failed!\r\n");
+  chMtxUnlock();
+}
 
-  app_cfg_local.data.temp_unit = UNIT_TEMP_DEG_F;
-  app_cfg_local.data.control_mode = ON_OFF;
-  app_cfg_local.data.hysteresis.value = 1;
-  app_cfg_local.data.hysteresis.unit = UNIT_TEMP_DEG_F;
+static void
+app_cfg_set_defaults(app_cfg_data_t* cfg)
+{
+  memset(cfg, 0, sizeof(app_cfg_data_t));
+  probe_offsets_gen++;
+
+  cfg->reset_count = 0;
+
+  cfg->ota_update_checkpoint.download_in_progress = false;
+  cfg->ota_update_checkpoint.update_size = 0;
+  cfg->ota_update_checkpoint.last_block_offset = 0;
+  memset(cfg->ota_update_checkpoint.update_ver, 0, sizeof(cfg->ota_update_checkpoint.update_ver));
+
+  cfg->temp_unit = UNIT_TEMP_DEG_F;
+  cfg->control_mode = ON_OFF;
+  cfg->hysteresis.value = 1;
+  cfg->hysteresis.unit = UNIT_TEMP_DEG_F;
+
+  cfg->net_settings.security_mode = 0;
+  cfg->net_settings.ip_config = IP_CFG_DHCP;
+  cfg->net_settings.ip = 0;
+  cfg->net_settings.subnet_mask = 0;
+  cfg->net_settings.gateway = 0;
+  cfg->net_settings.dns_server = 0;
+
+  /* Not touch_calib_reset(), which would publish a change of its own in the
+   * middle of this one and take app_cfg_mtx, which app_cfg_reset() holds
+   */
+  touch_get_default_calib(&cfg->touch_calib);
+
+  cfg->controller_settings[CONTROLLER_1].controller = CONTROLLER_1;
+  cfg->controller_settings[CONTROLLER_1].setpoint_type = SP_STATIC;
+  cfg->controller_settings[CONTROLLER_1].static_setpoint.value = 68;
+  cfg->controller_settings[CONTROLLER_1].static_setpoint.unit = UNIT_TEMP_DEG_F;
+
+  cfg->controller_settings[CONTROLLER_1].output_settings[OUTPUT_1].enabled = false;
+  cfg->controller_settings[CONTROLLER_1].output_settings[OUTPUT_1].function = OUTPUT_FUNC_COOLING;
+  cfg->controller_settings[CONTROLLER_1].output_settings[OUTPUT_1].cycle_delay.unit = UNIT_TIME_MIN;
+  cfg->controller_settings[CONTROLLER_1].output_settings[OUTPUT_1].cycle_delay.value = 3;
+
+  cfg->controller_settings[CONTROLLER_1].output_settings[OUTPUT_2].enabled = false;
+  cfg->controller_settings[CONTROLLER_1].output_settings[OUTPUT_2].function = OUTPUT_FUNC_HEATING;
+  cfg->controller_settings[CONTROLLER_1].output_settings[OUTPUT_2].cycle_delay.unit = UNIT_TIME_MIN;
+  cfg->controller_settings[CONTROLLER_1].output_settings[OUTPUT_2].cycle_delay.value = 3;
+
+  cfg->controller_settings[CONTROLLER_2].controller = CONTROLLER_2;
+  cfg->controller_settings[CONTROLLER_2].setpoint_type = SP_STATIC;
+  cfg->controller_settings[CONTROLLER_2].static_setpoint.value = 68;
+  cfg->controller_settings[CONTROLLER_2].static_setpoint.unit = UNIT_TEMP_DEG_F;
+
+  cfg->controller_settings[CONTROLLER_2].output_settings[OUTPUT_1].enabled = false;
+  cfg->controller_settings[CONTROLLER_2].output_settings[OUTPUT_1].function = OUTPUT_FUNC_COOLING;
+  cfg->controller_settings[CONTROLLER_2].output_settings[OUTPUT_1].cycle_delay.unit = UNIT_TIME_MIN;
+  cfg->controller_settings[CONTROLLER_2].output_settings[OUTPUT_1].cycle_delay.value = 3;
+
+  cfg->controller_settings[CONTROLLER_2].output_settings[OUTPUT_2].enabled = false;
+  cfg->controller_settings[CONTROLLER_2].output_settings[OUTPUT_2].function = OUTPUT_FUNC_HEATING;
+  cfg->controller_settings[CONTROLLER_2].output_settings[OUTPUT_2].cycle_delay.unit = UNIT_TIME_MIN;
+  cfg->controller_settings[CONTROLLER_2].output_settings[OUTPUT_2].cycle_delay.value = 3;
 
-  app_cfg_local.data.net_settings.security_mode = 0;
-  app_cfg_local.data.net_settings.ip_config = IP_CFG_DHCP;
-  app_cfg_local.data.net_settings.ip = 0;
-  app_cfg_local.data.net_settings.subnet_mask = 0;
-  app_cfg_local.data.net_settings.gateway = 0;
-  app_cfg_local.data.net_settings.dns_server = 0;
+}
 
-  touch_calib_reset();
+/* Finds the newest log and replays it over the current values. Returns
+ * false if there is no log.
+ */
+static bool
+app_cfg_load(app_cfg_data_t* cfg)
+{
+  log_hdr_t hdrs[2];
+  static const sxfs_part_id_t parts[2] = { SP_APP_CFG_1, SP_APP_CFG_2 };
+  int newest = -1;
+  int i;
+
+  for (i = 0; i < 2; ++i) {
+    if (!log_read(parts[i], 0, (uint8_t*)&hdrs[i], sizeof(log_hdr_t)) ||
+        hdrs[i].magic != LOG_MAGIC)
+      continue;
+
+    if (newest < 0 || (int32_t)(hdrs[i].seq - hdrs[newest].seq) > 0)
+      newest = i;
+  }
 
-  app_cfg_local.data.controller_settings[CONTROLLER_1].controller = CONTROLLER_1;
-  app_cfg_local.data.controller_settings[CONTROLLER_1].setpoint_type = SP_STATIC;
-  app_cfg_local.data.controller_settings[CONTROLLER_1].static_setpoint.value = 68;
-  app_cfg_local.data.controller_settings[CONTROLLER_1].static_setpoint.unit = UNIT_TEMP_DEG_F;
+  if (newest < 0)
+    return false;
 
-  app_cfg_local.data.controller_settings[CONTROLLER_1].output_settings[OUTPUT_1].enabled = false;
-  app_cfg_local.data.controller_settings[CONTROLLER_1].output_settings[OUTPUT_1].function = OUTPUT_FUNC_COOLING;
-  app_cfg_local.data.controller_settings[CONTROLLER_1].output_settings[OUTPUT_1].cycle_delay.unit = UNIT_TIME_MIN;
-  app_cfg_local.data.controller_settings[CONTROLLER_1].output_settings[OUTPUT_1].cycle_delay.value = 3;
+  active_part = parts[newest];
+  log_seq = hdrs[newest].seq;
+  write_offset = sizeof(log_hdr_t);
 
-  app_cfg_local.data.controller_settings[CONTROLLER_1].output_settings[OUTPUT_2].enabled = false;
-  app_cfg_local.data.controller_settings[CONTROLLER_1].output_settings[OUTPUT_2].function = OUTPUT_FUNC_HEATING;
-  app_cfg_local.data.controller_settings[CONTROLLER_1].output_settings[OUTPUT_2].cycle_delay.unit = UNIT_TIME_MIN;
-  app_cfg_local.data.controller_settings[CONTROLLER_1].output_settings[OUTPUT_2].cycle_delay.value = 3;
+  while (write_offset + sizeof(rec_hdr_t) <= LOG_SIZE) {
+    rec_hdr_t* hdr = &rec_buf.hdr;
 
-  app_cfg_local.data.controller_settings[CONTROLLER_2].controller = CONTROLLER_2;
-  app_cfg_local.data.controller_settings[CONTROLLER_2].setpoint_type = SP_STATIC;
-  app_cfg_local.data.controller_settings[CONTROLLER_2].static_setpoint.value = 68;
-  app_cfg_local.data.controller_settings[CONTROLLER_2].static_setpoint.unit = UNIT_TEMP_DEG_F;
+    if (!log_read(active_part, write_offset, (uint8_t*)hdr, sizeof(rec_hdr_t)))
+      break;
 
-  app_cfg_local.data.controller_settings[CONTROLLER_2].output_settings[OUTPUT_1].enabled = false;
-  app_cfg_local.data.controller_settings[CONTROLLER_2].output_settings[OUTPUT_1].function = OUTPUT_FUNC_COOLING;
-  app_cfg_local.data.controller_settings[CONTROLLER_2].output_settings[OUTPUT_1].cycle_delay.unit = UNIT_TIME_MIN;
-  app_cfg_local.data.controller_settings[CONTROLLER_2].output_settings[OUTPUT_1].cycle_delay.value = 3;
+    if (hdr->key == ERASED_KEY)
+      break;
 
-  app_cfg_local.data.controller_settings[CONTROLLER_2].output_settings[OUTPUT_2].enabled = false;
-  app_cfg_local.data.controller_settings[CONTROLLER_2].output_settings[OUTPUT_2].function = OUTPUT_FUNC_HEATING;
-  app_cfg_local.data.controller_settings[CONTROLLER_2].output_settings[OUTPUT_2].cycle_delay.unit = UNIT_TIME_MIN;
-  app_cfg_local.data.controller_settings[CONTROLLER_2].output_settings[OUTPUT_2].cycle_delay.value = 3;
+    if (hdr->len > sizeof(cfg_value_t) ||
+        write_offset + REC_SIZE(hdr->len) > LOG_SIZE ||
+        !log_read(active_part, write_offset + sizeof(rec_hdr_t), (uint8_t*)&rec_buf.value, hdr->len))
+      break;
 
-  app_cfg_local.crc = crc32_block(0, &app_cfg_local.data, sizeof(app_cfg_data_t));
-  app_cfg_flush();
-}
+    uint32_t crc = crc32_block(0, hdr, offsetof(rec_hdr_t, crc));
+    crc = crc32_block(crc, &rec_buf.value, hdr->len);
+    if (crc != hdr->crc)
+      break;
 
-static app_cfg_rec_t*
-app_cfg_load(sxfs_part_id_t* loaded_from)
-{
-  app_cfg_rec_t* app_cfg = app_cfg_load_from(SP_APP_CFG_1);
-  if (app_cfg != NULL) {
-    if (loaded_from != NULL)
-      *loaded_from = SP_APP_CFG_1;
+    /* Keys this build does not know about are left at their defaults. A
+     * value that has grown since the record was written keeps its defaults
+     * past the end of the record, so fields are only ever added to the end
+     * of a value.
+     */
+    if (hdr->key < NUM_CFG_KEYS &&
+        hdr->index < cfg_keys[hdr->key].count &&
+        hdr->len <= cfg_keys[hdr->key].size) {
+      const cfg_key_t* k = &cfg_keys[hdr->key];
+      memcpy((uint8_t*)cfg + k->offset + (hdr->index * k->size),
+          &rec_buf.value, hdr->len);
+    }
 
-    return app_cfg;
+    write_offset += REC_SIZE(hdr->len);
   }
 
-  app_cfg = app_cfg_load_from(SP_APP_CFG_2);
-  if (app_cfg != NULL) {
-    if (loaded_from != NULL)
-      *loaded_from = SP_APP_CFG_2;
-
-    return app_cfg;
-  }
+  return true;
+}
 
-  return NULL;
+/* True if the replay stopped at something other than blank flash */
+static bool
+log_is_torn()
+{
+  return write_offset + sizeof(rec_hdr_t) <= LOG_SIZE &&
+      !sxfs_is_erased(active_part, write_offset, sizeof(rec_hdr_t));
 }
 
 static app_cfg_rec_t*
-app_cfg_load_from(sxfs_part_id_t part)
+app_cfg_load_legacy(sxfs_part_id_t part)
 {
   bool ret;
   app_cfg_rec_t* app_cfg = malloc(sizeof(app_cfg_rec_t));
 
-  ret = sxfs_read(part, 0, (uint8_t*)app_cfg, sizeof(app_cfg_rec_t));
+  ret = log_read(part, 0, (uint8_t*)app_cfg, sizeof(app_cfg_rec_t));
   if (!ret) {
     free(app_cfg);
     return NULL;
   }
 
-  uint32_t calc_crc = crc32_block(0, &app_cfg->data, sizeof(app_cfg_data_t));
+  uint32_t calc_crc = crc32_block(0, &app_cfg->data, sizeof(legacy_app_cfg_data_t));
   if (calc_crc != app_cfg->crc) {
     free(app_cfg);
     return NULL;
@@ -179,10 +495,335 @@ app_cfg_load_from(sxfs_part_id_t part)
   return app_cfg;
 }
 
+/* Copies the old format's settings over the defaults in cfg. Profiles held
+ * in the controller settings are moved to the profile library, which must
+ * already be loaded.
+ */
+static void
+import_legacy(const legacy_app_cfg_data_t* legacy, app_cfg_data_t* cfg)
+{
+  int i;
+
+  cfg->reset_count = legacy->reset_count;
+  cfg->temp_unit = legacy->temp_unit;
+  cfg->control_mode = legacy->control_mode;
+  cfg->hysteresis = legacy->hysteresis;
+  cfg->screen_saver = legacy->screen_saver;
+  cfg->touch_calib = legacy->touch_calib;
+  cfg->ota_update_checkpoint = legacy->ota_update_checkpoint;
+  memcpy(cfg->auth_token, legacy->auth_token, sizeof(cfg->auth_token));
+  cfg->net_settings = legacy->net_settings;
+  cfg->fault = legacy->fault;
+
+  for (i = 0; i < MAX_NUM_SENSOR_CONFIGS; ++i) {
+    memcpy(cfg->sensor_configs[i].sensor_serial, legacy->sensor_configs[i].sensor_serial,
+        sizeof(sensor_serial_t));
+    cfg->sensor_configs[i].offset = legacy->sensor_configs[i].offset;
+  }
+
+  for (i = 0; i < NUM_CONTROLLERS; ++i) {
+    const legacy_controller_settings_t* lcs = &legacy->controller_settings[i];
+    const legacy_temp_profile_t* ltp = &lcs->temp_profile;
+    const legacy_temp_profile_checkpoint_t* lcp = &legacy->temp_profile_checkpoints[i];
+    controller_settings_t* cs = &cfg->controller_settings[i];
+    temp_profile_checkpoint_t* cp = &cfg->temp_profile_checkpoints[i];
+
+    cs->controller = lcs->controller;
+    cs->setpoint_type = lcs->setpoint_type;
+    cs->static_setpoint = lcs->static_setpoint;
+    memcpy(cs->output_settings, lcs->output_settings, sizeof(cs->output_settings));
+    cs->session_action = lcs->session_action;
+
+    cs->temp_profile.id = ltp->id;
+    cs->temp_profile.start_point = ltp->start_point;
+    cs->temp_profile.completion_action = ltp->completion_action;
+
+    if (ltp->num_steps > 0 && ltp->num_steps <= 32) {
+      temp_profile_t profile;
+
+      memset(&profile, 0, sizeof(profile));
+      profile.id = ltp->id;
+      memcpy(profile.name, ltp->name, sizeof(profile.name));
+      profile.name[sizeof(profile.name) - 1] = 0;
+      profile.num_steps = ltp->num_steps;
+      profile.start_value = ltp->start_value;
+
+      if (!temp_profile_lib_put(&profile, ltp->steps))
+        printf("Unable to import temp profile %d\r\n", (int)ltp->id);
+    }
+
+    cp->temp_profile_id = lcp->temp_profile_id;
+    cp->state = lcp->state;
+    cp->current_step = lcp->current_step;
+    cp->current_step_time = lcp->current_step_time / CH_FREQUENCY;
+  }
+}
+
+static app_cfg_data_t*
+cfg_current()
+{
+  return &snapshots[published].data;
+}
+
+/* Starts a change to the settings. Returns a copy of the published snapshot
+ * for the change to be made in. Must be called with app_cfg_mtx held.
+ */
+static app_cfg_data_t*
+update_begin()
+{
+  cfg_snapshot_t* next = &snapshots[published ^ 1];
+
+  next->seq++;
+  barrier();
+  memcpy(&next->data, &snapshots[published].data, sizeof(app_cfg_data_t));
+
+  return &next->data;
+}
+
+/* Publishes the change started by update_begin() */
+static void
+update_end()
+{
+  cfg_snapshot_t* next = &snapshots[published ^ 1];
+
+  barrier();
+  next->seq++;
+  published ^= 1;
+}
+
+static void
+read_snapshot(void* dst, uint32_t offset, uint32_t size)
+{
+  const cfg_snapshot_t* snapshot;
+  uint32_t seq;
+
+  do {
+    snapshot = &snapshots[published];
+    seq = snapshot->seq;
+    barrier();
+    memcpy(dst, (const uint8_t*)&snapshot->data + offset, size);
+    barrier();
+  } while ((seq & 1) || snapshot->seq != seq);
+}
+
+static void
+mark_dirty(cfg_key_id_t key, uint8_t index)
+{
+  chSysLock();
+  dirty[key] |= (1u << index);
+  change_gen++;
+  chBSemSignalI(&flush_sem);
+  chSysUnlock();
+}
+
+static void
+mark_all_dirty()
+{
+  int key;
+
+  chSysLock();
+  for (key = 0; key < NUM_CFG_KEYS; ++key) {
+    uint8_t count = cfg_keys[key].count;
+    dirty[key] = (count >= 32) ? 0xFFFFFFFF : ((1u << count) - 1);
+  }
+  chBSemSignalI(&flush_sem);
+  chSysUnlock();
+}
+
+/* Copies the published value of a key into rec_buf */
+static void
+build_rec(cfg_key_id_t key, uint8_t index)
+{
+  const cfg_key_t* k = &cfg_keys[key];
+
+  chSysLock();
+  dirty[key] &= ~(1u << index);
+  chSysUnlock();
+
+  memset(&rec_buf, 0xFF, REC_SIZE(k->size));
+  rec_buf.hdr.key = key;
+  rec_buf.hdr.index = index;
+  rec_buf.hdr.len = k->size;
+  read_snapshot(&rec_buf.value, k->offset + (index * k->size), k->size);
+
+  rec_buf.hdr.crc = crc32_block(0, &rec_buf.hdr, offsetof(rec_hdr_t, crc));
+  rec_buf.hdr.crc = crc32_block(rec_buf.hdr.crc, &rec_buf.value, k->size);
+}
+
+/* Appends the current value of a key to the log, compacting it if it is
+ * full. Must be called with log_mtx held.
+ */
+static bool
+append_rec(cfg_key_id_t key, uint8_t index)
+{
+  uint32_t rec_size = REC_SIZE(cfg_keys[key].size);
+
+  /* A snapshot includes this key anyway */
+  if (write_offset + rec_size > LOG_SIZE)
+    return compact();
+
+  build_rec(key, index);
+
+  if (!log_write(active_part, write_offset, (uint8_t*)&rec_buf, rec_size)) {
+    printf("app cfg write failed! %d\r\n", (int)write_offset);
+
+    /* Whatever made it to flash can't be written over */
+    return compact();
+  }
+
+  write_offset += rec_size;
+
+  return true;
+}
+
+/* Writes a record for every value to part, starting at offset */
+static bool
+write_snapshot(sxfs_part_id_t part, uint32_t* offset)
+{
+  int key;
+  int index;
+
+  for (key = 0; key < NUM_CFG_KEYS; ++key) {
+    uint32_t rec_size = REC_SIZE(cfg_keys[key].size);
+
+    for (index = 0; index < cfg_keys[key].count; ++index) {
+      build_rec(key, index);
+
+      if (!log_write(part, *offset, (uint8_t*)&rec_buf, rec_size))
+        return false;
+
+      *offset += rec_size;
+    }
+  }
+
+  return true;
+}
+
+/* Writes a snapshot of every value to the other partition and switches the
+ * log over to it. Must be called with log_mtx held.
+ */
+static bool
+compact()
+{
+  sxfs_part_id_t part = (active_part == SP_APP_CFG_1) ? SP_APP_CFG_2 : SP_APP_CFG_1;
+  uint32_t offset = sizeof(log_hdr_t);
+  log_hdr_t hdr = {
+      .magic = LOG_MAGIC,
+      .seq = log_seq + 1
+  };
+
+  if (!log_erase(part) ||
+      !write_snapshot(part, &offset) ||
+      !log_write(part, 0, (uint8_t*)&hdr, sizeof(hdr))) {
+    printf("app cfg compaction failed! %d\r\n", part);
+
+    /* Nothing was written as far as the old log is concerned */
+    mark_all_dirty();
+
+    return false;
+  }
+
+  active_part = part;
+  log_seq = hdr.seq;
+  write_offset = offset;
+
+  chSysLock();
+  stats.compactions++;
+  chSysUnlock();
+
+  return true;
+}
+
+static bool
+log_read(sxfs_part_id_t part, uint32_t offset, uint8_t* data, uint32_t data_len)
+{
+  chSysLock();
+  stats.bytes_read += data_len;
+  chSysUnlock();
+
+  return sxfs_read(part, offset, data, data_len);
+}
+
+static bool
+log_write(sxfs_part_id_t part, uint32_t offset, uint8_t* data, uint32_t data_len)
+{
+  chSysLock();
+  stats.bytes_written += data_len;
+  stats.records_written++;
+  chSysUnlock();
+
+  return sxfs_write(part, offset, data, data_len);
+}
+
+/* Erases only the erase units of a partition that aren't blank already. A
+ * log that was cut short by a reset or a failure leaves most of them so.
+ */
+static bool
+log_erase(sxfs_part_id_t part)
+{
+  uint32_t unit = sxfs_erase_size(part);
+  uint32_t offset;
+
+  for (offset = 0; offset < LOG_SIZE; offset += unit) {
+    chSysLock();
+    stats.bytes_read += unit;
+    chSysUnlock();
+
+    if (sxfs_is_erased(part, offset, unit))
+      continue;
+
+    chSysLock();
+    stats.erases++;
+    chSysUnlock();
+
+    if (!sxfs_erase(part, offset, unit))
+      return false;
+  }
+
+  return true;
+}
+
+void
+app_cfg_get_stats(app_cfg_stats_t* last_hour, app_cfg_stats_t* this_hour)
+{
+  chSysLock();
+  *last_hour = stats_hour;
+  *this_hour = stats;
+  chSysUnlock();
+}
+
+static void
+print_stats(BaseSequentialStream* chp, const char* period, const app_cfg_stats_t* s)
+{
+  chprintf(chp, "app cfg %s: read %u written %u in %u records, %u flushes, %u erases, %u compactions\r\n",
+      period, (unsigned)s->bytes_read, (unsigned)s->bytes_written,
+      (unsigned)s->records_written, (unsigned)s->flushes,
+      (unsigned)s->erases, (unsigned)s->compactions);
+}
+
+void
+app_cfg_dump_stats(BaseSequentialStream* chp)
+{
+  app_cfg_stats_t last_hour;
+  app_cfg_stats_t this_hour;
+
+  app_cfg_get_stats(&last_hour, &this_hour);
+
+  chprintf(chp, "app cfg generation %u\r\n", (unsigned)app_cfg_get_generation());
+  print_stats(chp, "last hour", &last_hour);
+  print_stats(chp, "this hour", &this_hour);
+}
+
+uint32_t
+app_cfg_get_generation()
+{
+  return change_gen;
+}
+
 unit_t
 app_cfg_get_temp_unit(void)
 {
-  return app_cfg_local.data.temp_unit;
+  return cfg_current()->temp_unit;
 }
 
 void
@@ -192,20 +833,23 @@ app_cfg_set_temp_unit(unit_t temp_unit)
       temp_unit != UNIT_TEMP_DEG_F)
     return;
 
-  if (temp_unit == app_cfg_local.data.temp_unit)
+  if (temp_unit == cfg_current()->temp_unit)
     return;
 
   chMtxLock(&app_cfg_mtx);
-  app_cfg_local.data.temp_unit = temp_unit;
+  app_cfg_data_t* cfg = update_begin();
+  cfg->temp_unit = temp_unit;
+  update_end();
+  mark_dirty(KEY_TEMP_UNIT, 0);
   chMtxUnlock();
 
-  msg_send(MSG_TEMP_UNIT, &app_cfg_local.data.temp_unit);
+  msg_send(MSG_TEMP_UNIT, &cfg_current()->temp_unit);
 }
 
 output_ctrl_t
 app_cfg_get_control_mode(void)
 {
-  return app_cfg_local.data.control_mode;
+  return cfg_current()->control_mode;
 }
 
 void
@@ -215,26 +859,31 @@ app_cfg_set_control_mode(output_ctrl_t control_mode)
       control_mode != PID)
     return;
 
-  if (control_mode == app_cfg_local.data.control_mode)
+  if (control_mode == cfg_current()->control_mode)
     return;
 
   chMtxLock(&app_cfg_mtx);
-  app_cfg_local.data.control_mode = control_mode;
+  app_cfg_data_t* cfg = update_begin();
+  cfg->control_mode = control_mode;
+  update_end();
+  mark_dirty(KEY_CONTROL_MODE, 0);
   chMtxUnlock();
 
-  msg_send(MSG_CONTROL_MODE, &app_cfg_local.data.control_mode);
+  msg_send(MSG_CONTROL_MODE, &cfg_current()->control_mode);
 }
 
 quantity_t
 app_cfg_get_hysteresis(void)
 {
-  return app_cfg_local.data.hysteresis;
+  quantity_t hysteresis;
+  CFG_READ(hysteresis, hysteresis);
+  return hysteresis;
 }
 
 void
 app_cfg_set_hysteresis(quantity_t hysteresis)
 {
-  if (memcmp(&hysteresis, &app_cfg_local.data.hysteresis, sizeof(quantity_t)) == 0)
+  if (memcmp(&hysteresis, &cfg_current()->hysteresis, sizeof(quantity_t)) == 0)
     return;
 
   if (hysteresis.unit == UNIT_TEMP_DEG_C) {
@@ -243,24 +892,32 @@ app_cfg_set_hysteresis(quantity_t hysteresis)
   }
 
   chMtxLock(&app_cfg_mtx);
-  app_cfg_local.data.hysteresis = hysteresis;
+  app_cfg_data_t* cfg = update_begin();
+  cfg->hysteresis = hysteresis;
+  update_end();
+  mark_dirty(KEY_HYSTERESIS, 0);
   chMtxUnlock();
 }
 
 quantity_t
 app_cfg_get_screen_saver(void)
 {
-  return app_cfg_local.data.screen_saver;
+  quantity_t screen_saver;
+  CFG_READ(screen_saver, screen_saver);
+  return screen_saver;
 }
 
 void
 app_cfg_set_screen_saver(quantity_t screen_saver)
 {
-  if (memcmp(&screen_saver, &app_cfg_local.data.screen_saver, sizeof(quantity_t)) == 0)
+  if (memcmp(&screen_saver, &cfg_current()->screen_saver, sizeof(quantity_t)) == 0)
     return;
 
   chMtxLock(&app_cfg_mtx);
-  app_cfg_local.data.screen_saver = screen_saver;
+  app_cfg_data_t* cfg = update_begin();
+  cfg->screen_saver = screen_saver;
+  update_end();
+  mark_dirty(KEY_SCREEN_SAVER, 0);
   chMtxUnlock();
 }
 
@@ -274,15 +931,35 @@ app_cfg_get_probe_offset(sensor_serial_t sensor_serial)
   offset.value = 0;
 
   for (i = 0; i < MAX_NUM_SENSOR_CONFIGS; i++) {
-    if (memcmp(sensor_serial, app_cfg_local.data.sensor_configs[i].sensor_serial, sizeof(sensor_serial_t)) == 0)
-      return app_cfg_local.data.sensor_configs[i].offset;
+    sensor_config_t sensor_config;
+    CFG_READ(sensor_config, sensor_configs[i]);
+    if (memcmp(sensor_serial, sensor_config.sensor_serial, sizeof(sensor_serial_t)) == 0)
+      return sensor_config.offset;
   }
-  
+
   return offset;
 }
 
-void
-app_cfg_set_probe_offset(quantity_t probe_offset, sensor_serial_t sensor_serial)
+sensor_filter_preset_t
+app_cfg_get_probe_filter(sensor_serial_t sensor_serial)
+{
+  uint8_t i;
+
+  for (i = 0; i < MAX_NUM_SENSOR_CONFIGS; i++) {
+    sensor_config_t sensor_config;
+    CFG_READ(sensor_config, sensor_configs[i]);
+    if (memcmp(sensor_serial, sensor_config.sensor_serial, sizeof(sensor_serial_t)) == 0)
+      return sensor_config.filter;
+  }
+
+  return SENSOR_FILTER_PRESET_DEFAULT;
+}
+
+/* Finds the config slot of a probe, or a free one for it. Returns -1 if
+ * every slot is taken. Called with app_cfg_mtx held.
+ */
+static int
+find_sensor_config(sensor_serial_t sensor_serial)
 {
   uint8_t i;
   int idx, next_idx;
@@ -290,7 +967,7 @@ app_cfg_set_probe_offset(quantity_t probe_offset, sensor_serial_t sensor_serial)
   idx = next_idx = -1;
 
   for(i = 0; i < MAX_NUM_SENSOR_CONFIGS; i++) {
-    sensor_serial_t* sensor_sn = &app_cfg_local.data.sensor_configs[i].sensor_serial;
+    sensor_serial_t* sensor_sn = &cfg_current()->sensor_configs[i].sensor_serial;
     if(memcmp(sensor_serial, sensor_sn, sizeof(sensor_serial_t)) == 0) {
       idx = i;
       break;
@@ -306,8 +983,45 @@ app_cfg_set_probe_offset(quantity_t probe_offset, sensor_serial_t sensor_serial)
   if (idx < 0)
     idx = next_idx;
 
-  if (idx < 0)
-    return;
+  return idx;
+}
+
+/* A probe's first setting claims a free slot for it, with the other
+ * setting at its default
+ */
+static sensor_config_t*
+begin_sensor_config_update(sensor_serial_t sensor_serial, int* idx)
+{
+  *idx = find_sensor_config(sensor_serial);
+  if (*idx < 0)
+    return NULL;
+
+  app_cfg_data_t* cfg = update_begin();
+  sensor_config_t* sensor_config = &cfg->sensor_configs[*idx];
+
+  if (memcmp(sensor_config->sensor_serial, sensor_serial, sizeof(sensor_serial_t)) != 0) {
+    memcpy(sensor_config->sensor_serial, sensor_serial, sizeof(sensor_serial_t));
+    sensor_config->offset.unit = UNIT_TEMP_DEG_F;
+    sensor_config->offset.value = 0;
+    sensor_config->filter = SENSOR_FILTER_PRESET_DEFAULT;
+  }
+
+  return sensor_config;
+}
+
+static void
+end_sensor_config_update(int idx)
+{
+  probe_offsets_gen++;
+  update_end();
+  mark_dirty(KEY_SENSOR_CONFIG, idx);
+}
+
+void
+app_cfg_set_probe_offset(quantity_t probe_offset, sensor_serial_t sensor_serial)
+{
+  sensor_config_t* sensor_config;
+  int idx;
 
   if (probe_offset.unit == UNIT_TEMP_DEG_C) {
     probe_offset.value *= (9.0f / 5.0f);
@@ -315,32 +1029,63 @@ app_cfg_set_probe_offset(quantity_t probe_offset, sensor_serial_t sensor_serial)
   }
 
   chMtxLock(&app_cfg_mtx);
-  memcpy(app_cfg_local.data.sensor_configs[idx].sensor_serial, sensor_serial, sizeof(sensor_serial_t));
-  app_cfg_local.data.sensor_configs[idx].offset = probe_offset;
+  sensor_config = begin_sensor_config_update(sensor_serial, &idx);
+  if (sensor_config != NULL) {
+    sensor_config->offset = probe_offset;
+    end_sensor_config_update(idx);
+  }
+  chMtxUnlock();
+}
+
+void
+app_cfg_set_probe_filter(sensor_filter_preset_t filter, sensor_serial_t sensor_serial)
+{
+  sensor_config_t* sensor_config;
+  int idx;
+
+  if (filter >= NUM_SENSOR_FILTER_PRESETS)
+    return;
+
+  chMtxLock(&app_cfg_mtx);
+  sensor_config = begin_sensor_config_update(sensor_serial, &idx);
+  if (sensor_config != NULL) {
+    sensor_config->filter = filter;
+    end_sensor_config_update(idx);
+  }
   chMtxUnlock();
 }
 
-const matrix_t*
-app_cfg_get_touch_calib(void)
+uint32_t
+app_cfg_get_probe_offsets_gen(void)
+{
+  return probe_offsets_gen;
+}
+
+void
+app_cfg_get_touch_calib(matrix_t* touch_calib)
 {
-  return &app_cfg_local.data.touch_calib;
+  CFG_READ(*touch_calib, touch_calib);
 }
 
 void
 app_cfg_set_touch_calib(matrix_t* touch_calib)
 {
   chMtxLock(&app_cfg_mtx);
-  app_cfg_local.data.touch_calib = *touch_calib;
+  app_cfg_data_t* cfg = update_begin();
+  cfg->touch_calib = *touch_calib;
+  update_end();
+  mark_dirty(KEY_TOUCH_CALIB, 0);
   chMtxUnlock();
 }
 
-const controller_settings_t*
-app_cfg_get_controller_settings(temp_controller_id_t controller)
+bool
+app_cfg_get_controller_settings(temp_controller_id_t controller, controller_settings_t* settings)
 {
   if (controller >= NUM_CONTROLLERS)
-    return NULL;
+    return false;
 
-  return &app_cfg_local.data.controller_settings[controller];
+  CFG_READ(*settings, controller_settings[controller]);
+  return true;
 }
 
 void
@@ -353,9 +1098,12 @@ app_cfg_set_controller_settings(
     return;
 
   if ((source == SS_SERVER) ||
-      memcmp(settings, &app_cfg_local.data.controller_settings[controller], sizeof(controller_settings_t)) != 0) {
+      memcmp(settings, &cfg_current()->controller_settings[controller], sizeof(controller_settings_t)) != 0) {
     chMtxLock(&app_cfg_mtx);
-    app_cfg_local.data.controller_settings[controller] = *settings;
+    app_cfg_data_t* cfg = update_begin();
+    cfg->controller_settings[controller] = *settings;
+    update_end();
+    mark_dirty(KEY_CONTROLLER_SETTINGS, controller);
     chMtxUnlock();
 
     msg_id_t msg_id;
@@ -369,13 +1117,14 @@ app_cfg_set_controller_settings(
 }
 
 
-const temp_profile_checkpoint_t*
-app_cfg_get_temp_profile_checkpoint(temp_controller_id_t controller)
+bool
+app_cfg_get_temp_profile_checkpoint(temp_controller_id_t controller, temp_profile_checkpoint_t* checkpoint)
 {
   if (controller >= NUM_CONTROLLERS)
-      return NULL;
+      return false;
 
-  return &app_cfg_local.data.temp_profile_checkpoints[controller];
+  CFG_READ(*checkpoint, temp_profile_checkpoints[controller]);
+  return true;
 }
 
 void
@@ -384,77 +1133,99 @@ app_cfg_set_temp_profile_checkpoint(temp_controller_id_t controller, temp_profil
   if (controller >= NUM_CONTROLLERS)
       return;
 
-  if (memcmp(checkpoint, &app_cfg_local.data.temp_profile_checkpoints[controller], sizeof(temp_profile_checkpoint_t)) != 0) {
+  if (memcmp(checkpoint, &cfg_current()->temp_profile_checkpoints[controller], sizeof(temp_profile_checkpoint_t)) != 0) {
     chMtxLock(&app_cfg_mtx);
-    app_cfg_local.data.temp_profile_checkpoints[controller] = *checkpoint;
+    app_cfg_data_t* cfg = update_begin();
+    cfg->temp_profile_checkpoints[controller] = *checkpoint;
+    update_end();
+    mark_dirty(KEY_TEMP_PROFILE_CHECKPOINT, controller);
     chMtxUnlock();
   }
 }
 
-const char*
-app_cfg_get_auth_token()
+void
+app_cfg_get_auth_token(char* auth_token, uint32_t size)
 {
-  return app_cfg_local.data.auth_token;
+  char token[sizeof(cfg_current()->auth_token)];
+
+  CFG_READ(token, auth_token);
+
+  strncpy(auth_token, token, size);
+  auth_token[size - 1] = 0;
 }
 
 void
 app_cfg_set_auth_token(const char* auth_token)
 {
   chMtxLock(&app_cfg_mtx);
-  strncpy(app_cfg_local.data.auth_token,
+  app_cfg_data_t* cfg = update_begin();
+  strncpy(cfg->auth_token,
       auth_token,
-      sizeof(app_cfg_local.data.auth_token));
+      sizeof(cfg->auth_token));
+  update_end();
+  mark_dirty(KEY_AUTH_TOKEN, 0);
   chMtxUnlock();
 }
 
-const net_settings_t*
-app_cfg_get_net_settings()
+void
+app_cfg_get_net_settings(net_settings_t* settings)
 {
-  return &app_cfg_local.data.net_settings;
+  CFG_READ(*settings, net_settings);
 }
 
 void
 app_cfg_set_net_settings(const net_settings_t* settings)
 {
-  if (memcmp(settings, &app_cfg_local.data.net_settings, sizeof(net_settings_t)) != 0) {
+  if (memcmp(settings, &cfg_current()->net_settings, sizeof(net_settings_t)) != 0) {
     chMtxLock(&app_cfg_mtx);
-    app_cfg_local.data.net_settings = *settings;
+    app_cfg_data_t* cfg = update_begin();
+    cfg->net_settings = *settings;
+    update_end();
+    mark_dirty(KEY_NET_SETTINGS, 0);
     chMtxUnlock();
 
     msg_send(MSG_NET_NETWORK_SETTINGS, NULL);
   }
 }
 
-const ota_update_checkpoint_t*
-app_cfg_get_ota_update_checkpoint(void)
+void
+app_cfg_get_ota_update_checkpoint(ota_update_checkpoint_t* checkpoint)
 {
-  return &app_cfg_local.data.ota_update_checkpoint;
+  CFG_READ(*checkpoint, ota_update_checkpoint);
 }
 
 void
 app_cfg_set_ota_update_checkpoint(const ota_update_checkpoint_t* checkpoint)
 {
   chMtxLock(&app_cfg_mtx);
-  app_cfg_local.data.ota_update_checkpoint = *checkpoint;
+  app_cfg_data_t* cfg = update_begin();
+  cfg->ota_update_checkpoint = *checkpoint;
+  update_end();
+  mark_dirty(KEY_OTA_UPDATE_CHECKPOINT, 0);
   chMtxUnlock();
 }
 
 uint32_t
 app_cfg_get_reset_count(void)
 {
-  return app_cfg_local.data.reset_count;
+  return cfg_current()->reset_count;
 }
 
 void
 app_cfg_clear_fault_data()
 {
-  memset(&app_cfg_local.data.fault, 0, sizeof(fault_data_t));
+  chMtxLock(&app_cfg_mtx);
+  app_cfg_data_t* cfg = update_begin();
+  memset(&cfg->fault, 0, sizeof(fault_data_t));
+  update_end();
+  mark_dirty(KEY_FAULT, 0);
+  chMtxUnlock();
 }
 
-const fault_data_t*
-app_cfg_get_fault_data()
+void
+app_cfg_get_fault_data(fault_data_t* fault)
 {
-  return &app_cfg_local.data.fault;
+  CFG_READ(*fault, fault);
 }
 
 void
@@ -463,43 +1234,41 @@ app_cfg_set_fault_data(fault_type_t fault_type, void* data, uint32_t data_size)
   if (data_size > MAX_FAULT_DATA)
     data_size = MAX_FAULT_DATA;
 
-  app_cfg_local.data.fault.type = fault_type;
-  memcpy(app_cfg_local.data.fault.data, data, data_size);
+  /* Called from fault handlers, so no locking. The handler flushes. */
+  app_cfg_data_t* cfg = update_begin();
+  cfg->fault.type = fault_type;
+  memcpy(cfg->fault.data, data, data_size);
+  update_end();
+  dirty[KEY_FAULT] |= 1;
+  change_gen++;
 }
 
+/* Appends a record for each value changed since the last flush. Values are
+ * read from the published snapshot, so the config mutex is never taken.
+ */
 void
 app_cfg_flush()
 {
-  chMtxLock(&app_cfg_mtx);
+  int key;
+  int index;
 
-  sxfs_part_id_t used_app_cfg_part = SP_APP_CFG_1;
-  app_cfg_rec_t* app_cfg = app_cfg_load(&used_app_cfg_part);
+  chMtxLock(&log_mtx);
 
-  app_cfg_local.crc = crc32_block(0, &app_cfg_local.data, sizeof(app_cfg_data_t));
+  chSysLock();
+  stats.flushes++;
+  chSysUnlock();
 
-  if (app_cfg == NULL || memcmp(&app_cfg_local, app_cfg, sizeof(app_cfg_rec_t)) != 0) {
-    bool ret;
-    sxfs_part_id_t unused_app_cfg_part =
-        (used_app_cfg_part == SP_APP_CFG_1) ? SP_APP_CFG_2 : SP_APP_CFG_1;
+  for (key = 0; key < NUM_CFG_KEYS; ++key) {
+    for (index = 0; dirty[key] != 0 && index < cfg_keys[key].count; ++index) {
+      if ((dirty[key] & (1u << index)) == 0)
+        continue;
 
-    ret = sxfs_erase_all(unused_app_cfg_part);
-    if (ret) {
-      ret = sxfs_write(unused_app_cfg_part, 0, (uint8_t*)&app_cfg_local, sizeof(app_cfg_local));
-      if (ret) {
-        ret = sxfs_erase_all(used_app_cfg_part);
-        if (!ret)
-          printf("used app cfg erase failed! %d\r\n", used_app_cfg_part);
+      if (!append_rec(key, index)) {
+        chMtxUnlock();
+        return;
       }
-      else {
-        printf("unused app cfg write failed! %d\r\n", unused_app_cfg_part);
-      }
-    }
-    else {
-      printf("unused app cfg erase failed! %d\r\n", unused_app_cfg_part);
     }
   }
-  chMtxUnlock();
 
-  if (app_cfg != NULL)
-    free(app_cfg);
+  chMtxUnlock();
 }
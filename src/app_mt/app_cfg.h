@@ -19,6 +19,15 @@ typedef enum {
   SS_SERVER
 } settings_source_t;
 
+typedef struct {
+  uint32_t bytes_read;
+  uint32_t bytes_written;
+  uint32_t records_written;
+  uint32_t erases;
+  uint32_t compactions;
+  uint32_t flushes;
+} app_cfg_stats_t;
+
 
 void
 app_cfg_init(void);
@@ -26,6 +35,17 @@ app_cfg_init(void);
 void
 app_cfg_reset(void);
 
+/* Holds off every change to the settings and their flash until
+ * app_cfg_reload(), which loads them from flash again as at boot. For the
+ * simulator's tests, which rewrite the config partitions in between. The
+ * calling thread must not change any settings while suspended.
+ */
+void
+app_cfg_suspend(void);
+
+void
+app_cfg_reload(void);
+
 unit_t
 app_cfg_get_temp_unit(void);
 
@@ -56,14 +76,28 @@ app_cfg_get_probe_offset(sensor_serial_t sensor_serial);
 void
 app_cfg_set_probe_offset(quantity_t probe_offset, sensor_serial_t sensor_serial);
 
-const matrix_t*
-app_cfg_get_touch_calib(void);
+sensor_filter_preset_t
+app_cfg_get_probe_filter(sensor_serial_t sensor_serial);
+
+void
+app_cfg_set_probe_filter(sensor_filter_preset_t filter, sensor_serial_t sensor_serial);
+
+/* Changes whenever any probe offset or filter is changed */
+uint32_t
+app_cfg_get_probe_offsets_gen(void);
+
+/* Getters for settings larger than a word copy them out, so a change made
+ * while they are read can't tear them
+ */
+void
+app_cfg_get_touch_calib(matrix_t* touch_calib);
 
 void
 app_cfg_set_touch_calib(matrix_t* touch_calib);
 
-const controller_settings_t*
-app_cfg_get_controller_settings(temp_controller_id_t controller);
+/* Returns false if there is no such controller */
+bool
+app_cfg_get_controller_settings(temp_controller_id_t controller, controller_settings_t* settings);
 
 void
 app_cfg_set_controller_settings(
@@ -71,8 +105,8 @@ app_cfg_set_controller_settings(
     settings_source_t source,
     controller_settings_t* settings);
 
-const temp_profile_checkpoint_t*
-app_cfg_get_temp_profile_checkpoint(temp_controller_id_t controller);
+bool
+app_cfg_get_temp_profile_checkpoint(temp_controller_id_t controller, temp_profile_checkpoint_t* checkpoint);
 
 void
 app_cfg_set_temp_profile_checkpoint(temp_controller_id_t controller, temp_profile_checkpoint_t* checkpoint);
@@ -83,20 +117,21 @@ app_cfg_get_output_settings(output_id_t output);
 void
 app_cfg_set_output_settings(output_id_t output, output_settings_t* settings);
 
-const char*
-app_cfg_get_auth_token(void);
+/* Copies out as much of the token as fits in size bytes, terminated */
+void
+app_cfg_get_auth_token(char* auth_token, uint32_t size);
 
 void
 app_cfg_set_auth_token(const char* auth_token);
 
-const net_settings_t*
-app_cfg_get_net_settings(void);
+void
+app_cfg_get_net_settings(net_settings_t* settings);
 
 void
 app_cfg_set_net_settings(const net_settings_t* settings);
 
-const ota_update_checkpoint_t*
-app_cfg_get_ota_update_checkpoint(void);
+void
+app_cfg_get_ota_update_checkpoint(ota_update_checkpoint_t* checkpoint);
 
 void
 app_cfg_set_ota_update_checkpoint(const ota_update_checkpoint_t* checkpoint);
@@ -104,8 +139,8 @@ app_cfg_set_ota_update_checkpoint(const ota_update_checkpoint_t* checkpoint);
 uint32_t
 app_cfg_get_reset_count(void);
 
-const fault_data_t*
-app_cfg_get_fault_data(void);
+void
+app_cfg_get_fault_data(fault_data_t* fault);
 
 void
 app_cfg_clear_fault_data(void);
@@ -116,4 +151,18 @@ app_cfg_set_fault_data(fault_type_t fault_type, void* data, uint32_t data_size);
 void
 app_cfg_flush(void);
 
+/* Changes whenever any setting is changed */
+uint32_t
+app_cfg_get_generation(void);
+
+/* Flash traffic of the config log over the last full hour, and so far in
+ * the current one
+ */
+void
+app_cfg_get_stats(app_cfg_stats_t* last_hour, app_cfg_stats_t* this_hour);
+
+/* Prints the generation and the log stats to chp */
+void
+app_cfg_dump_stats(BaseSequentialStream* chp);
+
 #endif
@@ -0,0 +1,64 @@
+#ifndef APP_CFG_LEGACY_H
+#define APP_CFG_LEGACY_H
+
+#include "app_cfg.h"
+
+/* Whole record format used before the log, imported on first boot. Its
+ * layout is frozen here as the last firmware to use it had it, when
+ * controller settings held the whole profile and sensor configs only held
+ * the offset. Don't change these to match the current types.
+ */
+typedef struct {
+  uint32_t id;
+  char name[100];
+  uint32_t num_steps;
+  quantity_t start_value;
+  temp_profile_step_t steps[32];
+  int start_point;
+  temp_profile_completion_action_t completion_action;
+} legacy_temp_profile_t;
+
+typedef struct {
+  temp_controller_id_t controller;
+  setpoint_type_t setpoint_type;
+  quantity_t static_setpoint;
+  legacy_temp_profile_t temp_profile;
+  output_settings_t output_settings[NUM_OUTPUTS];
+  session_action_t session_action;
+} legacy_controller_settings_t;
+
+typedef struct {
+  sensor_serial_t sensor_serial;
+  quantity_t offset;
+} legacy_sensor_config_t;
+
+typedef struct {
+  uint32_t temp_profile_id;
+  temp_profile_run_state_t state;
+  uint32_t current_step;
+  // system ticks
+  uint32_t current_step_time;
+} legacy_temp_profile_checkpoint_t;
+
+typedef struct {
+  uint32_t reset_count;
+  unit_t temp_unit;
+  output_ctrl_t control_mode;
+  quantity_t hysteresis;
+  quantity_t screen_saver;
+  legacy_sensor_config_t sensor_configs[MAX_NUM_SENSOR_CONFIGS];
+  matrix_t touch_calib;
+  legacy_controller_settings_t controller_settings[NUM_CONTROLLERS];
+  legacy_temp_profile_checkpoint_t temp_profile_checkpoints[NUM_CONTROLLERS];
+  ota_update_checkpoint_t ota_update_checkpoint;
+  char auth_token[64];
+  net_settings_t net_settings;
+  fault_data_t fault;
+} legacy_app_cfg_data_t;
+
+typedef struct {
+  legacy_app_cfg_data_t data;
+  uint32_t crc;
+} app_cfg_rec_t;
+
+#endif
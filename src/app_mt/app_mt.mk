@@ -26,6 +26,9 @@ PROJECT_AUTOGEN_CSRC = \
 PROJECT_CSRC = \
        app_cfg.c \
        app_hdr.c \
+       backlog.c \
+       crc32_bench.c \
+       debug_console.c \
        fault.c \
        font.c \
        gfx.c \
@@ -35,13 +38,17 @@ PROJECT_CSRC = \
        message.c \
        net.c \
        onewire.c \
+       onewire_rom.c \
        ota_update.c \
        pid.c \
        quantity_widget.c \
        recovery_img.c \
+       report_batch.c \
        sensor.c \
+       sensor_filter.c \
        temp_control.c \
        temp_profile.c \
+       temp_profile_lib.c \
        thread_watchdog.c \
        touch.c \
        touch_calib.c \
@@ -69,6 +76,7 @@ PROJECT_CSRC = \
        gui/wifi_scan.c \
        gui/self_test.c \
        gui/offset.c \
+       gui/profile_preview.c \
        wifi/core/cc3000_common.c \
        wifi/core/cc3000_spi.c \
        wifi/core/hci.c \
@@ -100,4 +108,41 @@ PROJECT_CSRC = \
        ../common/dfuse.c \
        ../common/sxfs.c
 
+# Target drivers that have no meaning on the host, and the models that
+# replace them in the simulator build.
+SIM_EXCLUDED_CSRC = \
+       debug_console.c \
+       fault.c \
+       lcd.c \
+       onewire.c \
+       touch.c \
+       ch/iwdg.c \
+       ch/iwdg_lld.c \
+       wifi/core/cc3000_spi.c \
+       ../common/iflash.c \
+       ../common/xflash.c
+
+SIM_CSRC = \
+       sim/sim_ctrl.c \
+       sim/sim_test.c \
+       sim/flash_model.c \
+       sim/lcd_sim.c \
+       sim/touch_sim.c \
+       sim/onewire_sim.c \
+       sim/cc3000_spi_sim.c \
+       sim/iflash_sim.c \
+       sim/xflash_sim.c \
+       sim/pid_fixed.c \
+       sim/pid_float.c \
+       sim/pid_test.c \
+       sim/temp_profile_test.c \
+       sim/app_cfg_test.c \
+       sim/sensor_filter_bench.c \
+       sim/crc32_bench.c \
+       sim/report_batch_bench.c
+
+ifeq ($(SIM),yes)
+include make-sim.mk
+else
 include make-bin.mk
+endif
@@ -0,0 +1,422 @@
+
+#include <ch.h>
+#include <hal.h>
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "backlog.h"
+#include "sxfs.h"
+#include "xflash.h"
+#include "common.h"
+#include "crc/crc32.h"
+
+
+/* The backlog partition is a ring of erase sectors. Each sector starts with
+ * a header holding a sequence number that goes up by one for every sector
+ * opened, followed by message frames. New frames are appended at the tail
+ * and sent from the head, which moves on as the server acknowledges them.
+ *
+ * NOR flash lets bits be cleared without an erase, so a frame is marked
+ * acknowledged by clearing its state, and a sector whose frames have all
+ * been acknowledged is marked reclaimed the same way. A reclaimed sector is
+ * only erased when the tail comes round to reuse it, so every sector that
+ * has ever been written keeps its header. Going round the ring from sector
+ * 0 the sequence numbers then only drop once, just after the tail, and boot
+ * finds the tail with a binary search over the sector headers. The head is
+ * found the same way, as reclaimed sectors always run from just after the
+ * tail up to the head.
+ */
+
+#define BACKLOG_MAGIC    0x474C4B42 // "BKLG"
+#define NO_SEQ           0xFFFFFFFF
+
+#define SECTOR_IN_USE    0xFFFFFFFF
+#define SECTOR_RECLAIMED 0x00000000
+
+#define FRAME_PENDING    0xFFFFFFFF
+#define FRAME_ACKED      0x00000000
+
+#define FRAME_SIZE(len)  ((sizeof(frame_hdr_t) + (len) + 3) & ~3)
+
+/* Sectors are 64K on parts whose 4K erases only work in the parameter
+ * sectors, but messages are kept to what fits a 4K sector either way, as
+ * readers allocate a buffer of backlog_max_msg_len()
+ */
+#define MAX_MSG_LEN      (XFLASH_SUBSECTOR_SIZE - sizeof(sector_hdr_t) - sizeof(frame_hdr_t))
+
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t state;
+} sector_hdr_t;
+
+/* nlen is ~len, to tell a torn header from a valid one. crc covers the
+ * message.
+ */
+typedef struct {
+  uint16_t len;
+  uint16_t nlen;
+  uint32_t crc;
+  uint32_t state;
+} frame_hdr_t;
+
+typedef struct {
+  uint32_t sector;
+  uint32_t offset;
+} backlog_pos_t;
+
+
+static uint32_t sector_size;
+static uint32_t num_sectors;
+
+// oldest frame not yet acknowledged
+static backlog_pos_t head;
+// next frame to send
+static backlog_pos_t send;
+// where the next frame goes
+static backlog_pos_t tail;
+static uint32_t tail_seq;
+// false if the tail sector can't be appended to
+static bool tail_open;
+
+
+static bool
+read_sector_hdr(uint32_t sector, sector_hdr_t* hdr)
+{
+  return sxfs_read(SP_WEB_API_BACKLOG, sector * sector_size, (uint8_t*)hdr, sizeof(sector_hdr_t)) &&
+      hdr->magic == BACKLOG_MAGIC;
+}
+
+/* Returns false at the end of the frames in a sector, or at a frame whose
+ * header is damaged.
+ */
+static bool
+read_frame_hdr(backlog_pos_t pos, frame_hdr_t* hdr)
+{
+  if (pos.offset + sizeof(frame_hdr_t) > sector_size ||
+      !sxfs_read(SP_WEB_API_BACKLOG, (pos.sector * sector_size) + pos.offset, (uint8_t*)hdr, sizeof(frame_hdr_t)))
+    return false;
+
+  return ((hdr->len ^ hdr->nlen) == 0xFFFF) &&
+      (pos.offset + FRAME_SIZE(hdr->len) <= sector_size);
+}
+
+static bool
+frame_crc_ok(backlog_pos_t pos, const frame_hdr_t* hdr)
+{
+  uint32_t crc;
+
+  return sxfs_crc(SP_WEB_API_BACKLOG, (pos.sector * sector_size) + pos.offset + sizeof(frame_hdr_t), hdr->len, &crc) &&
+      crc == hdr->crc;
+}
+
+static void
+set_state(uint32_t addr, uint32_t state)
+{
+  if (!sxfs_write(SP_WEB_API_BACKLOG, addr, (uint8_t*)&state, sizeof(state)))
+    printf("backlog state write failed at %d\r\n", (int)addr);
+}
+
+static void
+reclaim_sector(uint32_t sector)
+{
+  set_state((sector * sector_size) + offsetof(sector_hdr_t, state), SECTOR_RECLAIMED);
+}
+
+static uint32_t
+next_sector(uint32_t sector)
+{
+  return (sector + 1) % num_sectors;
+}
+
+/* Walks the frames of a sector from pos. Returns true, with pos at the
+ * frame, if a frame still to be acknowledged is found, otherwise leaves pos
+ * at the end of the valid frames.
+ */
+static bool
+find_pending(backlog_pos_t* pos)
+{
+  frame_hdr_t hdr;
+
+  while (read_frame_hdr(*pos, &hdr) && frame_crc_ok(*pos, &hdr)) {
+    if (hdr.state != FRAME_ACKED)
+      return true;
+
+    pos->offset += FRAME_SIZE(hdr.len);
+  }
+
+  return false;
+}
+
+/* Sectors 0 up to the tail were written on the current lap of the ring,
+ * and the rest on the previous lap or never.
+ */
+static bool
+find_tail()
+{
+  sector_hdr_t first;
+  sector_hdr_t hdr;
+  uint32_t seq;
+  uint32_t lo = 0;
+  uint32_t hi = num_sectors;
+
+  if (!read_sector_hdr(0, &first)) {
+    /* Sector 0 is only blank once the ring has wrapped if a reset came
+     * between erasing it and writing its header
+     */
+    if (!read_sector_hdr(num_sectors - 1, &hdr))
+      return false;
+
+    tail.sector = num_sectors - 1;
+    tail_seq = hdr.seq;
+    return true;
+  }
+
+  seq = first.seq;
+  while (hi - lo > 1) {
+    uint32_t mid = (lo + hi) / 2;
+
+    if (read_sector_hdr(mid, &hdr) && (int32_t)(hdr.seq - first.seq) >= 0) {
+      lo = mid;
+      seq = hdr.seq;
+    }
+    else {
+      hi = mid;
+    }
+  }
+
+  tail.sector = lo;
+  tail_seq = seq;
+  return true;
+}
+
+/* Going round from just after the tail, sectors are free up to the head */
+static bool
+sector_is_free(uint32_t dist)
+{
+  sector_hdr_t hdr;
+  uint32_t sector = (tail.sector + dist) % num_sectors;
+
+  return !read_sector_hdr(sector, &hdr) ||
+      hdr.state == SECTOR_RECLAIMED ||
+      hdr.seq != tail_seq - (num_sectors - dist);
+}
+
+static void
+find_head()
+{
+  uint32_t lo = 0;
+  uint32_t hi = num_sectors;
+
+  while (hi - lo > 1) {
+    uint32_t mid = (lo + hi) / 2;
+
+    if (sector_is_free(mid))
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  head.sector = (tail.sector + hi) % num_sectors;
+  head.offset = sizeof(sector_hdr_t);
+
+  // a reset may have come before a fully acknowledged sector was reclaimed
+  while (!find_pending(&head) && head.sector != tail.sector) {
+    reclaim_sector(head.sector);
+    head.sector = next_sector(head.sector);
+    head.offset = sizeof(sector_hdr_t);
+  }
+
+  if (head.sector == tail.sector && head.offset > tail.offset)
+    head.offset = tail.offset;
+}
+
+void
+backlog_init()
+{
+  sector_size = sxfs_erase_size(SP_WEB_API_BACKLOG);
+  num_sectors = sxfs_part_size(SP_WEB_API_BACKLOG) / sector_size;
+
+  if (!find_tail()) {
+    // empty, the first append opens sector 0
+    tail.sector = num_sectors - 1;
+    tail.offset = sector_size;
+    tail_seq = NO_SEQ;
+    tail_open = false;
+    head = send = tail;
+    return;
+  }
+
+  tail.offset = sizeof(sector_hdr_t);
+  while (true) {
+    frame_hdr_t hdr;
+    if (!read_frame_hdr(tail, &hdr) || !frame_crc_ok(tail, &hdr))
+      break;
+    tail.offset += FRAME_SIZE(hdr.len);
+  }
+
+  /* A frame torn by a reset can't be appended after */
+  tail_open = (tail.offset + sizeof(frame_hdr_t) > sector_size) ||
+      sxfs_is_erased(SP_WEB_API_BACKLOG, (tail.sector * sector_size) + tail.offset, sizeof(frame_hdr_t));
+  if (!tail_open)
+    printf("backlog damaged at %d:%d\r\n", (int)tail.sector, (int)tail.offset);
+
+  find_head();
+  send = head;
+
+  printf("backlog head %d:%d tail %d:%d\r\n",
+      (int)head.sector, (int)head.offset, (int)tail.sector, (int)tail.offset);
+}
+
+static bool
+open_sector()
+{
+  uint32_t sector = next_sector(tail.sector);
+  bool empty = (head.sector == tail.sector) && (head.offset == tail.offset);
+  sector_hdr_t hdr = {
+      .magic = BACKLOG_MAGIC,
+      .seq = tail_seq + 1,
+      .state = SECTOR_IN_USE
+  };
+
+  if (!empty && sector == head.sector) {
+    printf("backlog full\r\n");
+    return false;
+  }
+
+  if (!sxfs_is_erased(SP_WEB_API_BACKLOG, sector * sector_size, sector_size) &&
+      !sxfs_erase(SP_WEB_API_BACKLOG, sector * sector_size, sector_size))
+    return false;
+
+  if (!sxfs_write(SP_WEB_API_BACKLOG, sector * sector_size, (uint8_t*)&hdr, sizeof(hdr)))
+    return false;
+
+  if (empty && tail_seq != NO_SEQ)
+    reclaim_sector(tail.sector);
+
+  tail.sector = sector;
+  tail.offset = sizeof(sector_hdr_t);
+  tail_seq++;
+  tail_open = true;
+
+  if (empty)
+    head = send = tail;
+
+  return true;
+}
+
+bool
+backlog_append(const uint8_t* data, uint32_t len)
+{
+  if (len > backlog_max_msg_len())
+    return false;
+
+  if ((!tail_open || tail.offset + FRAME_SIZE(len) > sector_size) &&
+      !open_sector())
+    return false;
+
+  frame_hdr_t hdr = {
+      .len = len,
+      .nlen = ~len,
+      .crc = crc32_block(0xFFFFFFFF, (void*)data, len),
+      .state = FRAME_PENDING
+  };
+  uint32_t addr = (tail.sector * sector_size) + tail.offset;
+
+  /* The header goes first, so a frame torn by a reset is caught by its CRC */
+  if (!sxfs_write(SP_WEB_API_BACKLOG, addr, (uint8_t*)&hdr, sizeof(hdr)) ||
+      !sxfs_write(SP_WEB_API_BACKLOG, addr + sizeof(hdr), (uint8_t*)data, len)) {
+    tail_open = false;
+    return false;
+  }
+
+  tail.offset += FRAME_SIZE(len);
+
+  return true;
+}
+
+uint32_t
+backlog_next(uint8_t* buf)
+{
+  frame_hdr_t hdr;
+
+  while (backlog_has_unsent()) {
+    if (!read_frame_hdr(send, &hdr)) {
+      if (send.sector == tail.sector) {
+        send.offset = tail.offset;
+        continue;
+      }
+      send.sector = next_sector(send.sector);
+      send.offset = sizeof(sector_hdr_t);
+      continue;
+    }
+
+    backlog_pos_t pos = send;
+    send.offset += FRAME_SIZE(hdr.len);
+
+    if (hdr.state == FRAME_ACKED)
+      continue;
+
+    if (!sxfs_read(SP_WEB_API_BACKLOG, (pos.sector * sector_size) + pos.offset + sizeof(hdr), buf, hdr.len) ||
+        crc32_block(0xFFFFFFFF, buf, hdr.len) != hdr.crc) {
+      // nothing after a damaged frame in the sector can be trusted
+      printf("backlog frame damaged at %d:%d\r\n", (int)pos.sector, (int)pos.offset);
+      send.offset = (send.sector == tail.sector) ? tail.offset : sector_size;
+      continue;
+    }
+
+    return hdr.len;
+  }
+
+  return 0;
+}
+
+void
+backlog_ack()
+{
+  frame_hdr_t hdr;
+
+  while (head.sector != send.sector) {
+    reclaim_sector(head.sector);
+    head.sector = next_sector(head.sector);
+    head.offset = sizeof(sector_hdr_t);
+  }
+
+  /* Frames in a partly sent sector are marked one by one, so they are not
+   * sent again after a reset
+   */
+  while (head.offset < send.offset && read_frame_hdr(head, &hdr)) {
+    if (hdr.state != FRAME_ACKED)
+      set_state((head.sector * sector_size) + head.offset + offsetof(frame_hdr_t, state), FRAME_ACKED);
+    head.offset += FRAME_SIZE(hdr.len);
+  }
+
+  head.offset = send.offset;
+}
+
+void
+backlog_rewind()
+{
+  send = head;
+}
+
+bool
+backlog_has_unsent()
+{
+  return (send.sector != tail.sector) || (send.offset < tail.offset);
+}
+
+uint32_t
+backlog_max_msg_len()
+{
+  return MIN(MAX_MSG_LEN, sector_size - sizeof(sector_hdr_t) - sizeof(frame_hdr_t));
+}
+
+uint32_t
+backlog_frame_size(uint32_t len)
+{
+  return FRAME_SIZE(len);
+}
@@ -0,0 +1,55 @@
+#ifndef BACKLOG_H
+#define BACKLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Messages that could not be sent to the server, kept in flash in the order
+ * they were stored until the server has seen them. Only the web API thread
+ * may call these.
+ */
+
+void
+backlog_init(void);
+
+/* Returns false if the message is too long or the backlog is full */
+bool
+backlog_append(const uint8_t* data, uint32_t len);
+
+/* Copies out the oldest message not yet sent and returns its length, or 0
+ * if every stored message has been sent. buf must hold
+ * backlog_max_msg_len() bytes.
+ */
+uint32_t
+backlog_next(uint8_t* buf);
+
+/* The server has seen every message returned by backlog_next(), so the
+ * space they use can be reclaimed.
+ *
+ * The protocol has no acknowledgement message. The web API sends an auth
+ * request after the messages and calls this when the server answers it.
+ * That relies on the server handling the frames of a connection in order,
+ * and on it having stored the messages before it answers. A server that
+ * queues them and answers first, then loses the queue, loses them for
+ * good. A server that stored them but whose answer is lost gets them again.
+ */
+void
+backlog_ack(void);
+
+/* The messages sent since the last backlog_ack() may not have arrived, so
+ * backlog_next() starts over from the oldest of them.
+ */
+void
+backlog_rewind(void);
+
+bool
+backlog_has_unsent(void);
+
+uint32_t
+backlog_max_msg_len(void);
+
+/* Flash taken by a message of len bytes, including its frame header */
+uint32_t
+backlog_frame_size(uint32_t len);
+
+#endif
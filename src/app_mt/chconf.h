@@ -507,10 +507,18 @@
  * @details This hook is continuously invoked by the idle thread loop.
  */
 #if !defined(IDLE_LOOP_HOOK) || defined(__DOXYGEN__)
+#if defined(SIMULATOR)
+/* The simulator has no interrupts, timer ticks are polled from idle.*/
+void ChkIntSources(void);
+#define IDLE_LOOP_HOOK() {                                                  \
+  ChkIntSources();                                                          \
+}
+#else
 #define IDLE_LOOP_HOOK() {                                                  \
   /* Idle loop code here.*/                                                 \
 }
 #endif
+#endif
 
 /**
  * @brief   System tick event hook.
@@ -0,0 +1,108 @@
+
+#include "ch.h"
+#include "hal.h"
+
+#include "crc32_bench.h"
+#include "crc/crc32.h"
+
+#include <chprintf.h>
+
+
+// lengths checked against the bytewise loop at each alignment
+#define CHECK_LEN       300
+
+// bytes run through each path for timing, per block size
+#define TIMING_BYTES    (4 * 1024 * 1024)
+
+// bytes between counter reads, so short blocks aren't swamped by the reads
+#define TIMING_BATCH    (64 * 1024)
+
+
+typedef uint32_t (*crc_fn_t)(uint32_t crc, void* data, uint32_t len);
+
+
+static uint32_t
+crc32_bytewise(uint32_t crc, void* data, uint32_t len)
+{
+  const uint8_t* p = data;
+
+  while (len-- > 0)
+    crc = CRC32_UPDATE(crc, *p++);
+
+  return crc;
+}
+
+/* Returns the bytes fn folds in per thousand counter ticks. Blocks are
+ * taken from word aligned offsets across data.
+ */
+static uint32_t
+bytes_per_kilotick(crc_fn_t fn, const uint8_t* data, uint32_t len, uint32_t block_size)
+{
+  uint32_t span = len - block_size + 1;
+  uint32_t batch = (block_size < TIMING_BATCH) ? (TIMING_BATCH / block_size) : 1;
+  volatile uint32_t sink;
+  uint64_t ticks = 0;
+  uint32_t done = 0;
+
+  while (done < TIMING_BYTES) {
+    halrtcnt_t start = halGetCounterValue();
+    uint32_t i;
+
+    for (i = 0; i < batch; ++i) {
+      sink = fn(0xFFFFFFFF, (void*)(data + ((done % span) & ~3)), block_size);
+      done += block_size;
+    }
+    ticks += (halrtcnt_t)(halGetCounterValue() - start);
+  }
+  (void)sink;
+
+  return (ticks > 0) ? (uint32_t)(((uint64_t)done * 1000) / ticks) : 0;
+}
+
+void
+crc32_bench(BaseSequentialStream* chp, const uint8_t* data, uint32_t len)
+{
+  static const uint32_t block_sizes[] = { 64, 256, 4096 };
+  uint32_t mismatches = 0;
+  uint32_t off;
+  uint32_t n;
+  uint32_t i;
+
+  for (off = 0; off < 4; ++off) {
+    for (n = 0; n < CHECK_LEN - off; ++n) {
+      uint32_t crc = crc32_bytewise(0xFFFFFFFF, (void*)(data + off), n);
+
+      if (crc32_block(0xFFFFFFFF, (void*)(data + off), n) != crc ||
+          crc32_block_sw(0xFFFFFFFF, (void*)(data + off), n) != crc)
+        mismatches++;
+    }
+  }
+  chprintf(chp, "  %u mismatches against the bytewise CRC, \"123456789\" gives %08X\r\n",
+      (unsigned)mismatches, (unsigned)~crc32_block(0xFFFFFFFF, "123456789", 9));
+
+  if (halGetCounterFrequency() == 0) {
+    chprintf(chp, "  no realtime counter\r\n");
+    return;
+  }
+
+#if defined(CRC32_USE_HW) && !defined(SIMULATOR)
+  chprintf(chp, "  counter at %u Hz, bytes per 1000 ticks, block uses the CRC unit\r\n",
+      (unsigned)halGetCounterFrequency());
+#else
+  chprintf(chp, "  counter at %u Hz, bytes per 1000 ticks, block uses slicing\r\n",
+      (unsigned)halGetCounterFrequency());
+#endif
+  chprintf(chp, "  %10s %9s %9s %9s\r\n", "block", "bytewise", "slicing", "block");
+
+  for (i = 0; i <= sizeof(block_sizes) / sizeof(block_sizes[0]); ++i) {
+    uint32_t block_size = (i < sizeof(block_sizes) / sizeof(block_sizes[0])) ? block_sizes[i] : len;
+
+    if (block_size > len)
+      continue;
+
+    chprintf(chp, "  %10u %9u %9u %9u\r\n", (unsigned)block_size,
+        (unsigned)bytes_per_kilotick(crc32_bytewise, data, len, block_size),
+        (unsigned)bytes_per_kilotick(crc32_block_sw, data, len, block_size),
+        (unsigned)bytes_per_kilotick(crc32_block, data, len, block_size));
+  }
+}
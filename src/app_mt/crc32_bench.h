@@ -0,0 +1,22 @@
+#ifndef CRC32_BENCH_H
+#define CRC32_BENCH_H
+
+#include "ch.h"
+
+#include <stdint.h>
+
+/* Checks and times the CRC32 paths over data, which must be at least 300
+ * bytes long. crc32_block() and crc32_block_sw() are checked against a
+ * bytewise table loop for every alignment, then each path is timed over
+ * the block sizes the firmware uses, up to the whole of data. Throughput is
+ * printed in bytes per thousand realtime counter ticks, which are core
+ * clock cycles on the target.
+ *
+ * The simulator runs it over a buffer in RAM and the debug console over the
+ * application image in flash, as boot_app() does. Only the target has the
+ * CRC unit, so only there does crc32_block() differ from crc32_block_sw().
+ */
+void
+crc32_bench(BaseSequentialStream* chp, const uint8_t* data, uint32_t len);
+
+#endif
@@ -0,0 +1,178 @@
+
+#include "ch.h"
+#include "hal.h"
+
+#include "debug_console.h"
+#include "message.h"
+#include "app_cfg.h"
+#include "sensor.h"
+#include "crc32_bench.h"
+#include "app_hdr.h"
+
+#include <chprintf.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef DEBUG
+
+#define MAX_LINE 32
+#define CONSOLE ((BaseSequentialStream*)&SD3)
+
+/* Static estimate of the deepest path, "trace" dumping into chprintf and
+ * blocking in sdPut: ~80 bytes of Thread, ~50 for the line buffer, ~150 for
+ * the trace stats copies, ~110 for chvprintf, ~100 down through
+ * chOQPutTimeout to the context switch and 32 for an exception frame. That
+ * is already past the old 512, so this doubles it for margin. "stack"
+ * prints the measured headroom on the target.
+ */
+#define CONSOLE_STACK_SIZE 1024
+
+
+static msg_t debug_console_thread(void* arg);
+
+
+void
+debug_console_init()
+{
+  palSetPadMode(GPIOB, 10, PAL_MODE_ALTERNATE(7));
+  palSetPadMode(GPIOB, 11, PAL_MODE_ALTERNATE(7));
+  sdStart(&SD3, NULL);
+
+  chThdCreateFromHeap(NULL, CONSOLE_STACK_SIZE, LOWPRIO, debug_console_thread, NULL);
+}
+
+static void
+cmd_trace(const char* args)
+{
+  if (strcmp(args, "on") == 0)
+    msg_trace_enable(true);
+  else if (strcmp(args, "off") == 0)
+    msg_trace_enable(false);
+  else if (strcmp(args, "reset") == 0)
+    msg_reset_stats();
+  else
+    msg_trace_dump(CONSOLE);
+}
+
+/* filter <port> <preset>: picks the filter chain of a port's primary probe */
+static void
+cmd_filter(const char* args)
+{
+  char* end;
+  long sensor = strtol(args, &end, 10);
+  long preset = strtol(end, NULL, 10);
+
+  if (end == args ||
+      sensor < SENSOR_1 || sensor >= NUM_SENSORS ||
+      preset < 0 || preset >= NUM_SENSOR_FILTER_PRESETS) {
+    chprintf(CONSOLE, "console: filter <port 0-%d> <preset 0-%d>\r\n",
+        NUM_SENSORS - 1, NUM_SENSOR_FILTER_PRESETS - 1);
+    return;
+  }
+
+  if (!get_sensor_conn_status(sensor)) {
+    chprintf(CONSOLE, "console: no probe on port %d\r\n", (int)sensor);
+    return;
+  }
+
+  app_cfg_set_probe_filter(preset, get_sensor_cfg(sensor)->sensor_serial);
+}
+
+/* Stack bytes a thread has never touched. Thread stacks are filled with
+ * CH_STACK_FILL_VALUE when created (CH_DBG_FILL_THREADS) and the main and
+ * exception stacks by the startup code, and grow down towards p_stklimit.
+ */
+static uint32_t
+thread_stack_free(const Thread* tp)
+{
+  const uint8_t* p = (const uint8_t*)tp->p_stklimit;
+  const uint8_t* start = p;
+
+  while (*p == CH_STACK_FILL_VALUE)
+    p++;
+
+  return p - start;
+}
+
+/* stack: prints each thread's stack high-water mark. Listener working areas
+ * are sized by their creators, so those lines also show the size to cut from.
+ */
+static void
+cmd_stack()
+{
+  Thread* tp = chRegFirstThread();
+
+  do {
+    const char* name = (tp->p_name != NULL) ? tp->p_name : "?";
+    msg_listener_t* l = tp->msg_listener;
+
+    if (l != NULL)
+      chprintf(CONSOLE, "%-12s %5u of %5u bytes used\r\n", name,
+          (unsigned)msg_listener_get_stack_used(l),
+          (unsigned)msg_listener_get_stack_size(l));
+    else
+      chprintf(CONSOLE, "%-12s %5u bytes never used\r\n", name,
+          (unsigned)thread_stack_free(tp));
+    tp = chRegNextThread(tp);
+  } while (tp != NULL);
+}
+
+/* bench crc32: checks and times the CRC paths over the application image */
+static void
+cmd_bench(const char* args)
+{
+  extern uint8_t __app_base__;
+
+  if (strcmp(args, "crc32") == 0)
+    crc32_bench(CONSOLE, &__app_base__, _app_hdr.img_size);
+  else
+    chprintf(CONSOLE, "console: bench crc32\r\n");
+}
+
+static void
+exec_cmd(char* line)
+{
+  char* args = line + strcspn(line, " ");
+  if (*args != '\0')
+    *args++ = '\0';
+
+  if (strcmp(line, "trace") == 0)
+    cmd_trace(args);
+  else if (strcmp(line, "cfg") == 0)
+    app_cfg_dump_stats(CONSOLE);
+  else if (strcmp(line, "filter") == 0)
+    cmd_filter(args);
+  else if (strcmp(line, "stack") == 0)
+    cmd_stack();
+  else if (strcmp(line, "bench") == 0)
+    cmd_bench(args);
+  else if (line[0] != '\0')
+    chprintf(CONSOLE, "console: unknown command '%s'\r\n", line);
+}
+
+static msg_t
+debug_console_thread(void* arg)
+{
+  char line[MAX_LINE];
+  uint32_t len = 0;
+
+  (void)arg;
+  chRegSetThreadName("console");
+
+  while (1) {
+    char c = sdGet(&SD3);
+
+    if (c == '\r' || c == '\n') {
+      line[len] = '\0';
+      exec_cmd(line);
+      len = 0;
+    }
+    else if (len < MAX_LINE - 1) {
+      line[len++] = c;
+    }
+  }
+
+  return 0;
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef DEBUG_CONSOLE_H
+#define DEBUG_CONSOLE_H
+
+/* Command console on the spare USART3 pins (PB10 TX, PB11 RX, 115200 8N1)
+ * in debug builds. Commands are read one per line:
+ *
+ *   trace on|off|dump|reset    control the message bus tracer
+ *   cfg                        print the settings log flash stats
+ *   filter <port> <preset>     pick the filter chain of a port's probe
+ *   stack                      print each thread's stack high-water mark
+ *   bench crc32                check and time the CRC paths on the app image
+ *
+ * Replies go back out on the same port.
+ */
+void
+debug_console_init(void);
+
+#endif
@@ -7,10 +7,12 @@
 #include "gui.h"
 #include "temp_control.h"
 #include "app_cfg.h"
+#include "temp_profile_lib.h"
 #include "gui/quantity_select.h"
 #include "gui/button_list.h"
 #include "gui/output_settings.h"
 #include "gui/session_action.h"
+#include "gui/profile_preview.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -80,7 +82,7 @@ controller_settings_screen_create(temp_controller_id_t controller)
   s->button_list = button_list_screen_create(s->screen, title, back_button_clicked, s);
 
   s->controller = controller;
-  s->settings = *app_cfg_get_controller_settings(controller);
+  app_cfg_get_controller_settings(controller, &s->settings);
 
   /* Convert enabled flags to selection enum */
   if (s->settings.output_settings[OUTPUT_1].enabled &&
@@ -96,14 +98,15 @@ controller_settings_screen_create(temp_controller_id_t controller)
   /* Figure out which output selections are allowed by checking which outputs are currently
    * being controlled by the other controller.
    */
-  const controller_settings_t* other_controller_settings = app_cfg_get_controller_settings(other_controller);
+  controller_settings_t other_controller_settings;
+  app_cfg_get_controller_settings(other_controller, &other_controller_settings);
   s->output_selection_valid[SELECT_NONE] = true;
-  if (!other_controller_settings->output_settings[OUTPUT_1].enabled)
+  if (!other_controller_settings.output_settings[OUTPUT_1].enabled)
     s->output_selection_valid[SELECT_1] = true;
-  if (!other_controller_settings->output_settings[OUTPUT_2].enabled)
+  if (!other_controller_settings.output_settings[OUTPUT_2].enabled)
     s->output_selection_valid[SELECT_2] = true;
-  if (!other_controller_settings->output_settings[OUTPUT_1].enabled &&
-      !other_controller_settings->output_settings[OUTPUT_2].enabled)
+  if (!other_controller_settings.output_settings[OUTPUT_1].enabled &&
+      !other_controller_settings.output_settings[OUTPUT_2].enabled)
     s->output_selection_valid[SELECT_1_2] = true;
 
   /* If the current output selection is not valid, set it to none */
@@ -169,9 +172,9 @@ set_controller_settings(controller_settings_screen_t* s)
 
     case SP_TEMP_PROFILE:
     {
-      const temp_profile_t* tp = &s->settings.temp_profile;
-      if (strlen(tp->name) > 0)
-        snprintf(setpoint_subtext, 128, "Selected profile: '%s'", tp->name);
+      temp_profile_t tp;
+      if (temp_profile_lib_get(s->settings.temp_profile.id, &tp))
+        snprintf(setpoint_subtext, 128, "Selected profile: '%s'", tp.name);
       else
         snprintf(setpoint_subtext, 128, "Selected profile: No profiles uploaded from the web!");
 
@@ -267,10 +270,13 @@ setpoint_type_button_clicked(button_event_t* event)
     setpoint_type_t new_sp_type = SP_STATIC;
     switch (s->settings.setpoint_type) {
       case SP_STATIC:
-        if (strlen(s->settings.temp_profile.name) > 0) {
+      {
+        temp_profile_t tp;
+        if (temp_profile_lib_get(s->settings.temp_profile.id, &tp)) {
           new_sp_type = SP_TEMP_PROFILE;
         }
         break;
+      }
 
       case SP_TEMP_PROFILE:
         new_sp_type = SP_STATIC;
@@ -288,7 +294,13 @@ setpoint_type_button_clicked(button_event_t* event)
 static void
 temp_profile_button_clicked(button_event_t* event)
 {
-  (void)event;
+  if (event->id != EVT_BUTTON_CLICK)
+    return;
+
+  controller_settings_screen_t* s = widget_get_user_data(event->widget);
+
+  widget_t* preview_screen = profile_preview_screen_create(&s->settings.temp_profile);
+  gui_push_screen(preview_screen);
 }
 
 static void
@@ -356,7 +368,10 @@ back_button_clicked(button_event_t* event)
   if (event->id == EVT_BUTTON_CLICK) {
     controller_settings_screen_t* s = widget_get_user_data(event->widget);
 
-    if (memcmp(&s->settings, app_cfg_get_controller_settings(s->controller), sizeof(controller_settings_t)) != 0) {
+    controller_settings_t settings;
+    app_cfg_get_controller_settings(s->controller, &settings);
+
+    if (memcmp(&s->settings, &settings, sizeof(controller_settings_t)) != 0) {
         widget_t* session_action_screen = session_action_screen_create(s->controller, &s->settings);
         gui_push_screen(session_action_screen);
     }
@@ -3,10 +3,17 @@
 #include "gfx.h"
 
 #include <string.h>
+#include <math.h>
+
+
+// Smallest range of values plotted, so a flat line sits in the middle
+#define MIN_RANGE 1.0f
 
 
 typedef struct {
   widget_t* widget;
+  float points[SCATTER_PLOT_MAX_POINTS];
+  uint16_t num_points;
 } scatter_plot_t;
 
 
@@ -33,6 +40,20 @@ scatter_plot_create(widget_t* parent, rect_t rect)
   return s->widget;
 }
 
+void
+scatter_plot_set_points(widget_t* w, const float* points, uint16_t num_points)
+{
+  scatter_plot_t* s = widget_get_instance_data(w);
+
+  if (num_points > SCATTER_PLOT_MAX_POINTS)
+    num_points = SCATTER_PLOT_MAX_POINTS;
+
+  memcpy(s->points, points, num_points * sizeof(float));
+  s->num_points = num_points;
+
+  widget_invalidate(w);
+}
+
 static void
 scatter_plot_destroy(widget_t* w)
 {
@@ -43,8 +64,55 @@ scatter_plot_destroy(widget_t* w)
 static void
 scatter_plot_paint(paint_event_t* event)
 {
+  scatter_plot_t* s = widget_get_instance_data(event->widget);
   rect_t rect = widget_get_rect(event->widget);
+  float min = INFINITY;
+  float max = -INFINITY;
+  int last_x = 0;
+  int last_y = 0;
+  bool have_last = false;
+  int i;
 
   gfx_set_fg_color(WHITE);
   gfx_draw_rect(rect);
+
+  if (s->num_points < 2)
+    return;
+
+  for (i = 0; i < s->num_points; ++i) {
+    if (isnan(s->points[i]))
+      continue;
+    if (s->points[i] < min)
+      min = s->points[i];
+    if (s->points[i] > max)
+      max = s->points[i];
+  }
+
+  if (min > max)
+    return;
+
+  if ((max - min) < MIN_RANGE) {
+    float mid = (max + min) / 2;
+    min = mid - (MIN_RANGE / 2);
+    max = mid + (MIN_RANGE / 2);
+  }
+
+  gfx_set_fg_color(CYAN);
+  for (i = 0; i < s->num_points; ++i) {
+    if (isnan(s->points[i])) {
+      have_last = false;
+      continue;
+    }
+
+    int x = rect.x + 2 + ((i * (rect.width - 5)) / (s->num_points - 1));
+    int y = rect.y + rect.height - 3 -
+        (int)(((s->points[i] - min) * (rect.height - 5)) / (max - min));
+
+    if (have_last)
+      gfx_draw_line(last_x, last_y, x, y);
+
+    last_x = x;
+    last_y = y;
+    have_last = true;
+  }
 }
@@ -4,7 +4,16 @@
 
 #include "widget.h"
 
+// Most points a plot holds
+#define SCATTER_PLOT_MAX_POINTS 64
+
 widget_t*
 scatter_plot_create(widget_t* parent, rect_t rect);
 
+/* Plots values evenly spaced across the widget, joined by lines and scaled
+ * to fill its height. NAN values leave a gap.
+ */
+void
+scatter_plot_set_points(widget_t* w, const float* points, uint16_t num_points);
+
 #endif
@@ -15,8 +15,11 @@ typedef struct widget_stack_elem_s {
 static void dispatch_touch(touch_msg_t* event);
 static void dispatch_push_screen(widget_t* screen);
 static void dispatch_pop_screen(bool destroy);
-static void gui_dispatch(msg_id_t id, void* msg_data, void* listener_data, void* sub_data);
+static void gui_dispatch(msg_id_t id, void* msg_data, void* listener_data);
+static void dispatch_msg_to_widgets(msg_id_t id, void* msg_data);
 static void dispatch_msg_to_widget(widget_t* w, msg_id_t id, void* msg_data);
+static bool is_gui_msg(msg_id_t id);
+static void compact_subs(void);
 
 
 static msg_listener_t* gui_msg_listener;
@@ -24,6 +27,24 @@ static widget_t* touch_capture_widget;
 static widget_stack_elem_t* screen_stack = NULL;
 static systime_t last_paint_time;
 
+/* The gui listener subscribes to a message once and fans it out to the
+ * interested widgets itself, so the bus only wakes the gui thread once per
+ * message regardless of how many widgets are listening. Widgets get the
+ * message in the order they subscribed. No message has more than three
+ * widgets listening at once, the home screen, a screen pushed over it and a
+ * status widget.
+ */
+#define MAX_WIDGET_SUBS 4
+
+static widget_t* widget_subs[NUM_THREAD_MSGS][MAX_WIDGET_SUBS];
+static uint8_t num_widget_subs[NUM_THREAD_MSGS];
+
+/* Subscriptions dropped while a message is being fanned out are only marked
+ * dead, by clearing their widget, and removed once the fan-out is over.
+ */
+static uint32_t dispatch_depth;
+static bool have_dead_subs;
+
 
 void
 gui_init()
@@ -32,10 +53,10 @@ gui_init()
   msg_listener_set_idle_timeout(gui_msg_listener, 100);
   msg_listener_enable_watchdog(gui_msg_listener, 5000);
 
-  msg_subscribe(gui_msg_listener, MSG_TOUCH_INPUT, NULL);
-  msg_subscribe(gui_msg_listener, MSG_GUI_PUSH_SCREEN, NULL);
-  msg_subscribe(gui_msg_listener, MSG_GUI_POP_SCREEN, NULL);
-  msg_subscribe(gui_msg_listener, MSG_GUI_HIDE_SCREEN, NULL);
+  msg_subscribe(gui_msg_listener, MSG_TOUCH_INPUT);
+  msg_subscribe(gui_msg_listener, MSG_GUI_PUSH_SCREEN);
+  msg_subscribe(gui_msg_listener, MSG_GUI_POP_SCREEN);
+  msg_subscribe(gui_msg_listener, MSG_GUI_HIDE_SCREEN);
 }
 
 void
@@ -73,53 +94,82 @@ gui_release_touch_capture(void)
 void
 gui_msg_subscribe(msg_id_t id, widget_t* w)
 {
-  if (w == NULL)
+  if (w == NULL || id >= NUM_THREAD_MSGS)
+    return;
+
+  chDbgAssert(num_widget_subs[id] < MAX_WIDGET_SUBS, "gui_msg_subscribe(),#1", "too many widgets");
+
+  chSysLock();
+  if (num_widget_subs[id] >= MAX_WIDGET_SUBS) {
+    chSysUnlock();
     return;
+  }
+  widget_subs[id][num_widget_subs[id]++] = w;
+  chSysUnlock();
 
-  msg_subscribe(gui_msg_listener, id, w);
+  msg_subscribe(gui_msg_listener, id);
 }
 
 void
 gui_msg_unsubscribe(msg_id_t id, widget_t* w)
 {
-  if (w == NULL)
+  if (w == NULL || id >= NUM_THREAD_MSGS)
     return;
 
-  msg_unsubscribe(gui_msg_listener, id, w);
+  uint32_t i;
+  bool empty;
+
+  chSysLock();
+  for (i = 0; i < num_widget_subs[id]; ++i) {
+    if (widget_subs[id][i] == w) {
+      if (dispatch_depth > 0) {
+        widget_subs[id][i] = NULL;
+        have_dead_subs = true;
+      }
+      else {
+        num_widget_subs[id]--;
+        for (; i < num_widget_subs[id]; ++i)
+          widget_subs[id][i] = widget_subs[id][i + 1];
+      }
+      break;
+    }
+  }
+  empty = (num_widget_subs[id] == 0);
+  chSysUnlock();
+
+  if (empty && !is_gui_msg(id))
+    msg_unsubscribe(gui_msg_listener, id);
 }
 
 static void
-gui_dispatch(msg_id_t id, void* msg_data, void* listener_data, void* sub_data)
+gui_dispatch(msg_id_t id, void* msg_data, void* listener_data)
 {
   (void)listener_data;
 
-  if (sub_data != NULL) {
-    dispatch_msg_to_widget(sub_data, id, msg_data);
-  }
-  else {
-    switch(id) {
-    case MSG_GUI_PUSH_SCREEN:
-      dispatch_push_screen(msg_data);
-      break;
+  switch(id) {
+  case MSG_GUI_PUSH_SCREEN:
+    dispatch_push_screen(msg_data);
+    break;
 
-    case MSG_GUI_POP_SCREEN:
-      dispatch_pop_screen(true);
-      break;
+  case MSG_GUI_POP_SCREEN:
+    dispatch_pop_screen(true);
+    break;
 
-    case MSG_GUI_HIDE_SCREEN:
-      dispatch_pop_screen(false);
-      break;
+  case MSG_GUI_HIDE_SCREEN:
+    dispatch_pop_screen(false);
+    break;
 
-    case MSG_TOUCH_INPUT:
-      if (!screen_saver_is_active())
-    	dispatch_touch(msg_data);
-      break;
+  case MSG_TOUCH_INPUT:
+    if (!screen_saver_is_active())
+      dispatch_touch(msg_data);
+    break;
 
-    default:
-      break;
-    }
+  default:
+    break;
   }
 
+  dispatch_msg_to_widgets(id, msg_data);
+
   if ((chTimeNow() - last_paint_time) >= MS2ST(100)) {
     if (screen_stack != NULL) {
       widget_paint(screen_stack->widget);
@@ -180,6 +230,66 @@ dispatch_pop_screen(bool destroy)
   }
 }
 
+static void
+dispatch_msg_to_widgets(msg_id_t id, void* msg_data)
+{
+  uint32_t num_subs;
+  uint32_t i;
+
+  chSysLock();
+  dispatch_depth++;
+  num_subs = num_widget_subs[id];
+  chSysUnlock();
+
+  /* Widgets may unsubscribe, themselves or others, while handling the
+   * message, which leaves the slot in place with no widget. Widgets that
+   * subscribe meanwhile are added past num_subs and get the next one.
+   */
+  for (i = 0; i < num_subs; ++i) {
+    widget_t* w = widget_subs[id][i];
+    if (w != NULL)
+      dispatch_msg_to_widget(w, id, msg_data);
+  }
+
+  chSysLock();
+  dispatch_depth--;
+  chSysUnlock();
+
+  if (dispatch_depth == 0 && have_dead_subs)
+    compact_subs();
+}
+
+/* Removes the slots left empty by unsubscribing during a fan-out, keeping
+ * the others in order
+ */
+static void
+compact_subs()
+{
+  msg_id_t id;
+
+  have_dead_subs = false;
+
+  for (id = 0; id < NUM_THREAD_MSGS; ++id) {
+    uint32_t i;
+    uint32_t n = 0;
+    bool removed;
+    bool empty;
+
+    chSysLock();
+    for (i = 0; i < num_widget_subs[id]; ++i) {
+      if (widget_subs[id][i] != NULL)
+        widget_subs[id][n++] = widget_subs[id][i];
+    }
+    removed = (n != num_widget_subs[id]);
+    num_widget_subs[id] = n;
+    empty = (n == 0);
+    chSysUnlock();
+
+    if (removed && empty && !is_gui_msg(id))
+      msg_unsubscribe(gui_msg_listener, id);
+  }
+}
+
 static void
 dispatch_msg_to_widget(widget_t* w, msg_id_t id, void* msg_data)
 {
@@ -191,3 +301,18 @@ dispatch_msg_to_widget(widget_t* w, msg_id_t id, void* msg_data)
   };
   widget_dispatch_event(w, (event_t*)&event);
 }
+
+static bool
+is_gui_msg(msg_id_t id)
+{
+  switch (id) {
+  case MSG_TOUCH_INPUT:
+  case MSG_GUI_PUSH_SCREEN:
+  case MSG_GUI_POP_SCREEN:
+  case MSG_GUI_HIDE_SCREEN:
+    return true;
+
+  default:
+    return false;
+  }
+}
@@ -429,8 +429,10 @@ click_output_button(button_event_t* event)
   widget_t* parent = widget_get_parent(event->widget);
   home_screen_t* s = widget_get_instance_data(parent);
 
-  const controller_settings_t* controller1_settings = app_cfg_get_controller_settings(CONTROLLER_1);
-  const controller_settings_t* controller2_settings = app_cfg_get_controller_settings(CONTROLLER_2);
+  controller_settings_t controller1_settings;
+  controller_settings_t controller2_settings;
+  app_cfg_get_controller_settings(CONTROLLER_1, &controller1_settings);
+  app_cfg_get_controller_settings(CONTROLLER_2, &controller2_settings);
 
   output_id_t output;
 
@@ -439,8 +441,8 @@ click_output_button(button_event_t* event)
   else
     output = OUTPUT_2;
 
-  output_function_t controller_1_function = controller1_settings->output_settings[output].function;
-  output_function_t controller_2_function = controller2_settings->output_settings[output].function;
+  output_function_t controller_1_function = controller1_settings.output_settings[output].function;
+  output_function_t controller_2_function = controller2_settings.output_settings[output].function;
 
   if (controller_1_function == OUTPUT_FUNC_MANUAL ||
       controller_2_function == OUTPUT_FUNC_MANUAL) {
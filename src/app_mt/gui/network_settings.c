@@ -58,7 +58,7 @@ network_settings_screen_create()
 
   s->button_list = button_list_screen_create(s->widget, "Network Settings", back_button_clicked, s);
 
-  memcpy(&s->settings, app_cfg_get_net_settings(), sizeof(net_settings_t));
+  app_cfg_get_net_settings(&s->settings);
 
   rebuild_screen(s);
 
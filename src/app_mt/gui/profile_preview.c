@@ -0,0 +1,133 @@
+#include "gui/profile_preview.h"
+#include "button.h"
+#include "label.h"
+#include "scatter_plot.h"
+#include "gfx.h"
+#include "gui.h"
+#include "app_cfg.h"
+#include "temp_profile.h"
+#include "temp_profile_lib.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+// Setpoints sampled across the profile, one every 5 pixels of the plot
+#define PREVIEW_POINTS 62
+
+#define DAY (24 * 60 * 60)
+
+typedef struct {
+  widget_t* widget;
+} profile_preview_screen_t;
+
+
+static void profile_preview_screen_destroy(widget_t* w);
+static void back_button_clicked(button_event_t* event);
+static void format_temp(char* buf, size_t size, float value);
+
+static const widget_class_t profile_preview_widget_class = {
+    .on_destroy = profile_preview_screen_destroy,
+};
+
+/* Shows one pass of a profile, as it would run from its first step */
+widget_t*
+profile_preview_screen_create(const temp_profile_ref_t* profile)
+{
+  profile_preview_screen_t* s = calloc(1, sizeof(profile_preview_screen_t));
+  temp_profile_timeline_t* timeline = malloc(sizeof(temp_profile_timeline_t));
+  float points[PREVIEW_POINTS];
+  char title[64];
+  char summary[64];
+  temp_profile_t tp;
+
+  s->widget = widget_create(NULL, &profile_preview_widget_class, s, display_rect);
+
+  rect_t rect = {
+      .x = 15,
+      .y = 15,
+      .width = 56,
+      .height = 56,
+  };
+  widget_t* back_btn = button_create(s->widget, rect, img_left, WHITE, BLACK, back_button_clicked);
+  button_set_up_bg_color(back_btn, BLACK);
+  button_set_up_icon_color(back_btn, WHITE);
+  button_set_down_bg_color(back_btn, BLACK);
+  button_set_down_icon_color(back_btn, LIGHT_GRAY);
+  button_set_disabled_bg_color(back_btn, BLACK);
+  button_set_disabled_icon_color(back_btn, DARK_GRAY);
+
+  if (temp_profile_lib_get(profile->id, &tp))
+    snprintf(title, sizeof(title), "%s", tp.name);
+  else
+    snprintf(title, sizeof(title), "No profile");
+
+  rect.x = 85;
+  rect.y = 26;
+  rect.width = 220;
+  label_create(s->widget, rect, title, font_opensans_regular_22, WHITE, 1);
+
+  rect.x = 5;
+  rect.y = 80;
+  rect.width = DISP_WIDTH - 10;
+  rect.height = DISP_HEIGHT - 118;
+  widget_t* plot = scatter_plot_create(s->widget, rect);
+
+  summary[0] = '\0';
+  if (temp_profile_compile(timeline, profile) && timeline->duration > 0) {
+    char lo[16];
+    char hi[16];
+    float min = INFINITY;
+    float max = -INFINITY;
+    int i;
+
+    temp_profile_preview(timeline, points, PREVIEW_POINTS);
+    scatter_plot_set_points(plot, points, PREVIEW_POINTS);
+
+    for (i = 0; i < PREVIEW_POINTS; ++i) {
+      if (points[i] < min)
+        min = points[i];
+      if (points[i] > max)
+        max = points[i];
+    }
+
+    format_temp(lo, sizeof(lo), min);
+    format_temp(hi, sizeof(hi), max);
+    snprintf(summary, sizeof(summary), "%s to %s over %d.%d days", lo, hi,
+        (int)(timeline->duration / DAY),
+        (int)(((timeline->duration % DAY) * 10) / DAY));
+  }
+  free(timeline);
+
+  rect.y = DISP_HEIGHT - 32;
+  rect.height = 30;
+  label_create(s->widget, rect, summary, font_opensans_regular_18, WHITE, 1);
+
+  return s->widget;
+}
+
+static void
+format_temp(char* buf, size_t size, float value)
+{
+  quantity_t q = { .unit = UNIT_TEMP_DEG_F, .value = value };
+
+  q = quantity_convert(q, app_cfg_get_temp_unit());
+  snprintf(buf, size, "%d.%d %s",
+      (int)q.value,
+      ((int)(fabs(q.value) * 10.0f)) % 10,
+      (q.unit == UNIT_TEMP_DEG_F) ? "F" : "C");
+}
+
+static void
+profile_preview_screen_destroy(widget_t* w)
+{
+  profile_preview_screen_t* s = widget_get_instance_data(w);
+  free(s);
+}
+
+static void
+back_button_clicked(button_event_t* event)
+{
+  if (event->id == EVT_BUTTON_CLICK)
+    gui_pop_screen();
+}
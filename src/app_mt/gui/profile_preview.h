@@ -0,0 +1,11 @@
+
+#ifndef GUI_PROFILE_PREVIEW_H
+#define GUI_PROFILE_PREVIEW_H
+
+#include "widget.h"
+#include "temp_control.h"
+
+widget_t*
+profile_preview_screen_create(const temp_profile_ref_t* profile);
+
+#endif
@@ -196,7 +196,8 @@ trigger_op(recovery_screen_t* s)
       break;
 
     case RO_RESTORE_FIRMWARE:
-      bootloader_load_recovery_img();
+      if (!bootloader_load_recovery_img())
+        printf("Could not store the boot command\r\n");
       break;
 
     default:
@@ -136,7 +136,11 @@
  * @brief   Enables the SERIAL subsystem.
  */
 #if !defined(HAL_USE_SERIAL) || defined(__DOXYGEN__)
+#ifdef DEBUG
 #define HAL_USE_SERIAL              TRUE
+#else
+#define HAL_USE_SERIAL              FALSE
+#endif
 #endif
 
 /**
@@ -157,7 +161,7 @@
  * @brief   Enables the UART subsystem.
  */
 #if !defined(HAL_USE_UART) || defined(__DOXYGEN__)
-#define HAL_USE_UART                FALSE
+#define HAL_USE_UART                TRUE
 #endif
 
 /**
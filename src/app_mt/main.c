@@ -9,6 +9,7 @@
 #include "touch.h"
 #include "gui.h"
 #include "temp_control.h"
+#include "temp_profile_lib.h"
 #include "gui/home.h"
 #include "gui/recovery.h"
 #include "gui/self_test.h"
@@ -20,7 +21,13 @@
 #include "app_hdr.h"
 #include "screen_saver.h"
 #include "xflash.h"
+#include "crc/crc32.h"
 #include "recovery_img.h"
+#include "message.h"
+#include "debug_console.h"
+#ifdef SIMULATOR
+#include "sim.h"
+#endif
 
 #include <stdio.h>
 #include <string.h>
@@ -36,16 +43,18 @@ char device_id[32];
 static void
 check_for_faults(void)
 {
-  const fault_data_t* fault = app_cfg_get_fault_data();
-    if (fault->type != FAULT_NONE) {
+  fault_data_t fault;
+
+  app_cfg_get_fault_data(&fault);
+    if (fault.type != FAULT_NONE) {
       int i;
 
       printf("!!! FAULT DETECTED !!!\r\n");
-      printf("  type: %d\r\n  ", fault->type);
+      printf("  type: %d\r\n  ", fault.type);
       for (i = 0; i < MAX_FAULT_DATA / 8; ++i) {
         int j;
         for (j = 0; j < 8; ++j) {
-          printf("%d ", fault->data[i * 8 + j]);
+          printf("%d ", fault.data[i * 8 + j]);
         }
         printf("\r\n");
       }
@@ -85,11 +94,17 @@ main(void)
 {
   halInit();
   chSysInit();
+  crc32_init();
 
   get_device_id();
 
+  msg_init();
+
   xflash_init();
 
+  /* Before app_cfg, which moves profiles from an old config into it */
+  temp_profile_lib_init();
+
   app_cfg_init();
 
   check_for_faults();
@@ -97,8 +112,8 @@ main(void)
   gfx_init();
   touch_init();
 
-  sensor_init(SENSOR_1, SD_OW1);
-  sensor_init(SENSOR_2, SD_OW2);
+  sensor_init(SENSOR_1, &OWD1);
+  sensor_init(SENSOR_2, &OWD2);
 
   temp_control_init(CONTROLLER_1);
   temp_control_init(CONTROLLER_2);
@@ -122,6 +137,14 @@ main(void)
 
   recovery_img_init();
 
+#ifdef SIMULATOR
+  sim_ctrl_init();
+#endif
+
+#ifdef DEBUG
+  debug_console_init();
+#endif
+
   while (TRUE) {
     toggle_LED1();
   }
@@ -3,65 +3,240 @@
 #include "common.h"
 #include "thread_watchdog.h"
 
+#include <chprintf.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #define MAX_MAILBOX_MSGS 32
 
+/* Subscriptions are kept as a bitmap of listener indices per message id, so
+ * a listener is posted to at most once per message no matter how many of its
+ * own clients (e.g. GUI widgets) are interested in it.
+ */
+#define MAX_LISTENERS 16
+
+/* Posted messages are copied into a pool slot which is shared by every
+ * subscriber and released once the last of them has dispatched it. The slot
+ * size must hold the largest posted payload (currently net_status_t).
+ */
+#define MAX_POSTED_MSGS       12
+#define MAX_POSTED_MSG_SIZE   160
+#define MAX_POSTED_DELIVERIES 32
+
+/* Posted messages received while a listener is blocked in msg_send() are
+ * parked here until the send completes. There can never be more of them than
+ * there are delivery slots.
+ */
+#define MAX_PENDING_MSGS      MAX_POSTED_DELIVERIES
+
+/* State topics hold only the newest value of a (message id, instance) pair.
+ * Listeners are woken once and read whatever is newest at that point, so a
+ * slow listener skips stale updates instead of queueing them.
+ */
+#define MAX_STATE_TOPICS      8
+#define MAX_STATE_MSG_SIZE    MAX_POSTED_MSG_SIZE
+
+/* Lock-free reads of a state topic that overlap a write are retried this
+ * many times before the reader falls back to taking the writer's mutex.
+ */
+#define STATE_READ_TRIES      3
+
+/* The simulator board adds SIM_STACK_EXTRA bytes to every thread created
+ * from the heap.
+ */
+#ifdef SIM_STACK_EXTRA
+#define STACK_EXTRA           SIM_STACK_EXTRA
+#else
+#define STACK_EXTRA           0
+#endif
+
+/* Trace histograms are allocated on the first call to msg_trace_enable(). */
+typedef struct {
+  msg_trace_stats_t msgs[NUM_THREAD_MSGS];
+  msg_trace_stats_t listeners[MAX_LISTENERS];
+} msg_trace_t;
+
+#define compiler_barrier() __asm volatile("" ::: "memory")
+
 typedef struct msg_listener_s {
   Thread* thread;
   const char* name;
+  uint32_t index;
+  uint32_t stack_size;
   thread_msg_dispatch_t dispatch;
   systime_t timeout;
   void* user_data;
   bool watchdog_enabled;
+  uint32_t state_pending;
   Mailbox mb;
   msg_t mb_buf[MAX_MAILBOX_MSGS];
+  struct thread_msg_s* pending[MAX_PENDING_MSGS];
+  uint32_t pending_head;
+  uint32_t pending_count;
+  // state topics are copied here to be dispatched, rather than onto the stack
+  uint8_t state_buf[MAX_STATE_MSG_SIZE];
 } msg_listener_t;
 
 typedef struct {
+  msg_id_t id;
+  uint32_t refs;
+  uint32_t size;
+  uint8_t data[MAX_POSTED_MSG_SIZE];
+} posted_msg_t;
+
+typedef struct thread_msg_s {
   msg_listener_t* sender;
   msg_id_t id;
-  void* user_data;
   void* msg_data;
+  posted_msg_t* posted;
+  halrtcnt_t post_time;
   bool processed;
 } thread_msg_t;
 
-typedef struct msg_subscription_s {
-  msg_listener_t* listener;
-  void* user_data;
-  struct msg_subscription_s* next;
-} msg_subscription_t;
+struct msg_timer_s {
+  VirtualTimer vt;
+  msg_listener_t* l;
+  thread_msg_t msg;
+};
+
+typedef struct {
+  msg_id_t id;
+  uint32_t instance;
+  volatile uint32_t seq;
+  uint32_t size;
+  halrtcnt_t post_time;
+  Mutex write_mtx;
+  uint8_t data[MAX_STATE_MSG_SIZE];
+} state_topic_t;
 
 
 static msg_t
 msg_thread_func(void* arg);
 
+static void
+msg_timer_cb(void* arg);
+
 static void
 msg_loop_exec(msg_listener_t* l);
 
+static void
+msg_wait_exec(msg_listener_t* l);
+
 static thread_msg_t*
 msg_get(msg_listener_t* l);
 
 static void
 msg_release(thread_msg_t* msg);
 
+static void
+msg_deliver(msg_listener_t* l, msg_listener_t* self, msg_id_t id, void* msg_data);
+
+static void
+msg_dispatch(msg_listener_t* l, msg_id_t id, void* msg_data, halrtcnt_t post_time);
+
+static void
+posted_msg_unref(posted_msg_t* pm);
+
+static uint32_t
+cycles_to_us(halrtcnt_t cycles);
+
+static void
+trace_blocked(msg_listener_t* self, msg_id_t id, halrtcnt_t start);
+
+static void
+trace_mailbox_level(msg_listener_t* l);
+
+static void
+trace_hist_add(msg_trace_hist_t* hist, uint32_t us);
+
+static void
+trace_hist_print(BaseSequentialStream* chp, const char* label, const msg_trace_hist_t* hist);
+
+static void
+delivery_stats_update(msg_id_t id, uint32_t mailbox_posts);
+
+static state_topic_t*
+state_topic_get(msg_id_t id, uint32_t instance);
+
+static void
+state_topic_read(state_topic_t* topic, uint8_t* buf, halrtcnt_t* post_time);
+
+static bool
+state_notify(msg_listener_t* l, uint32_t topic_idx);
+
+static void
+state_drain(msg_listener_t* l);
+
+static bool
+oldest_queued_time(msg_listener_t* l, halrtcnt_t* post_time);
+
+static bool
+mailbox_empty(msg_listener_t* l);
+
 
-static msg_subscription_t* subs[NUM_THREAD_MSGS];
+static msg_listener_t* listeners[MAX_LISTENERS];
+static uint32_t num_listeners;
+static volatile uint32_t subs[NUM_THREAD_MSGS];
 
+static MemoryPool posted_msg_pool;
+static posted_msg_t posted_msg_buf[MAX_POSTED_MSGS];
+static MemoryPool delivery_pool;
+static thread_msg_t delivery_buf[MAX_POSTED_DELIVERIES];
+
+static state_topic_t state_topics[MAX_STATE_TOPICS];
+static uint32_t num_state_topics;
+
+/* Mailbox entry used only to wake a listener with pending state updates */
+static thread_msg_t state_wake_msg = {
+    .id = MSG_IDLE,
+    .msg_data = NULL,
+    .sender = NULL,
+    .posted = NULL,
+    .processed = true
+};
+
+static msg_delivery_stats_t delivery_stats[NUM_THREAD_MSGS];
+
+static bool trace_enabled;
+static msg_trace_t* trace;
+
+
+void
+msg_init()
+{
+  chPoolInit(&posted_msg_pool, sizeof(posted_msg_t), NULL);
+  chPoolLoadArray(&posted_msg_pool, posted_msg_buf, MAX_POSTED_MSGS);
+
+  chPoolInit(&delivery_pool, sizeof(thread_msg_t), NULL);
+  chPoolLoadArray(&delivery_pool, delivery_buf, MAX_POSTED_DELIVERIES);
+
+  int i;
+  for (i = 0; i < MAX_STATE_TOPICS; ++i)
+    chMtxInit(&state_topics[i].write_mtx);
+}
 
 msg_listener_t*
 msg_listener_create(const char* name, int stack_size, thread_msg_dispatch_t dispatch, void* user_data)
 {
   chDbgAssert(dispatch != NULL, "msg_listener_create(),#1", "");
+  chDbgAssert(num_listeners < MAX_LISTENERS, "msg_listener_create(),#2", "too many listeners");
 
   msg_listener_t* l = calloc(1, sizeof(msg_listener_t));
   l->name = name;
+  l->stack_size = stack_size;
   l->dispatch = dispatch;
   l->timeout = TIME_INFINITE;
   l->user_data = user_data;
   l->watchdog_enabled = false;
+  l->state_pending = 0;
   chMBInit(&l->mb, l->mb_buf, MAX_MAILBOX_MSGS);
+
+  chSysLock();
+  l->index = num_listeners++;
+  listeners[l->index] = l;
+  chSysUnlock();
+
   l->thread = chThdCreateFromHeap(NULL, stack_size, NORMALPRIO, msg_thread_func, l);
   return l;
 }
@@ -79,6 +254,83 @@ msg_listener_set_idle_timeout(msg_listener_t* l, uint32_t idle_timeout)
   l->timeout = MS2ST(idle_timeout);
 }
 
+msg_timer_t*
+msg_timer_create(msg_listener_t* l, void* msg_data)
+{
+  msg_timer_t* t = calloc(1, sizeof(msg_timer_t));
+  t->l = l;
+  t->msg.id = MSG_TIMER;
+  t->msg.msg_data = msg_data;
+  t->msg.sender = NULL;
+  t->msg.posted = NULL;
+  t->msg.processed = true;
+
+  return t;
+}
+
+void
+msg_timer_start(msg_timer_t* t, systime_t delay)
+{
+  if (delay == TIME_IMMEDIATE)
+    delay = 1;
+
+  chSysLock();
+  if (chVTIsArmedI(&t->vt))
+    chVTResetI(&t->vt);
+  chVTSetI(&t->vt, delay, msg_timer_cb, t);
+  chSysUnlock();
+}
+
+void
+msg_timer_stop(msg_timer_t* t)
+{
+  chSysLock();
+  if (chVTIsArmedI(&t->vt))
+    chVTResetI(&t->vt);
+  chSysUnlock();
+}
+
+static void
+msg_timer_cb(void* arg)
+{
+  msg_timer_t* t = arg;
+
+  chSysLockFromIsr();
+  /* The message is owned by the mailbox until it has been dispatched */
+  if (t->msg.processed) {
+    t->msg.processed = false;
+    t->msg.post_time = halGetCounterValue();
+
+    if (chMBPostI(&t->l->mb, (msg_t)&t->msg) != RDY_OK) {
+      /* Mailbox full, retry shortly rather than lose the expiry */
+      t->msg.processed = true;
+      chVTSetI(&t->vt, MS2ST(10), msg_timer_cb, t);
+    }
+  }
+  chSysUnlockFromIsr();
+}
+
+uint32_t
+msg_listener_get_stack_used(msg_listener_t* l)
+{
+  /* The stack grows down towards the thread structure and was filled with
+   * CH_STACK_FILL_VALUE when the thread was created (CH_DBG_FILL_THREADS).
+   */
+  const uint8_t* p = (const uint8_t*)(l->thread + 1);
+  const uint8_t* end = (const uint8_t*)l->thread + l->stack_size + STACK_EXTRA;
+
+  while (p < end && *p == CH_STACK_FILL_VALUE)
+    p++;
+
+  return end - p;
+}
+
+uint32_t
+msg_listener_get_stack_size(msg_listener_t* l)
+{
+  return l->stack_size + STACK_EXTRA;
+}
+
 static msg_t
 msg_thread_func(void* arg)
 {
@@ -87,7 +339,8 @@ msg_thread_func(void* arg)
 
   chRegSetThreadName(l->name);
 
-  l->dispatch(MSG_INIT, NULL, l->user_data, NULL);
+  /* MSG_INIT carries the listener so it can create its timers */
+  l->dispatch(MSG_INIT, l, l->user_data);
 
   while (1) {
     msg_loop_exec(l);
@@ -99,91 +352,357 @@ msg_thread_func(void* arg)
 static void
 msg_loop_exec(msg_listener_t* l)
 {
-  thread_msg_t* msg = msg_get(l);
+  thread_msg_t* msg;
 
-  if (msg != NULL) {
-    l->dispatch(msg->id, msg->msg_data, l->user_data, msg->user_data);
+  /* Anything parked while a send was in progress arrived before whatever is
+   * still in the mailbox.
+   */
+  if (l->pending_count > 0) {
+    msg = l->pending[l->pending_head];
+    l->pending_head = (l->pending_head + 1) % MAX_PENDING_MSGS;
+    l->pending_count--;
+  }
+  else if (l->state_pending != 0 && mailbox_empty(l)) {
+    /* The wake-up was consumed while blocked in a send. Anything still in
+     * the mailbox goes first, state_drain() holds back newer topics for it.
+     */
+    msg = &state_wake_msg;
+  }
+  else {
+    msg = msg_get(l);
+  }
+
+  if (msg == &state_wake_msg) {
+    /* pending state topics are dispatched below */
+  }
+  else if (msg != NULL) {
+    msg_dispatch(l, msg->id, msg->msg_data, msg->post_time);
 
     msg_release(msg);
   }
   else {
-    l->dispatch(MSG_IDLE, NULL, l->user_data, NULL);
+    l->dispatch(MSG_IDLE, NULL, l->user_data);
   }
+
+  state_drain(l);
+
+  if (l->watchdog_enabled)
+    thread_watchdog_kick();
+}
+
+/* Runs a listener's mailbox while it is blocked in msg_send(). Only
+ * synchronous messages are dispatched here, because their senders are blocked
+ * as well and waiting on them could deadlock. Posted messages and timer
+ * expiries are parked on the pending queue and state updates are left for the
+ * top-level loop, so the stack only grows with the length of a chain of
+ * synchronous sends instead of with the mailbox traffic. Only a full pending
+ * queue falls back to dispatching a parked kind of message here.
+ */
+static void
+msg_wait_exec(msg_listener_t* l)
+{
+  thread_msg_t* msg = msg_get(l);
+
+  if (msg == NULL || msg == &state_wake_msg || msg->id == MSG_RELEASE) {
+    /* nothing to dispatch, just re-check whether the send has completed */
+  }
+  else if ((msg->posted != NULL || msg->id == MSG_TIMER) &&
+           l->pending_count < MAX_PENDING_MSGS) {
+    l->pending[(l->pending_head + l->pending_count) % MAX_PENDING_MSGS] = msg;
+    l->pending_count++;
+  }
+  else {
+    msg_dispatch(l, msg->id, msg->msg_data, msg->post_time);
+
+    msg_release(msg);
+  }
+
   if (l->watchdog_enabled)
     thread_watchdog_kick();
 }
 
 void
-msg_subscribe(msg_listener_t* l, msg_id_t id, void* user_data)
+msg_subscribe(msg_listener_t* l, msg_id_t id)
 {
   if (id >= NUM_THREAD_MSGS)
     return;
 
-  msg_subscription_t* sub = calloc(1, sizeof(msg_subscription_t));
-  sub->listener = l;
-  sub->user_data = user_data;
+  chSysLock();
+  subs[id] |= (1 << l->index);
+  chSysUnlock();
+}
+
+void
+msg_unsubscribe(msg_listener_t* l, msg_id_t id)
+{
+  if (id >= NUM_THREAD_MSGS)
+    return;
 
   chSysLock();
-  sub->next = subs[id];
-  subs[id] = sub;
+  subs[id] &= ~(1 << l->index);
   chSysUnlock();
 }
 
 void
-msg_unsubscribe(msg_listener_t* l, msg_id_t id, void* user_data)
+msg_send(msg_id_t id, void* msg_data)
 {
   if (id >= NUM_THREAD_MSGS)
     return;
 
-  msg_subscription_t* sub;
-  msg_subscription_t* prev_sub = NULL;
-  for (sub = subs[id]; sub != NULL; sub = sub->next) {
-    if ((sub->listener == l) &&
-        (sub->user_data == user_data)) {
-      if (prev_sub != NULL) {
-        prev_sub->next = sub->next;
-      }
-      else {
-        subs[id] = sub->next;
-      }
-      free(sub);
-      break;
-    }
-    prev_sub = sub;
+  halrtcnt_t start = halGetCounterValue();
+  msg_listener_t* self = chThdSelf()->msg_listener;
+  uint32_t mailbox_posts = 0;
+  uint32_t sub_mask = subs[id];
+
+  while (sub_mask != 0) {
+    uint32_t i = __builtin_ctz(sub_mask);
+    sub_mask &= ~(1 << i);
+
+    if (listeners[i] != self)
+      mailbox_posts++;
+    msg_deliver(listeners[i], self, id, msg_data);
   }
+
+  delivery_stats_update(id, mailbox_posts);
+  trace_blocked(self, id, start);
 }
 
 void
-msg_send(msg_id_t id, void* msg_data)
+msg_post(msg_id_t id, void* msg_data, uint32_t msg_size)
 {
-  msg_subscription_t* sub;
+  if (id >= NUM_THREAD_MSGS)
+    return;
+
+  posted_msg_t* pm = NULL;
+  if (msg_size <= MAX_POSTED_MSG_SIZE)
+    pm = chPoolAlloc(&posted_msg_pool);
+
+  /* Oversized payloads and an exhausted pool degrade to a blocking send */
+  if (pm == NULL) {
+    msg_send(id, msg_data);
+    return;
+  }
+
+  halrtcnt_t start = halGetCounterValue();
+  msg_listener_t* self = chThdSelf()->msg_listener;
+  uint32_t mailbox_posts = 0;
+  uint32_t sub_mask = subs[id];
+
+  pm->id = id;
+  pm->refs = 1; /* held by the poster until every subscriber has been queued */
+  pm->size = msg_size;
+  memcpy(pm->data, msg_data, msg_size);
+
+  while (sub_mask != 0) {
+    uint32_t i = __builtin_ctz(sub_mask);
+    msg_listener_t* l = listeners[i];
+    thread_msg_t* msg = NULL;
+
+    sub_mask &= ~(1 << i);
+
+    if (l != self) {
+      mailbox_posts++;
+      msg = chPoolAlloc(&delivery_pool);
+    }
+
+    if (msg == NULL) {
+      msg_deliver(l, self, id, pm->data);
+      continue;
+    }
+
+    chSysLock();
+    pm->refs++;
+    chSysUnlock();
+
+    msg->id = id;
+    msg->msg_data = pm->data;
+    msg->sender = NULL;
+    msg->posted = pm;
+    msg->post_time = start;
+    msg->processed = false;
+
+    chMBPost(&l->mb, (msg_t)msg, TIME_INFINITE);
+    trace_mailbox_level(l);
+  }
+
+  posted_msg_unref(pm);
+
+  delivery_stats_update(id, mailbox_posts);
+  trace_blocked(self, id, start);
+}
 
+void
+msg_post_state(msg_id_t id, uint32_t instance, void* msg_data, uint32_t msg_size)
+{
   if (id >= NUM_THREAD_MSGS)
     return;
 
+  state_topic_t* topic = NULL;
+  if (msg_size <= MAX_STATE_MSG_SIZE)
+    topic = state_topic_get(id, instance);
+
+  /* Too large or out of topic slots, queue it like any other posted message */
+  if (topic == NULL) {
+    msg_post(id, msg_data, msg_size);
+    return;
+  }
+
+  halrtcnt_t start = halGetCounterValue();
   msg_listener_t* self = chThdSelf()->msg_listener;
+  uint32_t mailbox_posts = 0;
+  uint32_t sub_mask = subs[id];
 
-  for (sub = subs[id]; sub != NULL; sub = sub->next) {
-    if (sub->listener == self) {
-      sub->listener->dispatch(id, msg_data, sub->listener->user_data, sub->user_data);
+  /* Writers are serialized by the topic mutex. Readers retry while the
+   * sequence number is odd or changes underneath them, and only lock if that
+   * keeps happening.
+   */
+  chMtxLock(&topic->write_mtx);
+  topic->seq++;
+  compiler_barrier();
+  memcpy(topic->data, msg_data, msg_size);
+  topic->size = msg_size;
+  topic->post_time = start;
+  compiler_barrier();
+  topic->seq++;
+  chMtxUnlock();
+
+  while (sub_mask != 0) {
+    uint32_t i = __builtin_ctz(sub_mask);
+    msg_listener_t* l = listeners[i];
+
+    sub_mask &= ~(1 << i);
+
+    if (l == self) {
+      msg_dispatch(l, id, msg_data, start);
     }
-    else {
-      thread_msg_t msg = {
-        .id = id,
-        .msg_data = msg_data,
-        .user_data = sub->user_data,
-        .sender = self,
-        .processed = false
-      };
-
-      chMBPost(&sub->listener->mb, (msg_t)&msg, TIME_INFINITE);
-
-      while (!msg.processed) {
-        if (self != NULL)
-          msg_loop_exec(self);
-        else
-          chThdSleepMilliseconds(10);
-      }
+    else if (state_notify(l, topic - state_topics)) {
+      mailbox_posts++;
+      trace_mailbox_level(l);
+    }
+  }
+
+  delivery_stats_update(id, mailbox_posts);
+  trace_blocked(self, id, start);
+}
+
+void
+msg_get_delivery_stats(msg_id_t id, msg_delivery_stats_t* stats)
+{
+  if (id >= NUM_THREAD_MSGS)
+    return;
+
+  chSysLock();
+  *stats = delivery_stats[id];
+  chSysUnlock();
+}
+
+void
+msg_reset_stats()
+{
+  chSysLock();
+  memset(delivery_stats, 0, sizeof(delivery_stats));
+  if (trace != NULL)
+    memset(trace, 0, sizeof(msg_trace_t));
+  chSysUnlock();
+}
+
+void
+msg_trace_enable(bool enable)
+{
+  if (enable && trace == NULL)
+    trace = calloc(1, sizeof(msg_trace_t));
+
+  trace_enabled = enable && (trace != NULL);
+}
+
+void
+msg_trace_get_msg(msg_id_t id, msg_trace_stats_t* stats)
+{
+  if (id >= NUM_THREAD_MSGS)
+    return;
+
+  chSysLock();
+  if (trace != NULL)
+    *stats = trace->msgs[id];
+  else
+    memset(stats, 0, sizeof(msg_trace_stats_t));
+  chSysUnlock();
+}
+
+void
+msg_trace_get_listener(msg_listener_t* l, msg_trace_stats_t* stats)
+{
+  chSysLock();
+  if (trace != NULL)
+    *stats = trace->listeners[l->index];
+  else
+    memset(stats, 0, sizeof(msg_trace_stats_t));
+  chSysUnlock();
+}
+
+void
+msg_trace_dump(BaseSequentialStream* chp)
+{
+  msg_delivery_stats_t delivery;
+  msg_trace_stats_t stats;
+  uint32_t i;
+
+  if (trace == NULL) {
+    chprintf(chp, "Message tracing is not enabled\r\n");
+    return;
+  }
+
+  chprintf(chp, "Message trace (us, bucket 0 < 16us, bucket n < 2^(n+4)us)\r\n");
+
+  for (i = 0; i < NUM_THREAD_MSGS; ++i) {
+    msg_get_delivery_stats(i, &delivery);
+    if (delivery.published == 0)
+      continue;
+
+    msg_trace_get_msg(i, &stats);
+    chprintf(chp, "msg %d: published %u, mailbox posts %u\r\n",
+        (int)i, (unsigned)delivery.published, (unsigned)delivery.mailbox_posts);
+    trace_hist_print(chp, "latency", &stats.latency);
+    trace_hist_print(chp, "dispatch", &stats.dispatch);
+    trace_hist_print(chp, "blocked", &stats.blocked);
+  }
+
+  for (i = 0; i < num_listeners; ++i) {
+    msg_trace_get_listener(listeners[i], &stats);
+    chprintf(chp, "listener %s: mailbox high-water %u/%d, stack used %u/%u\r\n",
+        listeners[i]->name, (unsigned)stats.mailbox_hwm, MAX_MAILBOX_MSGS,
+        (unsigned)msg_listener_get_stack_used(listeners[i]),
+        (unsigned)msg_listener_get_stack_size(listeners[i]));
+    trace_hist_print(chp, "latency", &stats.latency);
+    trace_hist_print(chp, "dispatch", &stats.dispatch);
+    trace_hist_print(chp, "blocked", &stats.blocked);
+  }
+}
+
+static void
+msg_deliver(msg_listener_t* l, msg_listener_t* self, msg_id_t id, void* msg_data)
+{
+  if (l == self) {
+    msg_dispatch(l, id, msg_data, halGetCounterValue());
+  }
+  else {
+    thread_msg_t msg = {
+      .id = id,
+      .msg_data = msg_data,
+      .sender = self,
+      .posted = NULL,
+      .post_time = halGetCounterValue(),
+      .processed = false
+    };
+
+    chMBPost(&l->mb, (msg_t)&msg, TIME_INFINITE);
+    trace_mailbox_level(l);
+
+    while (!msg.processed) {
+      if (self != NULL)
+        msg_wait_exec(self);
+      else
+        chThdSleepMilliseconds(10);
     }
   }
 }
@@ -205,11 +724,301 @@ msg_release(thread_msg_t* msg)
   if (msg == NULL)
     return;
 
+  if (msg->posted != NULL) {
+    posted_msg_unref(msg->posted);
+    chPoolFree(&delivery_pool, msg);
+    return;
+  }
+
   msg->processed = true;
 
   if (msg->sender != NULL) {
     static thread_msg_t release_msg = {
-        .id = MSG_RELEASE,        .msg_data = NULL,        .user_data = NULL,        .sender = NULL,        .processed = true    };
-    chMBPost(&msg->sender->mb, (msg_t)&release_msg, TIME_INFINITE);
+        .id = MSG_RELEASE,
+        .msg_data = NULL,
+        .sender = NULL,
+        .processed = true
+    };
+
+    release_msg.post_time = halGetCounterValue();
+    chMBPost(&msg->sender->mb, (msg_t)&release_msg, TIME_INFINITE);
+  }
+}
+
+static void
+msg_dispatch(msg_listener_t* l, msg_id_t id, void* msg_data, halrtcnt_t post_time)
+{
+  if (!trace_enabled) {
+    l->dispatch(id, msg_data, l->user_data);
+    return;
+  }
+
+  halrtcnt_t start = halGetCounterValue();
+  l->dispatch(id, msg_data, l->user_data);
+  halrtcnt_t end = halGetCounterValue();
+
+  uint32_t latency_us = cycles_to_us(start - post_time);
+  uint32_t dispatch_us = cycles_to_us(end - start);
+
+  chSysLock();
+  trace_hist_add(&trace->msgs[id].latency, latency_us);
+  trace_hist_add(&trace->msgs[id].dispatch, dispatch_us);
+  trace_hist_add(&trace->listeners[l->index].latency, latency_us);
+  trace_hist_add(&trace->listeners[l->index].dispatch, dispatch_us);
+  chSysUnlock();
+}
+
+static void
+posted_msg_unref(posted_msg_t* pm)
+{
+  bool last_ref;
+
+  chSysLock();
+  last_ref = (--pm->refs == 0);
+  chSysUnlock();
+
+  if (last_ref)
+    chPoolFree(&posted_msg_pool, pm);
+}
+
+static uint32_t
+cycles_to_us(halrtcnt_t cycles)
+{
+  return cycles / (halGetCounterFrequency() / 1000000);
+}
+
+static void
+trace_blocked(msg_listener_t* self, msg_id_t id, halrtcnt_t start)
+{
+  if (!trace_enabled)
+    return;
+
+  uint32_t blocked_us = cycles_to_us(halGetCounterValue() - start);
+
+  chSysLock();
+  trace_hist_add(&trace->msgs[id].blocked, blocked_us);
+  if (self != NULL)
+    trace_hist_add(&trace->listeners[self->index].blocked, blocked_us);
+  chSysUnlock();
+}
+
+static void
+trace_mailbox_level(msg_listener_t* l)
+{
+  if (!trace_enabled)
+    return;
+
+  chSysLock();
+  uint32_t used = chMBGetUsedCountI(&l->mb);
+  if (used > trace->listeners[l->index].mailbox_hwm)
+    trace->listeners[l->index].mailbox_hwm = used;
+  chSysUnlock();
+}
+
+/* Must be called with the system locked */
+static void
+trace_hist_add(msg_trace_hist_t* hist, uint32_t us)
+{
+  uint32_t bucket = 0;
+
+  if (us >= 16) {
+    bucket = (31 - __builtin_clz(us)) - 3;
+    if (bucket >= MSG_TRACE_HIST_BUCKETS)
+      bucket = MSG_TRACE_HIST_BUCKETS - 1;
+  }
+
+  if (hist->buckets[bucket] < UINT16_MAX)
+    hist->buckets[bucket]++;
+
+  if (us > hist->max_us)
+    hist->max_us = us;
+}
+
+static void
+trace_hist_print(BaseSequentialStream* chp, const char* label, const msg_trace_hist_t* hist)
+{
+  int i;
+
+  chprintf(chp, "  %-8s max %7u:", label, (unsigned)hist->max_us);
+  for (i = 0; i < MSG_TRACE_HIST_BUCKETS; ++i)
+    chprintf(chp, " %u", (unsigned)hist->buckets[i]);
+  chprintf(chp, "\r\n");
+}
+
+static void
+delivery_stats_update(msg_id_t id, uint32_t mailbox_posts)
+{
+  chSysLock();
+  delivery_stats[id].published++;
+  delivery_stats[id].mailbox_posts += mailbox_posts;
+  chSysUnlock();
+}
+
+static state_topic_t*
+state_topic_get(msg_id_t id, uint32_t instance)
+{
+  state_topic_t* topic = NULL;
+  uint32_t i;
+
+  chSysLock();
+  for (i = 0; i < num_state_topics; ++i) {
+    if (state_topics[i].id == id &&
+        state_topics[i].instance == instance) {
+      topic = &state_topics[i];
+      break;
+    }
+  }
+
+  if (topic == NULL && num_state_topics < MAX_STATE_TOPICS) {
+    topic = &state_topics[num_state_topics++];
+    topic->id = id;
+    topic->instance = instance;
+  }
+  chSysUnlock();
+
+  return topic;
+}
+
+static void
+state_topic_read(state_topic_t* topic, uint8_t* buf, halrtcnt_t* post_time)
+{
+  int tries;
+
+  for (tries = 0; tries < STATE_READ_TRIES; ++tries) {
+    uint32_t seq = topic->seq;
+
+    if ((seq & 1) == 0) {
+      compiler_barrier();
+      memcpy(buf, topic->data, topic->size);
+      *post_time = topic->post_time;
+      compiler_barrier();
+
+      if (topic->seq == seq)
+        return;
+    }
+  }
+
+  /* A writer was preempted mid-update. Yielding would never let it run if it
+   * has a lower priority than this thread, but waiting on its mutex lends it
+   * this thread's priority until the update is done.
+   */
+  chMtxLock(&topic->write_mtx);
+  memcpy(buf, topic->data, topic->size);
+  *post_time = topic->post_time;
+  chMtxUnlock();
+}
+
+static bool
+state_notify(msg_listener_t* l, uint32_t topic_idx)
+{
+  bool wake;
+
+  chSysLock();
+  wake = (l->state_pending == 0);
+  l->state_pending |= (1 << topic_idx);
+
+  /* Only one wake-up is needed no matter how many topics change before the
+   * listener gets to them. If the mailbox is full the listener is busy and
+   * will pick up the pending topics after its next message anyway.
+   */
+  if (wake)
+    wake = (chMBPostS(&l->mb, (msg_t)&state_wake_msg, TIME_IMMEDIATE) == RDY_OK);
+  chSysUnlock();
+
+  return wake;
+}
+
+/* Finds when the oldest message still queued for a listener was sent,
+ * looking at the pending queue first and then the mailbox. State wake-ups
+ * carry no time and are skipped.
+ */
+static bool
+oldest_queued_time(msg_listener_t* l, halrtcnt_t* post_time)
+{
+  bool found = false;
+
+  if (l->pending_count > 0) {
+    *post_time = l->pending[l->pending_head]->post_time;
+    return true;
+  }
+
+  chSysLock();
+  msg_t* p = l->mb.mb_rdptr;
+  cnt_t used = chMBGetUsedCountI(&l->mb);
+
+  while (used-- > 0) {
+    thread_msg_t* msg = (thread_msg_t*)*p;
+
+    if (msg != &state_wake_msg) {
+      *post_time = msg->post_time;
+      found = true;
+      break;
+    }
+
+    if (++p >= l->mb.mb_top)
+      p = l->mb.mb_buffer;
+  }
+  chSysUnlock();
+
+  return found;
+}
+
+static bool
+mailbox_empty(msg_listener_t* l)
+{
+  bool empty;
+
+  chSysLock();
+  empty = (chMBGetUsedCountI(&l->mb) == 0);
+  chSysUnlock();
+
+  return empty;
+}
+
+/* A state topic only holds its newest value, so it can have been written
+ * after a message that is still queued behind the wake-up, e.g. a sample
+ * overtaking a MSG_SENSOR_TIMEOUT for the same sensor. Such a topic is held
+ * back until that message has been dispatched; msg_loop_exec() drains again
+ * after every message.
+ */
+static void
+state_drain(msg_listener_t* l)
+{
+  halrtcnt_t post_time;
+  halrtcnt_t oldest;
+  uint32_t pending;
+  uint32_t deferred = 0;
+  bool queued;
+
+  chSysLock();
+  pending = l->state_pending;
+  l->state_pending = 0;
+  chSysUnlock();
+
+  queued = oldest_queued_time(l, &oldest);
+
+  while (pending != 0) {
+    uint32_t topic_idx = __builtin_ctz(pending);
+    state_topic_t* topic = &state_topics[topic_idx];
+
+    pending &= ~(1 << topic_idx);
+
+    /* The listener may have unsubscribed since it was notified */
+    if ((subs[topic->id] & (1 << l->index)) == 0)
+      continue;
+
+    state_topic_read(topic, l->state_buf, &post_time);
+    if (queued && (int32_t)(post_time - oldest) > 0) {
+      deferred |= (1 << topic_idx);
+      continue;
+    }
+
+    msg_dispatch(l, topic->id, l->state_buf, post_time);
+  }
+
+  if (deferred != 0) {
+    chSysLock();
+    l->state_pending |= deferred;
+    chSysUnlock();
   }
 }
@@ -9,6 +9,7 @@ typedef enum {
   MSG_INIT,
   MSG_IDLE,
   MSG_RELEASE,
+  MSG_TIMER,
 
   MSG_TOUCH_INPUT,
 
@@ -66,8 +67,38 @@ typedef enum {
 struct msg_listener_s;
 typedef struct msg_listener_s msg_listener_t;
 
+struct msg_timer_s;
+typedef struct msg_timer_s msg_timer_t;
 
-typedef void (*thread_msg_dispatch_t)(msg_id_t id, void* msg_data, void* listener_data, void* sub_data);
+
+typedef void (*thread_msg_dispatch_t)(msg_id_t id, void* msg_data, void* listener_data);
+
+#define MSG_TRACE_HIST_BUCKETS 16
+
+/* Log2 histogram of durations in microseconds. Bucket 0 counts durations
+ * below 16us, bucket n counts [2^(n+3), 2^(n+4))us and the last bucket
+ * counts everything longer. Buckets saturate instead of wrapping.
+ */
+typedef struct {
+  uint16_t buckets[MSG_TRACE_HIST_BUCKETS];
+  uint32_t max_us;
+} msg_trace_hist_t;
+
+typedef struct {
+  msg_trace_hist_t latency;   // from send/post until dispatch starts
+  msg_trace_hist_t dispatch;  // time spent in the dispatch callback
+  msg_trace_hist_t blocked;   // time the sender spent in msg_send()/msg_post()
+  uint32_t mailbox_hwm;       // listeners only
+} msg_trace_stats_t;
+
+typedef struct {
+  uint32_t published;
+  uint32_t mailbox_posts;
+} msg_delivery_stats_t;
+
+
+void
+msg_init(void);
 
 msg_listener_t*
 msg_listener_create(const char* name, int stack_size, thread_msg_dispatch_t dispatch, void* user_data);
@@ -78,13 +109,77 @@ msg_listener_enable_watchdog(msg_listener_t* l, uint32_t period);
 void
 msg_listener_set_idle_timeout(msg_listener_t* l, uint32_t idle_timeout);
 
+/* One-shot timer that dispatches MSG_TIMER with the given msg_data to the
+ * listener when it expires. Expiries are not queued: a timer that fires
+ * again before its previous MSG_TIMER was dispatched is only delivered once,
+ * and one that is stopped just after firing may still deliver it.
+ */
+msg_timer_t*
+msg_timer_create(msg_listener_t* l, void* msg_data);
+
+/* (Re)arms the timer, cancelling any pending expiry */
+void
+msg_timer_start(msg_timer_t* t, systime_t delay);
+
+void
+msg_timer_stop(msg_timer_t* t);
+
+/* High-water mark of the listener thread's stack usage in bytes */
+uint32_t
+msg_listener_get_stack_used(msg_listener_t* l);
+
+/* Size of the listener thread's working area in bytes */
+uint32_t
+msg_listener_get_stack_size(msg_listener_t* l);
+
 void
-msg_subscribe(msg_listener_t* l, msg_id_t id, void* user_data);
+msg_subscribe(msg_listener_t* l, msg_id_t id);
 
 void
-msg_unsubscribe(msg_listener_t* l, msg_id_t id, void* user_data);
+msg_unsubscribe(msg_listener_t* l, msg_id_t id);
 
 void
 msg_send(msg_id_t id, void* msg_data);
 
+/* Copies msg_data into a message pool slot and returns without waiting for
+ * the subscribers to dispatch it. Falls back to msg_send() if the payload is
+ * too large or the pool is exhausted.
+ */
+void
+msg_post(msg_id_t id, void* msg_data, uint32_t msg_size);
+
+/* Publishes the current value of a state topic identified by id and instance
+ * (e.g. the sensor or output index). Only the newest value is kept; each
+ * subscriber is woken at most once and dispatched whatever is newest when it
+ * gets to run, skipping any intermediate updates.
+ */
+void
+msg_post_state(msg_id_t id, uint32_t instance, void* msg_data, uint32_t msg_size);
+
+/* Number of messages published with the given id and the number of mailbox
+ * posts (i.e. listener wake-ups) needed to deliver them.
+ */
+void
+msg_get_delivery_stats(msg_id_t id, msg_delivery_stats_t* stats);
+
+/* Clears the delivery counters and trace histograms */
+void
+msg_reset_stats(void);
+
+/* Message tracing is off by default. The histograms are allocated the first
+ * time it is enabled; while disabled the bus only pays for a flag check.
+ */
+void
+msg_trace_enable(bool enable);
+
+void
+msg_trace_get_msg(msg_id_t id, msg_trace_stats_t* stats);
+
+void
+msg_trace_get_listener(msg_listener_t* l, msg_trace_stats_t* stats);
+
+/* Prints every traced message and listener to chp */
+void
+msg_trace_dump(BaseSequentialStream* chp);
+
 #endif
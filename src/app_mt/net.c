@@ -38,7 +38,7 @@ typedef struct {
 
 
 static void
-dispatch_net_msg(msg_id_t id, void* msg_data, void* listener_data, void* sub_data);
+dispatch_net_msg(msg_id_t id, void* msg_data, void* listener_data);
 
 static void
 initialize_and_connect(void);
@@ -86,10 +86,10 @@ net_init()
 
   msg_listener_t* l = msg_listener_create("net", 2048, dispatch_net_msg, NULL);
   msg_listener_set_idle_timeout(l, 500);
-  msg_subscribe(l, MSG_NET_NETWORK_SETTINGS, NULL);
-  msg_subscribe(l, MSG_WLAN_CONNECT, NULL);
-  msg_subscribe(l, MSG_WLAN_DISCONNECT, NULL);
-  msg_subscribe(l, MSG_WLAN_DHCP, NULL);
+  msg_subscribe(l, MSG_NET_NETWORK_SETTINGS);
+  msg_subscribe(l, MSG_WLAN_CONNECT);
+  msg_subscribe(l, MSG_WLAN_DISCONNECT);
+  msg_subscribe(l, MSG_WLAN_DHCP);
 }
 
 const net_status_t*
@@ -117,14 +117,13 @@ set_state(net_state_t state)
   if (net_status.net_state != state) {
     state_begin_time = chTimeNow();
     net_status.net_state = state;
-    msg_send(MSG_NET_STATUS, &net_status);
+    msg_post_state(MSG_NET_STATUS, 0, &net_status, sizeof(net_status));
   }
 }
 
 static void
-dispatch_net_msg(msg_id_t id, void* msg_data, void* listener_data, void* sub_data)
+dispatch_net_msg(msg_id_t id, void* msg_data, void* listener_data)
 {
-  (void)sub_data;
   (void)listener_data;
 
   switch (id) {
@@ -340,7 +339,9 @@ prune_networks()
 static void
 initialize_and_connect()
 {
-  const net_settings_t* ns = app_cfg_get_net_settings();
+  net_settings_t ns;
+
+  app_cfg_get_net_settings(&ns);
 
   net_status.dhcp_resolved = false;
   set_state(NS_DISCONNECTED);
@@ -375,7 +376,7 @@ initialize_and_connect()
     uint32_t inactivity_timeout = 0;
     netapp_timeout_values(&dhcp_timeout, &arp_timeout, &keepalive, &inactivity_timeout);
 
-    netapp_dhcp(&ns->ip, &ns->subnet_mask, &ns->gateway, &ns->dns_server);
+    netapp_dhcp(&ns.ip, &ns.subnet_mask, &ns.gateway, &ns.dns_server);
 
     wlan_stop();
 
@@ -391,25 +392,27 @@ initialize_and_connect()
         mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
   }
 
-  if (strlen(ns->ssid) > 0) {
+  if (strlen(ns.ssid) > 0) {
     set_state(NS_CONNECTING);
 
     wlan_disconnect();
 
     chThdSleepMilliseconds(100);
 
-    wlan_connect(ns->security_mode,
-        ns->ssid,
-        strlen(ns->ssid),
+    wlan_connect(ns.security_mode,
+        ns.ssid,
+        strlen(ns.ssid),
         NULL,
-        (const uint8_t*)ns->passphrase,
-        strlen(ns->passphrase));
+        (const uint8_t*)ns.passphrase,
+        strlen(ns.passphrase));
   }
 }
 
 static void
 dispatch_idle()
 {
+  net_settings_t ns;
+
   scan_exec();
 
   if (force_reconnect) {
@@ -419,7 +422,8 @@ dispatch_idle()
 
   switch (net_status.net_state) {
     case NS_DISCONNECTED:
-      if (strlen(app_cfg_get_net_settings()->ssid) > 0)
+      app_cfg_get_net_settings(&ns);
+      if (strlen(ns.ssid) > 0)
         initialize_and_connect();
       break;
 
@@ -3,63 +3,237 @@
 #include "common.h"
 #include "crc/crc8.h"
 
-static const SerialConfig cfg_115k = {
-    .speed = 115200,
-    .cr1 = 0,
-    .cr2 = USART_CR2_STOP1_BITS,
-    .cr3 = USART_CR3_HDSEL,
+#include <string.h>
+
+
+/* Each 1-Wire time slot is one character on the half-duplex USART. At
+ * 115200 baud a 0x00 holds the line low for a write 0 slot and a 0xFF makes
+ * a write 1 or read slot, which only echoes back as 0xFF if no device pulled
+ * the line low. A reset is a 0xF0 at 9600 baud, which echoes back changed if
+ * any device answered with a presence pulse.
+ *
+ * A whole transaction is encoded into one buffer that DMA clocks out while
+ * the echo is received by DMA into another. The reset and the switch between
+ * the two baud rates, which only needs BRR rewritten, happen in the driver
+ * callbacks, so the calling thread is woken once, when it is all done.
+ */
+
+#define RESET_BAUD  9600
+#define SLOT_BAUD   115200
+#define RESET_CHAR  0xF0
+#define SLOT_0      0x00
+#define SLOT_1      0xFF
+
+#define MAX_SLOTS   (ONEWIRE_MAX_TRANSACTION * 8)
+
+#define TRANSACTION_TIMEOUT MS2ST(100)
+
+typedef enum {
+  TXN_IDLE,
+  TXN_RESET,
+  TXN_SLOTS
+} txn_phase_t;
+
+struct onewire_bus_s {
+  UARTDriver* uart;
+  uint32_t brr_reset;
+  uint32_t brr_slot;
+  BinarySemaphore done;
+  volatile txn_phase_t phase;
+  uint8_t pending;
+  bool presence;
+  uint16_t num_slots;
+  uint8_t reset_tx;
+  uint8_t reset_rx;
+  uint8_t slots_tx[MAX_SLOTS];
+  uint8_t slots_rx[MAX_SLOTS];
 };
 
-static const SerialConfig cfg_9600 = {
-    .speed = 9600,
+static void txend2_cb(UARTDriver* uartp);
+static void rxend_cb(UARTDriver* uartp);
+static void start_phase_i(onewire_bus_t* ob, txn_phase_t phase, uint8_t* tx, uint8_t* rx, uint16_t n);
+static void phase_done_i(onewire_bus_t* ob);
+static bool run_slots(onewire_bus_t* ob, bool reset, uint16_t num_slots);
+static void encode_byte(uint8_t* slots, uint8_t b);
+static uint8_t decode_byte(const uint8_t* slots);
+
+onewire_bus_t OWD1 = { .uart = UART_OW1 };
+onewire_bus_t OWD2 = { .uart = UART_OW2 };
+
+static const UARTConfig cfg_115k = {
+    .txend2_cb = txend2_cb,
+    .rxend_cb = rxend_cb,
+    .speed = SLOT_BAUD,
     .cr1 = 0,
     .cr2 = USART_CR2_STOP1_BITS,
     .cr3 = USART_CR3_HDSEL,
 };
 
+
 void
 onewire_init(onewire_bus_t* ob)
 {
-  sdStop(ob);
-  sdStart(ob, &cfg_115k);
+  // the same divisors the driver uses, so switching speed is one register write
+  uint32_t clock = (ob->uart->usart == USART1) ? STM32_PCLK2 : STM32_PCLK1;
+  ob->brr_reset = clock / RESET_BAUD;
+  ob->brr_slot = clock / SLOT_BAUD;
+
+  ob->reset_tx = RESET_CHAR;
+  ob->phase = TXN_IDLE;
+  chBSemInit(&ob->done, TRUE);
+
+  uartStop(ob->uart);
+  uartStart(ob->uart, &cfg_115k);
 }
 
-bool
-onewire_reset(onewire_bus_t* ob)
+static onewire_bus_t*
+get_bus(UARTDriver* uartp)
 {
-  sdStop(ob);
-  sdStart(ob, &cfg_9600);
+  return (uartp == OWD1.uart) ? &OWD1 : &OWD2;
+}
 
-  sdPut(ob, 0xF0);
-  msg_t recv = sdGetTimeout(ob, MS2ST(100));
+/* Each phase ends when both the last echo has been received and the last
+ * character has left the shift register, as BRR must not change while the
+ * USART is still sending. Both callbacks run at the same priority.
+ */
+static void
+txend2_cb(UARTDriver* uartp)
+{
+  onewire_bus_t* ob = get_bus(uartp);
 
-  sdStop(ob);
-  sdStart(ob, &cfg_115k);
+  chSysLockFromIsr();
+  if (ob->phase != TXN_IDLE && --ob->pending == 0)
+    phase_done_i(ob);
+  chSysUnlockFromIsr();
+}
 
-  if (recv < 0) {
-    return false;
+static void
+rxend_cb(UARTDriver* uartp)
+{
+  onewire_bus_t* ob = get_bus(uartp);
+
+  chSysLockFromIsr();
+  if (ob->phase != TXN_IDLE && --ob->pending == 0)
+    phase_done_i(ob);
+  chSysUnlockFromIsr();
+}
+
+static void
+start_phase_i(onewire_bus_t* ob, txn_phase_t phase, uint8_t* tx, uint8_t* rx, uint16_t n)
+{
+  ob->phase = phase;
+  ob->pending = 2;
+  uartStartReceiveI(ob->uart, n, rx);
+  uartStartSendI(ob->uart, n, tx);
+}
+
+static void
+phase_done_i(onewire_bus_t* ob)
+{
+  if (ob->phase == TXN_RESET) {
+    ob->presence = (ob->reset_rx != RESET_CHAR);
+    ob->uart->usart->BRR = ob->brr_slot;
+
+    if (ob->presence && ob->num_slots > 0) {
+      start_phase_i(ob, TXN_SLOTS, ob->slots_tx, ob->slots_rx, ob->num_slots);
+      return;
+    }
   }
-  if (recv == 0xF0) {
-    return false;
+
+  ob->phase = TXN_IDLE;
+  chBSemSignalI(&ob->done);
+}
+
+/* Runs the first num_slots slots of slots_tx, optionally preceded by a
+ * reset, and leaves what was read back in slots_rx.
+ */
+static bool
+run_slots(onewire_bus_t* ob, bool reset, uint16_t num_slots)
+{
+  msg_t ret;
+
+  ob->num_slots = num_slots;
+  ob->presence = false;
+
+  chSysLock();
+  if (reset) {
+    ob->uart->usart->BRR = ob->brr_reset;
+    start_phase_i(ob, TXN_RESET, &ob->reset_tx, &ob->reset_rx, 1);
   }
   else {
-    return true;
+    start_phase_i(ob, TXN_SLOTS, ob->slots_tx, ob->slots_rx, num_slots);
   }
+  ret = chBSemWaitTimeoutS(&ob->done, TRANSACTION_TIMEOUT);
+
+  if (ret != RDY_OK)
+    ob->phase = TXN_IDLE;
+  chSysUnlock();
+
+  if (ret != RDY_OK) {
+    uartStopSend(ob->uart);
+    uartStopReceive(ob->uart);
+    ob->uart->usart->BRR = ob->brr_slot;
+    return false;
+  }
+
+  return !reset || ob->presence;
+}
+
+static void
+encode_byte(uint8_t* slots, uint8_t b)
+{
+  int i;
+  for (i = 0; i < 8; ++i)
+    slots[i] = TESTBIT(&b, i) ? SLOT_1 : SLOT_0;
+}
+
+static uint8_t
+decode_byte(const uint8_t* slots)
+{
+  int i;
+  uint8_t v = 0;
+  for (i = 0; i < 8; ++i)
+    ASSIGNBIT(&v, i, slots[i] == SLOT_1);
+
+  return v;
 }
 
-// Reads the ROM from the device on the bus.
 bool
-onewire_read_rom(onewire_bus_t* ob, uint8_t* addr)
+onewire_transaction(onewire_bus_t* ob, bool reset,
+    const uint8_t* tx, uint8_t tx_len, uint8_t* rx, uint8_t rx_len)
 {
   int i;
 
-  if (!onewire_send_byte(ob, READ_ROM))
+  if (tx_len + rx_len > ONEWIRE_MAX_TRANSACTION)
     return false;
 
-  for (i = 0; i < 8; ++i) {
-    if (!onewire_recv_byte(ob, &addr[i]))
-      return false;
-  }
+  for (i = 0; i < tx_len; ++i)
+    encode_byte(&ob->slots_tx[i * 8], tx[i]);
+  memset(&ob->slots_tx[tx_len * 8], SLOT_1, rx_len * 8);
+
+  if (!run_slots(ob, reset, (tx_len + rx_len) * 8))
+    return false;
+
+  for (i = 0; i < rx_len; ++i)
+    rx[i] = decode_byte(&ob->slots_rx[(tx_len + i) * 8]);
+
+  return true;
+}
+
+bool
+onewire_reset(onewire_bus_t* ob)
+{
+  return run_slots(ob, true, 0);
+}
+
+// Reads the ROM from the device on the bus.
+bool
+onewire_read_rom(onewire_bus_t* ob, uint8_t* addr)
+{
+  uint8_t cmd = READ_ROM;
+
+  if (!onewire_transaction(ob, false, &cmd, 1, addr, 8))
+    return false;
 
   uint8_t crc = crc8_block(0, addr, 7);
   return (crc == addr[7]);
@@ -68,60 +242,29 @@ onewire_read_rom(onewire_bus_t* ob, uint8_t* addr)
 bool
 onewire_send_byte(onewire_bus_t* ob, uint8_t b)
 {
-  int i;
-  for (i = 0; i < 8; ++i) {
-    if (!onewire_send_bit(ob, TESTBIT(&b, i)))
-      return false;
-  }
-
-  return true;
+  return onewire_transaction(ob, false, &b, 1, NULL, 0);
 }
 
 bool
 onewire_recv_byte(onewire_bus_t* ob, uint8_t* b)
 {
-  int i;
-  uint8_t v = 0;
-  for (i = 0; i < 8; ++i) {
-    uint8_t bit;
-    if (!onewire_recv_bit(ob, &bit))
-      return false;
-    ASSIGNBIT(&v, i, bit);
-  }
-
-  *b = v;
-  return true;
+  return onewire_transaction(ob, false, NULL, 0, b, 1);
 }
 
 bool
 onewire_recv_bit(onewire_bus_t* ob, uint8_t* bit)
 {
-  sdPut(ob, 0xFF);
-  msg_t ret = sdGetTimeout(ob, MS2ST(100));
-  if (ret < 0) {
+  ob->slots_tx[0] = SLOT_1;
+  if (!run_slots(ob, false, 1))
     return false;
-  }
-
-  if (ret == 0xFF)
-    *bit = 1;
-  else
-    *bit = 0;
 
+  *bit = (ob->slots_rx[0] == SLOT_1);
   return true;
 }
 
 bool
 onewire_send_bit(onewire_bus_t* ob, uint8_t b)
 {
-  if (b)
-    sdPut(ob, 0xFF);
-  else
-    sdPut(ob, 0x00);
-
-  msg_t ret = sdGetTimeout(ob, MS2ST(100));
-  if (ret < 0) {
-    return false;
-  }
-
-  return true;
+  ob->slots_tx[0] = b ? SLOT_1 : SLOT_0;
+  return run_slots(ob, false, 1);
 }
@@ -7,7 +7,15 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-typedef SerialDriver onewire_bus_t;
+struct onewire_bus_s;
+typedef struct onewire_bus_s onewire_bus_t;
+
+// The 1-Wire ports, see UART_OW1 and UART_OW2 in board.h
+extern onewire_bus_t OWD1;
+extern onewire_bus_t OWD2;
+
+// Longest transaction, in bytes written plus bytes read
+#define ONEWIRE_MAX_TRANSACTION 24
 
 #define READ_ROM            0x33 // Identification
 #define SKIP_ROM            0xCC // Skip addressing
@@ -16,9 +24,24 @@ typedef SerialDriver onewire_bus_t;
 #define OVERDRIVE_SKIP_ROM  0x3C // Overdrive version of SKIP ROM
 #define OVERDRIVE_MATCH_ROM 0x69 // Overdriver version of MATCH ROM
 
+/* State of a SEARCH ROM enumeration, see onewire_search_next() */
+typedef struct {
+  uint8_t rom[8];
+  int last_discrepancy;
+  bool last_device;
+} onewire_search_t;
+
 void
 onewire_init(onewire_bus_t* ob);
 
+/* Runs one bus transaction: an optional reset, then tx_len bytes written
+ * and rx_len bytes read. Returns false on a bus error, or if a reset was
+ * asked for and no device answered it.
+ */
+bool
+onewire_transaction(onewire_bus_t* ob, bool reset,
+    const uint8_t* tx, uint8_t tx_len, uint8_t* rx, uint8_t rx_len);
+
 bool
 onewire_reset(onewire_bus_t* ob);
 
@@ -37,4 +60,18 @@ onewire_send_byte(onewire_bus_t* ob, uint8_t b);
 bool
 onewire_recv_byte(onewire_bus_t* ob, uint8_t* b);
 
+void
+onewire_search_init(onewire_search_t* search);
+
+/* Finds the next device on the bus and leaves its ROM in search->rom.
+ * Returns false once every device has been found, on a bus error, or when
+ * a ROM still reads corrupted after a few retries.
+ */
+bool
+onewire_search_next(onewire_bus_t* ob, onewire_search_t* search);
+
+/* Resets the bus and selects the device with the given ROM */
+bool
+onewire_match_rom(onewire_bus_t* ob, const uint8_t* addr);
+
 #endif
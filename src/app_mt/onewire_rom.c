@@ -0,0 +1,135 @@
+
+#include "onewire.h"
+#include "common.h"
+#include "crc/crc8.h"
+
+#include <string.h>
+
+
+/* ROM function commands, shared by the target and simulator bus drivers */
+
+// passes made at one branch of the search before its ROM is given up on
+#define SEARCH_RETRIES 3
+
+typedef enum {
+  SEARCH_PASS_OK,
+  SEARCH_PASS_CORRUPT,
+  SEARCH_PASS_BUS_ERROR
+} search_pass_result_t;
+
+
+static search_pass_result_t
+search_pass(onewire_bus_t* ob, onewire_search_t* search, int* last_zero);
+
+void
+onewire_search_init(onewire_search_t* search)
+{
+  search->last_discrepancy = -1;
+  search->last_device = false;
+}
+
+/* Walks the ROM binary tree as described in Maxim AN187. Each pass takes
+ * the 1 branch at the last discrepancy of the previous pass and the 0 branch
+ * at any new one.
+ *
+ * The search only moves on once a pass reads a ROM with a good CRC. A pass
+ * that reads a corrupted bit is repeated from the same state, so the glitch
+ * costs a retry instead of the device (and, on the final pass, the last
+ * device).
+ */
+bool
+onewire_search_next(onewire_bus_t* ob, onewire_search_t* search)
+{
+  uint8_t prev_rom[sizeof(search->rom)];
+  int tries;
+
+  if (search->last_device)
+    return false;
+
+  memcpy(prev_rom, search->rom, sizeof(prev_rom));
+
+  for (tries = 0; tries < SEARCH_RETRIES; ++tries) {
+    int last_zero;
+
+    switch (search_pass(ob, search, &last_zero)) {
+    case SEARCH_PASS_OK:
+      search->last_discrepancy = last_zero;
+      if (last_zero < 0)
+        search->last_device = true;
+      return true;
+
+    case SEARCH_PASS_BUS_ERROR:
+      return false;
+
+    default:
+      break;
+    }
+
+    // the branches below last_discrepancy come from the previous ROM
+    memcpy(search->rom, prev_rom, sizeof(prev_rom));
+  }
+
+  return false;
+}
+
+static search_pass_result_t
+search_pass(onewire_bus_t* ob, onewire_search_t* search, int* last_zero)
+{
+  int i;
+
+  *last_zero = -1;
+
+  if (!onewire_reset(ob))
+    return SEARCH_PASS_BUS_ERROR;
+
+  if (!onewire_send_byte(ob, SEARCH_ROM))
+    return SEARCH_PASS_BUS_ERROR;
+
+  for (i = 0; i < 64; ++i) {
+    uint8_t id_bit;
+    uint8_t cmp_id_bit;
+    uint8_t dir;
+
+    if (!onewire_recv_bit(ob, &id_bit) ||
+        !onewire_recv_bit(ob, &cmp_id_bit))
+      return SEARCH_PASS_BUS_ERROR;
+
+    // the reset saw a presence pulse, so a device dropping out is a glitch
+    if (id_bit && cmp_id_bit)
+      return SEARCH_PASS_CORRUPT;
+
+    if (id_bit != cmp_id_bit) {
+      dir = id_bit;
+    }
+    else {
+      if (i < search->last_discrepancy)
+        dir = TESTBIT(search->rom, i);
+      else
+        dir = (i == search->last_discrepancy);
+
+      if (!dir)
+        *last_zero = i;
+    }
+
+    ASSIGNBIT(search->rom, i, dir);
+
+    if (!onewire_send_bit(ob, dir))
+      return SEARCH_PASS_BUS_ERROR;
+  }
+
+  if (crc8_block(0, search->rom, 7) != search->rom[7])
+    return SEARCH_PASS_CORRUPT;
+
+  return SEARCH_PASS_OK;
+}
+
+bool
+onewire_match_rom(onewire_bus_t* ob, const uint8_t* addr)
+{
+  uint8_t cmd[9];
+
+  cmd[0] = MATCH_ROM;
+  memcpy(&cmd[1], addr, 8);
+
+  return onewire_transaction(ob, true, cmd, sizeof(cmd), NULL, 0);
+}
@@ -51,7 +51,7 @@ static void
 write_checkpoint(void);
 
 static void
-ota_update_dispatch(msg_id_t id, void* msg_data, void* listener_data, void* sub_data);
+ota_update_dispatch(msg_id_t id, void* msg_data, void* listener_data);
 
 static void
 dispatch_idle(void);
@@ -78,24 +78,26 @@ static ota_update_t update;
 void
 ota_update_init()
 {
-  const ota_update_checkpoint_t* checkpoint = app_cfg_get_ota_update_checkpoint();
+  ota_update_checkpoint_t checkpoint;
+
+  app_cfg_get_ota_update_checkpoint(&checkpoint);
 
   update.state = OU_WAIT_API_CONN;
-  update.download_in_progress = checkpoint->download_in_progress;
-  update.update_size = checkpoint->update_size;
-  update.last_block_offset = checkpoint->last_block_offset;
-  update.update_downloaded = checkpoint->last_block_offset;
+  update.download_in_progress = checkpoint.download_in_progress;
+  update.update_size = checkpoint.update_size;
+  update.last_block_offset = checkpoint.last_block_offset;
+  update.update_downloaded = checkpoint.last_block_offset;
   update.error_code = 0;
-  strncpy(update.update_ver, checkpoint->update_ver, sizeof(update.update_ver));
+  strncpy(update.update_ver, checkpoint.update_ver, sizeof(update.update_ver));
 
   msg_listener_t* l = msg_listener_create("ota_update", 2048, ota_update_dispatch, NULL);
   msg_listener_set_idle_timeout(l, 1000);
 
-  msg_subscribe(l, MSG_API_STATUS, NULL);
-  msg_subscribe(l, MSG_OTAU_CHECK, NULL);
-  msg_subscribe(l, MSG_OTAU_START, NULL);
-  msg_subscribe(l, MSG_API_FW_UPDATE_CHECK_RESPONSE, NULL);
-  msg_subscribe(l, MSG_API_FW_CHUNK, NULL);
+  msg_subscribe(l, MSG_API_STATUS);
+  msg_subscribe(l, MSG_OTAU_CHECK);
+  msg_subscribe(l, MSG_OTAU_START);
+  msg_subscribe(l, MSG_API_FW_UPDATE_CHECK_RESPONSE);
+  msg_subscribe(l, MSG_API_FW_CHUNK);
 }
 
 ota_update_status_t
@@ -117,14 +119,13 @@ set_state(ota_update_state_t state)
   update.state = state;
 
   ota_update_status_t status = ota_update_get_status();
-  msg_send(MSG_OTAU_STATUS, &status);
+  msg_post_state(MSG_OTAU_STATUS, 0, &status, sizeof(status));
 }
 
 static void
-ota_update_dispatch(msg_id_t id, void* msg_data, void* listener_data, void* sub_data)
+ota_update_dispatch(msg_id_t id, void* msg_data, void* listener_data)
 {
   (void)listener_data;
-  (void)sub_data;
 
   switch (id) {
   case MSG_API_STATUS:
@@ -226,14 +227,21 @@ dispatch_chunk(FirmwareDownloadResponse* update_chunk)
   update.update_downloaded = update_chunk->offset + update_chunk->data.size;
 
   if ((update_chunk->offset & (UPDATE_BLOCK_SIZE - 1)) == 0) {
+    /* The last block is only erased as far as the image reaches, rounded up
+     * to the partition's erase unit, which is a whole block on most parts
+     */
+    uint32_t erase_len = UPDATE_BLOCK_SIZE;
+    if (update.update_size > update_chunk->offset)
+      erase_len = MIN(erase_len, update.update_size - update_chunk->offset);
+
     update.last_block_offset = update_chunk->offset;
-    if (!sxfs_erase(SP_UPDATE_IMG, update.last_block_offset, UPDATE_BLOCK_SIZE)) {
+    if (!sxfs_erase(SP_UPDATE_IMG, update.last_block_offset, erase_len)) {
       update.error_code = OU_ERR_ERASE;
       set_state(OU_FAILED);
       return;
     }
 
-    if (!sxfs_is_erased(SP_UPDATE_IMG, update.last_block_offset, UPDATE_BLOCK_SIZE)) {
+    if (!sxfs_is_erased(SP_UPDATE_IMG, update.last_block_offset, erase_len)) {
       update.error_code = OU_ERR_ERASE_VERIFY;
       set_state(OU_FAILED);
       return;
@@ -278,7 +286,10 @@ dispatch_chunk(FirmwareDownloadResponse* update_chunk)
 
       chThdSleepSeconds(1);
 
-      bootloader_load_update_img();
+      if (!bootloader_load_update_img()) {
+        update.error_code = OU_ERR_ERASE;
+        set_state(OU_FAILED);
+      }
     }
     else {
       update.error_code = result;
@@ -13,6 +13,19 @@
  * [2] http://www.ece.eng.wayne.edu/~flin/Conference/AI-PID.pdf
  */
 
+#if PID_FIXED_POINT
+/* Products are formed in 64 bits and shifted back to the result format */
+#define MUL_GV(g, v)    ((pid_val_t)(((int64_t)(g) * (v)) >> PID_GAIN_FRAC_BITS))
+#define MUL_GV_G(g, v)  ((pid_gain_t)(((int64_t)(g) * (v)) >> PID_VAL_FRAC_BITS))
+#define MUL_GG(a, b)    ((pid_gain_t)(((int64_t)(a) * (b)) >> PID_GAIN_FRAC_BITS))
+#define DIV_VT(v, t)    ((pid_gain_t)(((int64_t)(v) << (PID_GAIN_FRAC_BITS - PID_VAL_FRAC_BITS)) / (int32_t)(t)))
+#else
+#define MUL_GV(g, v)    ((g) * (v))
+#define MUL_GV_G(g, v)  ((g) * (v))
+#define MUL_GG(a, b)    ((a) * (b))
+#define DIV_VT(v, t)    ((v) / (t))
+#endif
+
 void
 pid_init(pid_controller_t* pid)
 {
@@ -33,44 +46,47 @@ pid_exec(pid_controller_t* pid, float setpoint, float sample)
   systime_t time_diff = (now - pid->last_time);
 
   if (time_diff >= pid->sample_time) {
-    float err_p = (setpoint - sample);
-    float err_d = (sample - pid->last_sample);
-    float err_d_tune = (err_p - pid->last_err)/time_diff;
+    pid_val_t sample_v = PID_VAL(sample);
+    pid_val_t err_p = PID_VAL(setpoint) - sample_v;
+    pid_val_t err_d = (sample_v - pid->last_sample);
+    pid_gain_t err_d_tune = DIV_VT(err_p - pid->last_err, time_diff);
 
-    pid->err_i += (pid->ki * err_p);
+    pid->err_i += MUL_GV(pid->ki, err_p);
     pid->err_i = LIMIT(pid->err_i, pid->out_min, pid->out_max);
     pid->err_i_tune += err_p;
     pid->err_i_tune = LIMIT(pid->err_i_tune, pid->out_min, pid->out_max);
 
     tune_gains(pid, err_p, err_d_tune);
 
-    pid->out = (pid->kp * err_p) + pid->err_i - (pid->kd * err_d);
+    pid->out = MUL_GV(pid->kp, err_p) + pid->err_i - MUL_GV(pid->kd, err_d);
     pid->out = LIMIT(pid->out, pid->out_min, pid->out_max);
 
     pid->last_err  = err_p;
-    pid->last_sample = sample;
+    pid->last_sample = sample_v;
     pid->last_time = now;
   }
 }
 
-#define GAMMA 0.005
+#define GAMMA PID_GAIN(0.005f)
 void
-tune_gains(pid_controller_t* pid, float err_p, float err_d)
+tune_gains(pid_controller_t* pid, pid_val_t err_p, pid_gain_t err_d)
 {
+  pid_gain_t gamma_err = MUL_GV_G(GAMMA, err_p);
+
   if (pid->output_sign == NEGATIVE) {
     pid->kp = pid->kp *-1;
     pid->ki = pid->ki *-1;
     pid->kd = pid->kd *-1;
   }
 
-  pid->kp += -GAMMA * err_p;
-  pid->kp = LIMIT(pid->kp, 0, 50);
+  pid->kp -= gamma_err;
+  pid->kp = LIMIT(pid->kp, 0, PID_GAIN(50));
 
-  pid->ki += -GAMMA * err_p * pid->err_i_tune;
-  pid->ki = LIMIT(pid->ki, 0, 5);
+  pid->ki -= MUL_GV_G(gamma_err, pid->err_i_tune);
+  pid->ki = LIMIT(pid->ki, 0, PID_GAIN(5));
 
-  pid->kd += -GAMMA * err_p * err_d;
-  pid->kd = LIMIT(pid->kd, 0, 5);
+  pid->kd -= MUL_GG(gamma_err, err_d);
+  pid->kd = LIMIT(pid->kd, 0, PID_GAIN(5));
 
   pid_set_output_sign(pid, pid->output_sign);
 }
@@ -82,9 +98,9 @@ pid_set_gains(pid_controller_t* pid, float kp, float ki, float kd)
     return;
 
   uint32_t sample_time_s = pid->sample_time / CH_FREQUENCY;
-  pid->kp = kp;
-  pid->ki = ki * sample_time_s;
-  pid->kd = kd / sample_time_s;
+  pid->kp = PID_GAIN(kp);
+  pid->ki = PID_GAIN(ki * sample_time_s);
+  pid->kd = PID_GAIN(kd / sample_time_s);
 
   if (pid->output_sign == NEGATIVE) {
     pid->kp = -pid->kp;
@@ -105,7 +121,7 @@ pid_enable(pid_controller_t* pid, float sample, bool enabled)
 void
 pid_reinit(pid_controller_t* pid, float sample)
 {
-  pid->last_sample = sample;
+  pid->last_sample = PID_VAL(sample);
   pid->err_i = 0;
 }
 
@@ -127,8 +143,8 @@ pid_set_output_limits(pid_controller_t* pid, float min, float max)
   if (min >= max)
    return;
 
-  pid->out_min = min;
-  pid->out_max = max;
+  pid->out_min = PID_VAL(min);
+  pid->out_max = PID_VAL(max);
 
   if (pid->enabled) {
     pid->out = LIMIT(pid->out, pid->out_min, pid->out_max);
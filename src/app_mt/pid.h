@@ -10,6 +10,38 @@
 #include "sensor.h"
 
 
+/* The STM32F2 has no FPU, so by default the controller runs in fixed point.
+ * Build with PID_FIXED_POINT=FALSE to get the original soft-float engine.
+ */
+#if !defined(PID_FIXED_POINT)
+#define PID_FIXED_POINT TRUE
+#endif
+
+#if PID_FIXED_POINT
+/* Errors, integrator and output are Q16.16. Gains and the per-tick error
+ * derivative are Q8.24 so the slow self-tuning updates are not lost to
+ * rounding.
+ */
+#define PID_VAL_FRAC_BITS   16
+#define PID_GAIN_FRAC_BITS  24
+
+typedef int32_t pid_val_t;
+typedef int32_t pid_gain_t;
+
+#define PID_VAL(f)          ((pid_val_t)((f) * (1 << PID_VAL_FRAC_BITS) + (((f) < 0) ? -0.5f : 0.5f)))
+#define PID_GAIN(f)         ((pid_gain_t)((f) * (1 << PID_GAIN_FRAC_BITS) + (((f) < 0) ? -0.5f : 0.5f)))
+#define PID_VAL_FLOAT(v)    ((float)(v) / (1 << PID_VAL_FRAC_BITS))
+#define PID_GAIN_FLOAT(g)   ((float)(g) / (1 << PID_GAIN_FRAC_BITS))
+#else
+typedef float pid_val_t;
+typedef float pid_gain_t;
+
+#define PID_VAL(f)          ((pid_val_t)(f))
+#define PID_GAIN(f)         ((pid_gain_t)(f))
+#define PID_VAL_FLOAT(v)    (v)
+#define PID_GAIN_FLOAT(g)   (g)
+#endif
+
 typedef enum {
   POSITIVE,
   NEGATIVE
@@ -19,18 +51,18 @@ typedef struct {
   bool enabled;
   bool auto_mode;
 
-  float kp;
-  float ki;
-  float kd;
+  pid_gain_t kp;
+  pid_gain_t ki;
+  pid_gain_t kd;
 
-  float err_i;
-  float err_i_tune;
-  float last_err;
-  float last_sample;
+  pid_val_t err_i;
+  pid_val_t err_i_tune;
+  pid_val_t last_err;
+  pid_val_t last_sample;
 
-  float out;
-  float out_min;
-  float out_max;
+  pid_val_t out;
+  pid_val_t out_min;
+  pid_val_t out_max;
   int8_t output_sign;
 
   /* Time is in system ticks */
@@ -42,7 +74,7 @@ typedef struct {
 void pid_init(pid_controller_t* pid);
 void pid_exec(pid_controller_t* pid, float setpoint, float sample);
 void pid_set_gains(pid_controller_t* pid, float Kp, float Ki, float Kd);
-void tune_gains(pid_controller_t* pid, float err_p, float err_d);
+void tune_gains(pid_controller_t* pid, pid_val_t err_p, pid_gain_t err_d);
 void pid_enable(pid_controller_t* pid, float sample, bool enabled);
 void pid_reinit(pid_controller_t* pid, float sample);
 void pid_set_output_sign(pid_controller_t* pid, uint8_t direction);
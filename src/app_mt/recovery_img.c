@@ -15,7 +15,7 @@ void
 recovery_img_init()
 {
   recovery_img_load_state_t state = RECOVERY_IMG_CHECKING;
-  msg_send(MSG_RECOVERY_IMG_STATUS, &state);
+  msg_post(MSG_RECOVERY_IMG_STATUS, &state, sizeof(state));
 
   dfu_parse_result_t result = dfuse_verify(SP_RECOVERY_IMG);
   if (result != DFU_PARSE_OK) {
@@ -27,7 +27,7 @@ recovery_img_init()
   else {
     printf("Recovery image is present\r\n");
     state = RECOVERY_IMG_LOADED;
-    msg_send(MSG_RECOVERY_IMG_STATUS, &state);
+    msg_post(MSG_RECOVERY_IMG_STATUS, &state, sizeof(state));
   }
 }
 
@@ -52,20 +52,24 @@ recovery_img_thread(void* arg)
   };
 
   state = RECOVERY_IMG_LOADING;
-  msg_send(MSG_RECOVERY_IMG_STATUS, &state);
-  dfuse_write_self(SP_RECOVERY_IMG, img_recs, 2);
+  msg_post(MSG_RECOVERY_IMG_STATUS, &state, sizeof(state));
+  if (!dfuse_write_self(SP_RECOVERY_IMG, img_recs, 2)) {
+    state = RECOVERY_IMG_FAILED;
+    msg_post(MSG_RECOVERY_IMG_STATUS, &state, sizeof(state));
+    return 0;
+  }
 
   state = RECOVERY_IMG_CHECKING;
-  msg_send(MSG_RECOVERY_IMG_STATUS, &state);
+  msg_post(MSG_RECOVERY_IMG_STATUS, &state, sizeof(state));
 
   result = dfuse_verify(SP_RECOVERY_IMG);
   if (result == DFU_PARSE_OK) {
     state = RECOVERY_IMG_LOADED;
-    msg_send(MSG_RECOVERY_IMG_STATUS, &state);
+    msg_post(MSG_RECOVERY_IMG_STATUS, &state, sizeof(state));
   }
   else {
     state = RECOVERY_IMG_FAILED;
-    msg_send(MSG_RECOVERY_IMG_STATUS, &state);
+    msg_post(MSG_RECOVERY_IMG_STATUS, &state, sizeof(state));
   }
 
   printf("OK\r\n");
@@ -0,0 +1,238 @@
+
+#include "report_batch.h"
+
+#include <math.h>
+#include <string.h>
+
+
+// flags, plus five svarints per reading and three per output
+#define MAX_ENTRY_SIZE  (5 + (5 * 3) + (NUM_OUTPUTS * 5 * 3))
+
+#define FLAG_PID           (1 << 3)
+#define FLAG_PRESENT(out)  (1 << (4 + (2 * (out))))
+#define FLAG_STATUS(out)   (1 << (5 + (2 * (out))))
+#define FLAG_NO_READING    (1 << (4 + (2 * NUM_OUTPUTS)))
+#define FLAG_NO_SETPOINT   (1 << (5 + (2 * NUM_OUTPUTS)))
+
+
+/* Converting a NaN, an infinity or anything past INT32_MAX is undefined,
+ * so they are clamped first, NaN to 0
+ */
+static int32_t
+to_hundredths(float value)
+{
+  if (!(value >= -REPORT_BATCH_MAX_VALUE))
+    value = isnan(value) ? 0 : -REPORT_BATCH_MAX_VALUE;
+  else if (value > REPORT_BATCH_MAX_VALUE)
+    value = REPORT_BATCH_MAX_VALUE;
+
+  return (int32_t)((value * 100) + ((value >= 0) ? 0.5f : -0.5f));
+}
+
+static uint8_t*
+put_varint(uint8_t* p, uint32_t value)
+{
+  while (value >= 0x80) {
+    *p++ = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  *p++ = value;
+
+  return p;
+}
+
+static uint8_t*
+put_svarint(uint8_t* p, int32_t value)
+{
+  return put_varint(p, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+static bool
+get_varint(report_batch_reader_t* reader, uint32_t* value)
+{
+  int shift;
+
+  *value = 0;
+  for (shift = 0; shift < 35; shift += 7) {
+    if (reader->p >= reader->end)
+      return false;
+
+    uint8_t b = *reader->p++;
+    *value |= (uint32_t)(b & 0x7F) << shift;
+    if ((b & 0x80) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+static bool
+get_svarint(report_batch_reader_t* reader, int32_t* value)
+{
+  uint32_t v;
+
+  if (!get_varint(reader, &v))
+    return false;
+
+  *value = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+  return true;
+}
+
+void
+report_batch_init(report_batch_t* batch, uint32_t base_time)
+{
+  memset(batch, 0, sizeof(report_batch_t));
+
+  batch->buf[0] = REPORT_BATCH_MAGIC;
+  batch->len = put_varint(&batch->buf[1], base_time) - batch->buf;
+  batch->last.timestamp = base_time;
+}
+
+bool
+report_batch_add(report_batch_t* batch, const report_sample_t* sample)
+{
+  uint8_t entry[MAX_ENTRY_SIZE];
+  uint8_t* p = entry;
+  report_batch_state_t* last = &batch->last;
+  uint8_t c = sample->controller;
+  uint32_t flags = c;
+  int i;
+
+  if (c >= NUM_CONTROLLERS)
+    return true;
+
+  if (sample->has_pid)
+    flags |= FLAG_PID;
+  for (i = 0; i < NUM_OUTPUTS; ++i) {
+    if (sample->outputs[i].present)
+      flags |= FLAG_PRESENT(i);
+    if (sample->outputs[i].status)
+      flags |= FLAG_STATUS(i);
+  }
+
+  // a missing value leaves the last one in place for the next change
+  int32_t sensor_reading = last->sensor_reading[c];
+  int32_t setpoint = last->setpoint[c];
+
+  if (isnan(sample->sensor_reading))
+    flags |= FLAG_NO_READING;
+  else
+    sensor_reading = to_hundredths(sample->sensor_reading);
+
+  if (isnan(sample->setpoint))
+    flags |= FLAG_NO_SETPOINT;
+  else
+    setpoint = to_hundredths(sample->setpoint);
+
+  p = put_svarint(p, (int32_t)(sample->timestamp - last->timestamp));
+  p = put_varint(p, flags);
+  if ((flags & FLAG_NO_READING) == 0)
+    p = put_svarint(p, sensor_reading - last->sensor_reading[c]);
+  if ((flags & FLAG_NO_SETPOINT) == 0)
+    p = put_svarint(p, setpoint - last->setpoint[c]);
+
+  int32_t pid[NUM_OUTPUTS][3];
+  memcpy(pid, last->pid[c], sizeof(pid));
+  if (sample->has_pid) {
+    for (i = 0; i < NUM_OUTPUTS; ++i) {
+      const report_output_t* out = &sample->outputs[i];
+      if (!out->present)
+        continue;
+
+      pid[i][0] = to_hundredths(out->kp);
+      pid[i][1] = to_hundredths(out->ki);
+      pid[i][2] = to_hundredths(out->kd);
+      p = put_svarint(p, pid[i][0] - last->pid[c][i][0]);
+      p = put_svarint(p, pid[i][1] - last->pid[c][i][1]);
+      p = put_svarint(p, pid[i][2] - last->pid[c][i][2]);
+    }
+  }
+
+  uint32_t entry_len = p - entry;
+  if (batch->len + entry_len > sizeof(batch->buf))
+    return false;
+
+  memcpy(&batch->buf[batch->len], entry, entry_len);
+  batch->len += entry_len;
+  batch->count++;
+
+  last->timestamp = sample->timestamp;
+  last->sensor_reading[c] = sensor_reading;
+  last->setpoint[c] = setpoint;
+  memcpy(last->pid[c], pid, sizeof(pid));
+
+  return true;
+}
+
+bool
+report_batch_reader_init(report_batch_reader_t* reader, const uint8_t* buf, uint32_t len)
+{
+  memset(reader, 0, sizeof(report_batch_reader_t));
+
+  if (len < 1 || buf[0] != REPORT_BATCH_MAGIC)
+    return false;
+
+  reader->p = buf + 1;
+  reader->end = buf + len;
+
+  return get_varint(reader, &reader->last.timestamp);
+}
+
+bool
+report_batch_read(report_batch_reader_t* reader, report_sample_t* sample)
+{
+  report_batch_state_t* last = &reader->last;
+  int32_t dt;
+  uint32_t flags;
+  int32_t d_reading = 0;
+  int32_t d_setpoint = 0;
+  int i;
+  int j;
+
+  if (reader->p >= reader->end)
+    return false;
+
+  if (!get_svarint(reader, &dt) ||
+      !get_varint(reader, &flags) ||
+      (((flags & FLAG_NO_READING) == 0) && !get_svarint(reader, &d_reading)) ||
+      (((flags & FLAG_NO_SETPOINT) == 0) && !get_svarint(reader, &d_setpoint)))
+    return false;
+
+  uint8_t c = flags & 0x7;
+  if (c >= NUM_CONTROLLERS)
+    return false;
+
+  memset(sample, 0, sizeof(report_sample_t));
+
+  last->timestamp += dt;
+  last->sensor_reading[c] += d_reading;
+  last->setpoint[c] += d_setpoint;
+
+  sample->timestamp = last->timestamp;
+  sample->controller = c;
+  sample->has_pid = (flags & FLAG_PID) != 0;
+  sample->sensor_reading = (flags & FLAG_NO_READING) ? NAN : last->sensor_reading[c] / 100.0f;
+  sample->setpoint = (flags & FLAG_NO_SETPOINT) ? NAN : last->setpoint[c] / 100.0f;
+
+  for (i = 0; i < NUM_OUTPUTS; ++i) {
+    report_output_t* out = &sample->outputs[i];
+
+    out->present = (flags & FLAG_PRESENT(i)) != 0;
+    out->status = (flags & FLAG_STATUS(i)) != 0;
+    if (!out->present || !sample->has_pid)
+      continue;
+
+    for (j = 0; j < 3; ++j) {
+      int32_t d;
+      if (!get_svarint(reader, &d))
+        return false;
+      last->pid[c][i][j] += d;
+    }
+
+    out->kp = last->pid[c][i][0] / 100.0f;
+    out->ki = last->pid[c][i][1] / 100.0f;
+    out->kd = last->pid[c][i][2] / 100.0f;
+  }
+
+  return true;
+}
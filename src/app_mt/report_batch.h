@@ -0,0 +1,89 @@
+#ifndef REPORT_BATCH_H
+#define REPORT_BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "temp_control.h"
+
+/* Compact encoding of a run of controller reports, used to keep reports
+ * made while offline in the backlog. It only changes how they are stored,
+ * they are sent as ordinary DeviceReport messages.
+ *
+ * A batch is REPORT_BATCH_MAGIC, the timestamp its deltas start from as a
+ * varint and then one entry per report:
+ *
+ *   svarint  seconds since the previous entry
+ *   varint   flags: controller index in bits 0-2, bit 3 set if PID terms
+ *            follow, then for each output a present bit and a status bit
+ *            starting at bit 4, then a no reading bit and a no setpoint bit
+ *   svarint  change in sensor reading, in hundredths, unless there is none
+ *   svarint  change in setpoint, in hundredths, unless there is none
+ *   svarint  change in kp, ki and kd for each present output, in
+ *            hundredths, if the PID bit is set
+ *
+ * svarints are zig-zag encoded. Changes are from the last value given for
+ * the same controller, or from 0. A reading or setpoint that is NaN is
+ * stored as missing and read back as NaN, and other values are clamped to
+ * +/-REPORT_BATCH_MAX_VALUE.
+ */
+
+#define REPORT_BATCH_MAGIC      0xB1
+#define REPORT_BATCH_SIZE       1024
+#define REPORT_BATCH_MAX_VALUE  1e7f
+
+
+typedef struct {
+  bool present;
+  bool status;
+  float kp;
+  float ki;
+  float kd;
+} report_output_t;
+
+typedef struct {
+  uint32_t timestamp;
+  uint8_t controller;
+  bool has_pid;
+  float sensor_reading;
+  float setpoint;
+  report_output_t outputs[NUM_OUTPUTS];
+} report_sample_t;
+
+typedef struct {
+  uint32_t timestamp;
+  int32_t sensor_reading[NUM_CONTROLLERS];
+  int32_t setpoint[NUM_CONTROLLERS];
+  int32_t pid[NUM_CONTROLLERS][NUM_OUTPUTS][3];
+} report_batch_state_t;
+
+typedef struct {
+  uint8_t buf[REPORT_BATCH_SIZE];
+  uint32_t len;
+  uint32_t count;
+  report_batch_state_t last;
+} report_batch_t;
+
+typedef struct {
+  const uint8_t* p;
+  const uint8_t* end;
+  report_batch_state_t last;
+} report_batch_reader_t;
+
+
+void
+report_batch_init(report_batch_t* batch, uint32_t base_time);
+
+/* Returns false if the batch has no room left for the sample */
+bool
+report_batch_add(report_batch_t* batch, const report_sample_t* sample);
+
+/* Returns false if buf does not hold a batch */
+bool
+report_batch_reader_init(report_batch_reader_t* reader, const uint8_t* buf, uint32_t len);
+
+/* Returns false at the end of the batch, or if the rest of it is damaged */
+bool
+report_batch_read(report_batch_reader_t* reader, report_sample_t* sample);
+
+#endif
@@ -1,4 +1,5 @@
 #include "sensor.h"
+#include "sensor_filter.h"
 #include "onewire.h"
 #include "common.h"
 #include "message.h"
@@ -7,20 +8,106 @@
 #include "crc/crc8.h"
 
 #include <string.h>
+#include <math.h>
 
 
 #define SENSOR_TIMEOUT S2ST (2)
-#define SENSOR_SAMPLE_SIZE  (10)
 
+// Look for probes that have been plugged in this often. Removed probes are
+// noticed straight away when they stop answering.
+#define SENSOR_RESCAN_PERIOD S2ST(30)
+
+// Worst case conversion time, used until the probes have been read once
+#define MAX_CONVERSION_TIME MS2ST(750)
+#define MAX31850_CONVERSION_TIME MS2ST(100)
+#define CONVERSION_POLL_INTERVAL MS2ST(5)
+
+// Resolution is picked from the rate of change of the primary probe,
+// measured over this window
+#define RATE_WINDOW S2ST(60)
+
+// Rates in degrees F per minute to switch to a coarser resolution, and to
+// stay there
+#define RATE_FAST_ENTER     2.0f
+#define RATE_FAST_EXIT      1.0f
+#define RATE_MOVING_ENTER   0.5f
+#define RATE_MOVING_EXIT    0.25f
+
+// One step of a DS18B20 reading at the given resolution, in degrees F
+#define RESOLUTION_LSB(res) ((0.0625f * 1.8f) * (1 << (12 - (res))))
+
+#define CONVERT_T        0x44
+#define WRITE_SCRATCHPAD 0x4E
+#define READ_SCRATCHPAD  0xBE
+
+#define FAMILY_DS18B20  0x28
+#define FAMILY_MAX31850 0x3B
+
+// A DS18B20 reads 85C from power on until its first conversion
+#define DS18B20_POWER_ON_TEMP 0x0550
+#define POWER_ON_JUMP         SENSOR_FIX(5)
+
+typedef struct {
+  uint8_t num_stages;
+  sensor_filter_cfg_t stages[SENSOR_FILTER_MAX_STAGES];
+} filter_preset_t;
+
+// The chains a probe's config can pick, compared by 'bench sensor_filter'.
+// The default drops single bad readings and then averages like the original
+// filter.
+static const filter_preset_t filter_presets[NUM_SENSOR_FILTER_PRESETS] = {
+  [SENSOR_FILTER_PRESET_DEFAULT] = { 2, {
+      { .type = SENSOR_FILTER_MEDIAN,     .window = 3 },
+      { .type = SENSOR_FILTER_MOVING_AVG, .window = 10 } } },
+  [SENSOR_FILTER_PRESET_NONE] = { 0, { { .type = SENSOR_FILTER_NONE } } },
+  [SENSOR_FILTER_PRESET_SMOOTH] = { 2, {
+      { .type = SENSOR_FILTER_MEDIAN,     .window = 5 },
+      { .type = SENSOR_FILTER_MOVING_AVG, .window = 16 } } },
+  [SENSOR_FILTER_PRESET_EMA] = { 2, {
+      { .type = SENSOR_FILTER_MEDIAN,     .window = 3 },
+      { .type = SENSOR_FILTER_EMA,        .alpha = SENSOR_FIX(0.2f) } } },
+  [SENSOR_FILTER_PRESET_KALMAN] = { 2, {
+      { .type = SENSOR_FILTER_MEDIAN,     .window = 3 },
+      { .type = SENSOR_FILTER_KALMAN,     .q = SENSOR_FIX(0.0001f), .r = SENSOR_FIX(0.0025f) } } },
+};
+
+// Moving average windows are given in samples this far apart, which is how
+// often a 12 bit probe is read. They are scaled to cover the same time when
+// a coarser resolution reads the probe faster.
+#define FILTER_SAMPLE_PERIOD MS2ST(750)
+
+
+typedef struct {
+  uint8_t rom[8];
+  sensor_config_t sensor_config;
+  sensor_filter_chain_t filter;
+  sensor_fix_t last_temp;
+  bool has_last_temp;
+  systime_t conversion_time;
+  systime_t last_read_time;
+  uint8_t resolution;
+  uint8_t alarm[2];
+  bool seen;
+} sensor_device_t;
 
 typedef struct sensor_port_s {
   sensor_id_t sensor;
-  sensor_config_t sensor_config;
-  float sample_filter[SENSOR_SAMPLE_SIZE];
-  uint8_t sample_filter_index;
-  uint8_t sample_size;
   onewire_bus_t* bus;
   Thread* thread;
+  sensor_device_t devices[SENSOR_MAX_PROBES];
+  uint8_t num_devices;
+  bool rescan;
+  bool converting;
+  systime_t conversion_start;
+  systime_t conversion_time;
+  uint32_t offsets_gen;
+  uint8_t resolution;
+  float rate_ref_value;
+  systime_t rate_ref_time;
+  float rate;
+  float band_low;
+  float band_high;
+  systime_t last_scan_time;
   systime_t last_sample_time;
   bool connected;
 } sensor_port_t;
@@ -28,12 +115,20 @@ typedef struct sensor_port_s {
 static sensor_port_t* open_ports[NUM_SENSORS];
 
 static msg_t sensor_thread(void* arg);
-static bool sensor_get_sample(sensor_port_t* tp, quantity_t* sample);
-static void filter_sample(sensor_port_t* tp, quantity_t* sample);
-static void send_sensor_msg(sensor_port_t* tp, quantity_t* sample);
+static void scan_bus(sensor_port_t* tp);
+static bool start_conversion(sensor_port_t* tp);
+static bool wait_conversion(sensor_port_t* tp);
+static bool sample_bus(sensor_port_t* tp);
+static void refresh_configs(sensor_port_t* tp);
+static void update_resolution(sensor_port_t* tp, float sample);
+static void set_resolution(sensor_port_t* tp);
+static void init_filter(sensor_device_t* dev);
+static const filter_preset_t* filter_preset(sensor_device_t* dev);
+static void scale_filter(sensor_device_t* dev, systime_t sample_period);
+static void send_sensor_msg(sensor_port_t* tp, uint8_t probe, quantity_t* sample);
 static void send_timeout_msg(sensor_port_t* tp);
 
-static bool read_maxim_temp_sensor(sensor_port_t* tp, quantity_t* sample);
+static bool read_maxim_temp_sensor(sensor_port_t* tp, sensor_device_t* dev, sensor_fix_t* temp);
 
 
 sensor_port_t*
@@ -44,6 +139,9 @@ sensor_init(sensor_id_t sensor, onewire_bus_t* port)
 
   tp->sensor = sensor;
   tp->bus = port;
+  tp->resolution = 12;
+  tp->band_low = NAN;
+  tp->band_high = NAN;
   onewire_init(tp->bus);
 
   tp->thread = chThdCreateFromHeap(NULL, 1024, NORMALPRIO, sensor_thread, tp);
@@ -60,16 +158,20 @@ sensor_thread(void* arg)
   chRegSetThreadName("sensor");
 
   while (1) {
-    quantity_t sample;
-
     thread_watchdog_kick();
 
-    if (sensor_get_sample(tp, &sample)) {
-      filter_sample(tp, &sample);
-      sample.value = (sample.value + tp->sensor_config.offset.value);
+    if (!tp->converting) {
+      if (tp->rescan ||
+          tp->num_devices == 0 ||
+          (chTimeNow() - tp->last_scan_time) > SENSOR_RESCAN_PERIOD)
+        scan_bus(tp);
+
+      start_conversion(tp);
+    }
+
+    if (tp->converting && wait_conversion(tp) && sample_bus(tp)) {
       tp->connected = true;
       tp->last_sample_time = chTimeNow();
-      send_sensor_msg(tp, &sample);
     }
     else {
       if ((chTimeNow() - tp->last_sample_time) > SENSOR_TIMEOUT) {
@@ -78,126 +180,395 @@ sensor_thread(void* arg)
           send_timeout_msg(tp);
         }
       }
-    }
 
-    chThdSleepMilliseconds(100);
+      // nothing on the bus, don't spin looking for it
+      if (!tp->converting)
+        chThdSleepMilliseconds(100);
+    }
   }
 
   return 0;
 }
 
+/* Enumerates the probes on the bus. Probes that were already known keep
+ * their place and filter state, so the primary probe only changes when it
+ * is removed.
+ */
 static void
-filter_sample(sensor_port_t* tp, quantity_t* sample)
+scan_bus(sensor_port_t* tp)
 {
-  float filtered_sample = 0;
-  uint8_t i;
+  onewire_search_t search;
+  int i;
 
-  tp->sample_filter[tp->sample_filter_index] = sample->value;
-  if (++tp->sample_filter_index >= SENSOR_SAMPLE_SIZE)
-    tp->sample_filter_index = 0;
+  tp->rescan = false;
+  tp->last_scan_time = chTimeNow();
 
-  if (tp->sample_size < SENSOR_SAMPLE_SIZE)
-    tp->sample_size++;
+  for (i = 0; i < tp->num_devices; ++i)
+    tp->devices[i].seen = false;
 
-  for (i = 0; i < SENSOR_SAMPLE_SIZE; i++) {
-    filtered_sample += tp->sample_filter[i];
+  onewire_search_init(&search);
+  while (onewire_search_next(tp->bus, &search)) {
+    if (search.rom[0] != FAMILY_DS18B20 &&
+        search.rom[0] != FAMILY_MAX31850)
+      continue;
+
+    for (i = 0; i < tp->num_devices; ++i) {
+      if (memcmp(tp->devices[i].rom, search.rom, sizeof(search.rom)) == 0)
+        break;
+    }
+
+    if (i == tp->num_devices) {
+      if (tp->num_devices >= SENSOR_MAX_PROBES)
+        continue;
+
+      sensor_device_t* dev = &tp->devices[tp->num_devices++];
+      memset(dev, 0, sizeof(sensor_device_t));
+      memcpy(dev->rom, search.rom, sizeof(search.rom));
+      memcpy(dev->sensor_config.sensor_serial, &search.rom[1], sizeof(sensor_serial_t));
+      dev->sensor_config.offset = app_cfg_get_probe_offset(dev->sensor_config.sensor_serial);
+      dev->sensor_config.filter = app_cfg_get_probe_filter(dev->sensor_config.sensor_serial);
+      dev->conversion_time = MAX_CONVERSION_TIME;
+      init_filter(dev);
+    }
+
+    tp->devices[i].seen = true;
+  }
+
+  /* A search that was cut short by a bus error says nothing about the
+   * probes it did not get to
+   */
+  if (!search.last_device)
+    return;
+
+  for (i = 0; i < tp->num_devices; ) {
+    if (!tp->devices[i].seen) {
+      memmove(&tp->devices[i], &tp->devices[i + 1],
+          (tp->num_devices - i - 1) * sizeof(sensor_device_t));
+      tp->num_devices--;
+    }
+    else {
+      i++;
+    }
   }
-  sample->value = filtered_sample / tp->sample_size;
 }
 
-static void
-send_sensor_msg(sensor_port_t* tp, quantity_t* sample)
+/* Issues a T convert command to every probe on the bus at once */
+static bool
+start_conversion(sensor_port_t* tp)
 {
-  sensor_msg_t msg = {
-      .sensor = tp->sensor,
-      .sample = *sample
-  };
-  msg_send(MSG_SENSOR_SAMPLE, &msg);
+  int i;
+
+  if (tp->num_devices == 0)
+    return false;
+
+  static const uint8_t cmd[] = { SKIP_ROM, CONVERT_T };
+
+  if (!onewire_transaction(tp->bus, true, cmd, sizeof(cmd), NULL, 0)) {
+    tp->rescan = true;
+    return false;
+  }
+
+  tp->converting = true;
+  tp->conversion_start = chTimeNow();
+
+  // the bus is done when the slowest probe is
+  tp->conversion_time = 0;
+  for (i = 0; i < tp->num_devices; ++i) {
+    if (tp->devices[i].conversion_time > tp->conversion_time)
+      tp->conversion_time = tp->devices[i].conversion_time;
+  }
+
+  return true;
 }
 
-static void
-send_timeout_msg(sensor_port_t* tp)
+/* Sleeps until the conversion in flight should be done and then polls the
+ * bus until every probe reports that it is. Gives up after twice the
+ * expected conversion time.
+ */
+static bool
+wait_conversion(sensor_port_t* tp)
 {
-  sensor_timeout_msg_t msg = {
-      .sensor = tp->sensor
-  };
-  open_ports[tp->sensor]->connected = false;
-  msg_send(MSG_SENSOR_TIMEOUT, &msg);
+  systime_t elapsed = chTimeNow() - tp->conversion_start;
+  if (elapsed < tp->conversion_time)
+    chThdSleep(tp->conversion_time - elapsed);
+
+  tp->converting = false;
+
+  while (1) {
+    uint8_t bit;
+    if (!onewire_recv_bit(tp->bus, &bit)) {
+      tp->rescan = true;
+      return false;
+    }
+
+    if (bit)
+      return true;
+
+    if ((chTimeNow() - tp->conversion_start) > (2 * tp->conversion_time)) {
+      tp->rescan = true;
+      return false;
+    }
+
+    chThdSleep(CONVERSION_POLL_INTERVAL);
+  }
 }
 
+/* Reads the conversion that just finished from every probe and starts the
+ * next one before publishing the results, so the probes are converting while
+ * the samples are being processed. Returns true if the primary probe was
+ * read.
+ */
 static bool
-sensor_get_sample(sensor_port_t* tp, quantity_t* sample)
+sample_bus(sensor_port_t* tp)
 {
-  uint8_t addr[8];
+  sensor_fix_t temps[SENSOR_MAX_PROBES];
+  bool read[SENSOR_MAX_PROBES];
+  int i;
 
-  if (!onewire_reset(tp->bus))
-    return false;
+  for (i = 0; i < tp->num_devices; ++i) {
+    sensor_device_t* dev = &tp->devices[i];
 
-  if (!onewire_read_rom(tp->bus, addr))
-    return false;
+    read[i] = read_maxim_temp_sensor(tp, dev, &temps[i]);
+    if (!read[i]) {
+      tp->rescan = true;
+      continue;
+    }
 
-  tp->sensor_config.offset = app_cfg_get_probe_offset(tp->sensor_config.sensor_serial);
+    // a probe that browned out reports its power on value once; drop it
+    // rather than feed an 85C spike to the controller
+    if (dev->rom[0] == FAMILY_DS18B20 &&
+        temps[i] == ((sensor_fix_t)DS18B20_POWER_ON_TEMP << (SENSOR_FIX_FRAC_BITS - 4)) &&
+        dev->has_last_temp &&
+        abs(temps[i] - dev->last_temp) > POWER_ON_JUMP) {
+      read[i] = false;
+      continue;
+    }
 
-  if (memcmp(&tp->sensor_config.sensor_serial[0], &addr[1], sizeof(sensor_serial_t)) != 0) {
-    memcpy(&tp->sensor_config.sensor_serial[0], &addr[1], sizeof(sensor_serial_t));
-    tp->sensor_config.offset = app_cfg_get_probe_offset(tp->sensor_config.sensor_serial);
+    dev->last_temp = temps[i];
+    dev->has_last_temp = true;
   }
 
-  switch (addr[0]) {
-  case 0x3B: // MAX31850
-  case 0x28: // DS18B20
-    return read_maxim_temp_sensor(tp, sample);
+  // a rescan has to wait until the bus is idle
+  if (!tp->rescan &&
+      (chTimeNow() - tp->last_scan_time) <= SENSOR_RESCAN_PERIOD) {
+    set_resolution(tp);
+    start_conversion(tp);
+  }
 
-  default:
-    return false;
+  if (tp->offsets_gen != app_cfg_get_probe_offsets_gen())
+    refresh_configs(tp);
+
+  for (i = 0; i < tp->num_devices; ++i) {
+    sensor_device_t* dev = &tp->devices[i];
+    systime_t now = chTimeNow();
+    systime_t sample_period;
+    quantity_t sample;
+
+    if (!read[i])
+      continue;
+
+    if (dev->last_read_time == 0)
+      sample_period = dev->conversion_time;
+    else
+      sample_period = now - dev->last_read_time;
+    dev->last_read_time = now;
+
+    scale_filter(dev, sample_period);
+    sensor_fix_t temp = sensor_filter_chain_exec(&dev->filter, temps[i]);
+
+    // convert from degrees Celsius to degrees Fahrenheit
+    sample.unit = UNIT_TEMP_DEG_F;
+    sample.value = (SENSOR_FIX_FLOAT(temp) * 1.8f) + 32;
+    sample.value = (sample.value + dev->sensor_config.offset.value);
+
+    // only the primary probe is published; the rest keep their filters warm
+    if (i == 0) {
+      send_sensor_msg(tp, i, &sample);
+      update_resolution(tp, sample.value);
+    }
   }
 
-  return true;
+  return (tp->num_devices > 0) && read[0];
 }
 
-static bool
-read_maxim_temp_sensor(sensor_port_t* tp, quantity_t* sample)
+/* Offsets and filters are cached per probe and only looked up again when
+ * one of them has been changed. A probe whose filter changed starts over
+ * with an empty chain.
+ */
+static void
+refresh_configs(sensor_port_t* tp)
 {
   int i;
 
-  // issue a T convert command
-  if (!onewire_reset(tp->bus))
-    return false;
+  tp->offsets_gen = app_cfg_get_probe_offsets_gen();
 
-  if (!onewire_send_byte(tp->bus, SKIP_ROM))
-    return false;
+  for (i = 0; i < tp->num_devices; ++i) {
+    sensor_device_t* dev = &tp->devices[i];
+    sensor_filter_preset_t filter = app_cfg_get_probe_filter(dev->sensor_config.sensor_serial);
 
-  if (!onewire_send_byte(tp->bus, 0x44))
-    return false;
+    dev->sensor_config.offset = app_cfg_get_probe_offset(dev->sensor_config.sensor_serial);
+    if (filter != dev->sensor_config.filter) {
+      dev->sensor_config.filter = filter;
+      init_filter(dev);
+    }
+  }
+}
 
-  // wait for device to signal conversion complete
-  chThdSleepMilliseconds(700);
-  while (1) {
-    uint8_t bit;
-    if (!onewire_recv_bit(tp->bus, &bit))
-      return false;
+/* Picks the resolution for the next conversions. Coarse conversions are
+ * quicker, so the probes are sampled faster while the temperature is moving
+ * or close to where a relay switches, and at full resolution otherwise.
+ *
+ * A change of one step at the current resolution can be a steady
+ * temperature sitting on the edge between two readings, so it is not
+ * counted as movement. The rates to leave a coarse resolution are lower
+ * than those to enter it, so a rate near a threshold does not flip the
+ * resolution every window.
+ */
+static void
+update_resolution(sensor_port_t* tp, float sample)
+{
+  systime_t now = chTimeNow();
 
-    if (bit)
-      break;
+  if (tp->rate_ref_time == 0) {
+    tp->rate_ref_value = sample;
+    tp->rate_ref_time = now;
+    return;
+  }
+
+  if ((now - tp->rate_ref_time) >= RATE_WINDOW) {
+    float change = fabsf(sample - tp->rate_ref_value);
+
+    if (change <= RESOLUTION_LSB(tp->resolution))
+      tp->rate = 0;
     else
-      chThdSleepMilliseconds(100);
+      tp->rate = change * S2ST(60) / (now - tp->rate_ref_time);
+
+    tp->rate_ref_value = sample;
+    tp->rate_ref_time = now;
   }
 
-  // read the scratchpad register
-  if (!onewire_reset(tp->bus))
-    return false;
+  if (tp->rate >= ((tp->resolution <= 9) ? RATE_FAST_EXIT : RATE_FAST_ENTER))
+    tp->resolution = 9;
+  else if (tp->rate >= ((tp->resolution <= 10) ? RATE_MOVING_EXIT : RATE_MOVING_ENTER))
+    tp->resolution = 10;
+  else if (sample >= tp->band_low && sample <= tp->band_high)
+    tp->resolution = 11;
+  else
+    tp->resolution = 12;
+}
 
-  if (!onewire_send_byte(tp->bus, SKIP_ROM))
-    return false;
+/* Writes the configuration register of any DS18B20 that is not converting
+ * at the port's resolution. The setting is not copied to EEPROM, so a probe
+ * that loses power comes back at its default and is simply set again.
+ */
+static void
+set_resolution(sensor_port_t* tp)
+{
+  int i;
 
-  if (!onewire_send_byte(tp->bus, 0xBE))
-    return false;
+  for (i = 0; i < tp->num_devices; ++i) {
+    sensor_device_t* dev = &tp->devices[i];
 
-  uint8_t scratchpad[9];
-  for (i = 0; i < (int)sizeof(scratchpad); ++i) {
-    if (!onewire_recv_byte(tp->bus, &scratchpad[i]))
-      return false;
+    if (dev->rom[0] != FAMILY_DS18B20 ||
+        dev->resolution == tp->resolution)
+      continue;
+
+    uint8_t cmd[13];
+    cmd[0] = MATCH_ROM;
+    memcpy(&cmd[1], dev->rom, sizeof(dev->rom));
+    cmd[9] = WRITE_SCRATCHPAD;
+    cmd[10] = dev->alarm[0];
+    cmd[11] = dev->alarm[1];
+    cmd[12] = ((tp->resolution - 9) << 5) | 0x1F;
+
+    if (!onewire_transaction(tp->bus, true, cmd, sizeof(cmd), NULL, 0)) {
+      tp->rescan = true;
+      return;
+    }
+
+    dev->resolution = tp->resolution;
+    dev->conversion_time = MS2ST(750 >> (12 - tp->resolution));
+  }
+}
+
+/* The chain picked by the probe's config, or the default if the config
+ * names one this build doesn't have
+ */
+static const filter_preset_t*
+filter_preset(sensor_device_t* dev)
+{
+  if (dev->sensor_config.filter >= NUM_SENSOR_FILTER_PRESETS)
+    return &filter_presets[SENSOR_FILTER_PRESET_DEFAULT];
+
+  return &filter_presets[dev->sensor_config.filter];
+}
+
+static void
+init_filter(sensor_device_t* dev)
+{
+  const filter_preset_t* preset = filter_preset(dev);
+
+  sensor_filter_chain_init(&dev->filter, preset->stages, preset->num_stages);
+}
+
+static void
+scale_filter(sensor_device_t* dev, systime_t sample_period)
+{
+  const filter_preset_t* preset = filter_preset(dev);
+  int i;
+
+  if (sample_period == 0)
+    return;
+
+  for (i = 0; i < preset->num_stages; ++i) {
+    if (preset->stages[i].type != SENSOR_FILTER_MOVING_AVG)
+      continue;
+
+    uint32_t window = (preset->stages[i].window * FILTER_SAMPLE_PERIOD +
+        (sample_period / 2)) / sample_period;
+    if (window > SENSOR_FILTER_MAX_WINDOW)
+      window = SENSOR_FILTER_MAX_WINDOW;
+
+    sensor_filter_chain_set_window(&dev->filter, i, window);
   }
+}
+
+static void
+send_sensor_msg(sensor_port_t* tp, uint8_t probe, quantity_t* sample)
+{
+  sensor_msg_t msg = {
+      .sensor = tp->sensor,
+      .sample = *sample,
+      .probe = probe
+  };
+  memcpy(msg.serial, tp->devices[probe].sensor_config.sensor_serial, sizeof(sensor_serial_t));
+
+  msg_post_state(MSG_SENSOR_SAMPLE, tp->sensor, &msg, sizeof(msg));
+}
+
+static void
+send_timeout_msg(sensor_port_t* tp)
+{
+  sensor_timeout_msg_t msg = {
+      .sensor = tp->sensor
+  };
+  open_ports[tp->sensor]->connected = false;
+  msg_post(MSG_SENSOR_TIMEOUT, &msg, sizeof(msg));
+}
+
+static bool
+read_maxim_temp_sensor(sensor_port_t* tp, sensor_device_t* dev, sensor_fix_t* temp)
+{
+  uint8_t cmd[10];
+  uint8_t scratchpad[9];
+
+  // read the scratchpad register
+  cmd[0] = MATCH_ROM;
+  memcpy(&cmd[1], dev->rom, sizeof(dev->rom));
+  cmd[9] = READ_SCRATCHPAD;
+
+  if (!onewire_transaction(tp->bus, true, cmd, sizeof(cmd), scratchpad, sizeof(scratchpad)))
+    return false;
 
   uint8_t crc = crc8_block(0, scratchpad, 8);
   if (crc != scratchpad[8])
@@ -206,17 +577,43 @@ read_maxim_temp_sensor(sensor_port_t* tp, quantity_t* sample)
   // two unsigned data bytes need to be combined and converted to a signed short
   int16_t t = (scratchpad[1] << 8) + scratchpad[0];
 
-  // convert from 16ths of a degree Celsius to degrees Fahrenheit
-  sample->unit = UNIT_TEMP_DEG_F;
-  sample->value = ((t / 16.0f) * 1.8f) + 32;
+  // the resolution sets the time taken by the next conversion
+  if (dev->rom[0] == FAMILY_DS18B20) {
+    dev->resolution = 9 + ((scratchpad[4] >> 5) & 0x3);
+    dev->conversion_time = MS2ST(750 >> (12 - dev->resolution));
+    dev->alarm[0] = scratchpad[2];
+    dev->alarm[1] = scratchpad[3];
+
+    // below 12 bits the low bits of the reading are undefined
+    t &= ~((1 << (12 - dev->resolution)) - 1);
+  }
+  else {
+    dev->resolution = 14;
+    dev->conversion_time = MAX31850_CONVERSION_TIME;
+  }
+
+  // convert from 16ths of a degree Celsius
+  *temp = (sensor_fix_t)t << (SENSOR_FIX_FRAC_BITS - 4);
 
   return true;
 }
 
+void
+sensor_set_control_band(sensor_id_t sensor, float low, float high)
+{
+  sensor_port_t* tp = open_ports[sensor];
+
+  if (tp == NULL)
+    return;
+
+  tp->band_low = low;
+  tp->band_high = high;
+}
+
 sensor_config_t*
 get_sensor_cfg(sensor_id_t sensor_id)
 {
-  return &open_ports[sensor_id]->sensor_config;
+  return &open_ports[sensor_id]->devices[0].sensor_config;
 }
 
 bool
@@ -2,12 +2,16 @@
 #define SENSOR_H
 
 #include "onewire.h"
+#include "sensor_filter.h"
 #include "types.h"
 #include <stdint.h>
 
 
 #define MAX_NUM_SENSOR_CONFIGS 32
 
+// Probes sampled on each sensor port
+#define SENSOR_MAX_PROBES 8
+
 typedef enum {
   SENSOR_NONE = -1,
   SENSOR_1,
@@ -19,20 +23,38 @@ typedef enum {
 struct sensor_port_s;
 typedef struct sensor_port_s sensor_port_t;
 
+typedef uint8_t sensor_serial_t[6];
+
+/* Sample from one probe on a sensor port. Only probe 0, the port's primary
+ * probe, is published as MSG_SENSOR_SAMPLE; the other probes are tracked
+ * but have no consumer yet.
+ */
 typedef struct {
   sensor_id_t sensor;
   quantity_t sample;
+  uint8_t probe;
+  sensor_serial_t serial;
 } sensor_msg_t;
 
 typedef struct {
   sensor_id_t sensor;
 } sensor_timeout_msg_t;
 
-typedef uint8_t sensor_serial_t[6];
+/* Filter chains a probe can be set to run */
+typedef enum {
+  SENSOR_FILTER_PRESET_DEFAULT, // median 3, moving average 10
+  SENSOR_FILTER_PRESET_NONE,
+  SENSOR_FILTER_PRESET_SMOOTH,  // median 5, moving average 16
+  SENSOR_FILTER_PRESET_EMA,     // median 3, EMA 0.2
+  SENSOR_FILTER_PRESET_KALMAN,  // median 3, Kalman
+
+  NUM_SENSOR_FILTER_PRESETS
+} sensor_filter_preset_t;
 
 typedef struct {
   sensor_serial_t sensor_serial;
   quantity_t offset;
+  sensor_filter_preset_t filter;
 } sensor_config_t;
 
 typedef struct {
@@ -44,6 +66,12 @@ typedef struct {
 sensor_port_t*
 sensor_init(sensor_id_t sensor, onewire_bus_t* port);
 
+/* Sets the range of temperatures around the controller's relay thresholds.
+ * The port samples faster while its primary probe is inside it.
+ */
+void
+sensor_set_control_band(sensor_id_t sensor, float low, float high);
+
 sensor_config_t*
 get_sensor_cfg(sensor_id_t sensor_id);
 
@@ -0,0 +1,240 @@
+
+#include "sensor_filter.h"
+
+#include <string.h>
+
+
+#define FIX_ONE         (1 << SENSOR_FIX_FRAC_BITS)
+#define MUL_FIX(a, b)   ((sensor_fix_t)(((int64_t)(a) * (b)) >> SENSOR_FIX_FRAC_BITS))
+#define DIV_FIX(a, b)   ((sensor_fix_t)(((int64_t)(a) << SENSOR_FIX_FRAC_BITS) / (b)))
+
+static sensor_fix_t moving_avg_exec(sensor_filter_t* f, sensor_fix_t sample);
+static sensor_fix_t median_exec(sensor_filter_t* f, sensor_fix_t sample);
+static sensor_fix_t ema_exec(sensor_filter_t* f, sensor_fix_t sample);
+static sensor_fix_t kalman_exec(sensor_filter_t* f, sensor_fix_t sample);
+
+
+void
+sensor_filter_chain_init(sensor_filter_chain_t* chain, const sensor_filter_cfg_t* cfgs, uint8_t num_stages)
+{
+  int i;
+
+  if (num_stages > SENSOR_FILTER_MAX_STAGES)
+    num_stages = SENSOR_FILTER_MAX_STAGES;
+
+  chain->num_stages = num_stages;
+  for (i = 0; i < num_stages; ++i) {
+    sensor_filter_cfg_t* cfg = &chain->stages[i].cfg;
+
+    *cfg = cfgs[i];
+
+    switch (cfg->type) {
+      case SENSOR_FILTER_MOVING_AVG:
+        if (cfg->window < 1)
+          cfg->window = 1;
+        else if (cfg->window > SENSOR_FILTER_MAX_WINDOW)
+          cfg->window = SENSOR_FILTER_MAX_WINDOW;
+        break;
+
+      case SENSOR_FILTER_MEDIAN:
+        if (cfg->window > SENSOR_FILTER_MAX_MEDIAN)
+          cfg->window = SENSOR_FILTER_MAX_MEDIAN;
+        cfg->window |= 1;
+        break;
+
+      case SENSOR_FILTER_EMA:
+        if (cfg->alpha <= 0 || cfg->alpha > FIX_ONE)
+          cfg->alpha = FIX_ONE;
+        break;
+
+      case SENSOR_FILTER_KALMAN:
+        if (cfg->r <= 0)
+          cfg->r = 1;
+        if (cfg->q < 0)
+          cfg->q = 0;
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  sensor_filter_chain_reset(chain);
+}
+
+/* Forgets the samples seen so far, e.g. when a different probe has taken
+ * over the slot.
+ */
+void
+sensor_filter_chain_reset(sensor_filter_chain_t* chain)
+{
+  int i;
+
+  for (i = 0; i < chain->num_stages; ++i) {
+    sensor_filter_t* f = &chain->stages[i];
+    f->index = 0;
+    f->count = 0;
+    memset(&f->state, 0, sizeof(f->state));
+  }
+}
+
+void
+sensor_filter_chain_set_window(sensor_filter_chain_t* chain, uint8_t stage, uint8_t window)
+{
+  sensor_fix_t samples[SENSOR_FILTER_MAX_WINDOW];
+  sensor_filter_t* f;
+  int n;
+  int i;
+
+  if (stage >= chain->num_stages)
+    return;
+
+  f = &chain->stages[stage];
+  if (f->cfg.type != SENSOR_FILTER_MOVING_AVG)
+    return;
+
+  if (window < 1)
+    window = 1;
+  else if (window > SENSOR_FILTER_MAX_WINDOW)
+    window = SENSOR_FILTER_MAX_WINDOW;
+
+  if (window == f->cfg.window)
+    return;
+
+  // unroll the ring, oldest sample first
+  n = (f->count < window) ? f->count : window;
+  for (i = 0; i < n; ++i) {
+    int j = f->index - n + i;
+    if (j < 0)
+      j += f->cfg.window;
+    samples[i] = f->state.avg.samples[j];
+  }
+
+  f->state.avg.sum = 0;
+  for (i = 0; i < n; ++i) {
+    f->state.avg.samples[i] = samples[i];
+    f->state.avg.sum += samples[i];
+  }
+
+  f->cfg.window = window;
+  f->count = n;
+  f->index = n % window;
+}
+
+sensor_fix_t
+sensor_filter_chain_exec(sensor_filter_chain_t* chain, sensor_fix_t sample)
+{
+  int i;
+
+  for (i = 0; i < chain->num_stages; ++i) {
+    sensor_filter_t* f = &chain->stages[i];
+
+    switch (f->cfg.type) {
+      case SENSOR_FILTER_MOVING_AVG:
+        sample = moving_avg_exec(f, sample);
+        break;
+
+      case SENSOR_FILTER_MEDIAN:
+        sample = median_exec(f, sample);
+        break;
+
+      case SENSOR_FILTER_EMA:
+        sample = ema_exec(f, sample);
+        break;
+
+      case SENSOR_FILTER_KALMAN:
+        sample = kalman_exec(f, sample);
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  return sample;
+}
+
+/* Keeps a running sum, so each sample costs one add and one subtract
+ * whatever the window length.
+ */
+static sensor_fix_t
+moving_avg_exec(sensor_filter_t* f, sensor_fix_t sample)
+{
+  if (f->count < f->cfg.window)
+    f->count++;
+  else
+    f->state.avg.sum -= f->state.avg.samples[f->index];
+
+  f->state.avg.samples[f->index] = sample;
+  f->state.avg.sum += sample;
+
+  if (++f->index >= f->cfg.window)
+    f->index = 0;
+
+  return f->state.avg.sum / f->count;
+}
+
+/* Passes on the median of the last few samples, which drops any single bad
+ * reading instead of smearing it across the window like an average would.
+ */
+static sensor_fix_t
+median_exec(sensor_filter_t* f, sensor_fix_t sample)
+{
+  sensor_fix_t sorted[SENSOR_FILTER_MAX_MEDIAN];
+  int i;
+  int j;
+
+  f->state.median.samples[f->index] = sample;
+  if (++f->index >= f->cfg.window)
+    f->index = 0;
+
+  if (f->count < f->cfg.window)
+    f->count++;
+
+  // the window is at most SENSOR_FILTER_MAX_MEDIAN long, so the sort is too
+  for (i = 0; i < f->count; ++i) {
+    sensor_fix_t s = f->state.median.samples[i];
+
+    for (j = i; j > 0 && sorted[j - 1] > s; --j)
+      sorted[j] = sorted[j - 1];
+    sorted[j] = s;
+  }
+
+  return sorted[f->count / 2];
+}
+
+static sensor_fix_t
+ema_exec(sensor_filter_t* f, sensor_fix_t sample)
+{
+  if (f->count == 0) {
+    f->count = 1;
+    f->state.ema.y = sample;
+  }
+  else {
+    f->state.ema.y += MUL_FIX(f->cfg.alpha, sample - f->state.ema.y);
+  }
+
+  return f->state.ema.y;
+}
+
+/* Scalar Kalman filter for a temperature that drifts as a random walk */
+static sensor_fix_t
+kalman_exec(sensor_filter_t* f, sensor_fix_t sample)
+{
+  if (f->count == 0) {
+    f->count = 1;
+    f->state.kalman.x = sample;
+    f->state.kalman.p = f->cfg.r;
+    return sample;
+  }
+
+  // predict
+  f->state.kalman.p += f->cfg.q;
+
+  // update
+  sensor_fix_t k = DIV_FIX(f->state.kalman.p, f->state.kalman.p + f->cfg.r);
+  f->state.kalman.x += MUL_FIX(k, sample - f->state.kalman.x);
+  f->state.kalman.p = MUL_FIX(FIX_ONE - k, f->state.kalman.p);
+
+  return f->state.kalman.x;
+}
@@ -0,0 +1,94 @@
+#ifndef SENSOR_FILTER_H
+#define SENSOR_FILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/* Samples are filtered in Q16.16 degrees Celsius, straight from the probe's
+ * 1/16th degree readings, so the chain needs no floating point.
+ */
+#define SENSOR_FIX_FRAC_BITS 16
+
+typedef int32_t sensor_fix_t;
+
+#define SENSOR_FIX(f)       ((sensor_fix_t)((f) * (1 << SENSOR_FIX_FRAC_BITS) + (((f) < 0) ? -0.5f : 0.5f)))
+#define SENSOR_FIX_FLOAT(v) ((float)(v) / (1 << SENSOR_FIX_FRAC_BITS))
+
+// Longest window of the moving average and median stages
+#define SENSOR_FILTER_MAX_WINDOW 16
+#define SENSOR_FILTER_MAX_MEDIAN 5
+
+// Stages in one probe's chain
+#define SENSOR_FILTER_MAX_STAGES 4
+
+typedef enum {
+  SENSOR_FILTER_NONE,
+  SENSOR_FILTER_MOVING_AVG,
+  SENSOR_FILTER_MEDIAN,
+  SENSOR_FILTER_EMA,
+  SENSOR_FILTER_KALMAN
+} sensor_filter_type_t;
+
+/* Settings for one stage.
+ *   MOVING_AVG  window samples, up to SENSOR_FILTER_MAX_WINDOW
+ *   MEDIAN      window samples, odd and up to SENSOR_FILTER_MAX_MEDIAN
+ *   EMA         alpha is the weight of the new sample, 0 < alpha <= 1
+ *   KALMAN      q is the process noise and r the measurement noise
+ *               variance per sample, in degrees C squared
+ */
+typedef struct {
+  sensor_filter_type_t type;
+  uint8_t window;
+  sensor_fix_t alpha;
+  sensor_fix_t q;
+  sensor_fix_t r;
+} sensor_filter_cfg_t;
+
+typedef struct {
+  sensor_filter_cfg_t cfg;
+  uint8_t index;
+  uint8_t count;
+  union {
+    struct {
+      sensor_fix_t samples[SENSOR_FILTER_MAX_WINDOW];
+      int32_t sum;
+    } avg;
+    struct {
+      sensor_fix_t samples[SENSOR_FILTER_MAX_MEDIAN];
+    } median;
+    struct {
+      sensor_fix_t y;
+    } ema;
+    struct {
+      sensor_fix_t x;
+      sensor_fix_t p;
+    } kalman;
+  } state;
+} sensor_filter_t;
+
+typedef struct {
+  uint8_t num_stages;
+  sensor_filter_t stages[SENSOR_FILTER_MAX_STAGES];
+} sensor_filter_chain_t;
+
+
+void
+sensor_filter_chain_init(sensor_filter_chain_t* chain, const sensor_filter_cfg_t* cfgs, uint8_t num_stages);
+
+void
+sensor_filter_chain_reset(sensor_filter_chain_t* chain);
+
+/* Changes the window of a moving average stage, keeping the newest samples
+ * that still fit so the output doesn't jump. Other stages are left alone.
+ */
+void
+sensor_filter_chain_set_window(sensor_filter_chain_t* chain, uint8_t stage, uint8_t window);
+
+/* Runs one sample through each stage in turn and returns the output of the
+ * last one. Each stage costs a bounded amount of work per sample.
+ */
+sensor_fix_t
+sensor_filter_chain_exec(sensor_filter_chain_t* chain, sensor_fix_t sample);
+
+#endif
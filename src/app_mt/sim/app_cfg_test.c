@@ -0,0 +1,429 @@
+#include "ch.h"
+
+#include "sim.h"
+#include "app_cfg.h"
+#include "app_cfg_legacy.h"
+#include "temp_profile_lib.h"
+#include "sxfs.h"
+#include "crc/crc32.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Long enough for several of the old 2 s flush ticks */
+#define IDLE_TIME      10
+
+/* Edits closer together than the flush quiet time of 500 ms */
+#define NUM_EDITS      5
+#define EDIT_INTERVAL  100
+
+/* Past the quiet time, well short of the 5 s deadline */
+#define SETTLE_TIME    2000
+
+/* The old flush thread's period, in seconds */
+#define LEGACY_FLUSH_PERIOD 2
+
+#define SECONDS_PER_HOUR    (60 * 60)
+
+/* Profile ids given to the profiles in the imported record */
+#define IMPORT_PROFILE_ID  0x7E570000
+
+
+static void
+print_delta(const char* what, const app_cfg_stats_t* before, const app_cfg_stats_t* after)
+{
+  printf("  %s: read %u written %u in %u records, %u flushes\r\n", what,
+      (unsigned)(after->bytes_read - before->bytes_read),
+      (unsigned)(after->bytes_written - before->bytes_written),
+      (unsigned)(after->records_written - before->records_written),
+      (unsigned)(after->flushes - before->flushes));
+}
+
+/* Changes the hysteresis NUM_EDITS times, faster than the flush quiet time,
+ * and waits for the flush
+ */
+static void
+edit_burst(quantity_t* edited)
+{
+  int i;
+
+  for (i = 0; i < NUM_EDITS; ++i) {
+    edited->value += 0.5f;
+    app_cfg_set_hysteresis(*edited);
+    chThdSleepMilliseconds(EDIT_INTERVAL);
+  }
+  chThdSleepMilliseconds(SETTLE_TIME);
+}
+
+/* Measures the settings log through app_cfg_get_stats() and
+ * app_cfg_get_generation(). Left idle it must not touch flash, and a burst
+ * of edits to one setting must end up as a single flush of a single record,
+ * with no reads unless the log had to be compacted.
+ */
+bool
+sim_test_app_cfg_flush()
+{
+  app_cfg_stats_t last_hour;
+  app_cfg_stats_t before;
+  app_cfg_stats_t after;
+  quantity_t hysteresis = app_cfg_get_hysteresis();
+  quantity_t edited = hysteresis;
+  uint32_t gen;
+  bool pass = true;
+
+  app_cfg_get_stats(&last_hour, &before);
+  gen = app_cfg_get_generation();
+  chThdSleepSeconds(IDLE_TIME);
+  app_cfg_get_stats(&last_hour, &after);
+
+  print_delta("idle", &before, &after);
+  if (after.flushes != before.flushes ||
+      after.bytes_read != before.bytes_read ||
+      after.bytes_written != before.bytes_written ||
+      app_cfg_get_generation() != gen) {
+    printf("  flash used while idle\r\n");
+    pass = false;
+  }
+
+  before = after;
+  edit_burst(&edited);
+  app_cfg_get_stats(&last_hour, &after);
+
+  print_delta("edits", &before, &after);
+  printf("  generation %u -> %u\r\n", (unsigned)gen, (unsigned)app_cfg_get_generation());
+  if (app_cfg_get_generation() - gen != NUM_EDITS) {
+    printf("  generation should go up once per edit\r\n");
+    pass = false;
+  }
+  if (after.flushes - before.flushes != 1 ||
+      after.records_written - before.records_written != 1) {
+    printf("  edits should be written in one flush of one record\r\n");
+    pass = false;
+  }
+  if (after.compactions == before.compactions &&
+      after.bytes_read != before.bytes_read) {
+    printf("  flush read flash back\r\n");
+    pass = false;
+  }
+
+  app_cfg_set_hysteresis(hysteresis);
+  chThdSleepMilliseconds(SETTLE_TIME);
+
+  return pass;
+}
+
+/* Replays an hour of the old flush thread, which every 2 s read the whole
+ * record back from SP_APP_CFG_1, and from SP_APP_CFG_2 as well when the
+ * record had moved there, and on a change erased the other part, wrote the
+ * record to it and erased the part it came from. Edit bursts are spread
+ * evenly and each lands in a single tick.
+ */
+static void
+legacy_hour(uint32_t bursts, app_cfg_stats_t* s)
+{
+  bool in_part_1 = true;
+  uint32_t ticks = SECONDS_PER_HOUR / LEGACY_FLUSH_PERIOD;
+  uint32_t i;
+
+  memset(s, 0, sizeof(app_cfg_stats_t));
+  for (i = 0; i < ticks; ++i) {
+    s->bytes_read += (in_part_1 ? 1 : 2) * sizeof(app_cfg_rec_t);
+    s->flushes++;
+
+    // true once in every ticks / bursts
+    if (((i * bursts) % ticks) < bursts) {
+      s->bytes_written += sizeof(app_cfg_rec_t);
+      s->records_written++;
+      s->erases += 2;
+      in_part_1 = !in_part_1;
+    }
+  }
+}
+
+/* Flash traffic over an hour for a few edit rates, before and after the
+ * settings log. "Before" is the old flush replayed by legacy_hour(). "After"
+ * is measured: an idle stretch and one edit burst, scaled to the hour.
+ */
+void
+sim_bench_app_cfg_hour()
+{
+  static const uint32_t bursts_per_hour[] = { 0, 1, 12, 60 };
+  app_cfg_stats_t last_hour;
+  app_cfg_stats_t start;
+  app_cfg_stats_t idle;
+  app_cfg_stats_t burst;
+  quantity_t hysteresis = app_cfg_get_hysteresis();
+  quantity_t edited = hysteresis;
+  uint32_t i;
+
+  app_cfg_get_stats(&last_hour, &start);
+  chThdSleepSeconds(IDLE_TIME);
+  app_cfg_get_stats(&last_hour, &idle);
+
+  edit_burst(&edited);
+  app_cfg_get_stats(&last_hour, &burst);
+
+  app_cfg_set_hysteresis(hysteresis);
+  chThdSleepMilliseconds(SETTLE_TIME);
+
+  printf("  %-12s %24s %24s\r\n", "bursts/hour",
+      "before read/wr/erase", "after read/wr/erase");
+
+  for (i = 0; i < sizeof(bursts_per_hour) / sizeof(bursts_per_hour[0]); ++i) {
+    uint32_t n = bursts_per_hour[i];
+    uint32_t scale = SECONDS_PER_HOUR / IDLE_TIME;
+    app_cfg_stats_t before;
+
+    legacy_hour(n, &before);
+    printf("  %-12u %10u/%7u/%5u %10u/%7u/%5u\r\n", (unsigned)n,
+        (unsigned)before.bytes_read, (unsigned)before.bytes_written, (unsigned)before.erases,
+        (unsigned)((scale * (idle.bytes_read - start.bytes_read)) +
+                   (n * (burst.bytes_read - idle.bytes_read))),
+        (unsigned)((scale * (idle.bytes_written - start.bytes_written)) +
+                   (n * (burst.bytes_written - idle.bytes_written))),
+        (unsigned)((scale * (idle.erases - start.erases)) +
+                   (n * (burst.erases - idle.erases))));
+  }
+}
+
+/* Fills every field of an old format record with values that differ
+ * between fields and from the defaults
+ */
+static void
+make_legacy_rec(app_cfg_rec_t* rec)
+{
+  legacy_app_cfg_data_t* d = &rec->data;
+  int i;
+  int j;
+
+  memset(rec, 0, sizeof(app_cfg_rec_t));
+
+  d->reset_count = 41;
+  d->temp_unit = UNIT_TEMP_DEG_C;
+  d->control_mode = PID;
+  d->hysteresis.unit = UNIT_TEMP_DEG_F;
+  d->hysteresis.value = 2.5f;
+  d->screen_saver.unit = UNIT_TIME_MIN;
+  d->screen_saver.value = 7;
+
+  for (i = 0; i < MAX_NUM_SENSOR_CONFIGS; ++i) {
+    for (j = 0; j < (int)sizeof(sensor_serial_t); ++j)
+      d->sensor_configs[i].sensor_serial[j] = 0x28 + i + j;
+    d->sensor_configs[i].offset.unit = UNIT_TEMP_DEG_F;
+    d->sensor_configs[i].offset.value = (i - 16) * 0.25f;
+  }
+
+  d->touch_calib.An = 76321;
+  d->touch_calib.Bn = -1202;
+  d->touch_calib.Cn = -5339321;
+  d->touch_calib.Dn = 1304;
+  d->touch_calib.En = 55107;
+  d->touch_calib.Fn = -8202144;
+  d->touch_calib.Divider = 205667;
+
+  for (i = 0; i < NUM_CONTROLLERS; ++i) {
+    legacy_controller_settings_t* cs = &d->controller_settings[i];
+    legacy_temp_profile_t* tp = &cs->temp_profile;
+
+    cs->controller = i;
+    cs->setpoint_type = SP_TEMP_PROFILE;
+    cs->static_setpoint.unit = UNIT_TEMP_DEG_F;
+    cs->static_setpoint.value = 60 + i;
+    cs->output_settings[OUTPUT_1].enabled = true;
+    cs->output_settings[OUTPUT_1].function = OUTPUT_FUNC_HEATING;
+    cs->output_settings[OUTPUT_1].cycle_delay.unit = UNIT_TIME_MIN;
+    cs->output_settings[OUTPUT_1].cycle_delay.value = 4 + i;
+    cs->output_settings[OUTPUT_2].enabled = (i == 0);
+    cs->output_settings[OUTPUT_2].function = OUTPUT_FUNC_COOLING;
+    cs->output_settings[OUTPUT_2].cycle_delay.unit = UNIT_TIME_MIN;
+    cs->output_settings[OUTPUT_2].cycle_delay.value = 6 + i;
+    cs->session_action = EDIT_SESSION;
+
+    tp->id = IMPORT_PROFILE_ID + i;
+    snprintf(tp->name, sizeof(tp->name), "imported %d", i);
+    tp->num_steps = 32 - i;
+    tp->start_value.unit = UNIT_TEMP_DEG_F;
+    tp->start_value.value = 64 + i;
+    for (j = 0; j < (int)tp->num_steps; ++j) {
+      tp->steps[j].duration = 3600 * (j + 1);
+      tp->steps[j].value.unit = UNIT_TEMP_DEG_F;
+      tp->steps[j].value.value = 50 + j + i;
+      tp->steps[j].type = (j & 1) ? STEP_RAMP : STEP_HOLD;
+    }
+    tp->start_point = 3 + i;
+    tp->completion_action = TEMP_PROFILE_COMPLETION_ACTION_START_OVER;
+
+    d->temp_profile_checkpoints[i].temp_profile_id = tp->id;
+    d->temp_profile_checkpoints[i].state = TPS_RUNNING;
+    d->temp_profile_checkpoints[i].current_step = 5 + i;
+    d->temp_profile_checkpoints[i].current_step_time = (1234 + i) * CH_FREQUENCY;
+  }
+
+  d->ota_update_checkpoint.download_in_progress = true;
+  strcpy(d->ota_update_checkpoint.update_ver, "1.5.9");
+  d->ota_update_checkpoint.update_size = 300000;
+  d->ota_update_checkpoint.last_block_offset = 123456;
+
+  strcpy(d->auth_token, "0123456789abcdef0123456789abcdef");
+
+  strcpy(d->net_settings.ssid, "brewery");
+  strcpy(d->net_settings.passphrase, "hops and barley");
+  d->net_settings.security_mode = 3;
+  d->net_settings.ip_config = IP_CFG_STATIC;
+  d->net_settings.ip = 0xC0A80117;
+  d->net_settings.subnet_mask = 0xFFFFFF00;
+  d->net_settings.gateway = 0xC0A80101;
+  d->net_settings.dns_server = 0x08080808;
+
+  d->fault.type = BUS_FAULT;
+  for (i = 0; i < MAX_FAULT_DATA; ++i)
+    d->fault.data[i] = i;
+
+  rec->crc = crc32_block(0, d, sizeof(legacy_app_cfg_data_t));
+}
+
+/* Checks every setting against the record it was imported from */
+static bool
+check_import(const legacy_app_cfg_data_t* d, uint32_t reset_count)
+{
+  bool pass = true;
+  int i;
+  int j;
+  matrix_t touch_calib;
+  ota_update_checkpoint_t ota_update_checkpoint;
+  char auth_token[sizeof(d->auth_token)];
+  net_settings_t net_settings;
+  fault_data_t fault;
+
+#define CHECK(cond) \
+  do { if (!(cond)) { printf("  %s\r\n", #cond); pass = false; } } while (0)
+
+  CHECK(app_cfg_get_reset_count() == reset_count);
+  CHECK(app_cfg_get_temp_unit() == d->temp_unit);
+  CHECK(app_cfg_get_control_mode() == d->control_mode);
+  CHECK(app_cfg_get_hysteresis().unit == d->hysteresis.unit);
+  CHECK(app_cfg_get_hysteresis().value == d->hysteresis.value);
+  CHECK(app_cfg_get_screen_saver().unit == d->screen_saver.unit);
+  CHECK(app_cfg_get_screen_saver().value == d->screen_saver.value);
+
+  for (i = 0; i < MAX_NUM_SENSOR_CONFIGS; ++i) {
+    sensor_serial_t serial;
+    memcpy(serial, d->sensor_configs[i].sensor_serial, sizeof(serial));
+    CHECK(app_cfg_get_probe_offset(serial).value == d->sensor_configs[i].offset.value);
+    CHECK(app_cfg_get_probe_filter(serial) == SENSOR_FILTER_PRESET_DEFAULT);
+  }
+
+  app_cfg_get_touch_calib(&touch_calib);
+  CHECK(memcmp(&touch_calib, &d->touch_calib, sizeof(matrix_t)) == 0);
+
+  for (i = 0; i < NUM_CONTROLLERS; ++i) {
+    const legacy_controller_settings_t* lcs = &d->controller_settings[i];
+    const legacy_temp_profile_t* ltp = &lcs->temp_profile;
+    const legacy_temp_profile_checkpoint_t* lcp = &d->temp_profile_checkpoints[i];
+    controller_settings_t settings;
+    temp_profile_checkpoint_t checkpoint;
+    const controller_settings_t* cs = &settings;
+    const temp_profile_checkpoint_t* cp = &checkpoint;
+    temp_profile_step_t steps[32];
+    temp_profile_t tp;
+
+    CHECK(app_cfg_get_controller_settings(i, &settings));
+    CHECK(app_cfg_get_temp_profile_checkpoint(i, &checkpoint));
+
+    CHECK(cs->controller == lcs->controller);
+    CHECK(cs->setpoint_type == lcs->setpoint_type);
+    CHECK(cs->static_setpoint.value == lcs->static_setpoint.value);
+    CHECK(memcmp(cs->output_settings, lcs->output_settings, sizeof(cs->output_settings)) == 0);
+    CHECK(cs->session_action == lcs->session_action);
+    CHECK(cs->temp_profile.id == ltp->id);
+    CHECK(cs->temp_profile.start_point == ltp->start_point);
+    CHECK(cs->temp_profile.completion_action == ltp->completion_action);
+
+    CHECK(temp_profile_lib_get(ltp->id, &tp));
+    CHECK(strcmp(tp.name, ltp->name) == 0);
+    CHECK(tp.num_steps == ltp->num_steps);
+    CHECK(tp.start_value.value == ltp->start_value.value);
+    CHECK(temp_profile_lib_read_steps(ltp->id, 0, steps, 32) == ltp->num_steps);
+    for (j = 0; j < (int)ltp->num_steps; ++j)
+      CHECK(memcmp(&steps[j], &ltp->steps[j], sizeof(temp_profile_step_t)) == 0);
+
+    CHECK(cp->temp_profile_id == lcp->temp_profile_id);
+    CHECK(cp->state == lcp->state);
+    CHECK(cp->current_step == lcp->current_step);
+    CHECK(cp->current_step_time == lcp->current_step_time / CH_FREQUENCY);
+  }
+
+  app_cfg_get_ota_update_checkpoint(&ota_update_checkpoint);
+  CHECK(memcmp(&ota_update_checkpoint, &d->ota_update_checkpoint, sizeof(ota_update_checkpoint_t)) == 0);
+  app_cfg_get_auth_token(auth_token, sizeof(auth_token));
+  CHECK(strcmp(auth_token, d->auth_token) == 0);
+  app_cfg_get_net_settings(&net_settings);
+  CHECK(memcmp(&net_settings, &d->net_settings, sizeof(net_settings_t)) == 0);
+  app_cfg_get_fault_data(&fault);
+  CHECK(memcmp(&fault, &d->fault, sizeof(fault_data_t)) == 0);
+
+#undef CHECK
+
+  return pass;
+}
+
+static void
+write_part(sxfs_part_id_t part, uint8_t* data, uint32_t len)
+{
+  sxfs_erase_all(part);
+  if (data != NULL)
+    sxfs_write(part, 0, data, len);
+}
+
+/* Writes a config record in the format the firmware used before the log to
+ * the flash, the way a device being upgraded has it, and loads it as at
+ * boot. Every setting must come through, the first time from the old record
+ * and then from the log the import writes. The sim's own config is put back
+ * afterwards.
+ */
+bool
+sim_test_app_cfg_import()
+{
+  uint32_t part_size = sxfs_part_size(SP_APP_CFG_1);
+  uint8_t* saved1 = malloc(part_size);
+  uint8_t* saved2 = malloc(part_size);
+  app_cfg_rec_t* rec = malloc(sizeof(app_cfg_rec_t));
+  bool pass = true;
+  int i;
+
+  make_legacy_rec(rec);
+
+  app_cfg_suspend();
+  sxfs_read(SP_APP_CFG_1, 0, saved1, part_size);
+  sxfs_read(SP_APP_CFG_2, 0, saved2, part_size);
+  write_part(SP_APP_CFG_1, (uint8_t*)rec, sizeof(app_cfg_rec_t));
+  write_part(SP_APP_CFG_2, NULL, 0);
+  app_cfg_reload();
+
+  printf("  old record %u bytes, imported\r\n", (unsigned)sizeof(app_cfg_rec_t));
+  if (!check_import(&rec->data, rec->data.reset_count + 1))
+    pass = false;
+
+  app_cfg_suspend();
+  app_cfg_reload();
+
+  printf("  reloaded from the log\r\n");
+  if (!check_import(&rec->data, rec->data.reset_count + 2))
+    pass = false;
+
+  app_cfg_suspend();
+  write_part(SP_APP_CFG_1, saved1, part_size);
+  write_part(SP_APP_CFG_2, saved2, part_size);
+  app_cfg_reload();
+
+  for (i = 0; i < NUM_CONTROLLERS; ++i)
+    temp_profile_lib_delete(IMPORT_PROFILE_ID + i);
+
+  free(rec);
+  free(saved1);
+  free(saved2);
+
+  return pass;
+}
@@ -0,0 +1,37 @@
+
+#include "ch.h"
+#include "hal.h"
+
+#include "hci.h"
+#include "cc3000_spi.h"
+
+
+/* The simulator has no CC3000 fitted. Commands written to the module are
+ * dropped, so every HCI request runs into its command timeout and the
+ * network stack reports the module as unavailable.
+ */
+
+uint8_t wlan_tx_buffer[CC3000_TX_BUFFER_SIZE];
+
+
+void
+spi_open()
+{
+}
+
+void
+spi_close()
+{
+}
+
+uint8_t*
+spi_get_buffer()
+{
+  return wlan_tx_buffer + SPI_HEADER_SIZE;
+}
+
+void
+spi_write(uint16_t usLength)
+{
+  (void)usLength;
+}
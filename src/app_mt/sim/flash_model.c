@@ -0,0 +1,208 @@
+#include "ch.h"
+#include "hal.h"
+
+#include "sim.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Common NOR behaviour of the simulated flash parts.
+ *
+ * The array is kept in a file next to the executable, inverted so that the
+ * holes of a sparse file read back as erased bytes. A new image is created
+ * by writing only its last byte, which allocates nothing else on disk until
+ * it is written.
+ *
+ * Programming can only clear bits, as on the real parts, so writing over
+ * data that wasn't erased first leaves the AND of the two. Each erase is
+ * counted against the erase block it hits, and each operation adds the time
+ * the timing model gives it to the part's simulated busy time.
+ */
+
+
+static sim_flash_t* flashes[2];
+
+
+static void
+flash_load(sim_flash_t* f, const char* path)
+{
+  uint32_t i;
+
+  f->file = fopen(path, "r+b");
+  if (f->file != NULL) {
+    size_t n = fread(f->mem, 1, f->size, f->file);
+    if (n != f->size)
+      printf("%s: short image %s\r\n", f->name, path);
+
+    for (i = 0; i < n; ++i)
+      f->mem[i] = ~f->mem[i];
+  }
+  else {
+    f->file = fopen(path, "w+b");
+    if (f->file != NULL &&
+        (fseek(f->file, f->size - 1, SEEK_SET) != 0 ||
+         fputc(0, f->file) == EOF ||
+         fflush(f->file) != 0))
+      printf("%s: could not size %s\r\n", f->name, path);
+  }
+}
+
+void
+sim_flash_init(sim_flash_t* f, const char* env, const char* default_path)
+{
+  const char* path = getenv(env);
+  if (path == NULL)
+    path = default_path;
+
+  f->mem = malloc(f->size);
+  memset(f->mem, 0xFF, f->size);
+
+  f->erase_counts = calloc(f->num_blocks, sizeof(uint32_t));
+
+  flash_load(f, path);
+
+  if (flashes[0] == NULL)
+    flashes[0] = f;
+  else
+    flashes[1] = f;
+}
+
+bool
+sim_flash_in_range(const sim_flash_t* f, uint32_t offset, uint32_t len)
+{
+  return (offset <= f->size) && (len <= f->size - offset);
+}
+
+static void
+flash_sync(sim_flash_t* f, uint32_t offset, uint32_t len)
+{
+  uint8_t buf[256];
+
+  if (f->file == NULL)
+    return;
+
+  fseek(f->file, offset, SEEK_SET);
+  while (len > 0) {
+    uint32_t n = MIN(len, sizeof(buf));
+    uint32_t i;
+
+    for (i = 0; i < n; ++i)
+      buf[i] = ~f->mem[offset + i];
+    fwrite(buf, 1, n, f->file);
+
+    offset += n;
+    len -= n;
+  }
+  fflush(f->file);
+}
+
+void
+sim_flash_busy(sim_flash_t* f, sim_flash_op_t op, uint32_t us)
+{
+  f->ops[op].count++;
+  f->ops[op].total_us += us;
+  if (us > f->ops[op].max_us)
+    f->ops[op].max_us = us;
+}
+
+void
+sim_flash_program(sim_flash_t* f, uint32_t offset, const uint8_t* buf, uint32_t len)
+{
+  uint32_t i;
+
+  for (i = 0; i < len; ++i)
+    f->mem[offset + i] &= buf[i];
+
+  flash_sync(f, offset, len);
+}
+
+void
+sim_flash_erase(sim_flash_t* f, uint32_t offset, uint32_t len)
+{
+  uint32_t block;
+
+  memset(f->mem + offset, 0xFF, len);
+  flash_sync(f, offset, len);
+
+  for (block = offset / f->block_size;
+       block < (offset + len) / f->block_size;
+       ++block)
+    f->erase_counts[block]++;
+}
+
+void
+sim_flash_read(sim_flash_t* f, uint32_t offset, uint8_t* buf, uint32_t len)
+{
+  memcpy(buf, f->mem + offset, len);
+}
+
+static void
+flash_report(const sim_flash_t* f)
+{
+  static const char* op_names[NUM_SIM_FLASH_OPS] = {
+      [SIM_FLASH_READ] = "read",
+      [SIM_FLASH_PROGRAM] = "program",
+      [SIM_FLASH_ERASE] = "erase",
+  };
+  uint64_t busy_us = 0;
+  uint32_t total_erases = 0;
+  uint32_t max_erases = 0;
+  uint32_t max_block = 0;
+  uint32_t worn_blocks = 0;
+  int op;
+  uint32_t block;
+
+  for (op = 0; op < NUM_SIM_FLASH_OPS; ++op) {
+    const sim_flash_op_stats_t* s = &f->ops[op];
+    busy_us += s->total_us;
+    printf("%s %-8s count %u total %llu us max %u us\r\n",
+        f->name, op_names[op], (unsigned)s->count,
+        (unsigned long long)s->total_us, (unsigned)s->max_us);
+  }
+
+  for (block = 0; block < f->num_blocks; ++block) {
+    uint32_t n = f->erase_counts[block];
+
+    total_erases += n;
+    if (n > 0)
+      worn_blocks++;
+    if (n > max_erases) {
+      max_erases = n;
+      max_block = block;
+    }
+  }
+
+  printf("%s busy %llu us, %u erases over %u of %u blocks, most %u at 0x%08X\r\n",
+      f->name, (unsigned long long)busy_us, (unsigned)total_erases,
+      (unsigned)worn_blocks, (unsigned)f->num_blocks, (unsigned)max_erases,
+      (unsigned)(f->base + (max_block * f->block_size)));
+}
+
+void
+sim_flash_report()
+{
+  int i;
+
+  for (i = 0; i < 2; ++i) {
+    if (flashes[i] != NULL)
+      flash_report(flashes[i]);
+  }
+}
+
+void
+sim_flash_reset_stats()
+{
+  int i;
+
+  for (i = 0; i < 2; ++i) {
+    sim_flash_t* f = flashes[i];
+    if (f == NULL)
+      continue;
+
+    memset(f->ops, 0, sizeof(f->ops));
+    memset(f->erase_counts, 0, f->num_blocks * sizeof(uint32_t));
+  }
+}
@@ -0,0 +1,16 @@
+#ifndef _SIM_HALCONF_H_
+#define _SIM_HALCONF_H_
+
+/*
+ * Simulator HAL configuration. Only PAL and SERIAL have Posix drivers, the
+ * peripherals behind the other drivers are modelled in src/app_mt/sim.
+ */
+#define HAL_USE_ADC                 FALSE
+#define HAL_USE_EXT                 FALSE
+#define HAL_USE_PWM                 FALSE
+#define HAL_USE_SPI                 FALSE
+#define HAL_USE_IWDG                FALSE
+
+#include "../halconf.h"
+
+#endif /* _SIM_HALCONF_H_ */
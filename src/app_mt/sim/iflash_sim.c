@@ -0,0 +1,209 @@
+
+#include "ch.h"
+#include "hal.h"
+
+#include "iflash.h"
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Host model of the STM32F2 internal flash. The 1 MB array lives in a
+ * sparse file next to the executable (SIM_IFLASH overrides the name) and
+ * keeps the target addresses, so DFU images are written to 0x08000000 and
+ * up.
+ *
+ * Programming is done a word at a time, as on the target with x32
+ * parallelism, and can only clear bits. Each word and each sector erase is
+ * charged the time below, which SIM_IFLASH_TIMING can override with
+ * "<word us> <16K erase us> <64K erase us> <128K erase us>".
+ */
+
+#define FLASH_BASE      0x08000000
+#define FLASH_SIZE      (1024 * 1024)
+#define IFLASH_FILE     "iflash.img"
+
+// Every sector size is a multiple of this, so erases are counted in it
+#define WEAR_BLOCK_SIZE (16 * 1024)
+
+
+typedef struct {
+  uint32_t word_program_us;
+  uint32_t erase_16k_us;
+  uint32_t erase_64k_us;
+  uint32_t erase_128k_us;
+} iflash_timing_t;
+
+
+static sim_flash_t flash = {
+    .name = "iflash",
+    .base = FLASH_BASE,
+    .size = FLASH_SIZE,
+    .block_size = WEAR_BLOCK_SIZE,
+    .num_blocks = FLASH_SIZE / WEAR_BLOCK_SIZE,
+};
+
+// Typical x32 times from the datasheet
+static iflash_timing_t timing = {
+    .word_program_us = 16,
+    .erase_16k_us = 250000,
+    .erase_64k_us = 550000,
+    .erase_128k_us = 1100000,
+};
+
+
+static uint8_t*
+iflash_ptr(uint32_t address, uint32_t size)
+{
+  if (flash.mem == NULL) {
+    const char* t = getenv("SIM_IFLASH_TIMING");
+    if (t != NULL &&
+        sscanf(t, "%u %u %u %u", &timing.word_program_us, &timing.erase_16k_us,
+            &timing.erase_64k_us, &timing.erase_128k_us) != 4)
+      printf("iflash: bad timing '%s'\r\n", t);
+
+    sim_flash_init(&flash, "SIM_IFLASH", IFLASH_FILE);
+  }
+
+  if ((address < FLASH_BASE) ||
+      (address - FLASH_BASE) > FLASH_SIZE ||
+      size > FLASH_SIZE - (address - FLASH_BASE))
+    return NULL;
+
+  return flash.mem + (address - FLASH_BASE);
+}
+
+uint32_t
+iflash_sector_size(flashsector_t sector)
+{
+    if (sector <= 3)
+        return 16 * 1024;
+    else if (sector == 4)
+        return 64 * 1024;
+    else if (sector >= 5 && sector <= 11)
+        return 128 * 1024;
+    return 0;
+}
+
+uint32_t
+iflash_sector_begin(flashsector_t sector)
+{
+    uint32_t address = FLASH_BASE;
+    while (sector > 0)
+    {
+        --sector;
+        address += iflash_sector_size(sector);
+    }
+    return address;
+}
+
+uint32_t
+iflash_sector_end(flashsector_t sector)
+{
+    return iflash_sector_begin(sector + 1);
+}
+
+flashsector_t
+iflash_sector_at(uint32_t address)
+{
+    flashsector_t sector = 0;
+    while (address >= iflash_sector_end(sector))
+        ++sector;
+    return sector;
+}
+
+int
+iflash_sector_erase(flashsector_t sector)
+{
+  uint32_t address = iflash_sector_begin(sector);
+  uint32_t size = iflash_sector_size(sector);
+  uint8_t* p = iflash_ptr(address, size);
+
+  if (p == NULL || size == 0)
+    return FLASH_RETURN_BAD_FLASH;
+
+  sim_flash_erase(&flash, address - FLASH_BASE, size);
+  if (size == 16 * 1024)
+    sim_flash_busy(&flash, SIM_FLASH_ERASE, timing.erase_16k_us);
+  else if (size == 64 * 1024)
+    sim_flash_busy(&flash, SIM_FLASH_ERASE, timing.erase_64k_us);
+  else
+    sim_flash_busy(&flash, SIM_FLASH_ERASE, timing.erase_128k_us);
+
+  return FLASH_RETURN_SUCCESS;
+}
+
+int
+iflash_erase(uint32_t address, uint32_t s)
+{
+  int32_t size = s;
+  while (size > 0) {
+    flashsector_t sector = iflash_sector_at(address);
+    int err = iflash_sector_erase(sector);
+    if (err != FLASH_RETURN_SUCCESS)
+      return err;
+    address = iflash_sector_end(sector);
+    size -= iflash_sector_size(sector);
+  }
+
+  return FLASH_RETURN_SUCCESS;
+}
+
+bool_t
+iflash_is_erased(uint32_t address, uint32_t size)
+{
+  uint8_t* p = iflash_ptr(address, size);
+
+  if (p == NULL)
+    return FALSE;
+
+  while (size-- > 0) {
+    if (*p++ != 0xFF)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+bool_t
+iflash_compare(uint32_t address, const uint8_t* buffer, uint32_t size)
+{
+  uint8_t* p = iflash_ptr(address, size);
+
+  if (p == NULL)
+    return FALSE;
+
+  return memcmp(p, buffer, size) == 0;
+}
+
+int
+iflash_read(uint32_t address, uint8_t* buffer, uint32_t size)
+{
+  uint8_t* p = iflash_ptr(address, size);
+
+  if (p == NULL)
+    return FLASH_RETURN_BAD_FLASH;
+
+  sim_flash_read(&flash, address - FLASH_BASE, buffer, size);
+  return FLASH_RETURN_SUCCESS;
+}
+
+int
+iflash_write(uint32_t address, const uint8_t* buffer, uint32_t size)
+{
+  uint8_t* p = iflash_ptr(address, size);
+
+  if (p == NULL)
+    return FLASH_RETURN_BAD_FLASH;
+
+  sim_flash_program(&flash, address - FLASH_BASE, buffer, size);
+
+  // one program per word touched, including partial words at either end
+  uint32_t words = ((address + size + 3) / 4) - (address / 4);
+  while (words-- > 0)
+    sim_flash_busy(&flash, SIM_FLASH_PROGRAM, timing.word_program_us);
+
+  return FLASH_RETURN_SUCCESS;
+}
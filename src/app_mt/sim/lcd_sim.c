@@ -0,0 +1,111 @@
+
+#include "ch.h"
+#include "hal.h"
+
+#include "lcd.h"
+#include "sim.h"
+
+#include <stdio.h>
+
+
+/* Host model of the TFT controller. Pixels land in a display-oriented
+ * RGB565 framebuffer that can be dumped as a PPM screenshot.
+ */
+
+const rect_t display_rect = {
+    .x = 0,
+    .y = 0,
+    .width = DISP_WIDTH,
+    .height = DISP_HEIGHT
+};
+
+static uint16_t framebuffer[DISP_HEIGHT][DISP_WIDTH];
+static uint16_t win_x1, win_y1, win_x2, win_y2;
+static uint16_t cur_x, cur_y;
+static uint8_t brightness = 100;
+
+
+void
+lcd_init()
+{
+  lcd_clr_cursor();
+}
+
+void
+lcd_write(uint16_t val)
+{
+  lcd_write_data(val);
+}
+
+void
+lcd_write_cmd(uint8_t cmd)
+{
+  (void)cmd;
+}
+
+void
+lcd_write_data(uint16_t val)
+{
+  if (cur_x < DISP_WIDTH && cur_y < DISP_HEIGHT)
+    framebuffer[cur_y][cur_x] = val;
+
+  if (++cur_x > win_x2) {
+    cur_x = win_x1;
+    if (++cur_y > win_y2)
+      cur_y = win_y1;
+  }
+}
+
+void
+lcd_write_param(uint8_t cmd, uint16_t val)
+{
+  (void)cmd;
+  (void)val;
+}
+
+void
+lcd_set_cursor(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
+{
+  win_x1 = cur_x = x1;
+  win_y1 = cur_y = y1;
+  win_x2 = x2;
+  win_y2 = y2;
+}
+
+void
+lcd_clr_cursor()
+{
+  lcd_set_cursor(0, 0, DISP_WIDTH - 1, DISP_HEIGHT - 1);
+}
+
+void
+lcd_set_brightness(uint8_t percent)
+{
+  brightness = percent;
+}
+
+bool
+sim_lcd_screenshot(const char* path)
+{
+  FILE* f = fopen(path, "wb");
+  int x, y;
+
+  if (f == NULL)
+    return false;
+
+  fprintf(f, "P6\n%d %d\n255\n", DISP_WIDTH, DISP_HEIGHT);
+  for (y = 0; y < DISP_HEIGHT; ++y) {
+    for (x = 0; x < DISP_WIDTH; ++x) {
+      uint16_t c = (brightness > 0) ? framebuffer[y][x] : 0;
+      uint8_t rgb[3] = {
+          ((c >> 11) & 0x1F) << 3,
+          ((c >> 5) & 0x3F) << 2,
+          (c & 0x1F) << 3
+      };
+      fwrite(rgb, 1, sizeof(rgb), f);
+    }
+  }
+
+  fclose(f);
+  return true;
+}
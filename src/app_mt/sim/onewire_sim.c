@@ -0,0 +1,450 @@
+
+#include "ch.h"
+#include "hal.h"
+
+#include "onewire.h"
+#include "sim.h"
+#include "crc/crc8.h"
+
+#include <string.h>
+
+
+/* Host model of the 1-Wire buses. Each bus carries up to
+ * SIM_MAX_PROBES_PER_BUS DS18B20s that are modelled one time slot at a time,
+ * with the line being the wired-AND of the master and every device, so
+ * ROM addressing, search and collisions behave as they do on the wire.
+ */
+
+#define NUM_BUSES 2
+
+#define CONVERT_T         0x44
+#define READ_SCRATCHPAD   0xBE
+#define WRITE_SCRATCHPAD  0x4E
+#define COPY_SCRATCHPAD   0x48
+#define RECALL_E2         0xB8
+#define READ_POWER_SUPPLY 0xB4
+
+typedef enum {
+  DEV_IDLE,
+  DEV_ROM_CMD,
+  DEV_MATCH_ROM,
+  DEV_SEARCH_ROM,
+  DEV_FUNC_CMD,
+  DEV_TX,
+  DEV_RX,
+  DEV_READ_SLOTS
+} dev_phase_t;
+
+typedef struct {
+  bool present;
+  float temp;
+  uint8_t rom[8];
+  uint8_t scratchpad[9];
+
+  dev_phase_t phase;
+  uint8_t shift_reg;
+  uint16_t bit_idx;
+  uint8_t search_step;
+  uint8_t buf[9];
+  uint8_t buf_len;
+  bool converting;
+  systime_t conv_end;
+} sim_ds18b20_t;
+
+typedef struct {
+  sim_ds18b20_t devs[SIM_MAX_PROBES_PER_BUS];
+} sim_bus_t;
+
+
+struct onewire_bus_s {
+  uint8_t idx;
+};
+
+onewire_bus_t OWD1 = { .idx = 0 };
+onewire_bus_t OWD2 = { .idx = 1 };
+
+static sim_bus_t buses[NUM_BUSES];
+
+
+static sim_bus_t*
+get_bus(onewire_bus_t* ob)
+{
+  return &buses[ob->idx];
+}
+
+static systime_t
+conversion_time(const sim_ds18b20_t* dev)
+{
+  uint8_t res = (dev->scratchpad[4] >> 5) & 0x3;
+  return MS2ST(750 >> (3 - res));
+}
+
+static void
+latch_temp(sim_ds18b20_t* dev)
+{
+  uint8_t res = (dev->scratchpad[4] >> 5) & 0x3;
+  float t = dev->temp * 16;
+  int16_t raw = (int16_t)(t < 0 ? t - 0.5f : t + 0.5f);
+
+  raw &= ~((1 << (3 - res)) - 1);
+  dev->scratchpad[0] = raw & 0xFF;
+  dev->scratchpad[1] = (raw >> 8) & 0xFF;
+  dev->scratchpad[8] = crc8_block(0, dev->scratchpad, 8);
+}
+
+/* Completes a conversion once its time has elapsed. Conversions run
+ * independently of the bus, so this is checked whenever the device is
+ * touched rather than from a timer.
+ */
+static void
+dev_update(sim_ds18b20_t* dev)
+{
+  if (dev->converting && (int32_t)(chTimeNow() - dev->conv_end) >= 0) {
+    latch_temp(dev);
+    dev->converting = false;
+  }
+}
+
+static void
+dev_init(sim_ds18b20_t* dev, uint8_t bus_idx, uint8_t dev_idx)
+{
+  static const uint8_t default_scratchpad[8] = {
+      0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10
+  };
+
+  dev->present = (dev_idx == 0);
+  dev->temp = 20.0f;
+
+  dev->rom[0] = 0x28;
+  dev->rom[1] = 0x51 + dev_idx;
+  dev->rom[2] = 0x4D + bus_idx;
+  dev->rom[3] = 0x54;
+  dev->rom[4] = 0x00;
+  dev->rom[5] = 0x00;
+  dev->rom[6] = 0x00;
+  dev->rom[7] = crc8_block(0, dev->rom, 7);
+
+  memcpy(dev->scratchpad, default_scratchpad, sizeof(default_scratchpad));
+  dev->scratchpad[8] = crc8_block(0, dev->scratchpad, 8);
+
+  dev->phase = DEV_IDLE;
+}
+
+static void
+dev_start_tx(sim_ds18b20_t* dev, const uint8_t* data, uint8_t len)
+{
+  memcpy(dev->buf, data, len);
+  dev->buf_len = len;
+  dev->bit_idx = 0;
+  dev->phase = DEV_TX;
+}
+
+static void
+dev_rom_cmd(sim_ds18b20_t* dev, uint8_t cmd)
+{
+  dev->bit_idx = 0;
+  dev->search_step = 0;
+
+  switch (cmd) {
+  case READ_ROM:
+    dev_start_tx(dev, dev->rom, sizeof(dev->rom));
+    break;
+
+  case SKIP_ROM:
+    dev->phase = DEV_FUNC_CMD;
+    break;
+
+  case MATCH_ROM:
+    dev->phase = DEV_MATCH_ROM;
+    break;
+
+  case SEARCH_ROM:
+    dev->phase = DEV_SEARCH_ROM;
+    break;
+
+  default:
+    dev->phase = DEV_IDLE;
+    break;
+  }
+}
+
+static void
+dev_func_cmd(sim_ds18b20_t* dev, uint8_t cmd)
+{
+  dev->bit_idx = 0;
+
+  switch (cmd) {
+  case CONVERT_T:
+    dev->conv_end = chTimeNow() + conversion_time(dev);
+    dev->converting = true;
+    dev->phase = DEV_READ_SLOTS;
+    break;
+
+  case READ_SCRATCHPAD:
+    dev_start_tx(dev, dev->scratchpad, sizeof(dev->scratchpad));
+    break;
+
+  case WRITE_SCRATCHPAD:
+    dev->buf_len = 0;
+    dev->phase = DEV_RX;
+    break;
+
+  case READ_POWER_SUPPLY: /* Externally powered, idle read slots return ones */
+  case COPY_SCRATCHPAD:
+  case RECALL_E2:
+  default:
+    dev->phase = DEV_IDLE;
+    break;
+  }
+}
+
+/* Returns the level the device drives in the current slot, 1 if released */
+static uint8_t
+dev_drive(sim_ds18b20_t* dev)
+{
+  switch (dev->phase) {
+  case DEV_TX:
+    return (dev->buf[dev->bit_idx / 8] >> (dev->bit_idx % 8)) & 1;
+
+  case DEV_SEARCH_ROM:
+    if (dev->search_step < 2) {
+      uint8_t b = (dev->rom[dev->bit_idx / 8] >> (dev->bit_idx % 8)) & 1;
+      return (dev->search_step == 0) ? b : !b;
+    }
+    return 1;
+
+  case DEV_READ_SLOTS:
+    /* Read slots after CONVERT_T return 0 until the conversion is done */
+    return dev->converting ? 0 : 1;
+
+  default:
+    return 1;
+  }
+}
+
+/* Lets the device sample the line at the end of the current slot */
+static void
+dev_sample(sim_ds18b20_t* dev, uint8_t line)
+{
+  uint8_t rom_bit;
+
+  switch (dev->phase) {
+  case DEV_ROM_CMD:
+  case DEV_FUNC_CMD:
+    dev->shift_reg = (dev->shift_reg >> 1) | (line << 7);
+    if (++dev->bit_idx == 8) {
+      if (dev->phase == DEV_ROM_CMD)
+        dev_rom_cmd(dev, dev->shift_reg);
+      else
+        dev_func_cmd(dev, dev->shift_reg);
+    }
+    break;
+
+  case DEV_MATCH_ROM:
+    rom_bit = (dev->rom[dev->bit_idx / 8] >> (dev->bit_idx % 8)) & 1;
+    if (line != rom_bit)
+      dev->phase = DEV_IDLE;
+    else if (++dev->bit_idx == 64) {
+      dev->bit_idx = 0;
+      dev->phase = DEV_FUNC_CMD;
+    }
+    break;
+
+  case DEV_SEARCH_ROM:
+    if (++dev->search_step < 3)
+      break;
+
+    rom_bit = (dev->rom[dev->bit_idx / 8] >> (dev->bit_idx % 8)) & 1;
+    dev->search_step = 0;
+    if (line != rom_bit)
+      dev->phase = DEV_IDLE;
+    else if (++dev->bit_idx == 64) {
+      dev->bit_idx = 0;
+      dev->phase = DEV_FUNC_CMD;
+    }
+    break;
+
+  case DEV_TX:
+    if (++dev->bit_idx == (dev->buf_len * 8))
+      dev->phase = DEV_IDLE;
+    break;
+
+  case DEV_RX:
+    dev->shift_reg = (dev->shift_reg >> 1) | (line << 7);
+    if ((++dev->bit_idx % 8) == 0) {
+      dev->buf[dev->buf_len++] = dev->shift_reg;
+      if (dev->buf_len == 3) {
+        /* TH, TL and config land in bytes 2..4, unused config bits read 1 */
+        dev->scratchpad[2] = dev->buf[0];
+        dev->scratchpad[3] = dev->buf[1];
+        dev->scratchpad[4] = (dev->buf[2] & 0x60) | 0x1F;
+        dev->scratchpad[8] = crc8_block(0, dev->scratchpad, 8);
+        dev->phase = DEV_IDLE;
+      }
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+static uint8_t
+bus_slot(onewire_bus_t* ob, uint8_t master_bit)
+{
+  sim_bus_t* bus = get_bus(ob);
+  uint8_t line = master_bit;
+  int i;
+
+  chSysLock();
+
+  for (i = 0; i < SIM_MAX_PROBES_PER_BUS; ++i) {
+    if (bus->devs[i].present) {
+      dev_update(&bus->devs[i]);
+      line &= dev_drive(&bus->devs[i]);
+    }
+  }
+
+  for (i = 0; i < SIM_MAX_PROBES_PER_BUS; ++i) {
+    if (bus->devs[i].present)
+      dev_sample(&bus->devs[i], line);
+  }
+
+  chSysUnlock();
+
+  return line;
+}
+
+void
+onewire_init(onewire_bus_t* ob)
+{
+  sim_bus_t* bus = get_bus(ob);
+  int i;
+
+  for (i = 0; i < SIM_MAX_PROBES_PER_BUS; ++i)
+    dev_init(&bus->devs[i], ob->idx, i);
+}
+
+bool
+onewire_transaction(onewire_bus_t* ob, bool reset,
+    const uint8_t* tx, uint8_t tx_len, uint8_t* rx, uint8_t rx_len)
+{
+  int i;
+
+  if (tx_len + rx_len > ONEWIRE_MAX_TRANSACTION)
+    return false;
+
+  if (reset && !onewire_reset(ob))
+    return false;
+
+  for (i = 0; i < tx_len; ++i)
+    onewire_send_byte(ob, tx[i]);
+
+  for (i = 0; i < rx_len; ++i)
+    onewire_recv_byte(ob, &rx[i]);
+
+  return true;
+}
+
+bool
+onewire_reset(onewire_bus_t* ob)
+{
+  sim_bus_t* bus = get_bus(ob);
+  bool presence = false;
+  int i;
+
+  chSysLock();
+  for (i = 0; i < SIM_MAX_PROBES_PER_BUS; ++i) {
+    sim_ds18b20_t* dev = &bus->devs[i];
+    if (!dev->present)
+      continue;
+
+    /* A reset aborts everything but a conversion already in progress */
+    dev_update(dev);
+    dev->phase = DEV_ROM_CMD;
+    dev->bit_idx = 0;
+    presence = true;
+  }
+  chSysUnlock();
+
+  return presence;
+}
+
+bool
+onewire_read_rom(onewire_bus_t* ob, uint8_t* addr)
+{
+  int i;
+
+  if (!onewire_reset(ob))
+    return false;
+
+  if (!onewire_send_byte(ob, READ_ROM))
+    return false;
+
+  for (i = 0; i < 8; ++i) {
+    if (!onewire_recv_byte(ob, &addr[i]))
+      return false;
+  }
+
+  return true;
+}
+
+bool
+onewire_send_bit(onewire_bus_t* ob, uint8_t b)
+{
+  bus_slot(ob, b & 1);
+  return true;
+}
+
+bool
+onewire_recv_bit(onewire_bus_t* ob, uint8_t* b)
+{
+  *b = bus_slot(ob, 1);
+  return true;
+}
+
+bool
+onewire_send_byte(onewire_bus_t* ob, uint8_t b)
+{
+  int i;
+
+  for (i = 0; i < 8; ++i)
+    bus_slot(ob, (b >> i) & 1);
+
+  return true;
+}
+
+bool
+onewire_recv_byte(onewire_bus_t* ob, uint8_t* b)
+{
+  int i;
+
+  *b = 0;
+  for (i = 0; i < 8; ++i)
+    *b |= bus_slot(ob, 1) << i;
+
+  return true;
+}
+
+void
+sim_onewire_set_present(onewire_bus_t* ob, uint8_t idx, bool present)
+{
+  if (idx >= SIM_MAX_PROBES_PER_BUS)
+    return;
+
+  chSysLock();
+  get_bus(ob)->devs[idx].present = present;
+  get_bus(ob)->devs[idx].phase = DEV_IDLE;
+  chSysUnlock();
+}
+
+void
+sim_onewire_set_temp(onewire_bus_t* ob, uint8_t idx, float temp)
+{
+  if (idx >= SIM_MAX_PROBES_PER_BUS)
+    return;
+
+  chSysLock();
+  get_bus(ob)->devs[idx].temp = temp;
+  chSysUnlock();
+}
@@ -0,0 +1,88 @@
+#ifndef PID_ENGINE_H
+#define PID_ENGINE_H
+
+/* Builds pid.c into the including file with its functions renamed by
+ * PID_ENGINE(), which must be defined along with PID_FIXED_POINT before this
+ * is included. The controller reads the time from sim_pid_now rather than
+ * the system clock, so a trace runs as fast as the host allows and gives
+ * the same result every time.
+ */
+
+#include "ch.h"
+#include "hal.h"
+#include "sim.h"
+
+#include <string.h>
+
+#undef chTimeNow
+#define chTimeNow() sim_pid_now
+
+#define pid_init              PID_ENGINE(init)
+#define pid_exec              PID_ENGINE(exec)
+#define pid_set_gains         PID_ENGINE(set_gains)
+#define tune_gains            PID_ENGINE(tune_gains)
+#define pid_enable            PID_ENGINE(enable)
+#define pid_reinit            PID_ENGINE(reinit)
+#define pid_set_output_sign   PID_ENGINE(set_output_sign)
+#define pid_set_output_limits PID_ENGINE(set_output_limits)
+
+#include "pid.c"
+
+/* Runs the controller over a trace of samples, set up as temp_control does
+ * for a PID output, and stores its output after each sample.
+ */
+void
+PID_ENGINE(run)(const sim_pid_trace_t* trace, float* outputs)
+{
+  pid_controller_t pid;
+  uint32_t i;
+
+  memset(&pid, 0, sizeof(pid));
+
+  sim_pid_now = 0;
+  pid_init(&pid);
+  pid_set_output_limits(&pid, -20, 20);
+  pid_set_output_sign(&pid, trace->cooling ? NEGATIVE : POSITIVE);
+  pid_enable(&pid, trace->samples[0], true);
+
+  for (i = 0; i < trace->num_samples; ++i) {
+    sim_pid_now += pid.sample_time;
+    pid_exec(&pid, trace->setpoint, trace->samples[i]);
+    outputs[i] = PID_VAL_FLOAT(pid.out);
+  }
+}
+
+/* Runs the trace the given number of times and returns the realtime counter
+ * ticks spent in the pid_exec() loop, leaving out the set up of each run.
+ */
+uint64_t
+PID_ENGINE(time)(const sim_pid_trace_t* trace, uint32_t runs)
+{
+  pid_controller_t pid;
+  uint64_t ticks = 0;
+  uint32_t run;
+  uint32_t i;
+
+  for (run = 0; run < runs; ++run) {
+    halrtcnt_t start;
+
+    memset(&pid, 0, sizeof(pid));
+    sim_pid_now = 0;
+    pid_init(&pid);
+    pid_set_output_limits(&pid, -20, 20);
+    pid_set_output_sign(&pid, trace->cooling ? NEGATIVE : POSITIVE);
+    pid_enable(&pid, trace->samples[0], true);
+
+    // one run is short enough that the counter can't wrap twice
+    start = halGetCounterValue();
+    for (i = 0; i < trace->num_samples; ++i) {
+      sim_pid_now += pid.sample_time;
+      pid_exec(&pid, trace->setpoint, trace->samples[i]);
+    }
+    ticks += (halrtcnt_t)(halGetCounterValue() - start);
+  }
+
+  return ticks;
+}
+
+#endif
@@ -0,0 +1,5 @@
+/* The PID controller built in fixed point, as on the target */
+#define PID_FIXED_POINT TRUE
+#define PID_ENGINE(name) sim_pid_fixed_##name
+
+#include "pid_engine.h"
@@ -0,0 +1,7 @@
+/* The PID controller built with floats, to check the fixed point build
+ * against.
+ */
+#define PID_FIXED_POINT FALSE
+#define PID_ENGINE(name) sim_pid_float_##name
+
+#include "pid_engine.h"
@@ -0,0 +1,164 @@
+
+#include "ch.h"
+#include "hal.h"
+
+#include "sim.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/* Each trace is 2000 samples, a little over a day at the 2s sample time */
+#define TRACE_LEN 2000
+
+/* Largest difference allowed between the float and fixed point outputs,
+ * which run from -20 to 20
+ */
+#define MAX_OUTPUT_DIFF 0.05f
+
+// times each trace is run through each build for timing
+#define TIMING_RUNS 50
+
+#define PI 3.14159265f
+
+
+systime_t sim_pid_now;
+
+
+static float
+quantize(float temp)
+{
+  // DS18B20 at 12 bits
+  return floorf((temp * 16) + 0.5f) / 16;
+}
+
+/* Warming from 15 towards a 20 setpoint */
+static void
+gen_heat_step(float* samples)
+{
+  int i;
+  for (i = 0; i < TRACE_LEN; ++i)
+    samples[i] = quantize(20 - (5 * expf(-i / 300.0f)));
+}
+
+/* Swinging 2 degrees either side of a 4 degree setpoint */
+static void
+gen_cool_swing(float* samples)
+{
+  int i;
+  for (i = 0; i < TRACE_LEN; ++i)
+    samples[i] = quantize(4 + (2 * sinf((2 * PI * i) / 500)));
+}
+
+/* Noise of up to 0.3 degrees on a reading sitting at the setpoint */
+static void
+gen_noise(float* samples)
+{
+  uint32_t seed = 1;
+  int i;
+  for (i = 0; i < TRACE_LEN; ++i) {
+    seed = (seed * 1103515245) + 12345;
+    samples[i] = quantize(18 + ((((seed >> 16) & 0x7FFF) / 32767.0f) - 0.5f) * 0.6f);
+  }
+}
+
+static const struct {
+  const char* name;
+  void (*gen)(float* samples);
+  float setpoint;
+  bool cooling;
+} traces[] = {
+  { "heat step",  gen_heat_step,  20, false },
+  { "cool swing", gen_cool_swing, 4,  true },
+  { "noise",      gen_noise,      18, false },
+};
+
+/* Runs pid_exec() built with floats and in fixed point over the same
+ * traces, with temp_control's -20 to 20 output limits, and checks that the
+ * outputs stay close.
+ */
+bool
+sim_test_pid_fixed_point()
+{
+  float* samples = malloc(TRACE_LEN * sizeof(float));
+  float* float_out = malloc(TRACE_LEN * sizeof(float));
+  float* fixed_out = malloc(TRACE_LEN * sizeof(float));
+  bool pass = true;
+  uint32_t t;
+
+  for (t = 0; t < sizeof(traces) / sizeof(traces[0]); ++t) {
+    sim_pid_trace_t trace = {
+        .samples = samples,
+        .num_samples = TRACE_LEN,
+        .setpoint = traces[t].setpoint,
+        .cooling = traces[t].cooling
+    };
+    float max_diff = 0;
+    uint32_t i;
+
+    traces[t].gen(samples);
+    sim_pid_float_run(&trace, float_out);
+    sim_pid_fixed_run(&trace, fixed_out);
+
+    for (i = 0; i < TRACE_LEN; ++i) {
+      float diff = fabsf(float_out[i] - fixed_out[i]);
+      if (diff > max_diff)
+        max_diff = diff;
+    }
+
+    printf("  %s: max output difference %.4f\r\n", traces[t].name, max_diff);
+    if (max_diff > MAX_OUTPUT_DIFF)
+      pass = false;
+  }
+
+  free(samples);
+  free(float_out);
+  free(fixed_out);
+
+  return pass;
+}
+
+/* Prints the realtime counter ticks per pid_exec() call for the float and
+ * fixed point builds over the test traces. On the target the counter runs
+ * at the core clock, so these are cycles per call. In the simulator they are
+ * ticks of the host's counter and the float build runs on the host's FPU, so
+ * they do not show the soft-float cost the target pays.
+ */
+void
+sim_bench_pid_exec()
+{
+  float* samples = malloc(TRACE_LEN * sizeof(float));
+  uint32_t calls = TIMING_RUNS * TRACE_LEN;
+  uint32_t t;
+
+  if (halGetCounterFrequency() == 0) {
+    printf("  no realtime counter\r\n");
+    free(samples);
+    return;
+  }
+
+  printf("  counter at %u Hz, ticks per call\r\n", (unsigned)halGetCounterFrequency());
+  printf("  %-12s %10s %10s %8s\r\n", "trace", "float", "fixed", "speedup");
+
+  for (t = 0; t < sizeof(traces) / sizeof(traces[0]); ++t) {
+    sim_pid_trace_t trace = {
+        .samples = samples,
+        .num_samples = TRACE_LEN,
+        .setpoint = traces[t].setpoint,
+        .cooling = traces[t].cooling
+    };
+    double float_ticks;
+    double fixed_ticks;
+
+    traces[t].gen(samples);
+    float_ticks = (double)sim_pid_float_time(&trace, TIMING_RUNS) / calls;
+    fixed_ticks = (double)sim_pid_fixed_time(&trace, TIMING_RUNS) / calls;
+
+    printf("  %-12s %10.1f %10.1f %7.2fx\r\n", traces[t].name,
+        float_ticks, fixed_ticks,
+        (fixed_ticks > 0) ? (float_ticks / fixed_ticks) : 0.0);
+  }
+
+  free(samples);
+}
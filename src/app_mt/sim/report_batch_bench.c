@@ -0,0 +1,159 @@
+
+#include "sim.h"
+#include "report_batch.h"
+#include "backlog.h"
+#include "bbmt.pb.h"
+
+#include <pb_encode.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* A day of 30 s sensor reports */
+#define TRACE_LEN 2880
+
+#define BASE_TIME 1700000000
+
+
+/* Both controllers as send_sensor_report() fills them in: a fermenter
+ * drifting around its setpoint in 1/16 C steps, with the cooling output
+ * cycling and constant PID terms if they are reported
+ */
+static void
+gen_report(uint32_t i, uint8_t controller, bool pid, report_sample_t* sample)
+{
+  float t = (i * 0.02f) + (controller * 1.3f);
+  int out;
+
+  memset(sample, 0, sizeof(report_sample_t));
+  sample->timestamp = BASE_TIME + (i * 30);
+  sample->controller = controller;
+  sample->has_pid = pid;
+  sample->setpoint = 65 + (controller * 3);
+  sample->sensor_reading = floorf(((sample->setpoint + sinf(t)) * 16) + 0.5f) / 16;
+
+  for (out = 0; out < NUM_OUTPUTS; ++out) {
+    report_output_t* o = &sample->outputs[out];
+
+    o->present = true;
+    o->status = (out == OUTPUT_1) && (sinf(t) > 0.5f);
+    if (pid) {
+      o->kp = 12.5f;
+      o->ki = 0.25f;
+      o->kd = 3.75f + out;
+    }
+  }
+}
+
+static void
+sample_to_pb(const report_sample_t* sample, ControllerReport* pr)
+{
+  int i;
+
+  pr->controller_index = sample->controller;
+  pr->sensor_reading = sample->sensor_reading;
+  pr->setpoint = sample->setpoint;
+  pr->has_timestamp = true;
+  pr->timestamp = sample->timestamp;
+
+  for (i = 0; i < NUM_OUTPUTS; ++i) {
+    ControllerReport_OutputStatus* os = &pr->output_status[pr->output_status_count++];
+
+    os->output_index = i;
+    os->has_output_index = true;
+    os->status = sample->outputs[i].status;
+    os->has_status = true;
+    if (sample->has_pid) {
+      os->kp = sample->outputs[i].kp;
+      os->has_kp = true;
+      os->ki = sample->outputs[i].ki;
+      os->has_ki = true;
+      os->kd = sample->outputs[i].kd;
+      os->has_kd = true;
+    }
+  }
+}
+
+/* Length of a report as a length prefixed message, as send_api_msg() puts
+ * it on the wire and as it used to be stored in the backlog
+ */
+static uint32_t
+msg_len(const report_sample_t* samples, uint32_t num_samples, uint8_t* buf)
+{
+  ApiMessage* msg = calloc(1, sizeof(ApiMessage));
+  uint32_t i;
+
+  msg->type = ApiMessage_Type_DEVICE_REPORT;
+  msg->has_deviceReport = true;
+  for (i = 0; i < num_samples; ++i)
+    sample_to_pb(&samples[i], &msg->deviceReport.controller_reports[msg->deviceReport.controller_reports_count++]);
+
+  pb_ostream_t stream = pb_ostream_from_buffer(buf, ApiMessage_size);
+  pb_encode(&stream, ApiMessage_fields, msg);
+  free(msg);
+
+  return sizeof(uint32_t) + stream.bytes_written;
+}
+
+static void
+run_trace(bool pid)
+{
+  report_sample_t samples[NUM_CONTROLLERS];
+  report_sample_t decoded;
+  report_batch_reader_t reader;
+  report_batch_t* batch = malloc(sizeof(report_batch_t));
+  uint8_t* buf = malloc(ApiMessage_size);
+  uint32_t msg_flash = 0;
+  uint32_t batch_flash = 0;
+  uint32_t wire = 0;
+  float max_err = 0;
+  uint32_t i;
+  int c;
+
+  for (i = 0; i < TRACE_LEN; ++i) {
+    uint32_t len;
+
+    report_batch_init(batch, BASE_TIME + (i * 30));
+    for (c = 0; c < NUM_CONTROLLERS; ++c) {
+      gen_report(i, c, pid, &samples[c]);
+      report_batch_add(batch, &samples[c]);
+    }
+
+    len = msg_len(samples, NUM_CONTROLLERS, buf);
+    msg_flash += backlog_frame_size(len);
+    batch_flash += backlog_frame_size(batch->len);
+    wire += len;
+
+    report_batch_reader_init(&reader, batch->buf, batch->len);
+    for (c = 0; report_batch_read(&reader, &decoded); ++c) {
+      max_err = fmaxf(max_err, fabsf(decoded.sensor_reading - samples[c].sensor_reading));
+      max_err = fmaxf(max_err, fabsf(decoded.setpoint - samples[c].setpoint));
+    }
+  }
+
+  printf("  %-7s %12.1f %12.1f %12.1f %10.3f\r\n", pid ? "PID" : "on/off",
+      (double)msg_flash / TRACE_LEN, (double)batch_flash / TRACE_LEN,
+      (double)wire / TRACE_LEN, max_err);
+
+  free(buf);
+  free(batch);
+}
+
+/* Compares the backlog flash a day of offline sensor reports takes per 30 s
+ * interval stored as one DeviceReport message per interval, as they were,
+ * and as one report batch per interval, as they are. Batches only change
+ * storage: they are sent as the same DeviceReport messages, so the bytes
+ * on the wire are the same either way. max err is the largest change in a
+ * reading or setpoint through the batch encoding.
+ */
+void
+sim_bench_report_batch()
+{
+  printf("  %-7s %12s %12s %12s %10s\r\n", "reports",
+      "msg flash", "batch flash", "wire", "max err");
+  run_trace(false);
+  run_trace(true);
+}
@@ -0,0 +1,129 @@
+
+#include "sim.h"
+#include "sensor_filter.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+/* An hour of 1 s samples */
+#define TRACE_LEN 3600
+
+// samples before the error is counted, while the filters fill
+#define WARMUP 60
+
+// times each chain is run over the trace for timing
+#define TIMING_RUNS 200
+
+
+typedef struct {
+  const char* name;
+  uint8_t num_stages;
+  sensor_filter_cfg_t stages[SENSOR_FILTER_MAX_STAGES];
+} bench_chain_t;
+
+static const bench_chain_t chains[] = {
+  { "none", 0, { { .type = SENSOR_FILTER_NONE } } },
+  { "avg 10", 1, {
+      { .type = SENSOR_FILTER_MOVING_AVG, .window = 10 } } },
+  { "median 3, avg 10 (default)", 2, {
+      { .type = SENSOR_FILTER_MEDIAN, .window = 3 },
+      { .type = SENSOR_FILTER_MOVING_AVG, .window = 10 } } },
+  { "median 5, avg 16", 2, {
+      { .type = SENSOR_FILTER_MEDIAN, .window = 5 },
+      { .type = SENSOR_FILTER_MOVING_AVG, .window = 16 } } },
+  { "median 3, ema 0.2", 2, {
+      { .type = SENSOR_FILTER_MEDIAN, .window = 3 },
+      { .type = SENSOR_FILTER_EMA, .alpha = SENSOR_FIX(0.2f) } } },
+  { "median 3, kalman", 2, {
+      { .type = SENSOR_FILTER_MEDIAN, .window = 3 },
+      { .type = SENSOR_FILTER_KALMAN, .q = SENSOR_FIX(0.0001f), .r = SENSOR_FIX(0.0025f) } } },
+};
+
+
+/* A probe in a fermenter: a slow drift, a 2 C rise over 5 minutes half way
+ * through, 0.05 C of noise, 1/16 C steps and a 3 C spike every 500 samples.
+ */
+static void
+gen_trace(float* truth, sensor_fix_t* readings)
+{
+  uint32_t seed = 1;
+  int i;
+
+  for (i = 0; i < TRACE_LEN; ++i) {
+    float t = 20 + (0.5f * i / TRACE_LEN);
+    float noise = 0;
+    int j;
+
+    if (i >= 1800)
+      t += (i >= 2100) ? 2 : (2.0f * (i - 1800) / 300);
+    truth[i] = t;
+
+    // roughly normal, the sum of 4 uniforms
+    for (j = 0; j < 4; ++j) {
+      seed = (seed * 1103515245) + 12345;
+      noise += (((seed >> 16) & 0x7FFF) / 32767.0f) - 0.5f;
+    }
+    t += noise * 0.05f * 1.73f;
+
+    if ((i % 500) == 250)
+      t += 3;
+
+    readings[i] = (sensor_fix_t)floorf((t * 16) + 0.5f) << (SENSOR_FIX_FRAC_BITS - 4);
+  }
+}
+
+/* Runs each candidate chain over a synthetic trace and prints its error
+ * against the true temperature and its cost per sample on the host.
+ */
+void
+sim_bench_sensor_filter()
+{
+  float* truth = malloc(TRACE_LEN * sizeof(float));
+  sensor_fix_t* readings = malloc(TRACE_LEN * sizeof(sensor_fix_t));
+  uint32_t c;
+
+  gen_trace(truth, readings);
+
+  printf("  %-28s %8s %8s %10s\r\n", "chain", "rms C", "max C", "ns/sample");
+
+  for (c = 0; c < sizeof(chains) / sizeof(chains[0]); ++c) {
+    sensor_filter_chain_t chain;
+    double sum_sq = 0;
+    float max_err = 0;
+    volatile sensor_fix_t sink;
+    clock_t start;
+    double ns;
+    int i;
+    int run;
+
+    sensor_filter_chain_init(&chain, chains[c].stages, chains[c].num_stages);
+    for (i = 0; i < TRACE_LEN; ++i) {
+      float err = fabsf(SENSOR_FIX_FLOAT(sensor_filter_chain_exec(&chain, readings[i])) - truth[i]);
+
+      if (i < WARMUP)
+        continue;
+
+      sum_sq += err * err;
+      if (err > max_err)
+        max_err = err;
+    }
+
+    start = clock();
+    for (run = 0; run < TIMING_RUNS; ++run) {
+      sensor_filter_chain_reset(&chain);
+      for (i = 0; i < TRACE_LEN; ++i)
+        sink = sensor_filter_chain_exec(&chain, readings[i]);
+    }
+    (void)sink;
+    ns = ((double)(clock() - start) * 1e9) / CLOCKS_PER_SEC / ((double)TIMING_RUNS * TRACE_LEN);
+
+    printf("  %-28s %8.3f %8.3f %10.1f\r\n", chains[c].name,
+        sqrt(sum_sq / (TRACE_LEN - WARMUP)), max_err, ns);
+  }
+
+  free(truth);
+  free(readings);
+}
@@ -0,0 +1,147 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "onewire.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+
+#define SIM_MAX_PROBES_PER_BUS 4
+
+
+typedef enum {
+  SIM_FLASH_READ,
+  SIM_FLASH_PROGRAM,
+  SIM_FLASH_ERASE,
+  NUM_SIM_FLASH_OPS
+} sim_flash_op_t;
+
+typedef struct {
+  uint32_t count;
+  uint64_t total_us;
+  uint32_t max_us;
+} sim_flash_op_stats_t;
+
+/* A simulated flash part. Erases are counted per block_size block, the
+ * smallest unit the part erases, or a common divisor of its sector sizes.
+ */
+typedef struct {
+  const char* name;
+  uint32_t base;
+  uint32_t size;
+  uint32_t block_size;
+  uint32_t num_blocks;
+
+  uint8_t* mem;
+  FILE* file;
+  uint32_t* erase_counts;
+  sim_flash_op_stats_t ops[NUM_SIM_FLASH_OPS];
+} sim_flash_t;
+
+typedef struct {
+  const float* samples;
+  uint32_t num_samples;
+  float setpoint;
+  bool cooling;
+} sim_pid_trace_t;
+
+/* The clock read by the PID engines built for testing */
+extern systime_t sim_pid_now;
+
+/* stdout, for code that prints to a stream on the target */
+extern BaseSequentialStream sim_stdout;
+
+
+void
+sim_ctrl_init(void);
+
+bool
+sim_lcd_screenshot(const char* path);
+
+void
+sim_touch(bool touch_down, uint16_t x, uint16_t y);
+
+void
+sim_onewire_set_present(onewire_bus_t* ob, uint8_t idx, bool present);
+
+void
+sim_onewire_set_temp(onewire_bus_t* ob, uint8_t idx, float temp);
+
+void
+sim_flash_init(sim_flash_t* f, const char* env, const char* default_path);
+
+bool
+sim_flash_in_range(const sim_flash_t* f, uint32_t offset, uint32_t len);
+
+void
+sim_flash_read(sim_flash_t* f, uint32_t offset, uint8_t* buf, uint32_t len);
+
+void
+sim_flash_program(sim_flash_t* f, uint32_t offset, const uint8_t* buf, uint32_t len);
+
+void
+sim_flash_erase(sim_flash_t* f, uint32_t offset, uint32_t len);
+
+/* Adds us of modelled time for one op to the part's busy time */
+void
+sim_flash_busy(sim_flash_t* f, sim_flash_op_t op, uint32_t us);
+
+void
+sim_flash_report(void);
+
+void
+sim_flash_reset_stats(void);
+
+/* Runs the named test, or every test for "all". Returns false if a test
+ * failed or there is no such test.
+ */
+bool
+sim_test_run(const char* name);
+
+/* Runs the named benchmark, or every benchmark for "all" */
+void
+sim_bench_run(const char* name);
+
+void
+sim_pid_float_run(const sim_pid_trace_t* trace, float* outputs);
+
+void
+sim_pid_fixed_run(const sim_pid_trace_t* trace, float* outputs);
+
+/* Counter ticks spent in pid_exec() over the given number of runs */
+uint64_t
+sim_pid_float_time(const sim_pid_trace_t* trace, uint32_t runs);
+
+uint64_t
+sim_pid_fixed_time(const sim_pid_trace_t* trace, uint32_t runs);
+
+bool
+sim_test_pid_fixed_point(void);
+
+bool
+sim_test_temp_profile_long(void);
+
+bool
+sim_test_app_cfg_flush(void);
+
+bool
+sim_test_app_cfg_import(void);
+
+void
+sim_bench_pid_exec(void);
+
+void
+sim_bench_sensor_filter(void);
+
+void
+sim_bench_crc32(void);
+
+void
+sim_bench_report_batch(void);
+
+void
+sim_bench_app_cfg_hour(void);
+
+#endif
@@ -0,0 +1,253 @@
+
+#include "ch.h"
+#include "hal.h"
+
+#include "sim.h"
+#include "message.h"
+#include "app_cfg.h"
+
+#include <chprintf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+/* Simulator control thread. Reads one command per line from the file named
+ * by SIM_SCRIPT, or from stdin when it is not set, and drives the modelled
+ * peripherals:
+ *
+ *   touch <x> <y>              press the panel at display coordinates
+ *   release                    lift the touch
+ *   tap <x> <y>                press for 100 ms, then release
+ *   temp <bus> [<idx>] <degC>  set the temperature of a probe
+ *   probe <bus> [<idx>] on|off plug or unplug a probe
+ *   relays                     print the relay outputs
+ *   sleep <ms>                 pause the script
+ *   screenshot <file>          write the display to a PPM file
+ *   trace on|off|dump|reset    control the message bus tracer
+ *   flash [reset]              print or clear the flash time and wear report,
+ *                              printed with the settings log stats
+ *   test <name>|all            run tests, and exit with status 1 if one fails
+ *   bench <name>|all           run benchmarks
+ *   quit [<status>]            exit the simulator
+ *
+ * Buses are numbered from 1 as on the case, probes from 0.
+ */
+
+#define MAX_LINE 128
+#define POLL_INTERVAL MS2ST(10)
+
+
+static msg_t sim_ctrl_thread(void* arg);
+
+
+/* Stream for the dumps and benches the target prints to its debug console */
+static size_t
+stdout_write(void* instance, const uint8_t* bp, size_t n)
+{
+  (void)instance;
+  return fwrite(bp, 1, n, stdout);
+}
+
+static size_t
+stdout_read(void* instance, uint8_t* bp, size_t n)
+{
+  (void)instance;
+  (void)bp;
+  (void)n;
+  return 0;
+}
+
+static msg_t
+stdout_put(void* instance, uint8_t b)
+{
+  (void)instance;
+  putchar(b);
+  return RDY_OK;
+}
+
+static msg_t
+stdout_get(void* instance)
+{
+  (void)instance;
+  return Q_RESET;
+}
+
+static const struct BaseSequentialStreamVMT stdout_vmt = {
+  stdout_write, stdout_read, stdout_put, stdout_get
+};
+
+BaseSequentialStream sim_stdout = { &stdout_vmt };
+
+
+static onewire_bus_t*
+get_bus(int bus)
+{
+  return (bus == 2) ? &OWD2 : &OWD1;
+}
+
+static void
+cmd_probe(char* args, bool set_temp)
+{
+  int bus, idx;
+  char val[16];
+
+  if (sscanf(args, "%d %d %15s", &bus, &idx, val) != 3) {
+    idx = 0;
+    if (sscanf(args, "%d %15s", &bus, val) != 2) {
+      printf("sim: bad probe arguments '%s'\r\n", args);
+      return;
+    }
+  }
+
+  if (set_temp)
+    sim_onewire_set_temp(get_bus(bus), idx, strtof(val, NULL));
+  else
+    sim_onewire_set_present(get_bus(bus), idx, strcmp(val, "on") == 0);
+}
+
+static void
+cmd_trace(const char* args)
+{
+  if (strcmp(args, "on") == 0)
+    msg_trace_enable(true);
+  else if (strcmp(args, "off") == 0)
+    msg_trace_enable(false);
+  else if (strcmp(args, "reset") == 0)
+    msg_reset_stats();
+  else
+    msg_trace_dump(&sim_stdout);
+}
+
+static void
+exec_cmd(char* line)
+{
+  char* args;
+  int x, y;
+
+  line[strcspn(line, "\r\n#")] = '\0';
+
+  args = line + strcspn(line, " ");
+  if (*args != '\0')
+    *args++ = '\0';
+
+  if (line[0] == '\0')
+    return;
+
+  if (strcmp(line, "touch") == 0 && sscanf(args, "%d %d", &x, &y) == 2) {
+    sim_touch(true, x, y);
+  }
+  else if (strcmp(line, "release") == 0) {
+    sim_touch(false, 0, 0);
+  }
+  else if (strcmp(line, "tap") == 0 && sscanf(args, "%d %d", &x, &y) == 2) {
+    sim_touch(true, x, y);
+    chThdSleepMilliseconds(100);
+    sim_touch(false, x, y);
+  }
+  else if (strcmp(line, "temp") == 0) {
+    cmd_probe(args, true);
+  }
+  else if (strcmp(line, "probe") == 0) {
+    cmd_probe(args, false);
+  }
+  else if (strcmp(line, "relays") == 0) {
+    printf("relay1: %d relay2: %d\r\n",
+        (int)(palReadLatch(PORT_RELAY1) >> PAD_RELAY1) & 1,
+        (int)(palReadLatch(PORT_RELAY2) >> PAD_RELAY2) & 1);
+  }
+  else if (strcmp(line, "sleep") == 0) {
+    chThdSleepMilliseconds(atoi(args));
+  }
+  else if (strcmp(line, "screenshot") == 0) {
+    if (!sim_lcd_screenshot(args))
+      printf("sim: could not write '%s'\r\n", args);
+  }
+  else if (strcmp(line, "trace") == 0) {
+    cmd_trace(args);
+  }
+  else if (strcmp(line, "flash") == 0) {
+    if (strcmp(args, "reset") == 0) {
+      sim_flash_reset_stats();
+    }
+    else {
+      sim_flash_report();
+      app_cfg_dump_stats(&sim_stdout);
+    }
+  }
+  else if (strcmp(line, "test") == 0) {
+    if (!sim_test_run(args))
+      exit(1);
+  }
+  else if (strcmp(line, "bench") == 0) {
+    sim_bench_run(args);
+  }
+  else if (strcmp(line, "quit") == 0) {
+    exit(atoi(args));
+  }
+  else {
+    printf("sim: unknown command '%s'\r\n", line);
+  }
+}
+
+void
+sim_ctrl_init()
+{
+  chThdCreateFromHeap(NULL, 1024, NORMALPRIO, sim_ctrl_thread, NULL);
+}
+
+static msg_t
+sim_ctrl_thread(void* arg)
+{
+  (void)arg;
+  chRegSetThreadName("sim_ctrl");
+
+  const char* script = getenv("SIM_SCRIPT");
+  int fd = STDIN_FILENO;
+  char line[MAX_LINE];
+  size_t len = 0;
+
+  if (script != NULL) {
+    fd = open(script, O_RDONLY);
+    if (fd < 0) {
+      printf("sim: could not open script '%s'\r\n", script);
+      return 0;
+    }
+  }
+
+  /* Every thread shares one host thread, so input must never block */
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  while (1) {
+    ssize_t n = read(fd, &line[len], 1);
+
+    if (n == 1) {
+      if (line[len] == '\n' || len == (MAX_LINE - 2)) {
+        line[len + 1] = '\0';
+        exec_cmd(line);
+        len = 0;
+      }
+      else {
+        len++;
+      }
+    }
+    else if (n == 0 && script != NULL) {
+      /* End of script, keep running until told otherwise */
+      break;
+    }
+    else if (n < 0 && errno != EAGAIN) {
+      break;
+    }
+    else {
+      chThdSleep(POLL_INTERVAL);
+    }
+  }
+
+  if (script != NULL)
+    close(fd);
+
+  return 0;
+}
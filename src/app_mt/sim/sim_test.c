@@ -0,0 +1,85 @@
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+/* Self-checking tests run from the control script with 'test'. Each prints
+ * whatever it measured and returns false if the result is wrong.
+ */
+static const struct {
+  const char* name;
+  bool (*run)(void);
+} tests[] = {
+  { "pid_fixed_point",   sim_test_pid_fixed_point },
+  { "temp_profile_long", sim_test_temp_profile_long },
+  { "app_cfg_flush",     sim_test_app_cfg_flush },
+  { "app_cfg_import",    sim_test_app_cfg_import },
+};
+
+/* Benchmarks run with 'bench'. They only print what they measured. Times
+ * are for the host, so only compare them with each other.
+ */
+static const struct {
+  const char* name;
+  void (*run)(void);
+} benches[] = {
+  { "pid_exec",      sim_bench_pid_exec },
+  { "sensor_filter", sim_bench_sensor_filter },
+  { "crc32",         sim_bench_crc32 },
+  { "report_batch",  sim_bench_report_batch },
+  { "app_cfg_hour",  sim_bench_app_cfg_hour },
+};
+
+
+bool
+sim_test_run(const char* name)
+{
+  bool all = (strcmp(name, "all") == 0);
+  bool found = false;
+  bool pass = true;
+  uint32_t i;
+
+  for (i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+    if (!all && strcmp(name, tests[i].name) != 0)
+      continue;
+
+    found = true;
+    printf("test %s\r\n", tests[i].name);
+    if (tests[i].run()) {
+      printf("test %s: pass\r\n", tests[i].name);
+    }
+    else {
+      printf("test %s: FAIL\r\n", tests[i].name);
+      pass = false;
+    }
+  }
+
+  if (!found) {
+    printf("sim: unknown test '%s'\r\n", name);
+    return false;
+  }
+
+  return pass;
+}
+
+void
+sim_bench_run(const char* name)
+{
+  bool all = (strcmp(name, "all") == 0);
+  bool found = false;
+  uint32_t i;
+
+  for (i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+    if (!all && strcmp(name, benches[i].name) != 0)
+      continue;
+
+    found = true;
+    printf("bench %s\r\n", benches[i].name);
+    benches[i].run();
+  }
+
+  if (!found)
+    printf("sim: unknown benchmark '%s'\r\n", name);
+}
@@ -0,0 +1,220 @@
+
+#include "ch.h"
+
+#include "sim.h"
+#include "temp_profile.h"
+#include "temp_profile_lib.h"
+#include "app_cfg.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+
+#define TEST_PROFILE_ID 0x7E570001
+
+#define DAY (24 * 60 * 60)
+
+/* 60 half-day steps, a 55 day ramp and a 5 day hold, 90 days in all. The
+ * steps run through the 32 segment window twice, so it has to be paged in
+ * as the profile runs, and the long ramp alone is past the 49.7 days that
+ * 32-bit system ticks cover.
+ */
+#define NUM_SHORT_STEPS 60
+#define NUM_STEPS       (NUM_SHORT_STEPS + 2)
+#define DURATION        (90 * DAY)
+
+#define CHECK_INTERVAL (DAY / 4)
+
+#define PREVIEW_POINTS 61
+
+
+static temp_profile_step_t steps[NUM_STEPS];
+
+static void
+make_steps(temp_profile_t* profile)
+{
+  int i;
+
+  profile->id = TEST_PROFILE_ID;
+  snprintf(profile->name, sizeof(profile->name), "long profile test");
+  profile->num_steps = NUM_STEPS;
+  profile->start_value.value = 20;
+  profile->start_value.unit = UNIT_TEMP_DEG_C;
+
+  for (i = 0; i < NUM_SHORT_STEPS; ++i) {
+    steps[i].duration = DAY / 2;
+    steps[i].value.value = 18 + (i % 3);
+    steps[i].value.unit = UNIT_TEMP_DEG_C;
+    steps[i].type = (i % 2) ? STEP_HOLD : STEP_RAMP;
+  }
+
+  steps[NUM_SHORT_STEPS].duration = 55 * DAY;
+  steps[NUM_SHORT_STEPS].value.value = 2;
+  steps[NUM_SHORT_STEPS].value.unit = UNIT_TEMP_DEG_C;
+  steps[NUM_SHORT_STEPS].type = STEP_RAMP;
+
+  steps[NUM_SHORT_STEPS + 1].duration = 5 * DAY;
+  steps[NUM_SHORT_STEPS + 1].value.value = 4;
+  steps[NUM_SHORT_STEPS + 1].value.unit = UNIT_TEMP_DEG_C;
+  steps[NUM_SHORT_STEPS + 1].type = STEP_HOLD;
+}
+
+/* Walks the steps directly, returning the setpoint t seconds in */
+static float
+expected_setpoint(const temp_profile_t* profile, uint32_t t)
+{
+  float last = profile->start_value.value;
+  uint32_t start = 0;
+  uint32_t i;
+
+  for (i = 0; i < NUM_STEPS; ++i) {
+    if (t < start + steps[i].duration) {
+      if (steps[i].type == STEP_HOLD)
+        return steps[i].value.value;
+      return last + ((steps[i].value.value - last) * (t - start)) / steps[i].duration;
+    }
+
+    last = steps[i].value.value;
+    start += steps[i].duration;
+  }
+
+  return last;
+}
+
+/* Moves the run to offset + t seconds into the profile and reads the
+ * setpoint back the way the controller does. Time is stepped by setting the
+ * run's elapsed time, temp_profile_update() then pages the window.
+ */
+static bool
+run_to(temp_profile_run_t* run, uint32_t t, float* sp)
+{
+  quantity_t sample = { .unit = UNIT_TEMP_DEG_C, .value = 20 };
+
+  run->elapsed = t;
+  run->elapsed_time = chTimeNow();
+  temp_profile_update(run, sample);
+
+  return temp_profile_get_current_setpoint(run, sp);
+}
+
+static bool
+check_pass(temp_profile_run_t* run, const temp_profile_t* profile, uint32_t offset, uint32_t* pages)
+{
+  uint32_t first_segment = run->timeline.first_segment;
+  uint32_t t;
+
+  for (t = 0; t < DURATION; t += CHECK_INTERVAL) {
+    float expected = expected_setpoint(profile, t);
+    float sp;
+
+    if (!run_to(run, offset + t, &sp) ||
+        fabsf(sp - expected) > 0.01f) {
+      printf("  at %u s: setpoint %.3f, expected %.3f\r\n",
+          (unsigned)(offset + t), sp, expected);
+      return false;
+    }
+
+    if (run->timeline.first_segment != first_segment) {
+      first_segment = run->timeline.first_segment;
+      (*pages)++;
+    }
+  }
+
+  return true;
+}
+
+static bool
+check_preview(const temp_profile_timeline_t* timeline, const temp_profile_t* profile)
+{
+  float points[PREVIEW_POINTS];
+  int i;
+
+  temp_profile_preview(timeline, points, PREVIEW_POINTS);
+
+  for (i = 0; i < PREVIEW_POINTS; ++i) {
+    uint32_t t = ((uint64_t)DURATION * i) / (PREVIEW_POINTS - 1);
+    float expected = expected_setpoint(profile, t);
+
+    if (fabsf(points[i] - expected) > 0.01f) {
+      printf("  preview point %d at %u s: %.3f, expected %.3f\r\n",
+          i, (unsigned)t, points[i], expected);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Runs a 90 day profile through temp_profile_start(), temp_profile_update()
+ * and temp_profile_get_current_setpoint(), on the first pass and on a later
+ * pass of a profile that starts over, and checks its preview. The run uses
+ * controller 1's checkpoint, which is put back afterwards.
+ */
+bool
+sim_test_temp_profile_long()
+{
+  temp_profile_t profile;
+  temp_profile_run_t run;
+  temp_profile_checkpoint_t checkpoint;
+  temp_profile_ref_t ref = {
+      .id = TEST_PROFILE_ID,
+      .start_point = 0,
+      .completion_action = TEMP_PROFILE_COMPLETION_ACTION_START_OVER
+  };
+  quantity_t sample = { .unit = UNIT_TEMP_DEG_C, .value = 20 };
+  uint32_t pages = 0;
+  bool pass = true;
+  float sp;
+
+  make_steps(&profile);
+  if (!temp_profile_lib_put(&profile, steps)) {
+    printf("  could not store the profile\r\n");
+    return false;
+  }
+
+  app_cfg_get_temp_profile_checkpoint(CONTROLLER_1, &checkpoint);
+
+  memset(&run, 0, sizeof(run));
+  temp_profile_init(&run);
+  temp_profile_start(&run, CONTROLLER_1, &ref);
+  if (!run.timeline.valid || run.timeline.duration != DURATION) {
+    printf("  compiled duration %u s\r\n", (unsigned)run.timeline.duration);
+    pass = false;
+  }
+
+  /* The run waits for the start value before the clock starts */
+  temp_profile_update(&run, sample);
+  if (run.state != TPS_RUNNING) {
+    printf("  run did not start at the start value\r\n");
+    pass = false;
+  }
+
+  pass = pass &&
+      check_pass(&run, &profile, 0, &pages) &&
+      check_pass(&run, &profile, 2 * DURATION, &pages);
+
+  if (pass && pages < 4) {
+    printf("  window paged %u times over two passes\r\n", (unsigned)pages);
+    pass = false;
+  }
+
+  pass = pass && check_preview(&run.timeline, &profile);
+
+  /* Once a profile that holds its last value has run out, that value stays */
+  ref.completion_action = TEMP_PROFILE_COMPLETION_ACTION_HOLD_LAST;
+  temp_profile_start(&run, CONTROLLER_1, &ref);
+  temp_profile_update(&run, sample);
+  if (pass &&
+      (!run_to(&run, DURATION + 10 * DAY, &sp) ||
+       run.state != TPS_HOLD_LAST ||
+       sp != 4)) {
+    printf("  setpoint after the end %.3f\r\n", sp);
+    pass = false;
+  }
+
+  app_cfg_set_temp_profile_checkpoint(CONTROLLER_1, &checkpoint);
+  temp_profile_lib_delete(TEST_PROFILE_ID);
+
+  return pass;
+}
@@ -0,0 +1,76 @@
+
+#include "ch.h"
+#include "hal.h"
+
+#include "touch.h"
+#include "touch_calib.h"
+#include "message.h"
+#include "app_cfg.h"
+#include "sim.h"
+
+#include <string.h>
+
+
+/* Host model of the resistive touch panel. Touches are injected by the
+ * simulator control thread in display coordinates, so the raw and
+ * calibrated points are the same and the calibration matrix is only kept
+ * to round-trip it through the app config.
+ */
+
+static matrix_t calib_matrix;
+
+
+void
+touch_init()
+{
+  app_cfg_get_touch_calib(&calib_matrix);
+}
+
+void
+sim_touch(bool touch_down, uint16_t x, uint16_t y)
+{
+  touch_msg_t msg = {
+      .raw = { .x = x, .y = y },
+      .calib = { .x = x, .y = y },
+      .touch_down = touch_down
+  };
+  msg_send(MSG_TOUCH_INPUT, &msg);
+}
+
+void
+touch_set_calib(
+    const point_t* ref_pts,
+    const point_t* sampled_pts)
+{
+  setCalibrationMatrix(ref_pts, sampled_pts, &calib_matrix);
+}
+
+void
+touch_save_calib()
+{
+  app_cfg_set_touch_calib(&calib_matrix);
+}
+
+void
+touch_get_default_calib(matrix_t* calib)
+{
+  static const matrix_t default_calib = {
+    .An      = 1,
+    .Bn      = 0,
+    .Cn      = 0,
+    .Dn      = 0,
+    .En      = 1,
+    .Fn      = 0,
+    .Divider = 1
+  };
+  *calib = default_calib;
+}
+
+void
+touch_calib_reset()
+{
+  matrix_t default_calib;
+
+  touch_get_default_calib(&default_calib);
+  app_cfg_set_touch_calib(&default_calib);
+}
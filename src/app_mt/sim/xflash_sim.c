@@ -0,0 +1,268 @@
+#include "ch.h"
+#include "hal.h"
+#include "common.h"
+#include "crc/crc32.h"
+
+#include "xflash.h"
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Host model of the external SPI flash. The 4 MB array lives in a sparse
+ * file next to the executable (SIM_XFLASH overrides the name), so
+ * configuration and backlog data survive a restart of the simulator.
+ *
+ * Writes are split into page programs as on the target, and a page program
+ * wraps around within its page as the part does. Erases work in the same
+ * units as an S25FL-P/-S part with TBPARM clear: 4K erases only in the
+ * parameter sectors in the first 64K, and 64K sectors everywhere, so an
+ * erase the part would ignore fails here too. Each operation is charged the time below, which
+ * SIM_XFLASH_TIMING can override with "<page us> <4K erase us> <64K erase
+ * us>". The times show up in xflash_get_stats() and the simulator's flash
+ * report.
+ */
+
+#define XFLASH_SIZE     (4 * 1024 * 1024)
+#define XFLASH_FILE     "xflash.img"
+
+#define PARAM_REGION_SIZE XFLASH_SECTOR_SIZE
+
+// One byte every 8 clocks of a 30 MHz SPI
+#define READ_NS_PER_BYTE  267
+
+
+typedef struct {
+  uint32_t page_program_us;
+  uint32_t erase_4k_us;
+  uint32_t erase_64k_us;
+} xflash_timing_t;
+
+
+static void
+account(xflash_op_t op, sim_flash_op_t sim_op, uint32_t us);
+
+
+static sim_flash_t flash = {
+    .name = "xflash",
+    .base = 0,
+    .size = XFLASH_SIZE,
+    .block_size = XFLASH_SUBSECTOR_SIZE,
+    .num_blocks = XFLASH_SIZE / XFLASH_SUBSECTOR_SIZE,
+};
+
+// Typical times from the datasheet
+static xflash_timing_t timing = {
+    .page_program_us = 700,
+    .erase_4k_us = 45000,
+    .erase_64k_us = 150000,
+};
+
+static xflash_op_stats_t op_stats[NUM_XFLASH_OPS];
+static Mutex xflash_mutex;
+
+
+void
+xflash_init()
+{
+  const char* t = getenv("SIM_XFLASH_TIMING");
+  if (t != NULL &&
+      sscanf(t, "%u %u %u", &timing.page_program_us,
+          &timing.erase_4k_us, &timing.erase_64k_us) != 3)
+    printf("xflash: bad timing '%s'\r\n", t);
+
+  chMtxInit(&xflash_mutex);
+
+  sim_flash_init(&flash, "SIM_XFLASH", XFLASH_FILE);
+}
+
+static void
+account(xflash_op_t op, sim_flash_op_t sim_op, uint32_t us)
+{
+  xflash_op_stats_t* stats = &op_stats[op];
+
+  stats->count++;
+  stats->total_us += us;
+  if (us > stats->max_us)
+    stats->max_us = us;
+
+  sim_flash_busy(&flash, sim_op, us);
+}
+
+uint32_t
+xflash_erase_size(uint32_t addr, uint32_t size)
+{
+  if (addr + size <= PARAM_REGION_SIZE)
+    return XFLASH_SUBSECTOR_SIZE;
+
+  return XFLASH_SECTOR_SIZE;
+}
+
+int
+xflash_erase(uint32_t addr, uint32_t size)
+{
+  if (((addr & (XFLASH_SUBSECTOR_SIZE - 1)) != 0) ||
+      ((size & (XFLASH_SUBSECTOR_SIZE - 1)) != 0) ||
+      !sim_flash_in_range(&flash, addr, size))
+    return -1;
+
+  chMtxLock(&xflash_mutex);
+  while (size > 0) {
+    bool whole_sector = (size >= XFLASH_SECTOR_SIZE) &&
+        ((addr & (XFLASH_SECTOR_SIZE - 1)) == 0);
+    uint32_t erase_size = whole_sector ? XFLASH_SECTOR_SIZE : XFLASH_SUBSECTOR_SIZE;
+
+    if (xflash_erase_size(addr, erase_size) > erase_size) {
+      printf("xflash: 4K erase outside the parameter sectors at 0x%08X\r\n", (unsigned)addr);
+      chMtxUnlock();
+      return -1;
+    }
+
+    sim_flash_erase(&flash, addr, erase_size);
+    if (whole_sector)
+      account(XFLASH_OP_ERASE, SIM_FLASH_ERASE, timing.erase_64k_us);
+    else
+      account(XFLASH_OP_ERASE_4K, SIM_FLASH_ERASE, timing.erase_4k_us);
+
+    addr += erase_size;
+    size -= erase_size;
+  }
+  chMtxUnlock();
+
+  return 0;
+}
+
+bool
+xflash_is_erased(uint32_t addr, uint32_t len)
+{
+  uint32_t i;
+
+  if (!sim_flash_in_range(&flash, addr, len))
+    return false;
+
+  for (i = 0; i < len; ++i) {
+    if (flash.mem[addr + i] != 0xFF)
+      return false;
+  }
+
+  return true;
+}
+
+/* Programs up to a page. Bytes past the end of the page wrap around to its
+ * start.
+ */
+static void
+page_program(uint32_t addr, const uint8_t* buf, uint32_t len)
+{
+  uint32_t page = addr & ~(XFLASH_PAGE_SIZE - 1);
+  uint32_t offset = addr - page;
+
+  while (len > 0) {
+    uint32_t n = MIN(len, XFLASH_PAGE_SIZE - offset);
+
+    sim_flash_program(&flash, page + offset, buf, n);
+    buf += n;
+    len -= n;
+    offset = 0;
+  }
+
+  account(XFLASH_OP_PROGRAM, SIM_FLASH_PROGRAM, timing.page_program_us);
+}
+
+int
+xflash_write(uint32_t addr, const uint8_t* buf, uint32_t buf_len)
+{
+  uint32_t data_to_write = (XFLASH_PAGE_SIZE - (addr % XFLASH_PAGE_SIZE));
+  data_to_write = MIN(data_to_write, buf_len);
+
+  if (!sim_flash_in_range(&flash, addr, buf_len))
+    return -1;
+
+  chMtxLock(&xflash_mutex);
+  while (buf_len != 0) {
+    page_program(addr, buf, data_to_write);
+
+    addr += data_to_write;
+    buf += data_to_write;
+    buf_len -= data_to_write;
+    data_to_write = MIN(XFLASH_PAGE_SIZE, buf_len);
+  }
+  chMtxUnlock();
+
+  return 0;
+}
+
+void
+xflash_read(uint32_t addr, uint8_t* buf, uint32_t buf_len)
+{
+  if (!sim_flash_in_range(&flash, addr, buf_len)) {
+    memset(buf, 0xFF, buf_len);
+    return;
+  }
+
+  chMtxLock(&xflash_mutex);
+  sim_flash_read(&flash, addr, buf, buf_len);
+  account(XFLASH_OP_READ, SIM_FLASH_READ, (buf_len * READ_NS_PER_BYTE) / 1000);
+  chMtxUnlock();
+}
+
+/* Reads complete as soon as they are queued */
+void
+xflash_read_async(xflash_req_t* req, uint32_t addr, uint8_t* buf, uint32_t buf_len,
+    xflash_cb_t cb, void* arg)
+{
+  req->addr = addr;
+  req->buf = buf;
+  req->len = buf_len;
+  req->cb = cb;
+  req->arg = arg;
+  req->next = NULL;
+  chBSemInit(&req->done, TRUE);
+
+  xflash_read(addr, buf, buf_len);
+
+  chSysLock();
+  if (cb != NULL)
+    cb(req);
+  chBSemSignalI(&req->done);
+  chSchRescheduleS();
+  chSysUnlock();
+}
+
+void
+xflash_wait(xflash_req_t* req)
+{
+  chBSemWait(&req->done);
+}
+
+bool
+xflash_read_stream(uint32_t addr, uint32_t size, xflash_chunk_fn_t fn, void* arg)
+{
+  if (!sim_flash_in_range(&flash, addr, size))
+    return false;
+
+  sim_flash_busy(&flash, SIM_FLASH_READ, (size * READ_NS_PER_BYTE) / 1000);
+
+  return fn(flash.mem + addr, size, arg);
+}
+
+uint32_t
+xflash_crc(uint32_t addr, uint32_t size)
+{
+  if (!sim_flash_in_range(&flash, addr, size))
+    return 0;
+
+  sim_flash_busy(&flash, SIM_FLASH_READ, (size * READ_NS_PER_BYTE) / 1000);
+
+  return crc32_block(0xFFFFFFFF, flash.mem + addr, size);
+}
+
+void
+xflash_get_stats(xflash_op_t op, xflash_op_stats_t* stats)
+{
+  chSysLock();
+  *stats = op_stats[op];
+  chSysUnlock();
+}
@@ -25,8 +25,9 @@ typedef struct {
   output_status_t status;
   bool output_ovrd;
   systime_t cycle_delay_start_time;
+  msg_timer_t* cycle_delay_timer;
+  bool active;
   struct temp_controller_s* controller;
-  Thread* thread;
 } relay_output_t;
 
 typedef struct temp_controller_s {
@@ -39,20 +40,22 @@ typedef struct temp_controller_s {
 } temp_controller_t;
 
 
-static void dispatch_temp_input_msg(msg_id_t id, void* msg_data, void* listener_data, void* sub_data);
+static void dispatch_temp_input_msg(msg_id_t id, void* msg_data, void* listener_data);
 static void dispatch_controller_settings(temp_controller_t* tc, const controller_settings_t* msg, bool resume_profile);
-static void dispatch_init(temp_controller_t* tc);
+static void dispatch_init(temp_controller_t* tc, msg_listener_t* l);
 static void dispatch_sensor_sample(temp_controller_t* tc, sensor_msg_t* msg);
 static void dispatch_sensor_timeout(temp_controller_t* tc, sensor_timeout_msg_t* msg);
 static void dispatch_output_ovrd(temp_controller_t* tc, output_ovrd_msg_t* msg);
 static void output_init(temp_controller_t* tc, output_id_t id);
-static msg_t output_thread(void* arg);
+static void output_stop(relay_output_t* output);
+static void output_update(relay_output_t* output);
+static void update_outputs(temp_controller_t* tc);
 static void start_cycle_delay(relay_output_t* output);
 static void set_output_state(relay_output_t* output, output_state_t output_state);
 static void relay_control(relay_output_t* output);
 static void enable_relay(relay_output_t* output, bool enabled);
 static float get_sp(temp_controller_t* tc);
-static const output_settings_t* get_output_settings(temp_controller_t* tc, output_id_t output);
+static output_settings_t get_output_settings(temp_controller_t* tc, output_id_t output);
 
 static temp_controller_t* controllers[NUM_CONTROLLERS];
 
@@ -75,13 +78,15 @@ temp_control_init(temp_controller_id_t controller)
 
   tc->state = TC_SENSOR_TIMED_OUT;
 
+  temp_profile_init(&tc->temp_profile_run);
+
   msg_listener_t* l = msg_listener_create("temp_ctrl", 1024, dispatch_temp_input_msg, tc);
 
-  msg_subscribe(l, MSG_SENSOR_SAMPLE,   NULL);
-  msg_subscribe(l, MSG_SENSOR_TIMEOUT,  NULL);
-  msg_subscribe(l, MSG_API_CONTROLLER_SETTINGS, NULL);
-  msg_subscribe(l, MSG_CONTROLLER_SETTINGS, NULL);
-  msg_subscribe(l, MSG_OUTPUT_OVRD, NULL);
+  msg_subscribe(l, MSG_SENSOR_SAMPLE);
+  msg_subscribe(l, MSG_SENSOR_TIMEOUT);
+  msg_subscribe(l, MSG_API_CONTROLLER_SETTINGS);
+  msg_subscribe(l, MSG_CONTROLLER_SETTINGS);
+  msg_subscribe(l, MSG_OUTPUT_OVRD);
 }
 
 float
@@ -100,13 +105,13 @@ temp_control_get_status(temp_controller_id_t controller, output_id_t output)
 {
   temp_control_status_t status;
   temp_controller_t* tc = controllers[controller];
-  const output_settings_t* output_settings = get_output_settings(tc, output);
+  output_settings_t output_settings = get_output_settings(tc, output);
 
-  status.function = output_settings->function;
+  status.function = output_settings.function;
   status.output_enabled = tc->outputs[output].status.enabled;
-  status.kp = tc->outputs[output].pid_control.kp;
-  status.ki = tc->outputs[output].pid_control.ki;
-  status.kd = tc->outputs[output].pid_control.kd;
+  status.kp = PID_GAIN_FLOAT(tc->outputs[output].pid_control.kp);
+  status.ki = PID_GAIN_FLOAT(tc->outputs[output].pid_control.ki);
+  status.kd = PID_GAIN_FLOAT(tc->outputs[output].pid_control.kd);
 
   return (status);
 }
@@ -120,10 +125,10 @@ temp_control_get_controller_for(output_id_t output)
     return NULL;
 
   for (i = 0; i < NUM_CONTROLLERS; ++i) {
-    const controller_settings_t* controller_settings =
-        app_cfg_get_controller_settings(i);
+    controller_settings_t controller_settings;
+    app_cfg_get_controller_settings(i, &controller_settings);
 
-    if (controller_settings->output_settings[output].enabled)
+    if (controller_settings.output_settings[output].enabled)
       return controllers[i];
   }
 
@@ -143,114 +148,119 @@ temp_control_get_output_function(output_id_t output)
 {
   temp_controller_t* tc = temp_control_get_controller_for(output);
   if (tc != NULL)
-    return get_output_settings(tc, output)->function;
+    return get_output_settings(tc, output).function;
 
   return OUTPUT_FUNC_NONE;
 }
 
-static const output_settings_t*
+static output_settings_t
 get_output_settings(temp_controller_t* tc, output_id_t output)
 {
-  const controller_settings_t* settings = app_cfg_get_controller_settings(tc->controller);
-  return &settings->output_settings[output];
+  controller_settings_t settings;
+  app_cfg_get_controller_settings(tc->controller, &settings);
+  return settings.output_settings[output];
 }
 
 static void
 output_init(temp_controller_t* tc, output_id_t output)
 {
   relay_output_t* out = &tc->outputs[output];
-  const output_settings_t* settings = get_output_settings(tc, output);
+  output_settings_t settings = get_output_settings(tc, output);
 
   out->id = output;
   out->controller = tc;
+  out->status.output = output;
 
-  if (settings->function == OUTPUT_FUNC_MANUAL)
+  if (settings.function == OUTPUT_FUNC_MANUAL)
     return;
 
   pid_init(&out->pid_control);
   pid_set_output_limits(&out->pid_control, -20, 20);
 
-  if (settings->function == OUTPUT_FUNC_COOLING)
+  if (settings.function == OUTPUT_FUNC_COOLING)
     pid_set_output_sign(&out->pid_control, NEGATIVE);
   else
     pid_set_output_sign(&out->pid_control, POSITIVE);
 
-  out->thread = chThdCreateFromHeap(NULL, 1024, NORMALPRIO, output_thread, out);
-}
-
-static msg_t
-output_thread(void* arg)
-{
-  relay_output_t* output = arg;
-  chRegSetThreadName("output");
-
-  const output_settings_t* output_settings =
-      get_output_settings(output->controller, output->id);
-  systime_t cycle_delay = S2ST(60 * output_settings->cycle_delay.value);
-
-  if (output_settings->function == OUTPUT_FUNC_COOLING)
-    pid_set_output_sign(&output->pid_control, NEGATIVE);
-  else if (output_settings->function == OUTPUT_FUNC_HEATING)
-    pid_set_output_sign(&output->pid_control, POSITIVE);
+  pid_reinit(&out->pid_control, tc->last_sample.value);
 
-  pid_reinit(&output->pid_control,
-      output->controller->last_sample.value);
+  out->active = true;
 
   /* Wait 1 cycle delay before starting window and PID */
-  start_cycle_delay(output);
-
-  output->status.output = output->id;
-
-  while (!chThdShouldTerminate()) {
+  start_cycle_delay(out);
+}
 
-    /* If the probe associated with this output is not active or if the output is set
-     * to disabled turn OFF the output
-     */
-    if (output->controller->state != TC_ACTIVE ||
-        !output_settings->enabled)
-      set_output_state(output, OUTPUT_CONTROL_DISABLED);
+static void
+output_stop(relay_output_t* output)
+{
+  if (!output->active)
+    return;
 
-    switch (output->status.state) {
-      case OUTPUT_CONTROL_DISABLED:
-        enable_relay(output, false);
+  output->active = false;
+  msg_timer_stop(output->cycle_delay_timer);
+  enable_relay(output, false);
+}
 
-        if (output->controller->state == TC_ACTIVE &&
-            output_settings->enabled)
-          start_cycle_delay(output);
-        break;
+/* Runs the output state machine. Called whenever one of its inputs changes:
+ * a new sample, a sensor timeout, new settings, an override or the expiry of
+ * the cycle delay timer.
+ */
+static void
+output_update(relay_output_t* output)
+{
+  if (!output->active)
+    return;
 
-      case OUTPUT_CONTROL_ENABLED:
+  output_settings_t output_settings =
+      get_output_settings(output->controller, output->id);
+  systime_t cycle_delay = S2ST(60 * output_settings.cycle_delay.value);
+
+  /* If the probe associated with this output is not active or if the output is set
+   * to disabled turn OFF the output
+   */
+  if (output->controller->state != TC_ACTIVE ||
+      !output_settings.enabled)
+    set_output_state(output, OUTPUT_CONTROL_DISABLED);
+
+  switch (output->status.state) {
+    case OUTPUT_CONTROL_DISABLED:
+      enable_relay(output, false);
+
+      if (output->controller->state == TC_ACTIVE &&
+          output_settings.enabled)
+        start_cycle_delay(output);
+      break;
+
+    case OUTPUT_CONTROL_ENABLED:
+      relay_control(output);
+      break;
+
+    case CYCLE_DELAY:
+      if ((chTimeNow() - output->cycle_delay_start_time) >= cycle_delay) {
+        /* Restart PID after cycle delay */
+        if (output->pid_control.enabled == false)
+          output->pid_control.enabled = true;
+
+        set_output_state(output, OUTPUT_CONTROL_ENABLED);
         relay_control(output);
-        break;
-
-      case CYCLE_DELAY:
-        if (cycle_delay < 1) {
-          set_output_state(output, OUTPUT_CONTROL_ENABLED);
-          break;
-        }
-
-        if ((chTimeNow() - output->cycle_delay_start_time) > cycle_delay) {
-          /* Restart PID after cycle delay */
-          if (output->pid_control.enabled == false)
-            output->pid_control.enabled = true;
-
-          set_output_state(output, OUTPUT_CONTROL_ENABLED);
-        }
-        break;
-    }
-
-    chThdSleepSeconds(1);
+      }
+      break;
   }
+}
 
-  enable_relay(output, false);
+static void
+update_outputs(temp_controller_t* tc)
+{
+  int i;
 
-  return 0;
+  for (i = 0; i < NUM_OUTPUTS; ++i)
+    output_update(&tc->outputs[i]);
 }
 
 static void
 relay_control(relay_output_t* output)
 {
-  const output_settings_t* output_settings = get_output_settings(output->controller, output->id);
+  output_settings_t output_settings = get_output_settings(output->controller, output->id);
   float sample = output->controller->last_sample.value;
   float setpoint = get_sp(output->controller);
   float hysteresis = app_cfg_get_hysteresis().value;
@@ -263,9 +273,15 @@ relay_control(relay_output_t* output)
     return;
   }
 
+  /* No setpoint, e.g. the selected profile is missing from the library */
+  if (isnan(setpoint)) {
+    enable_relay(output, false);
+    return;
+  }
+
   switch (app_cfg_get_control_mode()) {
   case ON_OFF:
-    if (output_settings->function == OUTPUT_FUNC_HEATING) {
+    if (output_settings.function == OUTPUT_FUNC_HEATING) {
       if (sample <= setpoint - hysteresis)
         enable_relay(output, true);
       else if (sample >= setpoint)
@@ -283,14 +299,14 @@ relay_control(relay_output_t* output)
     if (output->pid_control.enabled == false)
       output->pid_control.enabled = true;
 
-    if (output_settings->function == OUTPUT_FUNC_HEATING) {
-      if (sample < (setpoint + output->pid_control.out) - hysteresis)
+    if (output_settings.function == OUTPUT_FUNC_HEATING) {
+      if (sample < (setpoint + PID_VAL_FLOAT(output->pid_control.out)) - hysteresis)
         enable_relay(output, true);
       else
         enable_relay(output, false);
     }
     else {
-      if (sample > (setpoint - output->pid_control.out) + hysteresis)
+      if (sample > (setpoint - PID_VAL_FLOAT(output->pid_control.out)) + hysteresis)
         enable_relay(output, true);
       else
         enable_relay(output, false);
@@ -311,15 +327,22 @@ enable_relay(relay_output_t* output, bool enable)
 
   palWritePad(GPIOC, out_gpio[output->id], enable);
   output->status.enabled = enable;
-  msg_send(MSG_OUTPUT_STATUS, &output->status);
+  msg_post_state(MSG_OUTPUT_STATUS, output->id, &output->status, sizeof(output->status));
 }
 
 static void
 start_cycle_delay(relay_output_t* output)
 {
+  output_settings_t output_settings =
+      get_output_settings(output->controller, output->id);
+  systime_t cycle_delay = S2ST(60 * output_settings.cycle_delay.value);
+
   output->pid_control.enabled = false;
   output->cycle_delay_start_time = chTimeNow();
   set_output_state(output, CYCLE_DELAY);
+
+  if (output->active)
+    msg_timer_start(output->cycle_delay_timer, cycle_delay);
 }
 
 static void
@@ -327,19 +350,22 @@ set_output_state(relay_output_t* output, output_state_t output_state)
 {
   if (output->status.state != output_state) {
     output->status.state = output_state;
-    msg_send(MSG_OUTPUT_STATUS, &output->status);
+    msg_post_state(MSG_OUTPUT_STATUS, output->id, &output->status, sizeof(output->status));
   }
 }
 
 static void
-dispatch_temp_input_msg(msg_id_t id, void* msg_data, void* listener_data, void* sub_data)
+dispatch_temp_input_msg(msg_id_t id, void* msg_data, void* listener_data)
 {
   (void)listener_data;
-  (void)sub_data;
 
   switch (id) {
   case MSG_INIT:
-    dispatch_init(listener_data);
+    dispatch_init(listener_data, msg_data);
+    break;
+
+  case MSG_TIMER:
+    output_update(msg_data);
     break;
 
   case MSG_SENSOR_SAMPLE:
@@ -368,10 +394,11 @@ static float
 get_sp(temp_controller_t* tc)
 {
   float sp;
-  const controller_settings_t* settings = app_cfg_get_controller_settings(tc->controller);
+  controller_settings_t settings;
 
-  if (settings->setpoint_type == SP_STATIC)
-    return settings->static_setpoint.value;
+  app_cfg_get_controller_settings(tc->controller, &settings);
+  if (settings.setpoint_type == SP_STATIC)
+    return settings.static_setpoint.value;
   else if (temp_profile_get_current_setpoint(&tc->temp_profile_run, &sp))
     return sp;
 
@@ -379,10 +406,16 @@ get_sp(temp_controller_t* tc)
 }
 
 static void
-dispatch_init(temp_controller_t* tc)
+dispatch_init(temp_controller_t* tc, msg_listener_t* l)
 {
-  const controller_settings_t* cs = app_cfg_get_controller_settings(tc->controller);
-  dispatch_controller_settings(tc, cs, true);
+  int i;
+
+  for (i = 0; i < NUM_OUTPUTS; ++i)
+    tc->outputs[i].cycle_delay_timer = msg_timer_create(l, &tc->outputs[i]);
+
+  controller_settings_t cs;
+  app_cfg_get_controller_settings(tc->controller, &cs);
+  dispatch_controller_settings(tc, &cs, true);
 }
 
 static void
@@ -397,19 +430,29 @@ dispatch_sensor_sample(temp_controller_t* tc, sensor_msg_t* msg)
   if (tc->state == TC_SENSOR_TIMED_OUT)
     tc->state = TC_ACTIVE;
 
-  const controller_settings_t* cs = app_cfg_get_controller_settings(tc->controller);
-  if (cs->setpoint_type == SP_TEMP_PROFILE)
+  controller_settings_t cs;
+  app_cfg_get_controller_settings(tc->controller, &cs);
+  if (cs.setpoint_type == SP_TEMP_PROFILE)
     temp_profile_update(&tc->temp_profile_run, msg->sample);
 
   for (i = 0; i < NUM_OUTPUTS; ++i) {
-    const output_settings_t* output_settings = get_output_settings(tc, tc->outputs[i].id);
+    output_settings_t output_settings = get_output_settings(tc, tc->outputs[i].id);
       if (app_cfg_get_control_mode() == PID &&
-          output_settings->enabled == true) {
+          output_settings.enabled == true) {
         pid_exec(&tc->outputs[i].pid_control,
             get_sp(tc),
             msg->sample.value);
       }
   }
+
+  update_outputs(tc);
+
+  /* Have the sensor sample faster around the relay thresholds, which lie
+   * within one hysteresis of the setpoint
+   */
+  float sp = get_sp(tc);
+  float band = 2 * app_cfg_get_hysteresis().value;
+  sensor_set_control_band(tc->sensor, sp - band, sp + band);
 }
 
 static void
@@ -418,8 +461,10 @@ dispatch_sensor_timeout(temp_controller_t* tc, sensor_timeout_msg_t* msg)
   if (msg->sensor != tc->sensor)
     return;
 
-  if (tc->state == TC_ACTIVE)
+  if (tc->state == TC_ACTIVE) {
     tc->state = TC_SENSOR_TIMED_OUT;
+    update_outputs(tc);
+  }
 }
 
 static void
@@ -429,15 +474,8 @@ dispatch_controller_settings(temp_controller_t* tc, const controller_settings_t*
   if (tc->controller != settings->controller)
     return;
 
-  /* Stop output threads */
-  for (i = 0; i < NUM_OUTPUTS; ++i) {
-    relay_output_t* out = &tc->outputs[i];
-    if (out->thread != NULL) {
-      chThdTerminate(out->thread);
-      chThdWait(out->thread);
-      out->thread = NULL;
-    }
-  }
+  for (i = 0; i < NUM_OUTPUTS; ++i)
+    output_stop(&tc->outputs[i]);
 
   tc->state = TC_IDLE;
 
@@ -449,12 +487,14 @@ dispatch_controller_settings(temp_controller_t* tc, const controller_settings_t*
   if (settings->setpoint_type == SP_TEMP_PROFILE) {
     temp_profile_run_t* tpr = &tc->temp_profile_run;
     if (resume_profile)
-      temp_profile_resume(tpr, tc->controller);
+      temp_profile_resume(tpr, tc->controller, &settings->temp_profile);
     else
-      temp_profile_start(tpr, tc->controller, settings->temp_profile.id, settings->temp_profile.start_point);
+      temp_profile_start(tpr, tc->controller, &settings->temp_profile);
   }
 
   tc->state = TC_SENSOR_TIMED_OUT;
+
+  update_outputs(tc);
 }
 
 static void
@@ -464,4 +504,6 @@ dispatch_output_ovrd(temp_controller_t* tc, output_ovrd_msg_t* msg)
     tc->outputs[msg->output].output_ovrd = true;
   else
     tc->outputs[msg->output].output_ovrd = false;
+
+  output_update(&tc->outputs[msg->output]);
 }
@@ -13,8 +13,6 @@ typedef enum {
   NUM_CONTROLLERS
 } temp_controller_id_t;
 
-#include "temp_profile.h"
-
 typedef enum {
   OUTPUT_NONE = -1,
   OUTPUT_1,
@@ -72,21 +70,30 @@ typedef struct {
   temp_profile_step_type_t type;
 } temp_profile_step_t;
 
+/* Profile header as stored in the profile library. The steps are kept in
+ * flash and read through temp_profile_lib_read_steps().
+ */
 typedef struct {
   uint32_t id;
   char name[100];
   uint32_t num_steps;
   quantity_t start_value;
-  temp_profile_step_t steps[32];
+} temp_profile_t;
+
+/* How a controller runs a profile from the library */
+typedef struct {
+  uint32_t id;
   int start_point;
   temp_profile_completion_action_t completion_action;
-} temp_profile_t;
+} temp_profile_ref_t;
+
+#include "temp_profile.h"
 
 typedef struct {
   temp_controller_id_t controller;
   setpoint_type_t setpoint_type;
   quantity_t static_setpoint;
-  temp_profile_t temp_profile;
+  temp_profile_ref_t temp_profile;
   output_settings_t output_settings[NUM_OUTPUTS];
   session_action_t session_action;
 } controller_settings_t;
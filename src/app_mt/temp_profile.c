@@ -1,33 +1,177 @@
-
 #include "temp_profile.h"
+#include "temp_profile_lib.h"
 #include "message.h"
 #include "app_cfg.h"
+#include "common.h"
 #include <stdio.h>
+#include <math.h>
 
 // 4 hours
 #define CHECKPOINT_PERIOD S2ST(4 * 60 * 60)
 
+// Steps read from the profile library at a time
+#define STEP_CHUNK_SIZE 8
+
+/* Walks the segments of a profile in order, reading its steps from the
+ * profile library a chunk at a time.
+ */
+typedef struct {
+  uint32_t profile_id;
+  uint32_t num_steps;
+  uint32_t step;
+  uint32_t start;
+  float last_value;
+  uint32_t chunk_first;
+  uint32_t chunk_len;
+  temp_profile_step_t chunk[STEP_CHUNK_SIZE];
+} segment_iter_t;
+
 static void write_checkpoint(temp_profile_run_t* run);
+static void update_elapsed(temp_profile_run_t* run);
+static uint32_t get_elapsed(const temp_profile_run_t* run);
+static void iter_init(segment_iter_t* it, const temp_profile_timeline_t* timeline);
+static bool iter_next(segment_iter_t* it, temp_profile_segment_t* seg);
+static void page_window(temp_profile_run_t* run);
+static bool wrap_time(const temp_profile_timeline_t* timeline, uint32_t* t);
+static uint32_t find_segment(const temp_profile_timeline_t* timeline, uint32_t t);
+static uint32_t find_step(const temp_profile_timeline_t* timeline, uint32_t t, uint32_t* step_start);
+static uint32_t window_start(const temp_profile_timeline_t* timeline);
+static uint32_t segment_end(const temp_profile_timeline_t* timeline, uint32_t seg);
+static float segment_value(const temp_profile_segment_t* seg, uint32_t t);
+
+
+/* Fills in everything but the segment window, which starts out empty. When
+ * the timeline belongs to a run, the run's mtx must be held.
+ */
+bool
+temp_profile_compile(temp_profile_timeline_t* timeline, const temp_profile_ref_t* ref)
+{
+  temp_profile_t profile;
+  temp_profile_segment_t seg;
+  segment_iter_t it;
+
+  timeline->profile_id = ref->id;
+  timeline->valid = temp_profile_lib_get(ref->id, &profile);
+  timeline->start_over =
+      (ref->completion_action == TEMP_PROFILE_COMPLETION_ACTION_START_OVER);
+
+  if (timeline->valid) {
+    timeline->num_steps = profile.num_steps;
+    timeline->start_value = profile.start_value.value;
+  }
+  else {
+    printf("temp profile %d not found\r\n", (int)ref->id);
+    timeline->num_steps = 0;
+    timeline->start_value = NAN;
+  }
+
+  iter_init(&it, timeline);
+  while (iter_next(&it, &seg))
+    ;
+
+  /* Stop at whatever could be read if the profile was cut short */
+  timeline->num_steps = it.step;
+  timeline->duration = it.start;
+  timeline->end_value = it.last_value;
+
+  timeline->first_segment = 0;
+  timeline->num_segments = 0;
+  timeline->window_end = 0;
+
+  return timeline->valid;
+}
+
+uint32_t
+temp_profile_lookup(const temp_profile_timeline_t* timeline, uint32_t t, float* sp)
+{
+  uint32_t seg;
+
+  if (!wrap_time(timeline, &t) || timeline->num_segments == 0) {
+    *sp = timeline->end_value;
+    return TEMP_PROFILE_NO_CHANGE;
+  }
 
+  /* The window is moved along as the profile runs. Until it catches up
+   * hold the setpoint at the nearest edge.
+   */
+  if (t < window_start(timeline))
+    t = window_start(timeline);
+  else if (t > timeline->window_end)
+    t = timeline->window_end;
+
+  seg = find_segment(timeline, t);
+  *sp = segment_value(&timeline->segments[seg], t);
+
+  return segment_end(timeline, seg) - t;
+}
 
 void
-temp_profile_start(temp_profile_run_t* run, temp_controller_id_t controller, uint32_t temp_profile_id, int start_point)
+temp_profile_preview(const temp_profile_timeline_t* timeline, float* points, uint32_t num_points)
 {
-  if ((temp_profile_id != run->temp_profile_id) ||
-      (start_point >= 0)) {
-    run->current_step = start_point;
-    run->current_step_start_time = chTimeNow();
+  temp_profile_segment_t seg;
+  segment_iter_t it;
+  bool have_seg;
+  uint32_t i;
+
+  iter_init(&it, timeline);
+  have_seg = iter_next(&it, &seg);
+
+  for (i = 0; i < num_points; ++i) {
+    uint32_t t = 0;
+
+    if (num_points > 1)
+      t = ((uint64_t)timeline->duration * i) / (num_points - 1);
+
+    /* Points are in time order, so the steps only need to be read once */
+    while (have_seg && it.start <= t && iter_next(&it, &seg))
+      ;
+
+    if (have_seg)
+      points[i] = segment_value(&seg, t);
+    else
+      points[i] = timeline->start_value;
+  }
+}
+
+void
+temp_profile_init(temp_profile_run_t* run)
+{
+  chMtxInit(&run->mtx);
+}
+
+void
+temp_profile_start(temp_profile_run_t* run, temp_controller_id_t controller, const temp_profile_ref_t* profile)
+{
+  uint32_t step = 0;
+
+  chMtxLock(&run->mtx);
+
+  temp_profile_compile(&run->timeline, profile);
 
-    if (run->current_step == 0) {
+  if (profile->start_point > 0)
+    step = profile->start_point;
+
+  if ((profile->id != run->temp_profile_id) ||
+      (profile->start_point >= 0)) {
+    temp_profile_load_window(&run->timeline, step);
+    run->elapsed = window_start(&run->timeline);
+    run->elapsed_time = chTimeNow();
+
+    if (step == 0) {
       run->state = TPS_SEEKING_START_VALUE;
     }
     else {
       run->state = TPS_RUNNING;
     }
   }
+  else {
+    page_window(run);
+  }
 
   run->controller = controller;
-  run->temp_profile_id = temp_profile_id;
+  run->temp_profile_id = profile->id;
+
+  chMtxUnlock();
 
   write_checkpoint(run);
 
@@ -35,68 +179,130 @@ temp_profile_start(temp_profile_run_t* run, temp_controller_id_t controller, uin
   printf("  controller: %d\r\n", (int)run->controller);
   printf("  profile id: %d\r\n", (int)run->temp_profile_id);
   printf("  state: %d\r\n", (int)run->state);
-  printf("  cur step: %d\r\n", (int)run->current_step);
-  printf("  cur step time: %d\r\n", (int)run->current_step_start_time);
-  printf("  next chkpt: %d\r\n", (int)run->next_checkpoint);
+  printf("  elapsed: %d\r\n", (int)run->elapsed);
+  printf("  duration: %d\r\n", (int)run->timeline.duration);
 }
 
 void
-temp_profile_resume(temp_profile_run_t* run, temp_controller_id_t controller)
+temp_profile_resume(temp_profile_run_t* run, temp_controller_id_t controller, const temp_profile_ref_t* profile)
 {
-  const temp_profile_checkpoint_t* checkpoint = app_cfg_get_temp_profile_checkpoint(controller);
+  temp_profile_checkpoint_t checkpoint;
+
+  app_cfg_get_temp_profile_checkpoint(controller, &checkpoint);
+
+  chMtxLock(&run->mtx);
+
+  temp_profile_compile(&run->timeline, profile);
+  temp_profile_load_window(&run->timeline, checkpoint.current_step);
 
   run->controller = controller;
-  run->temp_profile_id = checkpoint->temp_profile_id;
-  run->state = checkpoint->state;
-  run->current_step = checkpoint->current_step;
-  run->current_step_start_time = chTimeNow() - checkpoint->current_step_time;
-  run->next_checkpoint = chTimeNow() + CHECKPOINT_PERIOD;
+  run->temp_profile_id = checkpoint.temp_profile_id;
+  run->state = checkpoint.state;
+  run->elapsed = window_start(&run->timeline) + checkpoint.current_step_time;
+  run->elapsed_time = chTimeNow();
+  run->last_checkpoint = chTimeNow();
+
+  chMtxUnlock();
 
   printf("Resuming profile\r\n");
   printf("  controller: %d\r\n", (int)run->controller);
   printf("  profile id: %d\r\n", (int)run->temp_profile_id);
   printf("  state: %d\r\n", (int)run->state);
-  printf("  cur step: %d\r\n", (int)run->current_step);
-  printf("  cur step time: %d\r\n", (int)run->current_step_start_time);
-  printf("  next chkpt: %d\r\n", (int)run->next_checkpoint);
+  printf("  elapsed: %d\r\n", (int)run->elapsed);
+  printf("  duration: %d\r\n", (int)run->timeline.duration);
 }
 
 void
 temp_profile_update(temp_profile_run_t* run, quantity_t sample)
 {
+  const temp_profile_timeline_t* timeline = &run->timeline;
+
+  chMtxLock(&run->mtx);
+
   switch (run->state) {
     case TPS_SEEKING_START_VALUE:
     {
-      const temp_profile_t* profile = &app_cfg_get_controller_settings(run->controller)->temp_profile;
-      float start_err = sample.value - profile->start_value.value;
+      float start_err = sample.value - timeline->start_value;
 
       if (start_err < 1 && start_err > -1) {
-        run->current_step = 0;
-        run->current_step_start_time = chTimeNow();
+        run->elapsed = 0;
+        run->elapsed_time = chTimeNow();
         run->state = TPS_RUNNING;
       }
       break;
     }
 
+    case TPS_RUNNING:
+    {
+      update_elapsed(run);
+
+      if (run->elapsed >= timeline->duration) {
+        if (timeline->start_over && timeline->duration > 0)
+          run->elapsed %= timeline->duration;
+        else
+          run->state = TPS_HOLD_LAST;
+      }
+
+      page_window(run);
+      break;
+    }
+
     default:
       break;
   }
 
-  if (chTimeNow() > run->next_checkpoint)
+  chMtxUnlock();
+
+  if ((chTimeNow() - run->last_checkpoint) >= CHECKPOINT_PERIOD)
     write_checkpoint(run);
 }
 
+/* Moves elapsed up to the current time, keeping the part second over in
+ * elapsed_time. Must be called often enough that the ticks since
+ * elapsed_time do not wrap, which the once a second samples easily are.
+ */
+static void
+update_elapsed(temp_profile_run_t* run)
+{
+  uint32_t secs = (chTimeNow() - run->elapsed_time) / CH_FREQUENCY;
+
+  run->elapsed += secs;
+  run->elapsed_time += secs * CH_FREQUENCY;
+}
+
+static uint32_t
+get_elapsed(const temp_profile_run_t* run)
+{
+  return run->elapsed + ((chTimeNow() - run->elapsed_time) / CH_FREQUENCY);
+}
+
 static void
 write_checkpoint(temp_profile_run_t* run)
 {
+  const temp_profile_timeline_t* timeline = &run->timeline;
   temp_profile_checkpoint_t checkpoint = {
       .temp_profile_id = run->temp_profile_id,
       .state = run->state,
-      .current_step = run->current_step,
-      .current_step_time = chTimeNow() - run->current_step_start_time
+      .current_step = 0,
+      .current_step_time = 0
   };
+
+  if (run->state == TPS_RUNNING) {
+    uint32_t t = get_elapsed(run);
+
+    if (wrap_time(timeline, &t)) {
+      uint32_t step_start;
+
+      checkpoint.current_step = find_step(timeline, t, &step_start);
+      checkpoint.current_step_time = t - step_start;
+    }
+    else {
+      checkpoint.state = TPS_HOLD_LAST;
+    }
+  }
+
   app_cfg_set_temp_profile_checkpoint(run->controller, &checkpoint);
-  run->next_checkpoint = chTimeNow() + CHECKPOINT_PERIOD;
+  run->last_checkpoint = chTimeNow();
 
   printf("Saving profile checkpoint\r\n");
   printf("  profile id: %d\r\n", (int)checkpoint.temp_profile_id);
@@ -108,57 +314,209 @@ write_checkpoint(temp_profile_run_t* run)
 bool
 temp_profile_get_current_setpoint(temp_profile_run_t* run, float* sp)
 {
-  bool ret = true;
-  const temp_profile_t* profile = &app_cfg_get_controller_settings(run->controller)->temp_profile;
+  bool valid;
 
-  if (run->state == TPS_RUNNING) {
-    if (chTimeNow() > run->current_step_start_time + S2ST(profile->steps[run->current_step].duration)) {
-      if (++run->current_step >= profile->num_steps) {
-        if (profile->completion_action == TEMP_PROFILE_COMPLETION_ACTION_START_OVER) {
-          run->current_step = 0;
-          run->current_step_start_time = chTimeNow();
-        }
-        else {
-          run->state = TPS_HOLD_LAST;
-        }
-      }
-      else {
-        run->current_step_start_time = chTimeNow();
-      }
+  chMtxLock(&run->mtx);
+
+  valid = run->timeline.valid;
+  if (valid) {
+    switch (run->state) {
+      case TPS_SEEKING_START_VALUE:
+        *sp = run->timeline.start_value;
+        break;
+
+      case TPS_RUNNING:
+        temp_profile_lookup(&run->timeline, get_elapsed(run), sp);
+        break;
+
+      case TPS_HOLD_LAST:
+        *sp = run->timeline.end_value;
+        break;
     }
   }
 
-  switch (run->state) {
-    case TPS_SEEKING_START_VALUE:
-      *sp = profile->start_value.value;
-      break;
+  chMtxUnlock();
 
-    case TPS_RUNNING:
-    {
-      const temp_profile_step_t* cur_step = &profile->steps[run->current_step];
-      if (cur_step->type == STEP_HOLD) {
-        *sp = cur_step->value.value;
-      }
-      else {
-        float last_temp;
-        if (run->current_step == 0)
-          last_temp = profile->start_value.value;
-        else
-          last_temp = profile->steps[run->current_step - 1].value.value;
+  return valid;
+}
 
-        systime_t duration_into_step = chTimeNow() - run->current_step_start_time;
-        *sp = last_temp + ((cur_step->value.value - last_temp) * duration_into_step / S2ST(cur_step->duration));
-      }
-      break;
-    }
+static void
+iter_init(segment_iter_t* it, const temp_profile_timeline_t* timeline)
+{
+  it->profile_id = timeline->profile_id;
+  it->num_steps = timeline->num_steps;
+  it->step = 0;
+  it->start = 0;
+  it->last_value = timeline->start_value;
+  it->chunk_first = 0;
+  it->chunk_len = 0;
+}
 
-    case TPS_HOLD_LAST:
-      if (profile->num_steps > 0)
-        *sp = profile->steps[profile->num_steps-1].value.value;
-      else
-        *sp = profile->start_value.value;
-      break;
+static bool
+iter_next(segment_iter_t* it, temp_profile_segment_t* seg)
+{
+  const temp_profile_step_t* step;
+  uint32_t duration;
+
+  if (it->step >= it->num_steps)
+    return false;
+
+  if (it->step >= (it->chunk_first + it->chunk_len)) {
+    it->chunk_first = it->step;
+    it->chunk_len = temp_profile_lib_read_steps(it->profile_id, it->step,
+        it->chunk, STEP_CHUNK_SIZE);
+    if (it->chunk_len == 0)
+      return false;
   }
 
-  return ret;
+  step = &it->chunk[it->step - it->chunk_first];
+  duration = step->duration;
+
+  seg->start = it->start;
+  if (step->type == STEP_RAMP && duration > 0) {
+    seg->intercept = it->last_value;
+    seg->slope = (step->value.value - it->last_value) / duration;
+  }
+  else {
+    seg->intercept = step->value.value;
+    seg->slope = 0;
+  }
+
+  it->start += duration;
+  it->last_value = step->value.value;
+  it->step++;
+
+  return true;
+}
+
+void
+temp_profile_load_window(temp_profile_timeline_t* timeline, uint32_t first_segment)
+{
+  temp_profile_segment_t seg;
+  segment_iter_t it;
+  uint32_t n = 0;
+
+  iter_init(&it, timeline);
+  while (it.step < first_segment && iter_next(&it, &seg))
+    ;
+
+  timeline->first_segment = it.step;
+  while (n < TEMP_PROFILE_WINDOW_SIZE &&
+      iter_next(&it, &timeline->segments[n]))
+    n++;
+
+  timeline->num_segments = n;
+  timeline->window_end = it.start;
+}
+
+/* Keeps the current step in the first half of the window, so lookups from
+ * other threads always find it paged in. Must be called with run->mtx held.
+ */
+static void
+page_window(temp_profile_run_t* run)
+{
+  const temp_profile_timeline_t* timeline = &run->timeline;
+  uint32_t t = get_elapsed(run);
+  uint32_t step_start;
+  uint32_t step;
+
+  if (!wrap_time(timeline, &t))
+    return;
+
+  step = find_step(timeline, t, &step_start);
+
+  if (step < timeline->first_segment ||
+      step >= (timeline->first_segment + timeline->num_segments) ||
+      ((step - timeline->first_segment) >= (TEMP_PROFILE_WINDOW_SIZE / 2) &&
+       (timeline->first_segment + timeline->num_segments) < timeline->num_steps))
+    temp_profile_load_window(&run->timeline, step);
+}
+
+/* Maps t onto the current pass of the profile. Returns false once a profile
+ * that does not start over has run to completion.
+ */
+static bool
+wrap_time(const temp_profile_timeline_t* timeline, uint32_t* t)
+{
+  if (*t < timeline->duration)
+    return true;
+
+  if (!timeline->start_over || timeline->duration == 0)
+    return false;
+
+  *t %= timeline->duration;
+  return true;
+}
+
+/* Binary search for the last segment in the window starting at or before t */
+static uint32_t
+find_segment(const temp_profile_timeline_t* timeline, uint32_t t)
+{
+  uint32_t lo = 0;
+  uint32_t hi = timeline->num_segments;
+
+  while ((hi - lo) > 1) {
+    uint32_t mid = lo + ((hi - lo) / 2);
+
+    if (timeline->segments[mid].start <= t)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/* Finds the step that t falls in, searching the window when it covers t and
+ * reading through the profile otherwise
+ */
+static uint32_t
+find_step(const temp_profile_timeline_t* timeline, uint32_t t, uint32_t* step_start)
+{
+  temp_profile_segment_t seg;
+  segment_iter_t it;
+  uint32_t step = 0;
+
+  if (timeline->num_segments > 0 &&
+      t >= window_start(timeline) &&
+      t < timeline->window_end) {
+    uint32_t i = find_segment(timeline, t);
+
+    *step_start = timeline->segments[i].start;
+    return timeline->first_segment + i;
+  }
+
+  *step_start = 0;
+
+  iter_init(&it, timeline);
+  while (iter_next(&it, &seg) && seg.start <= t) {
+    step = it.step - 1;
+    *step_start = seg.start;
+  }
+
+  return step;
+}
+
+static uint32_t
+window_start(const temp_profile_timeline_t* timeline)
+{
+  if (timeline->num_segments > 0)
+    return timeline->segments[0].start;
+
+  return timeline->window_end;
+}
+
+static uint32_t
+segment_end(const temp_profile_timeline_t* timeline, uint32_t seg)
+{
+  if ((seg + 1) < timeline->num_segments)
+    return timeline->segments[seg + 1].start;
+
+  return timeline->window_end;
+}
+
+static float
+segment_value(const temp_profile_segment_t* seg, uint32_t t)
+{
+  return seg->intercept + (seg->slope * (t - seg->start));
 }
@@ -8,34 +8,102 @@
 #include "temp_control.h"
 
 
+/* Number of segments held in RAM at a time. The rest of the profile is paged
+ * in from the profile library as it runs.
+ */
+#define TEMP_PROFILE_WINDOW_SIZE 32
+
 typedef enum {
   TPS_SEEKING_START_VALUE,
   TPS_RUNNING,
   TPS_HOLD_LAST
 } temp_profile_run_state_t;
 
+/* Returned by temp_profile_lookup() when the setpoint will not change again */
+#define TEMP_PROFILE_NO_CHANGE UINT32_MAX
+
+/* One step of a compiled profile. The setpoint at time t (relative to the
+ * start of the profile) is intercept + slope * (t - start).
+ */
+typedef struct {
+  uint32_t start;
+  float slope;
+  float intercept;
+} temp_profile_segment_t;
+
+/* A profile compiled to absolute times, so the setpoint can be looked up
+ * without walking the steps. segments holds the window of num_segments
+ * segments starting at first_segment. Times are in seconds from the start of
+ * the profile, so they do not wrap the way system time does on profiles that
+ * run for weeks.
+ */
+typedef struct {
+  uint32_t profile_id;
+  bool valid;
+  uint32_t num_steps;
+  uint32_t duration;
+  bool start_over;
+  float start_value;
+  float end_value;
+  uint32_t first_segment;
+  uint32_t num_segments;
+  uint32_t window_end;
+  temp_profile_segment_t segments[TEMP_PROFILE_WINDOW_SIZE];
+} temp_profile_timeline_t;
+
+/* The run is only changed by the controller's thread, with mtx held so the
+ * setpoint can be read from other threads. elapsed is the time into the
+ * profile in seconds as of elapsed_time.
+ */
 typedef struct {
   temp_controller_id_t controller;
   uint32_t temp_profile_id;
   temp_profile_run_state_t state;
-  uint32_t current_step;
-  systime_t current_step_start_time;
-  systime_t next_checkpoint;
+  uint32_t elapsed;
+  systime_t elapsed_time;
+  systime_t last_checkpoint;
+  Mutex mtx;
+  temp_profile_timeline_t timeline;
 } temp_profile_run_t;
 
 typedef struct {
   uint32_t temp_profile_id;
   temp_profile_run_state_t state;
   uint32_t current_step;
-  systime_t current_step_time;
+  // seconds
+  uint32_t current_step_time;
 } temp_profile_checkpoint_t;
 
 
+bool
+temp_profile_compile(temp_profile_timeline_t* timeline, const temp_profile_ref_t* profile);
+
+/* Reads up to TEMP_PROFILE_WINDOW_SIZE segments starting at first_segment
+ * into the window. When the timeline belongs to a run, the run's mtx must be
+ * held.
+ */
+void
+temp_profile_load_window(temp_profile_timeline_t* timeline, uint32_t first_segment);
+
+/* Looks up the setpoint t seconds from the start of the profile. Returns the
+ * seconds until the setpoint next changes slope, or TEMP_PROFILE_NO_CHANGE if
+ * it never will.
+ */
+uint32_t
+temp_profile_lookup(const temp_profile_timeline_t* timeline, uint32_t t, float* sp);
+
+/* Samples num_points setpoints evenly spaced over one pass of the profile */
+void
+temp_profile_preview(const temp_profile_timeline_t* timeline, float* points, uint32_t num_points);
+
+void
+temp_profile_init(temp_profile_run_t* run);
+
 void
-temp_profile_start(temp_profile_run_t* run, temp_controller_id_t controller, uint32_t temp_profile_id, int start_point);
+temp_profile_start(temp_profile_run_t* run, temp_controller_id_t controller, const temp_profile_ref_t* profile);
 
 void
-temp_profile_resume(temp_profile_run_t* run, temp_controller_id_t controller);
+temp_profile_resume(temp_profile_run_t* run, temp_controller_id_t controller, const temp_profile_ref_t* profile);
 
 void
 temp_profile_update(temp_profile_run_t* run, quantity_t sample);
@@ -0,0 +1,451 @@
+
+#include "ch.h"
+#include "temp_profile_lib.h"
+#include "app_cfg.h"
+#include "sxfs.h"
+#include "common.h"
+#include "crc/crc32.h"
+
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+
+
+/* Profiles are stored as variable length records appended to one of two
+ * banks. A record that is replaced or deleted is marked dead in place, and
+ * when the active bank fills up the live records are copied to the other
+ * bank. The bank header is written last, so a copy that is interrupted
+ * leaves the old bank in use.
+ */
+
+#define BANK_SIZE      0x20000 // 128 KB
+#define NUM_BANKS      2
+#define COPY_BUF_SIZE  256
+
+#define BANK_MAGIC     0x424C5054 // "TPLB"
+#define REC_MAGIC      0x52504C54 // "TLPR"
+#define REC_LIVE       0xFFFFFFFF
+#define REC_DEAD       0x00000000
+#define ERASED_WORD    0xFFFFFFFF
+
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;
+} bank_hdr_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t len;
+  uint32_t crc;
+  uint32_t state;
+  temp_profile_t profile;
+} rec_hdr_t;
+
+typedef struct {
+  uint32_t id;
+  uint32_t offset;
+  uint32_t num_steps;
+} index_entry_t;
+
+
+static void scan_bank(void);
+static bool compact(void);
+static bool evict(void);
+static bool read_rec_hdr(uint32_t offset, rec_hdr_t* hdr);
+static bool rec_is_valid(uint32_t offset, const rec_hdr_t* hdr);
+static bool mark_dead(uint32_t offset);
+static int index_find(uint32_t id);
+static void index_remove(int idx);
+static uint32_t bank_base(uint32_t bank);
+
+
+static Mutex lib_mtx;
+static uint32_t active_bank;
+static uint32_t bank_seq;
+static uint32_t write_offset;
+
+/* Live records, oldest first */
+static index_entry_t lib_index[TEMP_PROFILE_LIB_MAX_PROFILES];
+static uint32_t num_entries;
+
+
+void
+temp_profile_lib_init()
+{
+  bank_hdr_t hdrs[NUM_BANKS];
+  uint32_t i;
+  int bank = -1;
+
+  chMtxInit(&lib_mtx);
+
+  for (i = 0; i < NUM_BANKS; ++i) {
+    sxfs_read(SP_TEMP_PROFILES, bank_base(i), (uint8_t*)&hdrs[i], sizeof(bank_hdr_t));
+    if (hdrs[i].magic != BANK_MAGIC)
+      continue;
+
+    if (bank < 0 || (int32_t)(hdrs[i].seq - hdrs[bank].seq) > 0)
+      bank = i;
+  }
+
+  if (bank < 0) {
+    bank_hdr_t hdr = {
+        .magic = BANK_MAGIC,
+        .seq = 0
+    };
+
+    printf("Formatting temp profile library\r\n");
+    bank = 0;
+    if (!sxfs_erase(SP_TEMP_PROFILES, bank_base(bank), BANK_SIZE) ||
+        !sxfs_write(SP_TEMP_PROFILES, bank_base(bank), (uint8_t*)&hdr, sizeof(hdr)))
+      printf("temp profile library format failed!\r\n");
+    hdrs[bank] = hdr;
+  }
+
+  active_bank = bank;
+  bank_seq = hdrs[bank].seq;
+
+  scan_bank();
+
+  printf("Loaded %d temp profiles\r\n", (int)num_entries);
+}
+
+bool
+temp_profile_lib_put(const temp_profile_t* profile, const temp_profile_step_t* steps)
+{
+  uint32_t steps_len = profile->num_steps * sizeof(temp_profile_step_t);
+  bool ret = false;
+  rec_hdr_t hdr;
+  int idx;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = REC_MAGIC;
+  hdr.len = sizeof(rec_hdr_t) + steps_len;
+  hdr.state = REC_LIVE;
+  hdr.profile = *profile;
+  hdr.crc = crc32_block(0, &hdr.profile, sizeof(temp_profile_t));
+  hdr.crc = crc32_block(hdr.crc, (void*)steps, steps_len);
+
+  if (hdr.len > (BANK_SIZE - sizeof(bank_hdr_t)))
+    return false;
+
+  chMtxLock(&lib_mtx);
+
+  idx = index_find(profile->id);
+  if (idx >= 0) {
+    rec_hdr_t old_hdr;
+
+    /* The server resends profiles with every settings update, don't wear
+     * the flash rewriting one that has not changed
+     */
+    if (read_rec_hdr(lib_index[idx].offset, &old_hdr) &&
+        old_hdr.len == hdr.len &&
+        old_hdr.crc == hdr.crc) {
+      chMtxUnlock();
+      return true;
+    }
+  }
+  else if (num_entries >= TEMP_PROFILE_LIB_MAX_PROFILES) {
+    if (!evict()) {
+      chMtxUnlock();
+      printf("temp profile library full!\r\n");
+      return false;
+    }
+  }
+
+  if ((write_offset + hdr.len) > (bank_base(active_bank) + BANK_SIZE))
+    compact();
+
+  if ((write_offset + hdr.len) <= (bank_base(active_bank) + BANK_SIZE)) {
+    /* The header goes first so a partially written record can always be
+     * skipped over
+     */
+    ret = sxfs_write(SP_TEMP_PROFILES, write_offset, (uint8_t*)&hdr, sizeof(hdr));
+    if (ret && steps_len > 0)
+      ret = sxfs_write(SP_TEMP_PROFILES, write_offset + sizeof(hdr), (uint8_t*)steps, steps_len);
+
+    if (ret) {
+      idx = index_find(profile->id);
+      if (idx >= 0) {
+        mark_dead(lib_index[idx].offset);
+        index_remove(idx);
+      }
+
+      lib_index[num_entries].id = profile->id;
+      lib_index[num_entries].offset = write_offset;
+      lib_index[num_entries].num_steps = profile->num_steps;
+      num_entries++;
+    }
+    else {
+      printf("temp profile write failed! %d\r\n", (int)profile->id);
+    }
+
+    write_offset += hdr.len;
+  }
+  else {
+    printf("no space for temp profile! %d\r\n", (int)profile->id);
+  }
+
+  chMtxUnlock();
+
+  return ret;
+}
+
+bool
+temp_profile_lib_get(uint32_t id, temp_profile_t* profile)
+{
+  bool ret = false;
+  rec_hdr_t hdr;
+  int idx;
+
+  chMtxLock(&lib_mtx);
+
+  idx = index_find(id);
+  if (idx >= 0 && read_rec_hdr(lib_index[idx].offset, &hdr)) {
+    *profile = hdr.profile;
+    ret = true;
+  }
+
+  chMtxUnlock();
+
+  return ret;
+}
+
+uint32_t
+temp_profile_lib_read_steps(uint32_t id, uint32_t first_step, temp_profile_step_t* steps, uint32_t num_steps)
+{
+  uint32_t steps_read = 0;
+  int idx;
+
+  chMtxLock(&lib_mtx);
+
+  idx = index_find(id);
+  if (idx >= 0 && first_step < lib_index[idx].num_steps) {
+    uint32_t offset = lib_index[idx].offset + sizeof(rec_hdr_t) +
+        (first_step * sizeof(temp_profile_step_t));
+
+    steps_read = MIN(num_steps, lib_index[idx].num_steps - first_step);
+    if (!sxfs_read(SP_TEMP_PROFILES, offset, (uint8_t*)steps, steps_read * sizeof(temp_profile_step_t)))
+      steps_read = 0;
+  }
+
+  chMtxUnlock();
+
+  return steps_read;
+}
+
+bool
+temp_profile_lib_delete(uint32_t id)
+{
+  bool ret = false;
+  int idx;
+
+  chMtxLock(&lib_mtx);
+
+  idx = index_find(id);
+  if (idx >= 0) {
+    ret = mark_dead(lib_index[idx].offset);
+    index_remove(idx);
+  }
+
+  chMtxUnlock();
+
+  return ret;
+}
+
+static void
+scan_bank()
+{
+  uint32_t offset = bank_base(active_bank) + sizeof(bank_hdr_t);
+  uint32_t end = bank_base(active_bank) + BANK_SIZE;
+
+  num_entries = 0;
+
+  while ((offset + sizeof(rec_hdr_t)) <= end) {
+    rec_hdr_t hdr;
+
+    if (!read_rec_hdr(offset, &hdr) || hdr.magic == ERASED_WORD)
+      break;
+
+    if (hdr.magic != REC_MAGIC ||
+        hdr.len < sizeof(rec_hdr_t) ||
+        (offset + hdr.len) > end) {
+      /* A header write was interrupted. Nothing after it can be trusted or
+       * written to, so leave the bank full and let the next write compact it.
+       */
+      printf("temp profile library corrupt at 0x%x\r\n", (unsigned int)offset);
+      offset = end;
+      break;
+    }
+
+    if (hdr.state == REC_LIVE && rec_is_valid(offset, &hdr)) {
+      /* A newer copy of a profile supersedes one that was not marked dead */
+      int idx = index_find(hdr.profile.id);
+      if (idx >= 0)
+        index_remove(idx);
+
+      if (num_entries < TEMP_PROFILE_LIB_MAX_PROFILES) {
+        lib_index[num_entries].id = hdr.profile.id;
+        lib_index[num_entries].offset = offset;
+        lib_index[num_entries].num_steps = hdr.profile.num_steps;
+        num_entries++;
+      }
+    }
+
+    offset += hdr.len;
+  }
+
+  write_offset = offset;
+}
+
+static bool
+compact()
+{
+  uint32_t new_bank = (active_bank + 1) % NUM_BANKS;
+  uint32_t offset = bank_base(new_bank) + sizeof(bank_hdr_t);
+  bank_hdr_t bank_hdr = {
+      .magic = BANK_MAGIC,
+      .seq = bank_seq + 1
+  };
+  bool ret;
+  uint32_t i;
+
+  printf("Compacting temp profile library\r\n");
+
+  ret = sxfs_erase(SP_TEMP_PROFILES, bank_base(new_bank), BANK_SIZE);
+
+  uint8_t* buf = malloc(COPY_BUF_SIZE);
+  for (i = 0; ret && i < num_entries; ++i) {
+    rec_hdr_t hdr;
+    uint32_t copied = 0;
+
+    ret = read_rec_hdr(lib_index[i].offset, &hdr);
+    while (ret && copied < hdr.len) {
+      uint32_t len = MIN(COPY_BUF_SIZE, hdr.len - copied);
+
+      ret = sxfs_read(SP_TEMP_PROFILES, lib_index[i].offset + copied, buf, len) &&
+          sxfs_write(SP_TEMP_PROFILES, offset + copied, buf, len);
+      copied += len;
+    }
+
+    offset += hdr.len;
+  }
+  free(buf);
+
+  if (ret)
+    ret = sxfs_write(SP_TEMP_PROFILES, bank_base(new_bank), (uint8_t*)&bank_hdr, sizeof(bank_hdr));
+
+  if (!ret) {
+    printf("temp profile library compaction failed!\r\n");
+    return false;
+  }
+
+  if (!sxfs_erase(SP_TEMP_PROFILES, bank_base(active_bank), BANK_SIZE))
+    printf("old temp profile bank erase failed! %d\r\n", (int)active_bank);
+
+  active_bank = new_bank;
+  bank_seq = bank_hdr.seq;
+  scan_bank();
+
+  return true;
+}
+
+/* Drops the oldest profile that no controller is using */
+static bool
+evict()
+{
+  uint32_t i;
+  int c;
+
+  for (i = 0; i < num_entries; ++i) {
+    bool in_use = false;
+
+    for (c = 0; c < NUM_CONTROLLERS; ++c) {
+      controller_settings_t cs;
+      app_cfg_get_controller_settings(c, &cs);
+      if (cs.setpoint_type == SP_TEMP_PROFILE &&
+          cs.temp_profile.id == lib_index[i].id)
+        in_use = true;
+    }
+
+    if (!in_use) {
+      mark_dead(lib_index[i].offset);
+      index_remove(i);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static bool
+read_rec_hdr(uint32_t offset, rec_hdr_t* hdr)
+{
+  return sxfs_read(SP_TEMP_PROFILES, offset, (uint8_t*)hdr, sizeof(rec_hdr_t));
+}
+
+static bool
+rec_is_valid(uint32_t offset, const rec_hdr_t* hdr)
+{
+  uint32_t steps_len = hdr->profile.num_steps * sizeof(temp_profile_step_t);
+  uint32_t crc = crc32_block(0, (void*)&hdr->profile, sizeof(temp_profile_t));
+  bool ret = true;
+
+  if (hdr->len != (sizeof(rec_hdr_t) + steps_len))
+    return false;
+
+  offset += sizeof(rec_hdr_t);
+
+  uint8_t* buf = malloc(COPY_BUF_SIZE);
+  while (ret && steps_len > 0) {
+    uint32_t len = MIN(COPY_BUF_SIZE, steps_len);
+
+    ret = sxfs_read(SP_TEMP_PROFILES, offset, buf, len);
+    crc = crc32_block(crc, buf, len);
+
+    offset += len;
+    steps_len -= len;
+  }
+  free(buf);
+
+  return ret && (crc == hdr->crc);
+}
+
+/* Flash bits can be cleared without an erase, so a record is killed by
+ * zeroing its state word
+ */
+static bool
+mark_dead(uint32_t offset)
+{
+  uint32_t state = REC_DEAD;
+
+  return sxfs_write(SP_TEMP_PROFILES, offset + offsetof(rec_hdr_t, state),
+      (uint8_t*)&state, sizeof(state));
+}
+
+static int
+index_find(uint32_t id)
+{
+  uint32_t i;
+
+  for (i = 0; i < num_entries; ++i) {
+    if (lib_index[i].id == id)
+      return i;
+  }
+
+  return -1;
+}
+
+static void
+index_remove(int idx)
+{
+  memmove(&lib_index[idx], &lib_index[idx + 1],
+      (num_entries - idx - 1) * sizeof(index_entry_t));
+  num_entries--;
+}
+
+static uint32_t
+bank_base(uint32_t bank)
+{
+  return bank * BANK_SIZE;
+}
@@ -0,0 +1,33 @@
+
+#ifndef TEMP_PROFILE_LIB_H
+#define TEMP_PROFILE_LIB_H
+
+#include "temp_control.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define TEMP_PROFILE_LIB_MAX_PROFILES 32
+
+
+void
+temp_profile_lib_init(void);
+
+/* Stores a profile, replacing any stored profile with the same id */
+bool
+temp_profile_lib_put(const temp_profile_t* profile, const temp_profile_step_t* steps);
+
+bool
+temp_profile_lib_get(uint32_t id, temp_profile_t* profile);
+
+/* Reads up to num_steps steps starting at first_step. Returns the number of
+ * steps read.
+ */
+uint32_t
+temp_profile_lib_read_steps(uint32_t id, uint32_t first_step, temp_profile_step_t* steps, uint32_t num_steps);
+
+bool
+temp_profile_lib_delete(uint32_t id);
+
+#endif
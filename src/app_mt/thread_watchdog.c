@@ -20,11 +20,13 @@ static msg_t
 thread_watchdog_thread(void* arg);
 
 
+#if HAL_USE_IWDG
 /*  */
 static const IWDGConfig iwdg_config = {
   .counter = 0x03FF,
   .div = 0x07        // 256 prescaler
 };
+#endif
 
 static ThreadWatchdog* monitored_threads;
 static uint32_t num_monitored_threads;
@@ -33,8 +35,10 @@ void
 thread_watchdog_init()
 {
   chThdCreateFromHeap(NULL, 1024, NORMALPRIO, thread_watchdog_thread, NULL);
+#if HAL_USE_IWDG
   iwdgInit();
   iwdgStart(&IWDGD, &iwdg_config);
+#endif
 }
 
 void
@@ -88,8 +92,12 @@ thread_watchdog_thread(void* arg)
       }
     }
 
+#if HAL_USE_IWDG
     if (all_threads_responsive)
       iwdgReset(&IWDGD);
+#else
+    (void)all_threads_responsive;
+#endif
 
     chThdSleepSeconds(1);
   }
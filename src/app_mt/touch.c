@@ -138,7 +138,7 @@ static matrix_t calib_matrix;
 void
 touch_init()
 {
-  memcpy(&calib_matrix, app_cfg_get_touch_calib(), sizeof(matrix_t));
+  app_cfg_get_touch_calib(&calib_matrix);
   chThdCreateFromHeap(NULL, 1024, NORMALPRIO, touch_thread, NULL);
 }
 
@@ -168,9 +168,9 @@ touch_save_calib()
 }
 
 void
-touch_calib_reset()
+touch_get_default_calib(matrix_t* calib)
 {
-  matrix_t default_calib = {
+  static const matrix_t default_calib = {
     .An      = 76320,
     .Bn      = 3080,
     .Cn      = -9475080,
@@ -179,6 +179,15 @@ touch_calib_reset()
     .Fn      = -4360660,
     .Divider = 205664
   };
+  *calib = default_calib;
+}
+
+void
+touch_calib_reset()
+{
+  matrix_t default_calib;
+
+  touch_get_default_calib(&default_calib);
   app_cfg_set_touch_calib(&default_calib);
 }
 
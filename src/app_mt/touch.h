@@ -3,6 +3,7 @@
 #define TOUCH_H
 
 #include "types.h"
+#include "touch_calib.h"
 
 
 typedef struct {
@@ -23,6 +24,10 @@ touch_set_calib(
 void
 touch_save_calib(void);
 
+/* The calibration used until the panel has been calibrated */
+void
+touch_get_default_calib(matrix_t* calib);
+
 void
 touch_calib_reset(void);
 
@@ -16,9 +16,11 @@
 #include "sensor.h"
 #include "app_cfg.h"
 #include "temp_control.h"
+#include "temp_profile_lib.h"
 #include "app_cfg.h"
 #include "ota_update.h"
-#include "sxfs.h"
+#include "backlog.h"
+#include "report_batch.h"
 #include "pid.h"
 
 #ifndef WEB_API_HOST
@@ -39,6 +41,19 @@
 #define RECV_TIMEOUT           S2ST(20)
 #define MAX_SEND_ERRS          25
 
+/* The backlog is sent a little at a time from the idle handler. After
+ * BACKLOG_WINDOW bytes, or once it runs out, an auth request goes out as a
+ * sync point. The messages sent before it count as received when the
+ * server answers it, and nothing more is sent from the backlog until then.
+ * With no answer after BACKLOG_SYNC_TIMEOUT they are sent again.
+ */
+#define BACKLOG_BURST          1024
+#define BACKLOG_WINDOW         (16 * 1024)
+#define BACKLOG_SYNC_TIMEOUT   S2ST(30)
+
+#define REPORTS_PER_MSG \
+  (sizeof(((DeviceReport*)0)->controller_reports) / sizeof(ControllerReport))
+
 
 typedef enum {
   RECV_LEN,
@@ -77,7 +92,10 @@ typedef struct {
   uint32_t send_errors;
   msg_parser_t parser;
   msg_listener_t* msg_listener;
-  uint32_t backlog_pos;
+  uint32_t backlog_unacked;
+  bool backlog_sync_pending;
+  systime_t backlog_sync_time;
+  uint32_t bytes_sent;
 } web_api_t;
 
 
@@ -85,7 +103,7 @@ static void
 set_state(web_api_t* api, api_state_t state);
 
 static void
-web_api_dispatch(msg_id_t id, void* msg_data, void* listener_data, void* sub_data);
+web_api_dispatch(msg_id_t id, void* msg_data, void* listener_data);
 
 static void
 web_api_idle(web_api_t* api);
@@ -106,9 +124,21 @@ static void
 send_backlog(web_api_t* api);
 
 static void
-socket_message_rx(web_api_t* api, const uint8_t* data, uint32_t data_len);
+request_backlog_sync(web_api_t* api);
+
+static void
+backlog_sync_received(web_api_t* api);
+
+static bool
+send_report_batch(web_api_t* api, const uint8_t* buf, uint32_t len);
 
 static void
+batch_sensor_report(web_api_t* api, DeviceReport* report);
+
+static void
+socket_message_rx(web_api_t* api, const uint8_t* data, uint32_t data_len);
+
+static bool
 send_api_msg(web_api_t* api, ApiMessage* msg, bool can_backlog);
 
 static void
@@ -161,6 +191,9 @@ dispatch_device_settings_from_server(DeviceSettings* settings);
 static void
 dispatch_controller_settings_from_server(ControllerSettings* settings);
 
+static void
+store_temp_profile(TempProfile* tpm);
+
 static void
 dispatch_server_time(web_api_t* api, ServerTime* server_time);
 
@@ -187,25 +220,17 @@ web_api_init()
   api = calloc(1, sizeof(web_api_t));
   api->status.state = AS_AWAITING_NET_CONNECTION;
 
-  api->backlog_pos = 0;
-  while (1) {
-    uint32_t msg_len = 0xFFFFFFFF;
-    bool ret = sxfs_read(SP_WEB_API_BACKLOG, api->backlog_pos, (uint8_t*)&msg_len, sizeof(msg_len));
-    if (!ret || msg_len == 0xFFFFFFFF)
-      break;
-
-    api->backlog_pos += msg_len;
-  }
+  backlog_init();
 
   api->msg_listener = msg_listener_create("web_api", 2048, web_api_dispatch, api);
   msg_listener_set_idle_timeout(api->msg_listener, 100);
   msg_listener_enable_watchdog(api->msg_listener, 3 * 60 * 1000);
 
-  msg_subscribe(api->msg_listener, MSG_NET_STATUS, NULL);
-  msg_subscribe(api->msg_listener, MSG_API_FW_UPDATE_CHECK, NULL);
-  msg_subscribe(api->msg_listener, MSG_API_FW_DNLD_RQST, NULL);
-  msg_subscribe(api->msg_listener, MSG_SENSOR_SAMPLE, NULL);
-  msg_subscribe(api->msg_listener, MSG_CONTROLLER_SETTINGS, NULL);
+  msg_subscribe(api->msg_listener, MSG_NET_STATUS);
+  msg_subscribe(api->msg_listener, MSG_API_FW_UPDATE_CHECK);
+  msg_subscribe(api->msg_listener, MSG_API_FW_DNLD_RQST);
+  msg_subscribe(api->msg_listener, MSG_SENSOR_SAMPLE);
+  msg_subscribe(api->msg_listener, MSG_CONTROLLER_SETTINGS);
 }
 
 const api_status_t*
@@ -221,9 +246,8 @@ web_api_get_endpoint()
 }
 
 static void
-web_api_dispatch(msg_id_t id, void* msg_data, void* listener_data, void* sub_data)
+web_api_dispatch(msg_id_t id, void* msg_data, void* listener_data)
 {
-  (void)sub_data;
   (void)msg_data;
 
   web_api_t* api = listener_data;
@@ -276,10 +300,19 @@ set_state(web_api_t* api, api_state_t state)
   if (api->status.state != state) {
     api->status.state = state;
 
+    /* The backlog is only sent while connected, and anything sent on a
+     * connection that has gone may not have arrived
+     */
+    if (state != AS_CONNECTED) {
+      backlog_rewind();
+      api->backlog_unacked = 0;
+      api->backlog_sync_pending = false;
+    }
+
     api_status_t status_msg = {
         .state = state
     };
-    msg_send(MSG_API_STATUS, &status_msg);
+    msg_post_state(MSG_API_STATUS, 0, &status_msg, sizeof(status_msg));
   }
 }
 
@@ -299,7 +332,9 @@ web_api_idle(web_api_t* api)
 static bool
 was_authenticated()
 {
-  const char* auth_token = app_cfg_get_auth_token();
+  char auth_token[2];
+
+  app_cfg_get_auth_token(auth_token, sizeof(auth_token));
   return auth_token[0] != 0;
 }
 
@@ -348,8 +383,17 @@ monitor_connection(web_api_t* api)
 static void
 send_data_to_server(web_api_t* api)
 {
+  if (api->backlog_sync_pending &&
+      (chTimeNow() - api->backlog_sync_time) > BACKLOG_SYNC_TIMEOUT) {
+    printf("Backlog sync timed out\r\n");
+    backlog_rewind();
+    api->backlog_unacked = 0;
+    api->backlog_sync_pending = false;
+  }
+
   if ((api->status.state == AS_CONNECTED) &&
-      (api->backlog_pos > 0))
+      !api->backlog_sync_pending &&
+      backlog_has_unsent())
     send_backlog(api);
 
   if (was_authenticated()) {
@@ -370,31 +414,137 @@ send_data_to_server(web_api_t* api)
 static void
 send_backlog(web_api_t* api)
 {
-  uint32_t backlog_read_pos = 0;
-  uint32_t data_left_to_send = api->backlog_pos;
-  uint8_t* send_buf = malloc(1024);
-
-  printf("Sending %d bytes from backlog\r\n", (int)data_left_to_send);
+  uint32_t sent = 0;
+  uint8_t* send_buf = malloc(backlog_max_msg_len());
 
-  while (data_left_to_send > 0) {
-    uint32_t send_len = MIN(1024, data_left_to_send);
-    if (!sxfs_read(SP_WEB_API_BACKLOG, backlog_read_pos, send_buf, send_len)) {
-      printf("Backlog read failed!\r\n");
+  while ((sent < BACKLOG_BURST) &&
+         (api->backlog_unacked < BACKLOG_WINDOW)) {
+    uint32_t send_len = backlog_next(send_buf);
+    if (send_len == 0)
       break;
-    }
 
-    if (!socket_send(api, send_buf, send_len)) {
+    // a batch goes out as the larger messages it expands to
+    uint32_t bytes_sent = api->bytes_sent;
+
+    /* Messages are stored as sent, and the first byte of their big-endian
+     * length is always 0
+     */
+    bool sent_ok = (send_buf[0] == REPORT_BATCH_MAGIC) ?
+        send_report_batch(api, send_buf, send_len) :
+        socket_send(api, send_buf, send_len);
+
+    if (!sent_ok) {
       printf("Backlog send failed!\r\n");
+      backlog_rewind();
+      api->backlog_unacked = 0;
       break;
     }
 
-    backlog_read_pos += send_len;
-    data_left_to_send -= send_len;
+    sent += api->bytes_sent - bytes_sent;
+    api->backlog_unacked += api->bytes_sent - bytes_sent;
   }
   free(send_buf);
 
-  sxfs_erase_all(SP_WEB_API_BACKLOG);
-  api->backlog_pos = 0;
+  if ((api->backlog_unacked > 0) &&
+      ((api->backlog_unacked >= BACKLOG_WINDOW) || !backlog_has_unsent()))
+    request_backlog_sync(api);
+}
+
+static void
+sample_to_controller_report(const report_sample_t* sample, ControllerReport* pr)
+{
+  int i;
+
+  pr->controller_index = sample->controller;
+  pr->sensor_reading = sample->sensor_reading;
+  pr->setpoint = sample->setpoint;
+  pr->has_timestamp = true;
+  pr->timestamp = sample->timestamp;
+
+  for (i = 0; i < NUM_OUTPUTS; ++i) {
+    const report_output_t* out = &sample->outputs[i];
+    if (!out->present)
+      continue;
+
+    pr->output_status[pr->output_status_count].output_index = i;
+    pr->output_status[pr->output_status_count].has_output_index = true;
+
+    pr->output_status[pr->output_status_count].status = out->status;
+    pr->output_status[pr->output_status_count].has_status = true;
+
+    if (sample->has_pid) {
+      pr->output_status[pr->output_status_count].kp = out->kp;
+      pr->output_status[pr->output_status_count].has_kp = true;
+
+      pr->output_status[pr->output_status_count].ki = out->ki;
+      pr->output_status[pr->output_status_count].has_ki = true;
+
+      pr->output_status[pr->output_status_count].kd = out->kd;
+      pr->output_status[pr->output_status_count].has_kd = true;
+    }
+    pr->output_status_count++;
+  }
+}
+
+/* Sends the reports in a batch as DeviceReport messages, with as many to a
+ * message as it holds. The server has no batch message, so a batch goes
+ * out as the same messages its reports would have been sent as live.
+ */
+static bool
+send_report_batch(web_api_t* api, const uint8_t* buf, uint32_t len)
+{
+  report_batch_reader_t reader;
+  report_sample_t sample;
+  bool ok = true;
+
+  if (!report_batch_reader_init(&reader, buf, len)) {
+    printf("Bad report batch in backlog!\r\n");
+    return true;
+  }
+
+  ApiMessage* msg = calloc(1, sizeof(ApiMessage));
+  msg->type = ApiMessage_Type_DEVICE_REPORT;
+  msg->has_deviceReport = true;
+
+  while (ok && report_batch_read(&reader, &sample)) {
+    ControllerReport* pr = &msg->deviceReport.controller_reports[msg->deviceReport.controller_reports_count];
+    msg->deviceReport.controller_reports_count++;
+
+    sample_to_controller_report(&sample, pr);
+
+    if (msg->deviceReport.controller_reports_count == REPORTS_PER_MSG) {
+      ok = send_api_msg(api, msg, false);
+      memset(&msg->deviceReport, 0, sizeof(msg->deviceReport));
+    }
+  }
+
+  if (ok && msg->deviceReport.controller_reports_count > 0)
+    ok = send_api_msg(api, msg, false);
+
+  free(msg);
+
+  return ok;
+}
+
+/* The server answers requests in order, so its answer to a request sent
+ * after the backlog messages means it has handled them
+ */
+static void
+request_backlog_sync(web_api_t* api)
+{
+  request_auth(api);
+  api->backlog_sync_pending = true;
+  api->backlog_sync_time = chTimeNow();
+}
+
+static void
+backlog_sync_received(web_api_t* api)
+{
+  if (api->backlog_sync_pending) {
+    backlog_ack();
+    api->backlog_unacked = 0;
+    api->backlog_sync_pending = false;
+  }
 }
 
 static bool
@@ -488,9 +638,10 @@ socket_poll(web_api_t* api)
 static void
 populate_output_status(ControllerReport* pr, sensor_id_t controller, output_id_t output)
 {
-  const controller_settings_t* controller_settings = app_cfg_get_controller_settings(controller);
+  controller_settings_t controller_settings;
 
-  if (controller_settings->output_settings[output].enabled) {
+  app_cfg_get_controller_settings(controller, &controller_settings);
+  if (controller_settings.output_settings[output].enabled) {
     output_ctrl_t control_mode = app_cfg_get_control_mode();
     temp_control_status_t output_status = temp_control_get_status(controller, output);
 
@@ -545,12 +696,73 @@ send_sensor_report(web_api_t* api)
 
   if (msg->deviceReport.controller_reports_count > 0) {
     printf("sending sensor report %d\r\n", msg->deviceReport.controller_reports_count);
-    send_api_msg(api, msg, api->server_time_available);
+    if (api->status.state > AS_CONNECTING)
+      send_api_msg(api, msg, false);
+    else if (api->server_time_available)
+      batch_sensor_report(api, &msg->deviceReport);
+    else
+      printf("Unable to save message to backlog!\r\n");
   }
 
   free(msg);
 }
 
+static void
+controller_report_to_sample(const ControllerReport* pr, report_sample_t* sample)
+{
+  uint32_t i;
+
+  memset(sample, 0, sizeof(report_sample_t));
+  sample->timestamp = pr->timestamp;
+  sample->controller = pr->controller_index;
+  sample->sensor_reading = pr->sensor_reading;
+  sample->setpoint = pr->setpoint;
+
+  for (i = 0; i < pr->output_status_count; ++i) {
+    if (pr->output_status[i].output_index >= NUM_OUTPUTS)
+      continue;
+
+    report_output_t* out = &sample->outputs[pr->output_status[i].output_index];
+    out->present = true;
+    out->status = pr->output_status[i].status;
+
+    if (pr->output_status[i].has_kp) {
+      sample->has_pid = true;
+      out->kp = pr->output_status[i].kp;
+      out->ki = pr->output_status[i].ki;
+      out->kd = pr->output_status[i].kd;
+    }
+  }
+}
+
+/* Each sensor report goes to flash as its own batch, so a reset loses at
+ * most the one being made. Every batch pays for its headers and starts its
+ * deltas from 0, so it is smaller than the DeviceReport message it replaces
+ * but much larger than it would be as part of a longer batch. The sim's
+ * 'bench report_batch' measures both.
+ */
+static void
+batch_sensor_report(web_api_t* api, DeviceReport* report)
+{
+  report_batch_t* batch = malloc(sizeof(report_batch_t));
+  uint32_t i;
+
+  for (i = 0; i < report->controller_reports_count; ++i) {
+    report_sample_t sample;
+    controller_report_to_sample(&report->controller_reports[i], &sample);
+
+    if (i == 0)
+      report_batch_init(batch, sample.timestamp);
+    report_batch_add(batch, &sample);
+  }
+
+  printf("Saving %d reports to backlog\r\n", (int)batch->count);
+  if (!backlog_append(batch->buf, batch->len))
+    printf("Unable to save reports to backlog!\r\n");
+
+  free(batch);
+}
+
 static time_t
 get_server_time(web_api_t* api)
 {
@@ -577,7 +789,7 @@ request_auth(web_api_t* api)
   msg->type = ApiMessage_Type_AUTH_REQUEST;
   msg->has_authRequest = true;
   strncpy(msg->authRequest.device_id, device_id, sizeof(msg->authRequest.device_id));
-  strncpy(msg->authRequest.auth_token, app_cfg_get_auth_token(), sizeof(msg->authRequest.auth_token));
+  app_cfg_get_auth_token(msg->authRequest.auth_token, sizeof(msg->authRequest.auth_token));
 
   send_api_msg(api, msg, false);
 
@@ -673,24 +885,25 @@ send_controller_settings(
   for (i = 0; i < NUM_CONTROLLERS; ++i) {
     if (api->controller_status[i].new_settings) {
       api->controller_status[i].new_settings = false;
-      const controller_settings_t* ssl = app_cfg_get_controller_settings(i);
+      controller_settings_t ssl;
+      app_cfg_get_controller_settings(i, &ssl);
       ControllerSettings* ss = &msg->controllerSettings;
 
       ss->has_session_action = true;
-      ss->session_action = ssl->session_action;
+      ss->session_action = ssl.session_action;
 
       ss->sensor_index = i;
-      switch (ssl->setpoint_type) {
+      switch (ssl.setpoint_type) {
         case SP_STATIC:
           ss->setpoint_type = ControllerSettings_SetpointType_STATIC;
           ss->has_static_setpoint = true;
-          ss->static_setpoint = ssl->static_setpoint.value;
+          ss->static_setpoint = ssl.static_setpoint.value;
           break;
 
         case SP_TEMP_PROFILE:
           ss->setpoint_type = ControllerSettings_SetpointType_TEMP_PROFILE;
           ss->has_temp_profile_id = true;
-          ss->temp_profile_id = ssl->temp_profile.id;
+          ss->temp_profile_id = ssl.temp_profile.id;
           ss->has_temp_profile_completion_action = true;
           ss->temp_profile_completion_action = ControllerSettings_CompletionAction_HOLD_LAST;
           ss->has_temp_profile_start_point = true;
@@ -698,13 +911,13 @@ send_controller_settings(
           break;
 
         default:
-          printf("Invalid setpoint type: %d\r\n", ssl->setpoint_type);
+          printf("Invalid setpoint type: %d\r\n", ssl.setpoint_type);
           break;
       }
 
       int j;
       for (j = 0; j < NUM_OUTPUTS; ++j) {
-        const output_settings_t* osl = &ssl->output_settings[j];
+        const output_settings_t* osl = &ssl.output_settings[j];
         if (osl->enabled) {
           OutputSettings* os = &msg->controllerSettings.output_settings[msg->controllerSettings.output_settings_count];
           msg->controllerSettings.output_settings_count++;
@@ -754,27 +967,28 @@ dispatch_firmware_rqst(web_api_t* api, firmware_update_t* firmware_data)
   free(msg);
 }
 
-static void
+static bool
 send_api_msg(web_api_t* api, ApiMessage* msg, bool can_backlog)
 {
-  uint8_t* buffer = malloc(ApiMessage_size);
+  bool sent = false;
+  uint32_t buf_len;
+  // the length goes in front, so a backlogged message is stored whole
+  uint8_t* buffer = malloc(sizeof(buf_len) + ApiMessage_size);
 
-  pb_ostream_t stream = pb_ostream_from_buffer(buffer, ApiMessage_size);
+  pb_ostream_t stream = pb_ostream_from_buffer(buffer + sizeof(buf_len), ApiMessage_size);
   bool encoded_ok = pb_encode(&stream, ApiMessage_fields, msg);
 
   if (encoded_ok) {
-    uint32_t buf_len = htonl(stream.bytes_written);
-    if (send_or_store(api, &buf_len, sizeof(buf_len), can_backlog)) {
-      if (!send_or_store(api, buffer, stream.bytes_written, can_backlog)) {
-        printf("buffer send failed!\r\n");
-      }
-    }
-    else {
-      printf("message length send failed!\r\n");
-    }
+    buf_len = htonl(stream.bytes_written);
+    memcpy(buffer, &buf_len, sizeof(buf_len));
+    sent = send_or_store(api, buffer, sizeof(buf_len) + stream.bytes_written, can_backlog);
+    if (!sent)
+      printf("message send failed!\r\n");
   }
 
   free(buffer);
+
+  return sent;
 }
 
 static bool
@@ -789,11 +1003,8 @@ send_or_store(web_api_t* api, void* buf, uint32_t buf_len, bool can_backlog)
       return false;
     }
 
-    printf("Not connected. Saving to backlog %d\r\n", (int)api->backlog_pos);
-    bool ret = sxfs_write(SP_WEB_API_BACKLOG, api->backlog_pos, buf, buf_len);
-    if (ret)
-      api->backlog_pos += buf_len;
-    return ret;
+    printf("Not connected. Saving to backlog\r\n");
+    return backlog_append(buf, buf_len);
   }
 }
 
@@ -816,6 +1027,7 @@ socket_send(web_api_t* api, void* buf, uint32_t buf_len)
     }
     bytes_left -= ret;
     buf += ret;
+    api->bytes_sent += ret;
     api->last_send_time = chTimeNow();
   }
 
@@ -860,6 +1072,7 @@ dispatch_api_msg(web_api_t* api, ApiMessage* msg)
     if (msg->authResponse.authenticated) {
       printf("auth succeeded\r\n");
       set_state(api, AS_CONNECTED);
+      backlog_sync_received(api);
     }
     else {
       printf("auth failed, restarting activation\r\n");
@@ -918,11 +1131,17 @@ dispatch_controller_settings_from_server(ControllerSettings* settings)
   printf("got controller settings from server\r\n");
 
   controller_settings_t* csl = calloc(1, sizeof(controller_settings_t));
-  memcpy(csl, app_cfg_get_controller_settings(settings->sensor_index), sizeof(controller_settings_t));
+  if (!app_cfg_get_controller_settings(settings->sensor_index, csl)) {
+    free(csl);
+    return;
+  }
 
   csl->controller = settings->sensor_index;
 
   printf("  got %d temp profiles\r\n", settings->temp_profiles_count);
+  for (i = 0; i < (int)settings->temp_profiles_count; ++i)
+    store_temp_profile(&settings->temp_profiles[i]);
+
   printf("  got %d output settings\r\n", settings->output_settings_count);
   csl->output_settings[OUTPUT_1].enabled = false;
   csl->output_settings[OUTPUT_2].enabled = false;
@@ -959,42 +1178,13 @@ dispatch_controller_settings_from_server(ControllerSettings* settings)
       else {
         csl->setpoint_type = SP_TEMP_PROFILE;
 
-        TempProfile* tpm = &settings->temp_profiles[0];
-        csl->temp_profile.id = tpm->id;
-        strncpy(csl->temp_profile.name, tpm->name, sizeof(csl->temp_profile.name));
-        csl->temp_profile.num_steps = tpm->steps_count;
-        csl->temp_profile.start_value.value = tpm->start_value;
-        csl->temp_profile.start_value.unit = UNIT_TEMP_DEG_F;
+        csl->temp_profile.id = settings->temp_profile_id;
         csl->temp_profile.start_point = settings->temp_profile_start_point;
         csl->temp_profile.completion_action = settings->temp_profile_completion_action;
 
-        printf("    profile '%s' (%d)\r\n", csl->temp_profile.name, (int)csl->temp_profile.id);
-        printf("      steps %d\r\n", (int)csl->temp_profile.num_steps);
-        printf("      start temp %f\r\n", csl->temp_profile.start_value.value);
+        printf("    profile %d\r\n", (int)csl->temp_profile.id);
         printf("      start point %d\r\n", csl->temp_profile.start_point);
         printf("      completion action %d\r\n", csl->temp_profile.completion_action);
-
-        for (i = 0; i < (int)tpm->steps_count; ++i) {
-          temp_profile_step_t* step = &csl->temp_profile.steps[i];
-          TempProfileStep* stepm = &tpm->steps[i];
-
-          step->duration = stepm->duration;
-          step->value.value = stepm->value;
-          step->value.unit = UNIT_TEMP_DEG_F;
-          switch(stepm->type) {
-            case TempProfileStep_TempProfileStepType_HOLD:
-              step->type = STEP_HOLD;
-              break;
-
-            case TempProfileStep_TempProfileStepType_RAMP:
-              step->type = STEP_RAMP;
-              break;
-
-            default:
-              printf("Invalid step type: %d\r\n", stepm->type);
-              break;
-          }
-        }
       }
       break;
 
@@ -1012,6 +1202,52 @@ dispatch_controller_settings_from_server(ControllerSettings* settings)
   free(csl);
 }
 
+static void
+store_temp_profile(TempProfile* tpm)
+{
+  int i;
+  temp_profile_t profile;
+  temp_profile_step_t* steps = calloc(MAX(tpm->steps_count, 1), sizeof(temp_profile_step_t));
+
+  memset(&profile, 0, sizeof(profile));
+  profile.id = tpm->id;
+  strncpy(profile.name, tpm->name, sizeof(profile.name) - 1);
+  profile.num_steps = tpm->steps_count;
+  profile.start_value.value = tpm->start_value;
+  profile.start_value.unit = UNIT_TEMP_DEG_F;
+
+  printf("    profile '%s' (%d)\r\n", profile.name, (int)profile.id);
+  printf("      steps %d\r\n", (int)profile.num_steps);
+  printf("      start temp %f\r\n", profile.start_value.value);
+
+  for (i = 0; i < (int)tpm->steps_count; ++i) {
+    temp_profile_step_t* step = &steps[i];
+    TempProfileStep* stepm = &tpm->steps[i];
+
+    step->duration = stepm->duration;
+    step->value.value = stepm->value;
+    step->value.unit = UNIT_TEMP_DEG_F;
+    switch(stepm->type) {
+      case TempProfileStep_TempProfileStepType_HOLD:
+        step->type = STEP_HOLD;
+        break;
+
+      case TempProfileStep_TempProfileStepType_RAMP:
+        step->type = STEP_RAMP;
+        break;
+
+      default:
+        printf("Invalid step type: %d\r\n", stepm->type);
+        break;
+    }
+  }
+
+  if (!temp_profile_lib_put(&profile, steps))
+    printf("Failed to store temp profile %d\r\n", (int)profile.id);
+
+  free(steps);
+}
+
 static void
 dispatch_server_time(web_api_t* api, ServerTime* server_time)
 {
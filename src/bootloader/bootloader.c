@@ -98,9 +98,12 @@ process_boot_cmd()
       break;
   }
 
+  /* BOOT_DEFAULT is all zero bits, so it is programmed over the command
+   * without an erase. An erase that failed would leave the image to be
+   * written again on every boot.
+   */
   if (boot_cmd != BOOT_DEFAULT) {
     boot_cmd = BOOT_DEFAULT;
-    sxfs_erase_all(SP_BOOT_PARAMS);
     sxfs_write(SP_BOOT_PARAMS, 0, (uint8_t*)&boot_cmd, sizeof(boot_cmd));
   }
 }
@@ -2,6 +2,7 @@
 #include "ch.h"
 #include "hal.h"
 #include "xflash.h"
+#include "crc/crc32.h"
 #include "bootloader.h"
 
 
@@ -10,6 +11,7 @@ main(void)
 {
   halInit();
   chSysInit();
+  crc32_init();
   xflash_init();
   bootloader_exec();
   return -1;
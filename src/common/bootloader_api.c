@@ -5,23 +5,29 @@
 #include "bootloader_api.h"
 #include "sxfs.h"
 
-static void
+static bool
 save_boot_cmd(boot_cmd_t boot_cmd)
 {
-  sxfs_erase_all(SP_BOOT_PARAMS);
-  sxfs_write(SP_BOOT_PARAMS, 0, (uint8_t*)&boot_cmd, sizeof(boot_cmd));
+  /* After a failed erase the stored command would be the old one ANDed with
+   * the new one, so don't reset into it
+   */
+  if (!sxfs_erase(SP_BOOT_PARAMS, 0, sizeof(boot_cmd)) ||
+      !sxfs_write(SP_BOOT_PARAMS, 0, (uint8_t*)&boot_cmd, sizeof(boot_cmd)))
+    return false;
 
   NVIC_SystemReset();
+
+  return false;
 }
 
-void
+bool
 bootloader_load_recovery_img()
 {
-  save_boot_cmd(BOOT_LOAD_RECOVERY_IMG);
+  return save_boot_cmd(BOOT_LOAD_RECOVERY_IMG);
 }
 
-void
+bool
 bootloader_load_update_img()
 {
-  save_boot_cmd(BOOT_LOAD_UPDATE_IMG);
+  return save_boot_cmd(BOOT_LOAD_UPDATE_IMG);
 }
@@ -2,8 +2,13 @@
 #ifndef BOOTLOADER_API_H
 #define BOOTLOADER_API_H
 
+#include <stdbool.h>
+
+/* BOOT_DEFAULT must stay all zero bits, so the bootloader can program it
+ * over any other command without an erase
+ */
 typedef enum {
-  BOOT_DEFAULT,
+  BOOT_DEFAULT = 0,
   BOOT_LOAD_RECOVERY_IMG,
   BOOT_LOAD_UPDATE_IMG,
 } boot_cmd_t;
@@ -14,10 +19,13 @@ typedef struct {
 
 extern const bootloader_api_t _bootloader_api;
 
-void
+/* These reset into the bootloader, so they only return, with false, if the
+ * boot command could not be stored
+ */
+bool
 bootloader_load_recovery_img(void);
 
-void
+bool
 bootloader_load_update_img(void);
 
 #endif
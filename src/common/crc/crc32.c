@@ -16,6 +16,26 @@
 
 #include "crc32.h"
 
+#include <stddef.h>
+
+#if defined(CRC32_USE_HW) && !defined(SIMULATOR)
+#include "ch.h"
+#include "hal.h"
+#endif
+
+/* Number of bytes crc32_block() folds in per table lookup round, 4 or 8.
+ * Each extra byte costs another 1 KB table.
+ */
+#ifndef CRC32_SLICES
+#define CRC32_SLICES 8
+#endif
+
+/* Blocks shorter than this aren't worth setting up the CRC unit for */
+#define CRC32_HW_MIN_LEN      64
+
+/* Words fed to the CRC unit per critical section */
+#define CRC32_HW_CHUNK_WORDS  64
+
 /* ======================================================================== */
 /*  CRC32_TBL    -- Lookup table used for the CRC-32 code.                  */
 /* ======================================================================== */
@@ -75,6 +95,398 @@ uint32_t crc32_tbl[256] =
     0x2D02EF8DL
 };
 
+/* ======================================================================== */
+/*  CRC32_SLICE_TBL -- Tables for slicing-by-4/8.  Entry n of table k is    */
+/*                     the CRC of byte n followed by k zero bytes, table 0  */
+/*                     being CRC32_TBL itself.                              */
+/* ======================================================================== */
+static const uint32_t crc32_slice_tbl[CRC32_SLICES - 1][256] =
+{
+  {
+    0x00000000L, 0x191B3141L, 0x32366282L, 0x2B2D53C3L, 0x646CC504L,
+    0x7D77F445L, 0x565AA786L, 0x4F4196C7L, 0xC8D98A08L, 0xD1C2BB49L,
+    0xFAEFE88AL, 0xE3F4D9CBL, 0xACB54F0CL, 0xB5AE7E4DL, 0x9E832D8EL,
+    0x87981CCFL, 0x4AC21251L, 0x53D92310L, 0x78F470D3L, 0x61EF4192L,
+    0x2EAED755L, 0x37B5E614L, 0x1C98B5D7L, 0x05838496L, 0x821B9859L,
+    0x9B00A918L, 0xB02DFADBL, 0xA936CB9AL, 0xE6775D5DL, 0xFF6C6C1CL,
+    0xD4413FDFL, 0xCD5A0E9EL, 0x958424A2L, 0x8C9F15E3L, 0xA7B24620L,
+    0xBEA97761L, 0xF1E8E1A6L, 0xE8F3D0E7L, 0xC3DE8324L, 0xDAC5B265L,
+    0x5D5DAEAAL, 0x44469FEBL, 0x6F6BCC28L, 0x7670FD69L, 0x39316BAEL,
+    0x202A5AEFL, 0x0B07092CL, 0x121C386DL, 0xDF4636F3L, 0xC65D07B2L,
+    0xED705471L, 0xF46B6530L, 0xBB2AF3F7L, 0xA231C2B6L, 0x891C9175L,
+    0x9007A034L, 0x179FBCFBL, 0x0E848DBAL, 0x25A9DE79L, 0x3CB2EF38L,
+    0x73F379FFL, 0x6AE848BEL, 0x41C51B7DL, 0x58DE2A3CL, 0xF0794F05L,
+    0xE9627E44L, 0xC24F2D87L, 0xDB541CC6L, 0x94158A01L, 0x8D0EBB40L,
+    0xA623E883L, 0xBF38D9C2L, 0x38A0C50DL, 0x21BBF44CL, 0x0A96A78FL,
+    0x138D96CEL, 0x5CCC0009L, 0x45D73148L, 0x6EFA628BL, 0x77E153CAL,
+    0xBABB5D54L, 0xA3A06C15L, 0x888D3FD6L, 0x91960E97L, 0xDED79850L,
+    0xC7CCA911L, 0xECE1FAD2L, 0xF5FACB93L, 0x7262D75CL, 0x6B79E61DL,
+    0x4054B5DEL, 0x594F849FL, 0x160E1258L, 0x0F152319L, 0x243870DAL,
+    0x3D23419BL, 0x65FD6BA7L, 0x7CE65AE6L, 0x57CB0925L, 0x4ED03864L,
+    0x0191AEA3L, 0x188A9FE2L, 0x33A7CC21L, 0x2ABCFD60L, 0xAD24E1AFL,
+    0xB43FD0EEL, 0x9F12832DL, 0x8609B26CL, 0xC94824ABL, 0xD05315EAL,
+    0xFB7E4629L, 0xE2657768L, 0x2F3F79F6L, 0x362448B7L, 0x1D091B74L,
+    0x04122A35L, 0x4B53BCF2L, 0x52488DB3L, 0x7965DE70L, 0x607EEF31L,
+    0xE7E6F3FEL, 0xFEFDC2BFL, 0xD5D0917CL, 0xCCCBA03DL, 0x838A36FAL,
+    0x9A9107BBL, 0xB1BC5478L, 0xA8A76539L, 0x3B83984BL, 0x2298A90AL,
+    0x09B5FAC9L, 0x10AECB88L, 0x5FEF5D4FL, 0x46F46C0EL, 0x6DD93FCDL,
+    0x74C20E8CL, 0xF35A1243L, 0xEA412302L, 0xC16C70C1L, 0xD8774180L,
+    0x9736D747L, 0x8E2DE606L, 0xA500B5C5L, 0xBC1B8484L, 0x71418A1AL,
+    0x685ABB5BL, 0x4377E898L, 0x5A6CD9D9L, 0x152D4F1EL, 0x0C367E5FL,
+    0x271B2D9CL, 0x3E001CDDL, 0xB9980012L, 0xA0833153L, 0x8BAE6290L,
+    0x92B553D1L, 0xDDF4C516L, 0xC4EFF457L, 0xEFC2A794L, 0xF6D996D5L,
+    0xAE07BCE9L, 0xB71C8DA8L, 0x9C31DE6BL, 0x852AEF2AL, 0xCA6B79EDL,
+    0xD37048ACL, 0xF85D1B6FL, 0xE1462A2EL, 0x66DE36E1L, 0x7FC507A0L,
+    0x54E85463L, 0x4DF36522L, 0x02B2F3E5L, 0x1BA9C2A4L, 0x30849167L,
+    0x299FA026L, 0xE4C5AEB8L, 0xFDDE9FF9L, 0xD6F3CC3AL, 0xCFE8FD7BL,
+    0x80A96BBCL, 0x99B25AFDL, 0xB29F093EL, 0xAB84387FL, 0x2C1C24B0L,
+    0x350715F1L, 0x1E2A4632L, 0x07317773L, 0x4870E1B4L, 0x516BD0F5L,
+    0x7A468336L, 0x635DB277L, 0xCBFAD74EL, 0xD2E1E60FL, 0xF9CCB5CCL,
+    0xE0D7848DL, 0xAF96124AL, 0xB68D230BL, 0x9DA070C8L, 0x84BB4189L,
+    0x03235D46L, 0x1A386C07L, 0x31153FC4L, 0x280E0E85L, 0x674F9842L,
+    0x7E54A903L, 0x5579FAC0L, 0x4C62CB81L, 0x8138C51FL, 0x9823F45EL,
+    0xB30EA79DL, 0xAA1596DCL, 0xE554001BL, 0xFC4F315AL, 0xD7626299L,
+    0xCE7953D8L, 0x49E14F17L, 0x50FA7E56L, 0x7BD72D95L, 0x62CC1CD4L,
+    0x2D8D8A13L, 0x3496BB52L, 0x1FBBE891L, 0x06A0D9D0L, 0x5E7EF3ECL,
+    0x4765C2ADL, 0x6C48916EL, 0x7553A02FL, 0x3A1236E8L, 0x230907A9L,
+    0x0824546AL, 0x113F652BL, 0x96A779E4L, 0x8FBC48A5L, 0xA4911B66L,
+    0xBD8A2A27L, 0xF2CBBCE0L, 0xEBD08DA1L, 0xC0FDDE62L, 0xD9E6EF23L,
+    0x14BCE1BDL, 0x0DA7D0FCL, 0x268A833FL, 0x3F91B27EL, 0x70D024B9L,
+    0x69CB15F8L, 0x42E6463BL, 0x5BFD777AL, 0xDC656BB5L, 0xC57E5AF4L,
+    0xEE530937L, 0xF7483876L, 0xB809AEB1L, 0xA1129FF0L, 0x8A3FCC33L,
+    0x9324FD72L
+  },
+  {
+    0x00000000L, 0x01C26A37L, 0x0384D46EL, 0x0246BE59L, 0x0709A8DCL,
+    0x06CBC2EBL, 0x048D7CB2L, 0x054F1685L, 0x0E1351B8L, 0x0FD13B8FL,
+    0x0D9785D6L, 0x0C55EFE1L, 0x091AF964L, 0x08D89353L, 0x0A9E2D0AL,
+    0x0B5C473DL, 0x1C26A370L, 0x1DE4C947L, 0x1FA2771EL, 0x1E601D29L,
+    0x1B2F0BACL, 0x1AED619BL, 0x18ABDFC2L, 0x1969B5F5L, 0x1235F2C8L,
+    0x13F798FFL, 0x11B126A6L, 0x10734C91L, 0x153C5A14L, 0x14FE3023L,
+    0x16B88E7AL, 0x177AE44DL, 0x384D46E0L, 0x398F2CD7L, 0x3BC9928EL,
+    0x3A0BF8B9L, 0x3F44EE3CL, 0x3E86840BL, 0x3CC03A52L, 0x3D025065L,
+    0x365E1758L, 0x379C7D6FL, 0x35DAC336L, 0x3418A901L, 0x3157BF84L,
+    0x3095D5B3L, 0x32D36BEAL, 0x331101DDL, 0x246BE590L, 0x25A98FA7L,
+    0x27EF31FEL, 0x262D5BC9L, 0x23624D4CL, 0x22A0277BL, 0x20E69922L,
+    0x2124F315L, 0x2A78B428L, 0x2BBADE1FL, 0x29FC6046L, 0x283E0A71L,
+    0x2D711CF4L, 0x2CB376C3L, 0x2EF5C89AL, 0x2F37A2ADL, 0x709A8DC0L,
+    0x7158E7F7L, 0x731E59AEL, 0x72DC3399L, 0x7793251CL, 0x76514F2BL,
+    0x7417F172L, 0x75D59B45L, 0x7E89DC78L, 0x7F4BB64FL, 0x7D0D0816L,
+    0x7CCF6221L, 0x798074A4L, 0x78421E93L, 0x7A04A0CAL, 0x7BC6CAFDL,
+    0x6CBC2EB0L, 0x6D7E4487L, 0x6F38FADEL, 0x6EFA90E9L, 0x6BB5866CL,
+    0x6A77EC5BL, 0x68315202L, 0x69F33835L, 0x62AF7F08L, 0x636D153FL,
+    0x612BAB66L, 0x60E9C151L, 0x65A6D7D4L, 0x6464BDE3L, 0x662203BAL,
+    0x67E0698DL, 0x48D7CB20L, 0x4915A117L, 0x4B531F4EL, 0x4A917579L,
+    0x4FDE63FCL, 0x4E1C09CBL, 0x4C5AB792L, 0x4D98DDA5L, 0x46C49A98L,
+    0x4706F0AFL, 0x45404EF6L, 0x448224C1L, 0x41CD3244L, 0x400F5873L,
+    0x4249E62AL, 0x438B8C1DL, 0x54F16850L, 0x55330267L, 0x5775BC3EL,
+    0x56B7D609L, 0x53F8C08CL, 0x523AAABBL, 0x507C14E2L, 0x51BE7ED5L,
+    0x5AE239E8L, 0x5B2053DFL, 0x5966ED86L, 0x58A487B1L, 0x5DEB9134L,
+    0x5C29FB03L, 0x5E6F455AL, 0x5FAD2F6DL, 0xE1351B80L, 0xE0F771B7L,
+    0xE2B1CFEEL, 0xE373A5D9L, 0xE63CB35CL, 0xE7FED96BL, 0xE5B86732L,
+    0xE47A0D05L, 0xEF264A38L, 0xEEE4200FL, 0xECA29E56L, 0xED60F461L,
+    0xE82FE2E4L, 0xE9ED88D3L, 0xEBAB368AL, 0xEA695CBDL, 0xFD13B8F0L,
+    0xFCD1D2C7L, 0xFE976C9EL, 0xFF5506A9L, 0xFA1A102CL, 0xFBD87A1BL,
+    0xF99EC442L, 0xF85CAE75L, 0xF300E948L, 0xF2C2837FL, 0xF0843D26L,
+    0xF1465711L, 0xF4094194L, 0xF5CB2BA3L, 0xF78D95FAL, 0xF64FFFCDL,
+    0xD9785D60L, 0xD8BA3757L, 0xDAFC890EL, 0xDB3EE339L, 0xDE71F5BCL,
+    0xDFB39F8BL, 0xDDF521D2L, 0xDC374BE5L, 0xD76B0CD8L, 0xD6A966EFL,
+    0xD4EFD8B6L, 0xD52DB281L, 0xD062A404L, 0xD1A0CE33L, 0xD3E6706AL,
+    0xD2241A5DL, 0xC55EFE10L, 0xC49C9427L, 0xC6DA2A7EL, 0xC7184049L,
+    0xC25756CCL, 0xC3953CFBL, 0xC1D382A2L, 0xC011E895L, 0xCB4DAFA8L,
+    0xCA8FC59FL, 0xC8C97BC6L, 0xC90B11F1L, 0xCC440774L, 0xCD866D43L,
+    0xCFC0D31AL, 0xCE02B92DL, 0x91AF9640L, 0x906DFC77L, 0x922B422EL,
+    0x93E92819L, 0x96A63E9CL, 0x976454ABL, 0x9522EAF2L, 0x94E080C5L,
+    0x9FBCC7F8L, 0x9E7EADCFL, 0x9C381396L, 0x9DFA79A1L, 0x98B56F24L,
+    0x99770513L, 0x9B31BB4AL, 0x9AF3D17DL, 0x8D893530L, 0x8C4B5F07L,
+    0x8E0DE15EL, 0x8FCF8B69L, 0x8A809DECL, 0x8B42F7DBL, 0x89044982L,
+    0x88C623B5L, 0x839A6488L, 0x82580EBFL, 0x801EB0E6L, 0x81DCDAD1L,
+    0x8493CC54L, 0x8551A663L, 0x8717183AL, 0x86D5720DL, 0xA9E2D0A0L,
+    0xA820BA97L, 0xAA6604CEL, 0xABA46EF9L, 0xAEEB787CL, 0xAF29124BL,
+    0xAD6FAC12L, 0xACADC625L, 0xA7F18118L, 0xA633EB2FL, 0xA4755576L,
+    0xA5B73F41L, 0xA0F829C4L, 0xA13A43F3L, 0xA37CFDAAL, 0xA2BE979DL,
+    0xB5C473D0L, 0xB40619E7L, 0xB640A7BEL, 0xB782CD89L, 0xB2CDDB0CL,
+    0xB30FB13BL, 0xB1490F62L, 0xB08B6555L, 0xBBD72268L, 0xBA15485FL,
+    0xB853F606L, 0xB9919C31L, 0xBCDE8AB4L, 0xBD1CE083L, 0xBF5A5EDAL,
+    0xBE9834EDL
+  },
+  {
+    0x00000000L, 0xB8BC6765L, 0xAA09C88BL, 0x12B5AFEEL, 0x8F629757L,
+    0x37DEF032L, 0x256B5FDCL, 0x9DD738B9L, 0xC5B428EFL, 0x7D084F8AL,
+    0x6FBDE064L, 0xD7018701L, 0x4AD6BFB8L, 0xF26AD8DDL, 0xE0DF7733L,
+    0x58631056L, 0x5019579FL, 0xE8A530FAL, 0xFA109F14L, 0x42ACF871L,
+    0xDF7BC0C8L, 0x67C7A7ADL, 0x75720843L, 0xCDCE6F26L, 0x95AD7F70L,
+    0x2D111815L, 0x3FA4B7FBL, 0x8718D09EL, 0x1ACFE827L, 0xA2738F42L,
+    0xB0C620ACL, 0x087A47C9L, 0xA032AF3EL, 0x188EC85BL, 0x0A3B67B5L,
+    0xB28700D0L, 0x2F503869L, 0x97EC5F0CL, 0x8559F0E2L, 0x3DE59787L,
+    0x658687D1L, 0xDD3AE0B4L, 0xCF8F4F5AL, 0x7733283FL, 0xEAE41086L,
+    0x525877E3L, 0x40EDD80DL, 0xF851BF68L, 0xF02BF8A1L, 0x48979FC4L,
+    0x5A22302AL, 0xE29E574FL, 0x7F496FF6L, 0xC7F50893L, 0xD540A77DL,
+    0x6DFCC018L, 0x359FD04EL, 0x8D23B72BL, 0x9F9618C5L, 0x272A7FA0L,
+    0xBAFD4719L, 0x0241207CL, 0x10F48F92L, 0xA848E8F7L, 0x9B14583DL,
+    0x23A83F58L, 0x311D90B6L, 0x89A1F7D3L, 0x1476CF6AL, 0xACCAA80FL,
+    0xBE7F07E1L, 0x06C36084L, 0x5EA070D2L, 0xE61C17B7L, 0xF4A9B859L,
+    0x4C15DF3CL, 0xD1C2E785L, 0x697E80E0L, 0x7BCB2F0EL, 0xC377486BL,
+    0xCB0D0FA2L, 0x73B168C7L, 0x6104C729L, 0xD9B8A04CL, 0x446F98F5L,
+    0xFCD3FF90L, 0xEE66507EL, 0x56DA371BL, 0x0EB9274DL, 0xB6054028L,
+    0xA4B0EFC6L, 0x1C0C88A3L, 0x81DBB01AL, 0x3967D77FL, 0x2BD27891L,
+    0x936E1FF4L, 0x3B26F703L, 0x839A9066L, 0x912F3F88L, 0x299358EDL,
+    0xB4446054L, 0x0CF80731L, 0x1E4DA8DFL, 0xA6F1CFBAL, 0xFE92DFECL,
+    0x462EB889L, 0x549B1767L, 0xEC277002L, 0x71F048BBL, 0xC94C2FDEL,
+    0xDBF98030L, 0x6345E755L, 0x6B3FA09CL, 0xD383C7F9L, 0xC1366817L,
+    0x798A0F72L, 0xE45D37CBL, 0x5CE150AEL, 0x4E54FF40L, 0xF6E89825L,
+    0xAE8B8873L, 0x1637EF16L, 0x048240F8L, 0xBC3E279DL, 0x21E91F24L,
+    0x99557841L, 0x8BE0D7AFL, 0x335CB0CAL, 0xED59B63BL, 0x55E5D15EL,
+    0x47507EB0L, 0xFFEC19D5L, 0x623B216CL, 0xDA874609L, 0xC832E9E7L,
+    0x708E8E82L, 0x28ED9ED4L, 0x9051F9B1L, 0x82E4565FL, 0x3A58313AL,
+    0xA78F0983L, 0x1F336EE6L, 0x0D86C108L, 0xB53AA66DL, 0xBD40E1A4L,
+    0x05FC86C1L, 0x1749292FL, 0xAFF54E4AL, 0x322276F3L, 0x8A9E1196L,
+    0x982BBE78L, 0x2097D91DL, 0x78F4C94BL, 0xC048AE2EL, 0xD2FD01C0L,
+    0x6A4166A5L, 0xF7965E1CL, 0x4F2A3979L, 0x5D9F9697L, 0xE523F1F2L,
+    0x4D6B1905L, 0xF5D77E60L, 0xE762D18EL, 0x5FDEB6EBL, 0xC2098E52L,
+    0x7AB5E937L, 0x680046D9L, 0xD0BC21BCL, 0x88DF31EAL, 0x3063568FL,
+    0x22D6F961L, 0x9A6A9E04L, 0x07BDA6BDL, 0xBF01C1D8L, 0xADB46E36L,
+    0x15080953L, 0x1D724E9AL, 0xA5CE29FFL, 0xB77B8611L, 0x0FC7E174L,
+    0x9210D9CDL, 0x2AACBEA8L, 0x38191146L, 0x80A57623L, 0xD8C66675L,
+    0x607A0110L, 0x72CFAEFEL, 0xCA73C99BL, 0x57A4F122L, 0xEF189647L,
+    0xFDAD39A9L, 0x45115ECCL, 0x764DEE06L, 0xCEF18963L, 0xDC44268DL,
+    0x64F841E8L, 0xF92F7951L, 0x41931E34L, 0x5326B1DAL, 0xEB9AD6BFL,
+    0xB3F9C6E9L, 0x0B45A18CL, 0x19F00E62L, 0xA14C6907L, 0x3C9B51BEL,
+    0x842736DBL, 0x96929935L, 0x2E2EFE50L, 0x2654B999L, 0x9EE8DEFCL,
+    0x8C5D7112L, 0x34E11677L, 0xA9362ECEL, 0x118A49ABL, 0x033FE645L,
+    0xBB838120L, 0xE3E09176L, 0x5B5CF613L, 0x49E959FDL, 0xF1553E98L,
+    0x6C820621L, 0xD43E6144L, 0xC68BCEAAL, 0x7E37A9CFL, 0xD67F4138L,
+    0x6EC3265DL, 0x7C7689B3L, 0xC4CAEED6L, 0x591DD66FL, 0xE1A1B10AL,
+    0xF3141EE4L, 0x4BA87981L, 0x13CB69D7L, 0xAB770EB2L, 0xB9C2A15CL,
+    0x017EC639L, 0x9CA9FE80L, 0x241599E5L, 0x36A0360BL, 0x8E1C516EL,
+    0x866616A7L, 0x3EDA71C2L, 0x2C6FDE2CL, 0x94D3B949L, 0x090481F0L,
+    0xB1B8E695L, 0xA30D497BL, 0x1BB12E1EL, 0x43D23E48L, 0xFB6E592DL,
+    0xE9DBF6C3L, 0x516791A6L, 0xCCB0A91FL, 0x740CCE7AL, 0x66B96194L,
+    0xDE0506F1L
+  },
+#if CRC32_SLICES == 8
+  {
+    0x00000000L, 0x3D6029B0L, 0x7AC05360L, 0x47A07AD0L, 0xF580A6C0L,
+    0xC8E08F70L, 0x8F40F5A0L, 0xB220DC10L, 0x30704BC1L, 0x0D106271L,
+    0x4AB018A1L, 0x77D03111L, 0xC5F0ED01L, 0xF890C4B1L, 0xBF30BE61L,
+    0x825097D1L, 0x60E09782L, 0x5D80BE32L, 0x1A20C4E2L, 0x2740ED52L,
+    0x95603142L, 0xA80018F2L, 0xEFA06222L, 0xD2C04B92L, 0x5090DC43L,
+    0x6DF0F5F3L, 0x2A508F23L, 0x1730A693L, 0xA5107A83L, 0x98705333L,
+    0xDFD029E3L, 0xE2B00053L, 0xC1C12F04L, 0xFCA106B4L, 0xBB017C64L,
+    0x866155D4L, 0x344189C4L, 0x0921A074L, 0x4E81DAA4L, 0x73E1F314L,
+    0xF1B164C5L, 0xCCD14D75L, 0x8B7137A5L, 0xB6111E15L, 0x0431C205L,
+    0x3951EBB5L, 0x7EF19165L, 0x4391B8D5L, 0xA121B886L, 0x9C419136L,
+    0xDBE1EBE6L, 0xE681C256L, 0x54A11E46L, 0x69C137F6L, 0x2E614D26L,
+    0x13016496L, 0x9151F347L, 0xAC31DAF7L, 0xEB91A027L, 0xD6F18997L,
+    0x64D15587L, 0x59B17C37L, 0x1E1106E7L, 0x23712F57L, 0x58F35849L,
+    0x659371F9L, 0x22330B29L, 0x1F532299L, 0xAD73FE89L, 0x9013D739L,
+    0xD7B3ADE9L, 0xEAD38459L, 0x68831388L, 0x55E33A38L, 0x124340E8L,
+    0x2F236958L, 0x9D03B548L, 0xA0639CF8L, 0xE7C3E628L, 0xDAA3CF98L,
+    0x3813CFCBL, 0x0573E67BL, 0x42D39CABL, 0x7FB3B51BL, 0xCD93690BL,
+    0xF0F340BBL, 0xB7533A6BL, 0x8A3313DBL, 0x0863840AL, 0x3503ADBAL,
+    0x72A3D76AL, 0x4FC3FEDAL, 0xFDE322CAL, 0xC0830B7AL, 0x872371AAL,
+    0xBA43581AL, 0x9932774DL, 0xA4525EFDL, 0xE3F2242DL, 0xDE920D9DL,
+    0x6CB2D18DL, 0x51D2F83DL, 0x167282EDL, 0x2B12AB5DL, 0xA9423C8CL,
+    0x9422153CL, 0xD3826FECL, 0xEEE2465CL, 0x5CC29A4CL, 0x61A2B3FCL,
+    0x2602C92CL, 0x1B62E09CL, 0xF9D2E0CFL, 0xC4B2C97FL, 0x8312B3AFL,
+    0xBE729A1FL, 0x0C52460FL, 0x31326FBFL, 0x7692156FL, 0x4BF23CDFL,
+    0xC9A2AB0EL, 0xF4C282BEL, 0xB362F86EL, 0x8E02D1DEL, 0x3C220DCEL,
+    0x0142247EL, 0x46E25EAEL, 0x7B82771EL, 0xB1E6B092L, 0x8C869922L,
+    0xCB26E3F2L, 0xF646CA42L, 0x44661652L, 0x79063FE2L, 0x3EA64532L,
+    0x03C66C82L, 0x8196FB53L, 0xBCF6D2E3L, 0xFB56A833L, 0xC6368183L,
+    0x74165D93L, 0x49767423L, 0x0ED60EF3L, 0x33B62743L, 0xD1062710L,
+    0xEC660EA0L, 0xABC67470L, 0x96A65DC0L, 0x248681D0L, 0x19E6A860L,
+    0x5E46D2B0L, 0x6326FB00L, 0xE1766CD1L, 0xDC164561L, 0x9BB63FB1L,
+    0xA6D61601L, 0x14F6CA11L, 0x2996E3A1L, 0x6E369971L, 0x5356B0C1L,
+    0x70279F96L, 0x4D47B626L, 0x0AE7CCF6L, 0x3787E546L, 0x85A73956L,
+    0xB8C710E6L, 0xFF676A36L, 0xC2074386L, 0x4057D457L, 0x7D37FDE7L,
+    0x3A978737L, 0x07F7AE87L, 0xB5D77297L, 0x88B75B27L, 0xCF1721F7L,
+    0xF2770847L, 0x10C70814L, 0x2DA721A4L, 0x6A075B74L, 0x576772C4L,
+    0xE547AED4L, 0xD8278764L, 0x9F87FDB4L, 0xA2E7D404L, 0x20B743D5L,
+    0x1DD76A65L, 0x5A7710B5L, 0x67173905L, 0xD537E515L, 0xE857CCA5L,
+    0xAFF7B675L, 0x92979FC5L, 0xE915E8DBL, 0xD475C16BL, 0x93D5BBBBL,
+    0xAEB5920BL, 0x1C954E1BL, 0x21F567ABL, 0x66551D7BL, 0x5B3534CBL,
+    0xD965A31AL, 0xE4058AAAL, 0xA3A5F07AL, 0x9EC5D9CAL, 0x2CE505DAL,
+    0x11852C6AL, 0x562556BAL, 0x6B457F0AL, 0x89F57F59L, 0xB49556E9L,
+    0xF3352C39L, 0xCE550589L, 0x7C75D999L, 0x4115F029L, 0x06B58AF9L,
+    0x3BD5A349L, 0xB9853498L, 0x84E51D28L, 0xC34567F8L, 0xFE254E48L,
+    0x4C059258L, 0x7165BBE8L, 0x36C5C138L, 0x0BA5E888L, 0x28D4C7DFL,
+    0x15B4EE6FL, 0x521494BFL, 0x6F74BD0FL, 0xDD54611FL, 0xE03448AFL,
+    0xA794327FL, 0x9AF41BCFL, 0x18A48C1EL, 0x25C4A5AEL, 0x6264DF7EL,
+    0x5F04F6CEL, 0xED242ADEL, 0xD044036EL, 0x97E479BEL, 0xAA84500EL,
+    0x4834505DL, 0x755479EDL, 0x32F4033DL, 0x0F942A8DL, 0xBDB4F69DL,
+    0x80D4DF2DL, 0xC774A5FDL, 0xFA148C4DL, 0x78441B9CL, 0x4524322CL,
+    0x028448FCL, 0x3FE4614CL, 0x8DC4BD5CL, 0xB0A494ECL, 0xF704EE3CL,
+    0xCA64C78CL
+  },
+  {
+    0x00000000L, 0xCB5CD3A5L, 0x4DC8A10BL, 0x869472AEL, 0x9B914216L,
+    0x50CD91B3L, 0xD659E31DL, 0x1D0530B8L, 0xEC53826DL, 0x270F51C8L,
+    0xA19B2366L, 0x6AC7F0C3L, 0x77C2C07BL, 0xBC9E13DEL, 0x3A0A6170L,
+    0xF156B2D5L, 0x03D6029BL, 0xC88AD13EL, 0x4E1EA390L, 0x85427035L,
+    0x9847408DL, 0x531B9328L, 0xD58FE186L, 0x1ED33223L, 0xEF8580F6L,
+    0x24D95353L, 0xA24D21FDL, 0x6911F258L, 0x7414C2E0L, 0xBF481145L,
+    0x39DC63EBL, 0xF280B04EL, 0x07AC0536L, 0xCCF0D693L, 0x4A64A43DL,
+    0x81387798L, 0x9C3D4720L, 0x57619485L, 0xD1F5E62BL, 0x1AA9358EL,
+    0xEBFF875BL, 0x20A354FEL, 0xA6372650L, 0x6D6BF5F5L, 0x706EC54DL,
+    0xBB3216E8L, 0x3DA66446L, 0xF6FAB7E3L, 0x047A07ADL, 0xCF26D408L,
+    0x49B2A6A6L, 0x82EE7503L, 0x9FEB45BBL, 0x54B7961EL, 0xD223E4B0L,
+    0x197F3715L, 0xE82985C0L, 0x23755665L, 0xA5E124CBL, 0x6EBDF76EL,
+    0x73B8C7D6L, 0xB8E41473L, 0x3E7066DDL, 0xF52CB578L, 0x0F580A6CL,
+    0xC404D9C9L, 0x4290AB67L, 0x89CC78C2L, 0x94C9487AL, 0x5F959BDFL,
+    0xD901E971L, 0x125D3AD4L, 0xE30B8801L, 0x28575BA4L, 0xAEC3290AL,
+    0x659FFAAFL, 0x789ACA17L, 0xB3C619B2L, 0x35526B1CL, 0xFE0EB8B9L,
+    0x0C8E08F7L, 0xC7D2DB52L, 0x4146A9FCL, 0x8A1A7A59L, 0x971F4AE1L,
+    0x5C439944L, 0xDAD7EBEAL, 0x118B384FL, 0xE0DD8A9AL, 0x2B81593FL,
+    0xAD152B91L, 0x6649F834L, 0x7B4CC88CL, 0xB0101B29L, 0x36846987L,
+    0xFDD8BA22L, 0x08F40F5AL, 0xC3A8DCFFL, 0x453CAE51L, 0x8E607DF4L,
+    0x93654D4CL, 0x58399EE9L, 0xDEADEC47L, 0x15F13FE2L, 0xE4A78D37L,
+    0x2FFB5E92L, 0xA96F2C3CL, 0x6233FF99L, 0x7F36CF21L, 0xB46A1C84L,
+    0x32FE6E2AL, 0xF9A2BD8FL, 0x0B220DC1L, 0xC07EDE64L, 0x46EAACCAL,
+    0x8DB67F6FL, 0x90B34FD7L, 0x5BEF9C72L, 0xDD7BEEDCL, 0x16273D79L,
+    0xE7718FACL, 0x2C2D5C09L, 0xAAB92EA7L, 0x61E5FD02L, 0x7CE0CDBAL,
+    0xB7BC1E1FL, 0x31286CB1L, 0xFA74BF14L, 0x1EB014D8L, 0xD5ECC77DL,
+    0x5378B5D3L, 0x98246676L, 0x852156CEL, 0x4E7D856BL, 0xC8E9F7C5L,
+    0x03B52460L, 0xF2E396B5L, 0x39BF4510L, 0xBF2B37BEL, 0x7477E41BL,
+    0x6972D4A3L, 0xA22E0706L, 0x24BA75A8L, 0xEFE6A60DL, 0x1D661643L,
+    0xD63AC5E6L, 0x50AEB748L, 0x9BF264EDL, 0x86F75455L, 0x4DAB87F0L,
+    0xCB3FF55EL, 0x006326FBL, 0xF135942EL, 0x3A69478BL, 0xBCFD3525L,
+    0x77A1E680L, 0x6AA4D638L, 0xA1F8059DL, 0x276C7733L, 0xEC30A496L,
+    0x191C11EEL, 0xD240C24BL, 0x54D4B0E5L, 0x9F886340L, 0x828D53F8L,
+    0x49D1805DL, 0xCF45F2F3L, 0x04192156L, 0xF54F9383L, 0x3E134026L,
+    0xB8873288L, 0x73DBE12DL, 0x6EDED195L, 0xA5820230L, 0x2316709EL,
+    0xE84AA33BL, 0x1ACA1375L, 0xD196C0D0L, 0x5702B27EL, 0x9C5E61DBL,
+    0x815B5163L, 0x4A0782C6L, 0xCC93F068L, 0x07CF23CDL, 0xF6999118L,
+    0x3DC542BDL, 0xBB513013L, 0x700DE3B6L, 0x6D08D30EL, 0xA65400ABL,
+    0x20C07205L, 0xEB9CA1A0L, 0x11E81EB4L, 0xDAB4CD11L, 0x5C20BFBFL,
+    0x977C6C1AL, 0x8A795CA2L, 0x41258F07L, 0xC7B1FDA9L, 0x0CED2E0CL,
+    0xFDBB9CD9L, 0x36E74F7CL, 0xB0733DD2L, 0x7B2FEE77L, 0x662ADECFL,
+    0xAD760D6AL, 0x2BE27FC4L, 0xE0BEAC61L, 0x123E1C2FL, 0xD962CF8AL,
+    0x5FF6BD24L, 0x94AA6E81L, 0x89AF5E39L, 0x42F38D9CL, 0xC467FF32L,
+    0x0F3B2C97L, 0xFE6D9E42L, 0x35314DE7L, 0xB3A53F49L, 0x78F9ECECL,
+    0x65FCDC54L, 0xAEA00FF1L, 0x28347D5FL, 0xE368AEFAL, 0x16441B82L,
+    0xDD18C827L, 0x5B8CBA89L, 0x90D0692CL, 0x8DD55994L, 0x46898A31L,
+    0xC01DF89FL, 0x0B412B3AL, 0xFA1799EFL, 0x314B4A4AL, 0xB7DF38E4L,
+    0x7C83EB41L, 0x6186DBF9L, 0xAADA085CL, 0x2C4E7AF2L, 0xE712A957L,
+    0x15921919L, 0xDECECABCL, 0x585AB812L, 0x93066BB7L, 0x8E035B0FL,
+    0x455F88AAL, 0xC3CBFA04L, 0x089729A1L, 0xF9C19B74L, 0x329D48D1L,
+    0xB4093A7FL, 0x7F55E9DAL, 0x6250D962L, 0xA90C0AC7L, 0x2F987869L,
+    0xE4C4ABCCL
+  },
+  {
+    0x00000000L, 0xA6770BB4L, 0x979F1129L, 0x31E81A9DL, 0xF44F2413L,
+    0x52382FA7L, 0x63D0353AL, 0xC5A73E8EL, 0x33EF4E67L, 0x959845D3L,
+    0xA4705F4EL, 0x020754FAL, 0xC7A06A74L, 0x61D761C0L, 0x503F7B5DL,
+    0xF64870E9L, 0x67DE9CCEL, 0xC1A9977AL, 0xF0418DE7L, 0x56368653L,
+    0x9391B8DDL, 0x35E6B369L, 0x040EA9F4L, 0xA279A240L, 0x5431D2A9L,
+    0xF246D91DL, 0xC3AEC380L, 0x65D9C834L, 0xA07EF6BAL, 0x0609FD0EL,
+    0x37E1E793L, 0x9196EC27L, 0xCFBD399CL, 0x69CA3228L, 0x582228B5L,
+    0xFE552301L, 0x3BF21D8FL, 0x9D85163BL, 0xAC6D0CA6L, 0x0A1A0712L,
+    0xFC5277FBL, 0x5A257C4FL, 0x6BCD66D2L, 0xCDBA6D66L, 0x081D53E8L,
+    0xAE6A585CL, 0x9F8242C1L, 0x39F54975L, 0xA863A552L, 0x0E14AEE6L,
+    0x3FFCB47BL, 0x998BBFCFL, 0x5C2C8141L, 0xFA5B8AF5L, 0xCBB39068L,
+    0x6DC49BDCL, 0x9B8CEB35L, 0x3DFBE081L, 0x0C13FA1CL, 0xAA64F1A8L,
+    0x6FC3CF26L, 0xC9B4C492L, 0xF85CDE0FL, 0x5E2BD5BBL, 0x440B7579L,
+    0xE27C7ECDL, 0xD3946450L, 0x75E36FE4L, 0xB044516AL, 0x16335ADEL,
+    0x27DB4043L, 0x81AC4BF7L, 0x77E43B1EL, 0xD19330AAL, 0xE07B2A37L,
+    0x460C2183L, 0x83AB1F0DL, 0x25DC14B9L, 0x14340E24L, 0xB2430590L,
+    0x23D5E9B7L, 0x85A2E203L, 0xB44AF89EL, 0x123DF32AL, 0xD79ACDA4L,
+    0x71EDC610L, 0x4005DC8DL, 0xE672D739L, 0x103AA7D0L, 0xB64DAC64L,
+    0x87A5B6F9L, 0x21D2BD4DL, 0xE47583C3L, 0x42028877L, 0x73EA92EAL,
+    0xD59D995EL, 0x8BB64CE5L, 0x2DC14751L, 0x1C295DCCL, 0xBA5E5678L,
+    0x7FF968F6L, 0xD98E6342L, 0xE86679DFL, 0x4E11726BL, 0xB8590282L,
+    0x1E2E0936L, 0x2FC613ABL, 0x89B1181FL, 0x4C162691L, 0xEA612D25L,
+    0xDB8937B8L, 0x7DFE3C0CL, 0xEC68D02BL, 0x4A1FDB9FL, 0x7BF7C102L,
+    0xDD80CAB6L, 0x1827F438L, 0xBE50FF8CL, 0x8FB8E511L, 0x29CFEEA5L,
+    0xDF879E4CL, 0x79F095F8L, 0x48188F65L, 0xEE6F84D1L, 0x2BC8BA5FL,
+    0x8DBFB1EBL, 0xBC57AB76L, 0x1A20A0C2L, 0x8816EAF2L, 0x2E61E146L,
+    0x1F89FBDBL, 0xB9FEF06FL, 0x7C59CEE1L, 0xDA2EC555L, 0xEBC6DFC8L,
+    0x4DB1D47CL, 0xBBF9A495L, 0x1D8EAF21L, 0x2C66B5BCL, 0x8A11BE08L,
+    0x4FB68086L, 0xE9C18B32L, 0xD82991AFL, 0x7E5E9A1BL, 0xEFC8763CL,
+    0x49BF7D88L, 0x78576715L, 0xDE206CA1L, 0x1B87522FL, 0xBDF0599BL,
+    0x8C184306L, 0x2A6F48B2L, 0xDC27385BL, 0x7A5033EFL, 0x4BB82972L,
+    0xEDCF22C6L, 0x28681C48L, 0x8E1F17FCL, 0xBFF70D61L, 0x198006D5L,
+    0x47ABD36EL, 0xE1DCD8DAL, 0xD034C247L, 0x7643C9F3L, 0xB3E4F77DL,
+    0x1593FCC9L, 0x247BE654L, 0x820CEDE0L, 0x74449D09L, 0xD23396BDL,
+    0xE3DB8C20L, 0x45AC8794L, 0x800BB91AL, 0x267CB2AEL, 0x1794A833L,
+    0xB1E3A387L, 0x20754FA0L, 0x86024414L, 0xB7EA5E89L, 0x119D553DL,
+    0xD43A6BB3L, 0x724D6007L, 0x43A57A9AL, 0xE5D2712EL, 0x139A01C7L,
+    0xB5ED0A73L, 0x840510EEL, 0x22721B5AL, 0xE7D525D4L, 0x41A22E60L,
+    0x704A34FDL, 0xD63D3F49L, 0xCC1D9F8BL, 0x6A6A943FL, 0x5B828EA2L,
+    0xFDF58516L, 0x3852BB98L, 0x9E25B02CL, 0xAFCDAAB1L, 0x09BAA105L,
+    0xFFF2D1ECL, 0x5985DA58L, 0x686DC0C5L, 0xCE1ACB71L, 0x0BBDF5FFL,
+    0xADCAFE4BL, 0x9C22E4D6L, 0x3A55EF62L, 0xABC30345L, 0x0DB408F1L,
+    0x3C5C126CL, 0x9A2B19D8L, 0x5F8C2756L, 0xF9FB2CE2L, 0xC813367FL,
+    0x6E643DCBL, 0x982C4D22L, 0x3E5B4696L, 0x0FB35C0BL, 0xA9C457BFL,
+    0x6C636931L, 0xCA146285L, 0xFBFC7818L, 0x5D8B73ACL, 0x03A0A617L,
+    0xA5D7ADA3L, 0x943FB73EL, 0x3248BC8AL, 0xF7EF8204L, 0x519889B0L,
+    0x6070932DL, 0xC6079899L, 0x304FE870L, 0x9638E3C4L, 0xA7D0F959L,
+    0x01A7F2EDL, 0xC400CC63L, 0x6277C7D7L, 0x539FDD4AL, 0xF5E8D6FEL,
+    0x647E3AD9L, 0xC209316DL, 0xF3E12BF0L, 0x55962044L, 0x90311ECAL,
+    0x3646157EL, 0x07AE0FE3L, 0xA1D90457L, 0x579174BEL, 0xF1E67F0AL,
+    0xC00E6597L, 0x66796E23L, 0xA3DE50ADL, 0x05A95B19L, 0x34414184L,
+    0x92364A30L
+  },
+  {
+    0x00000000L, 0xCCAA009EL, 0x4225077DL, 0x8E8F07E3L, 0x844A0EFAL,
+    0x48E00E64L, 0xC66F0987L, 0x0AC50919L, 0xD3E51BB5L, 0x1F4F1B2BL,
+    0x91C01CC8L, 0x5D6A1C56L, 0x57AF154FL, 0x9B0515D1L, 0x158A1232L,
+    0xD92012ACL, 0x7CBB312BL, 0xB01131B5L, 0x3E9E3656L, 0xF23436C8L,
+    0xF8F13FD1L, 0x345B3F4FL, 0xBAD438ACL, 0x767E3832L, 0xAF5E2A9EL,
+    0x63F42A00L, 0xED7B2DE3L, 0x21D12D7DL, 0x2B142464L, 0xE7BE24FAL,
+    0x69312319L, 0xA59B2387L, 0xF9766256L, 0x35DC62C8L, 0xBB53652BL,
+    0x77F965B5L, 0x7D3C6CACL, 0xB1966C32L, 0x3F196BD1L, 0xF3B36B4FL,
+    0x2A9379E3L, 0xE639797DL, 0x68B67E9EL, 0xA41C7E00L, 0xAED97719L,
+    0x62737787L, 0xECFC7064L, 0x205670FAL, 0x85CD537DL, 0x496753E3L,
+    0xC7E85400L, 0x0B42549EL, 0x01875D87L, 0xCD2D5D19L, 0x43A25AFAL,
+    0x8F085A64L, 0x562848C8L, 0x9A824856L, 0x140D4FB5L, 0xD8A74F2BL,
+    0xD2624632L, 0x1EC846ACL, 0x9047414FL, 0x5CED41D1L, 0x299DC2EDL,
+    0xE537C273L, 0x6BB8C590L, 0xA712C50EL, 0xADD7CC17L, 0x617DCC89L,
+    0xEFF2CB6AL, 0x2358CBF4L, 0xFA78D958L, 0x36D2D9C6L, 0xB85DDE25L,
+    0x74F7DEBBL, 0x7E32D7A2L, 0xB298D73CL, 0x3C17D0DFL, 0xF0BDD041L,
+    0x5526F3C6L, 0x998CF358L, 0x1703F4BBL, 0xDBA9F425L, 0xD16CFD3CL,
+    0x1DC6FDA2L, 0x9349FA41L, 0x5FE3FADFL, 0x86C3E873L, 0x4A69E8EDL,
+    0xC4E6EF0EL, 0x084CEF90L, 0x0289E689L, 0xCE23E617L, 0x40ACE1F4L,
+    0x8C06E16AL, 0xD0EBA0BBL, 0x1C41A025L, 0x92CEA7C6L, 0x5E64A758L,
+    0x54A1AE41L, 0x980BAEDFL, 0x1684A93CL, 0xDA2EA9A2L, 0x030EBB0EL,
+    0xCFA4BB90L, 0x412BBC73L, 0x8D81BCEDL, 0x8744B5F4L, 0x4BEEB56AL,
+    0xC561B289L, 0x09CBB217L, 0xAC509190L, 0x60FA910EL, 0xEE7596EDL,
+    0x22DF9673L, 0x281A9F6AL, 0xE4B09FF4L, 0x6A3F9817L, 0xA6959889L,
+    0x7FB58A25L, 0xB31F8ABBL, 0x3D908D58L, 0xF13A8DC6L, 0xFBFF84DFL,
+    0x37558441L, 0xB9DA83A2L, 0x7570833CL, 0x533B85DAL, 0x9F918544L,
+    0x111E82A7L, 0xDDB48239L, 0xD7718B20L, 0x1BDB8BBEL, 0x95548C5DL,
+    0x59FE8CC3L, 0x80DE9E6FL, 0x4C749EF1L, 0xC2FB9912L, 0x0E51998CL,
+    0x04949095L, 0xC83E900BL, 0x46B197E8L, 0x8A1B9776L, 0x2F80B4F1L,
+    0xE32AB46FL, 0x6DA5B38CL, 0xA10FB312L, 0xABCABA0BL, 0x6760BA95L,
+    0xE9EFBD76L, 0x2545BDE8L, 0xFC65AF44L, 0x30CFAFDAL, 0xBE40A839L,
+    0x72EAA8A7L, 0x782FA1BEL, 0xB485A120L, 0x3A0AA6C3L, 0xF6A0A65DL,
+    0xAA4DE78CL, 0x66E7E712L, 0xE868E0F1L, 0x24C2E06FL, 0x2E07E976L,
+    0xE2ADE9E8L, 0x6C22EE0BL, 0xA088EE95L, 0x79A8FC39L, 0xB502FCA7L,
+    0x3B8DFB44L, 0xF727FBDAL, 0xFDE2F2C3L, 0x3148F25DL, 0xBFC7F5BEL,
+    0x736DF520L, 0xD6F6D6A7L, 0x1A5CD639L, 0x94D3D1DAL, 0x5879D144L,
+    0x52BCD85DL, 0x9E16D8C3L, 0x1099DF20L, 0xDC33DFBEL, 0x0513CD12L,
+    0xC9B9CD8CL, 0x4736CA6FL, 0x8B9CCAF1L, 0x8159C3E8L, 0x4DF3C376L,
+    0xC37CC495L, 0x0FD6C40BL, 0x7AA64737L, 0xB60C47A9L, 0x3883404AL,
+    0xF42940D4L, 0xFEEC49CDL, 0x32464953L, 0xBCC94EB0L, 0x70634E2EL,
+    0xA9435C82L, 0x65E95C1CL, 0xEB665BFFL, 0x27CC5B61L, 0x2D095278L,
+    0xE1A352E6L, 0x6F2C5505L, 0xA386559BL, 0x061D761CL, 0xCAB77682L,
+    0x44387161L, 0x889271FFL, 0x825778E6L, 0x4EFD7878L, 0xC0727F9BL,
+    0x0CD87F05L, 0xD5F86DA9L, 0x19526D37L, 0x97DD6AD4L, 0x5B776A4AL,
+    0x51B26353L, 0x9D1863CDL, 0x1397642EL, 0xDF3D64B0L, 0x83D02561L,
+    0x4F7A25FFL, 0xC1F5221CL, 0x0D5F2282L, 0x079A2B9BL, 0xCB302B05L,
+    0x45BF2CE6L, 0x89152C78L, 0x50353ED4L, 0x9C9F3E4AL, 0x121039A9L,
+    0xDEBA3937L, 0xD47F302EL, 0x18D530B0L, 0x965A3753L, 0x5AF037CDL,
+    0xFF6B144AL, 0x33C114D4L, 0xBD4E1337L, 0x71E413A9L, 0x7B211AB0L,
+    0xB78B1A2EL, 0x39041DCDL, 0xF5AE1D53L, 0x2C8E0FFFL, 0xE0240F61L,
+    0x6EAB0882L, 0xA201081CL, 0xA8C40105L, 0x646E019BL, 0xEAE10678L,
+    0x264B06E6L
+  }
+#endif
+};
+
+#define SLICE_TBL(k, n) \
+  ((k) == 0 ? crc32_tbl[(n)] : crc32_slice_tbl[(k) - 1][(n)])
+
 /* ======================================================================== */
 /*  CRC32_UPDATE -- Updates a 32-bit CRC using the lookup table above.      */
 /*                  Note:  The 32-bit CRC is set up as a right-shifting     */
@@ -113,19 +525,147 @@ uint32_t crc32_upd32(uint32_t crc, uint32_t data)
   return crc;
 }
 
+/* ======================================================================== */
+/*  CRC32_WORDS_SW -- Updates a 32-bit CRC on word-aligned data by slicing, */
+/*                    4 or 8 bytes per round.  Words are little-endian.     */
+/* ======================================================================== */
+static uint32_t crc32_words_sw(uint32_t crc, const uint32_t* words,
+                               uint32_t num_words)
+{
+#if CRC32_SLICES == 8
+  while (num_words >= 2)
+  {
+    uint32_t a = words[0] ^ crc;
+    uint32_t b = words[1];
+
+    crc = SLICE_TBL(7,  a        & 0xFF) ^ SLICE_TBL(6, (a >>  8) & 0xFF) ^
+          SLICE_TBL(5, (a >> 16) & 0xFF) ^ SLICE_TBL(4,  a >> 24        ) ^
+          SLICE_TBL(3,  b        & 0xFF) ^ SLICE_TBL(2, (b >>  8) & 0xFF) ^
+          SLICE_TBL(1, (b >> 16) & 0xFF) ^ SLICE_TBL(0,  b >> 24        );
+
+    words += 2;
+    num_words -= 2;
+  }
+#endif
+
+  while (num_words > 0)
+  {
+    uint32_t a = *words++ ^ crc;
+
+    crc = SLICE_TBL(3,  a        & 0xFF) ^ SLICE_TBL(2, (a >>  8) & 0xFF) ^
+          SLICE_TBL(1, (a >> 16) & 0xFF) ^ SLICE_TBL(0,  a >> 24        );
+
+    num_words--;
+  }
+
+  return crc;
+}
+
+#if defined(CRC32_USE_HW) && !defined(SIMULATOR)
+/* ======================================================================== */
+/*  CRC32_WORDS_HW -- Updates a 32-bit CRC on word-aligned data with the    */
+/*                    STM32 CRC unit.  The unit shifts the same polynomial  */
+/*                    the other way, MSB first, so the data words and the   */
+/*                    result are bit-reversed.  It can only be reset to     */
+/*                    0xFFFFFFFF, so the CRC so far is folded into the      */
+/*                    first word instead:  after a reset the unit computes  */
+/*                    F(0xFFFFFFFF ^ w), and F(rbit(crc) ^ rbit(w0)) is     */
+/*                    wanted.                                               */
+/* ======================================================================== */
+static uint32_t crc32_words_hw(uint32_t crc, const uint32_t* words,
+                               uint32_t num_words)
+{
+  while (num_words > 0)
+  {
+    uint32_t n = (num_words < CRC32_HW_CHUNK_WORDS) ? num_words
+                                                    : CRC32_HW_CHUNK_WORDS;
+    uint32_t i;
+
+    chSysLock();
+    CRC->CR = CRC_CR_RESET;
+    CRC->DR = ~__RBIT(words[0] ^ crc);
+    for (i = 1; i < n; i++)
+      CRC->DR = __RBIT(words[i]);
+    crc = __RBIT(CRC->DR);
+    chSysUnlock();
+
+    words += n;
+    num_words -= n;
+  }
+
+  return crc;
+}
+#endif
+
+/* ======================================================================== */
+/*  CRC32_INIT   -- Turns on the clock of the STM32 CRC unit, when it is    */
+/*                  used.  Called once at startup, before other threads     */
+/*                  run, as RCC is shared with the drivers.                 */
+/* ======================================================================== */
+void crc32_init(void)
+{
+#if defined(CRC32_USE_HW) && !defined(SIMULATOR)
+  rccEnableAHB1(RCC_AHB1ENR_CRCEN, FALSE);
+#endif
+}
+
+/* ======================================================================== */
+/*  CRC32_BLOCK_PATH -- Updates a 32-bit CRC on a block of 8-bit data.      */
+/*                      Whole words in the middle of the block go through   */
+/*                      the CRC unit when use_hw is set and the unit is     */
+/*                      used, and through the slicing tables otherwise.     */
+/* ======================================================================== */
+static uint32_t crc32_block_path(uint32_t crc, void* data, uint32_t len,
+                                 int use_hw)
+{
+  const uint8_t* p = data;
+
+  (void)use_hw;
+
+  /* Bytes up to the first word boundary */
+  while (len > 0 && ((uintptr_t)p & 3) != 0)
+  {
+    crc = CRC32_UPDATE(crc, *p++);
+    len--;
+  }
+
+#if defined(CRC32_USE_HW) && !defined(SIMULATOR)
+  if (use_hw && len >= CRC32_HW_MIN_LEN)
+    crc = crc32_words_hw(crc, (const uint32_t*)p, len / 4);
+  else
+#endif
+    crc = crc32_words_sw(crc, (const uint32_t*)p, len / 4);
+
+  p += len & ~3;
+  len &= 3;
+
+  /* Bytes after the last whole word */
+  while (len > 0)
+  {
+    crc = CRC32_UPDATE(crc, *p++);
+    len--;
+  }
+
+  return crc;
+}
+
 /* ======================================================================== */
 /*  CRC32_BLOCK  -- Updates a 32-bit CRC on a block of 8-bit data.          */
 /*                  Note:  The 32-bit CRC is set up as a right-shifting     */
-/*                  CRC with no inversions.                                 */
+/*                  CRC with no inversions.  Whole words in the middle of   */
+/*                  the block go through the fast paths.                    */
 /* ======================================================================== */
 uint32_t crc32_block(uint32_t crc, void* data, uint32_t len)
 {
-  uint32_t i;
-
-  for (i = 0; i < len; i++)
-    crc = (crc >> 8) ^ crc32_tbl[(crc ^ ((uint8_t*)data)[i]) & 0xFF];
+  return crc32_block_path(crc, data, len, 1);
+}
 
-  return crc;
+/* ======================================================================== */
+/*  CRC32_BLOCK_SW -- Same as CRC32_BLOCK, but never uses the CRC unit.     */
+/* ======================================================================== */
+uint32_t crc32_block_sw(uint32_t crc, void* data, uint32_t len)
+{
+  return crc32_block_path(crc, data, len, 0);
 }
 
 /* ======================================================================== */
@@ -48,6 +48,12 @@ uint32_t crc32_upd16(uint32_t crc, uint16_t data);
 /* ======================================================================== */
 uint32_t crc32_upd32(uint32_t crc, uint32_t data);
 
+/* ======================================================================== */
+/*  CRC32_INIT   -- Turns on the CRC unit if it is used.  Must be called    */
+/*                  once at startup, before the first crc32_block().        */
+/* ======================================================================== */
+void crc32_init(void);
+
 /* ======================================================================== */
 /*  CRC32_BLOCK  -- Updates a 32-bit CRC on a block of 8-bit data.          */
 /*                  Note:  The 32-bit CRC is set up as a right-shifting     */
@@ -55,6 +61,12 @@ uint32_t crc32_upd32(uint32_t crc, uint32_t data);
 /* ======================================================================== */
 uint32_t crc32_block(uint32_t crc, void* data, uint32_t len);
 
+/* ======================================================================== */
+/*  CRC32_BLOCK_SW -- Same as CRC32_BLOCK, but never uses the CRC unit.     */
+/*                    Lets the two paths be checked against each other.     */
+/* ======================================================================== */
+uint32_t crc32_block_sw(uint32_t crc, void* data, uint32_t len);
+
 #endif
 /* ======================================================================== */
 /*     This specific file is placed in the public domain by its author,     */
@@ -264,7 +264,7 @@ dfuse_apply_update(sxfs_part_id_t part, addr_range_t* valid_addr_range)
   return dfuse_parse(part, &ops, valid_addr_range);
 }
 
-void
+bool
 dfuse_write_self(sxfs_part_id_t part, image_rec_t* img_recs, uint32_t num_img_recs)
 {
   uint32_t offset = 0;
@@ -277,8 +277,9 @@ dfuse_write_self(sxfs_part_id_t part, image_rec_t* img_recs, uint32_t num_img_re
   // NOTE: assumes only one target
   uint32_t dfu_image_size = sizeof(dfu_prefix_t) + sizeof(dfu_target_prefix_t) + target_size;
 
-  // Clear space for the image
-  sxfs_erase_all(part);
+  // Clear space for the image, rounded up to the partition's erase unit
+  if (!sxfs_erase(part, 0, dfu_image_size + sizeof(dfu_suffix_t)))
+    return false;
 
   // write prefix
   dfu_prefix_t prefix = {
@@ -336,4 +337,6 @@ dfuse_write_self(sxfs_part_id_t part, image_rec_t* img_recs, uint32_t num_img_re
 
   // Write CRC
   sxfs_write(part, offset, (uint8_t*)&suffix.crc, sizeof(uint32_t));
+
+  return true;
 }
@@ -35,5 +35,6 @@ dfuse_verify(sxfs_part_id_t part);
 dfu_parse_result_t
 dfuse_apply_update(sxfs_part_id_t part, addr_range_t* valid_addr_range);
 
-void
+/* Returns false if the partition could not be erased */
+bool
 dfuse_write_self(sxfs_part_id_t part, image_rec_t* img_recs, uint32_t num_img_recs);
@@ -38,6 +38,10 @@ static const part_info_t part_info[NUM_SXFS_PARTS] = {
         .offset = 0x00320000,
         .size   = 0x00010000 // 64 KB
     },
+    [SP_TEMP_PROFILES] = {
+        .offset = 0x00330000,
+        .size   = 0x00040000 // 256 KB
+    },
 };
 
 
@@ -47,11 +51,16 @@ sxfs_erase(sxfs_part_id_t part_id, uint32_t offset, uint32_t len)
   if (part_id >= NUM_SXFS_PARTS)
     return false;
 
-  // Round up to the nearest 64K which is the smallest erasable size
-  len = (((len - 1) / XFLASH_SECTOR_SIZE) + 1) * XFLASH_SECTOR_SIZE;
+  if (len == 0)
+    return true;
 
+  // Round up to the partition's erase unit
   part_info_t pinfo = part_info[part_id];
-  if (offset + len > pinfo.size)
+  uint32_t erase_size = xflash_erase_size(pinfo.offset, pinfo.size);
+  len = (((len - 1) / erase_size) + 1) * erase_size;
+
+  if (((offset & (erase_size - 1)) != 0) ||
+      (offset + len > pinfo.size))
     return false;
 
   if (xflash_erase(pinfo.offset + offset, len) != 0)
@@ -60,6 +69,25 @@ sxfs_erase(sxfs_part_id_t part_id, uint32_t offset, uint32_t len)
   return true;
 }
 
+uint32_t
+sxfs_erase_size(sxfs_part_id_t part_id)
+{
+  if (part_id >= NUM_SXFS_PARTS)
+    return 0;
+
+  part_info_t pinfo = part_info[part_id];
+  return xflash_erase_size(pinfo.offset, pinfo.size);
+}
+
+uint32_t
+sxfs_part_size(sxfs_part_id_t part_id)
+{
+  if (part_id >= NUM_SXFS_PARTS)
+    return 0;
+
+  return part_info[part_id].size;
+}
+
 bool
 sxfs_erase_all(sxfs_part_id_t part_id)
 {
@@ -20,6 +20,7 @@ typedef enum {
   SP_WEB_API_BACKLOG,
   SP_APP_CFG_1,
   SP_APP_CFG_2,
+  SP_TEMP_PROFILES,
 
   NUM_SXFS_PARTS
 } sxfs_part_id_t;
@@ -31,9 +32,21 @@ sxfs_write(sxfs_part_id_t part_id, uint32_t offset, uint8_t* data, uint32_t data
 bool
 sxfs_read(sxfs_part_id_t part_id, uint32_t offset, uint8_t* data, uint32_t data_len);
 
+/* offset must be a multiple of the partition's erase size and len is
+ * rounded up to one.
+ */
 bool
 sxfs_erase(sxfs_part_id_t part_id, uint32_t offset, uint32_t len);
 
+/* The erase unit of the whole partition, which depends on where the flash
+ * part has its 4K parameter sectors. Only valid after xflash_init().
+ */
+uint32_t
+sxfs_erase_size(sxfs_part_id_t part_id);
+
+uint32_t
+sxfs_part_size(sxfs_part_id_t part_id);
+
 bool
 sxfs_erase_all(sxfs_part_id_t part_id);
 
@@ -12,6 +12,11 @@
 
 #define NO_ADDR 0xFFFFFFFF
 
+/* Size of each read issued by the streaming readers. Two are in flight at a
+ * time, so one is being processed while DMA fills the other.
+ */
+#define READ_CHUNK_SIZE 1024
+
 
 // Read Commands
 #define CMD_READ      0x03
@@ -62,6 +67,36 @@
 #define SR_P_ERR 0x40
 #define SR_SRWD  0x80
 
+// Configuration Register Bitmasks
+#define CR_TBPARM 0x04
+
+// RDID manufacturer and memory type
+#define MFG_SPANSION   0x01
+#define TYPE_S25FL1_K  0x40
+
+/* P4E only erases the 4K parameter sectors. On S25FL-P and -S parts they
+ * sit at the bottom of the array, or at the top if TBPARM is set, and the
+ * rest of the array only takes 64K sector erases. The number of parameter
+ * sectors differs between parts, so only the first 64K of them are used.
+ * S25FL1-K parts take P4E anywhere, and parts that aren't recognised are
+ * only erased in 64K sectors.
+ */
+#define PARAM_REGION_SIZE XFLASH_SECTOR_SIZE
+
+
+/* How to wait for a program or erase to finish. The status register is
+ * polled back to back for spin_us, which covers a page program on a good
+ * day, then with a sleep between polls that starts at one tick and doubles
+ * up to max_sleep_ms. Sleeping rather than yielding lets lower priority
+ * threads run, as a yield only hands over to threads of the same priority.
+ * Erases take hundreds of milliseconds, so they go straight to sleeping.
+ */
+typedef struct {
+  uint32_t spin_us;
+  uint32_t max_sleep_ms;
+  uint8_t err_mask;
+} wait_profile_t;
+
 
 static void
 xflash_txn_begin(void);
@@ -80,25 +115,94 @@ read_status_reg(void);
 static void
 write_enable(void);
 
+static void
+identify_part(void);
+
+static void
+spi_end_cb(SPIDriver* spip);
+
+static void
+start_req_i(xflash_req_t* req);
+
+static void
+wait_queue_idle(void);
+
+static bool
+crc_chunk(const uint8_t* buf, uint32_t len, void* arg);
+
+static int
+wait_ready(const wait_profile_t* wp, halrtcnt_t start);
+
+static uint32_t
+cycles_to_us(halrtcnt_t cycles);
+
+static void
+op_stats_update(xflash_op_t op, halrtcnt_t start);
+
+static bool
+erased_chunk(const uint8_t* buf, uint32_t len, void* arg);
+
 
 static const SPIConfig flash_spi_cfg = {
-    .end_cb = NULL,
+    .end_cb = spi_end_cb,
     .ssport = PORT_SFLASH_CS,
     .sspad = PAD_SFLASH_CS,
     .cr1 = SPI_CR1_CPOL | SPI_CR1_CPHA
 };
 static Mutex xflash_mutex;
 
+static const wait_profile_t program_wait = {
+    .spin_us = 50,
+    .max_sleep_ms = 1,
+    .err_mask = SR_P_ERR
+};
+
+static const wait_profile_t erase_wait = {
+    .spin_us = 0,
+    .max_sleep_ms = 16,
+    .err_mask = SR_E_ERR
+};
+
+static const wait_profile_t erase_4k_wait = {
+    .spin_us = 0,
+    .max_sleep_ms = 4,
+    .err_mask = SR_E_ERR
+};
+
+static xflash_op_stats_t op_stats[NUM_XFLASH_OPS];
+
+// where P4E works, found by identify_part()
+static uint32_t param_start;
+static uint32_t param_end;
+
+/* Queued reads. The head is the one on the bus. Each read is a FAST_READ
+ * header sent by DMA followed by the data received by DMA. The SPI end
+ * callback moves a read from one phase to the next and starts the next read,
+ * so a queue of reads runs back to back without waking any thread. The flash
+ * has its SPI bus to itself, so queued reads don't acquire it. Synchronous
+ * commands hold xflash_mutex and wait for the queue to drain first.
+ */
+static xflash_req_t* queue_head;
+static xflash_req_t* queue_tail;
+static bool reading_data;
+static uint8_t read_hdr[5];
+static BinarySemaphore queue_idle;
+
 
 void
 xflash_init()
 {
   chMtxInit(&xflash_mutex);
+  chBSemInit(&queue_idle, FALSE);
+
+  identify_part();
 }
 
 static void
 xflash_txn_begin()
 {
+  wait_queue_idle();
+
 #if SPI_USE_MUTUAL_EXCLUSION
   spiAcquireBus(SPI_FLASH);
 #endif
@@ -153,81 +257,161 @@ write_enable()
   send_cmd(CMD_WREN, NO_ADDR, NULL, 0, NULL, 0);
 }
 
+static void
+identify_part()
+{
+  uint8_t id[3];
+  uint8_t cr;
+
+  send_cmd(CMD_RDID, NO_ADDR, NULL, 0, id, sizeof(id));
+
+  // id[2] is log2 of the size in bytes
+  if (id[0] != MFG_SPANSION || id[2] < 16 || id[2] > 31)
+    return;
+
+  uint32_t size = 1u << id[2];
+  if (id[1] == TYPE_S25FL1_K) {
+    param_start = 0;
+    param_end = size;
+    return;
+  }
+
+  send_cmd(CMD_RCR, NO_ADDR, NULL, 0, &cr, 1);
+  if (cr & CR_TBPARM) {
+    param_start = size - PARAM_REGION_SIZE;
+    param_end = size;
+  }
+  else {
+    param_start = 0;
+    param_end = PARAM_REGION_SIZE;
+  }
+}
+
+uint32_t
+xflash_erase_size(uint32_t addr, uint32_t size)
+{
+  if (addr >= param_start && addr + size <= param_end)
+    return XFLASH_SUBSECTOR_SIZE;
+
+  return XFLASH_SECTOR_SIZE;
+}
+
+static uint32_t
+cycles_to_us(halrtcnt_t cycles)
+{
+  return cycles / (halGetCounterFrequency() / 1000000);
+}
+
 static int
-erase(uint32_t erase_addr)
+wait_ready(const wait_profile_t* wp, halrtcnt_t start)
 {
-  write_enable();
-  send_cmd(CMD_SE, erase_addr, NULL, 0, NULL, 0);
+  systime_t sleep = 1;
 
   while (1) {
     uint8_t sr = read_status_reg();
-    if (sr & SR_E_ERR) {
+    if (sr & wp->err_mask) {
       send_cmd(CMD_CLSR, NO_ADDR, NULL, 0, NULL, 0);
       return -1;
     }
 
-    if (sr & SR_WIP)
-      chThdSleepMilliseconds(10);
-    else
-      break;
+    if ((sr & SR_WIP) == 0)
+      return 0;
+
+    if (cycles_to_us(halGetCounterValue() - start) < wp->spin_us)
+      continue;
+
+    chThdSleep(sleep);
+    if (sleep < MS2ST(wp->max_sleep_ms))
+      sleep *= 2;
   }
+}
 
-  return 0;
+static void
+op_stats_update(xflash_op_t op, halrtcnt_t start)
+{
+  uint32_t us = cycles_to_us(halGetCounterValue() - start);
+  xflash_op_stats_t* stats = &op_stats[op];
+
+  chSysLock();
+  stats->count++;
+  stats->total_us += us;
+  if (us > stats->max_us)
+    stats->max_us = us;
+  chSysUnlock();
+}
+
+void
+xflash_get_stats(xflash_op_t op, xflash_op_stats_t* stats)
+{
+  chSysLock();
+  *stats = op_stats[op];
+  chSysUnlock();
+}
+
+static int
+erase(uint32_t erase_addr, bool whole_sector)
+{
+  write_enable();
+  send_cmd(whole_sector ? CMD_SE : CMD_P4E, erase_addr, NULL, 0, NULL, 0);
+
+  halrtcnt_t start = halGetCounterValue();
+  int ret = wait_ready(whole_sector ? &erase_wait : &erase_4k_wait, start);
+  op_stats_update(whole_sector ? XFLASH_OP_ERASE : XFLASH_OP_ERASE_4K, start);
+
+  return ret;
 }
 
 int
 xflash_erase(uint32_t addr, uint32_t size)
 {
-  int bytes_remaining = size;
+  uint32_t bytes_remaining = size;
   uint32_t erase_addr = addr;
 
   while (bytes_remaining > 0) {
-    if ((bytes_remaining < XFLASH_SECTOR_SIZE) ||
-        ((erase_addr & (XFLASH_SECTOR_SIZE - 1)) != 0))
+    if ((bytes_remaining < XFLASH_SUBSECTOR_SIZE) ||
+        ((erase_addr & (XFLASH_SUBSECTOR_SIZE - 1)) != 0))
+      return -1;
+
+    bool whole_sector = (bytes_remaining >= XFLASH_SECTOR_SIZE) &&
+        ((erase_addr & (XFLASH_SECTOR_SIZE - 1)) == 0);
+    uint32_t erase_size = whole_sector ? XFLASH_SECTOR_SIZE : XFLASH_SUBSECTOR_SIZE;
+
+    // the part would ignore a P4E outside the parameter sectors
+    if (xflash_erase_size(erase_addr, erase_size) > erase_size)
       return -1;
 
     chMtxLock(&xflash_mutex);
-    int ret = erase(erase_addr);
+    int ret = erase(erase_addr, whole_sector);
     chMtxUnlock();
 
     if (ret != 0)
       return ret;
 
-    erase_addr += XFLASH_SECTOR_SIZE;
-    bytes_remaining -= XFLASH_SECTOR_SIZE;
+    erase_addr += erase_size;
+    bytes_remaining -= erase_size;
   }
 
   return 0;
 }
 
-bool
-xflash_is_erased(uint32_t addr, uint32_t len)
+static bool
+erased_chunk(const uint8_t* buf, uint32_t len, void* arg)
 {
-  uint8_t* buf = malloc(256);
-  bool erased = true;
-
-  while (len > 0) {
-    int read_len = MIN(256, len);
-    xflash_read(addr, buf, read_len);
-
-    int i;
-    for (i = 0; i < read_len; ++i) {
-      if (buf[i] != 0xFF) {
-        erased = false;
-        break;
-      }
-    }
+  uint32_t i;
+  (void)arg;
 
-    if (!erased)
-      break;
-
-    addr += read_len;
-    len -= read_len;
+  for (i = 0; i < len; ++i) {
+    if (buf[i] != 0xFF)
+      return false;
   }
 
-  free(buf);
+  return true;
+}
 
-  return erased;
+bool
+xflash_is_erased(uint32_t addr, uint32_t len)
+{
+  return xflash_read_stream(addr, len, erased_chunk, NULL);
 }
 
 static int
@@ -237,35 +421,29 @@ page_program(uint32_t addr, const uint8_t* buf, uint32_t buf_len)
 
   send_cmd(CMD_PP, addr, buf, buf_len, NULL, 0);
 
-  while (1) {
-    uint8_t sr = read_status_reg();
-    if (sr & SR_P_ERR) {
-      send_cmd(CMD_CLSR, NO_ADDR, NULL, 0, NULL, 0);
-      return -1;
-    }
-
-    if (sr & SR_WIP)
-      chThdSleepMilliseconds(10);
-    else
-      break;
-  }
+  halrtcnt_t start = halGetCounterValue();
+  int ret = wait_ready(&program_wait, start);
+  op_stats_update(XFLASH_OP_PROGRAM, start);
 
-  return 0;
+  return ret;
 }
 
+/* The pages of a write are programmed back to back under one hold of the
+ * mutex, each one started as soon as the flash reports the last one done.
+ */
 int
 xflash_write(uint32_t addr, const uint8_t* buf, uint32_t buf_len)
 {
   uint32_t data_to_write = (XFLASH_PAGE_SIZE - (addr % XFLASH_PAGE_SIZE));
   data_to_write = MIN(data_to_write, buf_len);
+  int ret = 0;
 
-  while (buf_len != 0) {
-    chMtxLock(&xflash_mutex);
-    int ret = page_program(addr, buf, data_to_write);
-    chMtxUnlock();
+  chMtxLock(&xflash_mutex);
 
+  while (buf_len != 0) {
+    ret = page_program(addr, buf, data_to_write);
     if (ret != 0)
-      return ret;
+      break;
 
     addr += data_to_write;
     buf += data_to_write;
@@ -273,35 +451,187 @@ xflash_write(uint32_t addr, const uint8_t* buf, uint32_t buf_len)
     data_to_write = MIN(XFLASH_PAGE_SIZE, buf_len);
   }
 
-  return 0;
+  chMtxUnlock();
+
+  return ret;
 }
 
 void
 xflash_read(uint32_t addr, uint8_t* buf, uint32_t buf_len)
 {
+  xflash_req_t req;
+  halrtcnt_t start = halGetCounterValue();
+
+  xflash_read_async(&req, addr, buf, buf_len, NULL, NULL);
+  xflash_wait(&req);
+
+  op_stats_update(XFLASH_OP_READ, start);
+}
+
+void
+xflash_read_async(xflash_req_t* req, uint32_t addr, uint8_t* buf, uint32_t buf_len,
+    xflash_cb_t cb, void* arg)
+{
+  req->addr = addr;
+  req->buf = buf;
+  req->len = buf_len;
+  req->cb = cb;
+  req->arg = arg;
+  req->next = NULL;
+  chBSemInit(&req->done, TRUE);
+
+  if (buf_len == 0) {
+    if (cb != NULL) {
+      chSysLock();
+      cb(req);
+      chSysUnlock();
+    }
+    chBSemSignal(&req->done);
+    return;
+  }
+
   chMtxLock(&xflash_mutex);
-  send_cmd(CMD_READ, addr, NULL, 0, buf, buf_len);
+
+  chSysLock();
+  if (queue_head == NULL) {
+    chSysUnlock();
+    spiStart(SPI_FLASH, &flash_spi_cfg);
+    chSysLock();
+
+    chBSemResetI(&queue_idle, TRUE);
+    queue_head = queue_tail = req;
+    start_req_i(req);
+  }
+  else {
+    queue_tail->next = req;
+    queue_tail = req;
+  }
+  chSysUnlock();
+
   chMtxUnlock();
 }
 
-uint32_t
-xflash_crc(uint32_t addr, uint32_t size)
+void
+xflash_wait(xflash_req_t* req)
 {
-  uint8_t* buf = calloc(1, 256);
-  uint32_t crc = 0xFFFFFFFF;
+  chBSemWait(&req->done);
+}
+
+static void
+start_req_i(xflash_req_t* req)
+{
+  read_hdr[0] = CMD_FAST_READ;
+  read_hdr[1] = req->addr >> 16;
+  read_hdr[2] = req->addr >> 8;
+  read_hdr[3] = req->addr;
+  read_hdr[4] = 0; // dummy byte
+
+  reading_data = false;
+  spiSelectI(SPI_FLASH);
+  spiStartSendI(SPI_FLASH, sizeof(read_hdr), read_hdr);
+}
+
+static void
+spi_end_cb(SPIDriver* spip)
+{
+  xflash_req_t* req = queue_head;
+
+  // synchronous commands run with the queue empty
+  if (req == NULL)
+    return;
+
+  chSysLockFromIsr();
+  if (!reading_data) {
+    reading_data = true;
+    spiStartReceiveI(spip, req->len, req->buf);
+  }
+  else {
+    spiUnselectI(spip);
+
+    queue_head = req->next;
+    if (queue_head != NULL)
+      start_req_i(queue_head);
+    else
+      chBSemSignalI(&queue_idle);
+
+    if (req->cb != NULL)
+      req->cb(req);
+    chBSemSignalI(&req->done);
+  }
+  chSysUnlockFromIsr();
+}
+
+/* Must be called with xflash_mutex held, which keeps new reads from being
+ * queued.
+ */
+static void
+wait_queue_idle()
+{
+  chSysLock();
+  if (queue_head != NULL)
+    chBSemWaitS(&queue_idle);
+  chSysUnlock();
+}
+
+/* Reads a range in chunks, reading the next chunk while fn processes the
+ * current one. Stops early if fn returns false.
+ */
+bool
+xflash_read_stream(uint32_t addr, uint32_t size, xflash_chunk_fn_t fn, void* arg)
+{
+  xflash_req_t reqs[2];
+  uint8_t* bufs = malloc(2 * READ_CHUNK_SIZE);
+  bool ret = true;
+  int cur = 0;
+
+  if (bufs == NULL)
+    return false;
+
+  if (size > 0)
+    xflash_read_async(&reqs[cur], addr, bufs, MIN(size, READ_CHUNK_SIZE), NULL, NULL);
 
   while (size > 0) {
-    uint32_t nrecv = MIN(size, 256);
+    uint32_t len = reqs[cur].len;
+    uint32_t next_len = MIN(size - len, READ_CHUNK_SIZE);
+    int next = cur ^ 1;
 
-    xflash_read(addr, buf, nrecv);
+    if (next_len > 0)
+      xflash_read_async(&reqs[next], addr + len, bufs + (next * READ_CHUNK_SIZE), next_len, NULL, NULL);
 
-    crc = crc32_block(crc, buf, nrecv);
+    xflash_wait(&reqs[cur]);
+    ret = fn(bufs + (cur * READ_CHUNK_SIZE), len, arg);
 
-    addr += nrecv;
-    size -= nrecv;
+    addr += len;
+    size -= len;
+    cur = next;
+
+    if (!ret) {
+      // the buffer is still being read into
+      if (size > 0)
+        xflash_wait(&reqs[cur]);
+      break;
+    }
   }
 
-  free(buf);
+  free(bufs);
+
+  return ret;
+}
+
+static bool
+crc_chunk(const uint8_t* buf, uint32_t len, void* arg)
+{
+  uint32_t* crc = arg;
+  *crc = crc32_block(*crc, (void*)buf, len);
+  return true;
+}
+
+uint32_t
+xflash_crc(uint32_t addr, uint32_t size)
+{
+  uint32_t crc = 0xFFFFFFFF;
+
+  xflash_read_stream(addr, size, crc_chunk, &crc);
 
   return crc;
 }
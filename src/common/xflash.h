@@ -2,19 +2,68 @@
 #ifndef XFLASH_H
 #define XFLASH_H
 
+#include "ch.h"
+
 #include <stdbool.h>
 
 
 #define XFLASH_SECTOR_SIZE      0x10000 // 64K
+#define XFLASH_SUBSECTOR_SIZE   0x1000  // 4K, only in the parameter sectors
 #define XFLASH_PAGE_SIZE        0x100   // 256
 
 
+typedef enum {
+  XFLASH_OP_READ,     // synchronous reads
+  XFLASH_OP_PROGRAM,  // page programs, from command to completion
+  XFLASH_OP_ERASE,    // 64K sector erases, from command to completion
+  XFLASH_OP_ERASE_4K, // 4K sub-sector erases, from command to completion
+  NUM_XFLASH_OPS
+} xflash_op_t;
+
+typedef struct {
+  uint32_t count;
+  uint32_t total_us;
+  uint32_t max_us;
+} xflash_op_stats_t;
+
+typedef struct xflash_req_s xflash_req_t;
+
+/* Called from the SPI interrupt with the system locked, so only I-class
+ * functions may be used.
+ */
+typedef void (*xflash_cb_t)(xflash_req_t* req);
+
+/* Called from the reading thread with each chunk of a streamed read.
+ * Returning false stops the read.
+ */
+typedef bool (*xflash_chunk_fn_t)(const uint8_t* buf, uint32_t len, void* arg);
+
+struct xflash_req_s {
+  uint32_t addr;
+  uint8_t* buf;
+  uint32_t len;
+  xflash_cb_t cb;
+  void* arg;
+  BinarySemaphore done;
+  xflash_req_t* next;
+};
+
+
 void
 xflash_init(void);
 
+/* Erases a range aligned to xflash_erase_size(), using whole sector erases
+ * wherever the range covers a whole sector.
+ */
 int
 xflash_erase(uint32_t addr, uint32_t size);
 
+/* The smallest unit a range can be erased in. XFLASH_SUBSECTOR_SIZE if it
+ * lies within the part's 4K parameter sectors, otherwise XFLASH_SECTOR_SIZE.
+ */
+uint32_t
+xflash_erase_size(uint32_t addr, uint32_t size);
+
 bool
 xflash_is_erased(uint32_t addr, uint32_t len);
 
@@ -24,7 +73,24 @@ xflash_write(uint32_t addr, const uint8_t* buf, uint32_t buf_len);
 void
 xflash_read(uint32_t addr, uint8_t* buf, uint32_t buf_len);
 
+/* Queues a read and returns straight away. The request and buffer must stay
+ * valid until the read completes, which calls cb, if given, and then
+ * releases xflash_wait().
+ */
+void
+xflash_read_async(xflash_req_t* req, uint32_t addr, uint8_t* buf, uint32_t buf_len,
+    xflash_cb_t cb, void* arg);
+
+void
+xflash_wait(xflash_req_t* req);
+
+bool
+xflash_read_stream(uint32_t addr, uint32_t size, xflash_chunk_fn_t fn, void* arg);
+
 uint32_t
 xflash_crc(uint32_t addr, uint32_t size);
 
+void
+xflash_get_stats(xflash_op_t op, xflash_op_stats_t* stats);
+
 #endif